@@ -46,17 +46,118 @@ static inline void atomic_write(volatile void *target, unsigned long value)
 }
 
 
+/*
+ * 64-bit compare and swap
+ */
+#define ATOMIC_HAS_CAS64    1
+
+static inline int atomic_cas64(volatile void *target, u64 old_value, u64 new_value)
+{
+    u64 result;
+    
+    __asm__ __volatile__
+    (
+        "lock cmpxchg8b  (%%esi)"
+        : "=A" (result)
+        : "A" (old_value), "b" ((u32)new_value), "c" ((u32)(new_value >> 32)), "S" (target)
+        : "memory"
+    );
+    
+    return (result == old_value ? 1 : 0);
+}
+
+
 /*
  * Fetch and add
  */
+static inline unsigned long atomic_xadd(volatile unsigned long *target, unsigned long value)
+{
+    __asm__ __volatile__
+    (
+        "lock xaddl     %%eax, (%%esi)"
+        : "=a" (value)
+        : "a" (value), "S" (target)
+        : "memory"
+    );
+    
+    return value;
+}
+
+static inline void atomic_add(volatile unsigned long *target, unsigned long value)
+{
+    __asm__ __volatile__
+    (
+        "lock addl      %%eax, (%%esi)"
+        :
+        : "a" (value), "S" (target)
+        : "memory"
+    );
+}
+
 static inline void atomic_inc(volatile unsigned long *target)
 {
-    unsigned long old_val, new_val;
+    __asm__ __volatile__
+    (
+        "lock incl      (%%esi)"
+        :
+        : "S" (target)
+        : "memory"
+    );
+}
+
+static inline void atomic_dec(volatile unsigned long *target)
+{
+    __asm__ __volatile__
+    (
+        "lock decl      (%%esi)"
+        :
+        : "S" (target)
+        : "memory"
+    );
+}
+
+
+/*
+ * Exchange
+ */
+static inline unsigned long atomic_xchg(volatile unsigned long *target, unsigned long value)
+{
+    // xchg with a memory operand is always locked
+    __asm__ __volatile__
+    (
+        "xchgl          %%eax, (%%esi)"
+        : "=a" (value)
+        : "a" (value), "S" (target)
+        : "memory"
+    );
+    
+    return value;
+}
+
+
+/*
+ * Fetch and bitwise ops, the old value is returned
+ */
+static inline unsigned long atomic_or(volatile unsigned long *target, unsigned long mask)
+{
+    unsigned long old_val;
+    
+    do {
+        old_val = *target;
+    } while (!atomic_cas(target, old_val, old_val | mask));
+    
+    return old_val;
+}
+
+static inline unsigned long atomic_and(volatile unsigned long *target, unsigned long mask)
+{
+    unsigned long old_val;
     
     do {
         old_val = *target;
-        new_val = old_val + 1;
-    } while (!atomic_cas(target, old_val, new_val));
+    } while (!atomic_cas(target, old_val, old_val & mask));
+    
+    return old_val;
 }
 
 
@@ -94,4 +195,18 @@ static inline void atomic_writebar()
 }
 
 
+/*
+ * Spin-wait hint
+ */
+static inline void atomic_pause()
+{
+    __asm__ __volatile__
+    (
+        "pause"
+        :
+        :
+    );
+}
+
+
 #endif
@@ -0,0 +1,26 @@
+#ifndef __ARCH_IA32_COMMON_INCLUDE_CYCLE__
+#define __ARCH_IA32_COMMON_INCLUDE_CYCLE__
+
+
+#include "common/include/data.h"
+
+
+/*
+ * Cycle counter - time stamp counter
+ */
+static inline u64 read_cycles()
+{
+    unsigned long high, low;
+    
+    __asm__ __volatile__
+    (
+        "rdtsc"
+        : "=a" (low), "=d" (high)
+        :
+    );
+    
+    return ((u64)high << 32) | (u64)low;
+}
+
+
+#endif
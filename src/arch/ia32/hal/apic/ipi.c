@@ -55,7 +55,7 @@ int register_ipi(int_handler handler)
     }
     
     // First alloc a vector and IPI ID
-    int vector = alloc_int_vector(handler);
+    int vector = alloc_int_vector(real_handler);
     int ipi_id = cur_ipi_id++;
     
     //kprintf("Vector %d\n", vector);    
@@ -63,7 +63,7 @@ int register_ipi(int_handler handler)
     // Then set the IPI record
     ipi_map[ipi_id].vector = vector;
     ipi_map[ipi_id].registered = 1;
-    ipi_map[ipi_id].handler = handler;
+    ipi_map[ipi_id].handler = real_handler;
     
     return ipi_id;
 }
@@ -179,3 +179,32 @@ int lapic_vaddr_ipi_broadcast(int self, int ipi_id)
     
     return check_lapic();
 }
+
+/*
+ * Return
+ *      0 = Failed
+ *      1 = Succeed
+ */
+int ipi_send(int cpu_id, int ipi_id)
+{
+    struct apic_interupt_command_register icr;
+    
+    // Wait for the previous IPI to be accepted
+    do {
+        icr.value_low = lapic_vaddr[APIC_ICR_LO];
+    } while (icr.delivs == APIC_DELIVS_PENDING);
+    
+    icr.value_high = lapic_vaddr[APIC_ICR_HI];
+    icr.delmod = APIC_DELMOD_FIXED;
+    icr.destmod = APIC_DESTMOD_PHYS;
+    icr.level = APIC_LEVEL_ASSERT;
+    icr.shorthand = APIC_SHORTHAND_NONE;
+    icr.trigger_mode = APIC_TRIGMOD_EDGE;
+    icr.vector = get_ipi_vector(ipi_id);
+    icr.dest = get_apic_id_by_cpu_id(cpu_id);
+    
+    lapic_vaddr[APIC_ICR_HI] = icr.value_high;
+    lapic_vaddr[APIC_ICR_LO] = icr.value_low;
+    
+    return check_lapic();
+}
@@ -7,44 +7,53 @@
 #include "hal/include/exec.h"
 
 
+/*
+ * Each side is translated once per page, then every run that stays within
+ * one source page and one destination page is copied at once
+ */
 static void cross_as_copy(
     ulong src_page_dir_pfn, ulong src_start, ulong length,
     ulong dest_page_dir_pfn, ulong dest_start)
 {
-    ulong i;
+    ulong src_page = 1, dest_page = 1;
+    ulong src_paddr = 0, dest_paddr = 0;
+    ulong src_left, dest_left, run;
     
-    ulong src_end = src_start + length;
-    
-    // Round down src start and dest start
-    src_start /= sizeof(ulong);
-    src_start *= sizeof(ulong);
-    
-    dest_start /= sizeof(ulong);
-    dest_start *= sizeof(ulong);
-    
-    // Round up src end
-    if (src_end % sizeof(ulong)) {
-        src_end /= sizeof(ulong);
-        src_end++;
-        src_end *= sizeof(ulong);
-    }
-    
-    // Calculate actual length
-    length = src_end - src_start;
-    
-    // Do the actual copy
-    ulong cur_src_paddr, cur_dest_paddr;
-    for (i = 0; i < length; i += sizeof(ulong)) {
-        // Get physical address
-        cur_src_paddr = get_paddr(src_page_dir_pfn, src_start + i);
-        cur_dest_paddr = get_paddr(dest_page_dir_pfn, dest_start + i);
-        assert(cur_src_paddr && cur_dest_paddr);
+    while (length) {
+        // Translate only when a new page is entered
+        if (ALIGN_DOWN(src_start, PAGE_SIZE) != src_page) {
+            src_page = ALIGN_DOWN(src_start, PAGE_SIZE);
+            src_paddr = get_paddr(src_page_dir_pfn, src_page);
+            assert(src_paddr);
+        }
+        
+        if (ALIGN_DOWN(dest_start, PAGE_SIZE) != dest_page) {
+            dest_page = ALIGN_DOWN(dest_start, PAGE_SIZE);
+            dest_paddr = get_paddr(dest_page_dir_pfn, dest_page);
+            assert(dest_paddr);
+        }
+        
+        // The run ends at whichever page boundary comes first
+        src_left = src_page + PAGE_SIZE - src_start;
+        dest_left = dest_page + PAGE_SIZE - dest_start;
+        
+        run = length;
+        if (run > src_left) {
+            run = src_left;
+        }
+        if (run > dest_left) {
+            run = dest_left;
+        }
         
-        // Copy the value
-        ulong word = *((ulong *)cur_src_paddr);
-        *((ulong *)cur_dest_paddr) = word;
+        memcpy(
+            (void *)(dest_paddr + dest_start - dest_page),
+            (void *)(src_paddr + src_start - src_page),
+            run
+        );
         
-        //kprintf("%h ", word);
+        src_start += run;
+        dest_start += run;
+        length -= run;
     }
 }
 
@@ -21,6 +21,7 @@ static void hal_entry()
 {
     // First we init the screen then tell the user we are in HAL
     init_video();
+    init_serial();
     kprintf("We are in HAL!\n");
     
     // Init CPUID
@@ -68,6 +69,9 @@ static void hal_entry()
     // Init syscall
     init_syscall();
     
+    // Init page fault
+    init_page_fault();
+    
     // Init time
     init_rtc();
     init_blocked_delay();
@@ -75,6 +79,10 @@ static void hal_entry()
     // Init devices
     init_keyboard();
     
+    // Init TLB
+    init_tlb();
+    //test_tlb();
+    
     // Init user high 4MB page
     init_user_hi4();
     
@@ -114,6 +122,9 @@ static void ap_entry()
     // Init GDT
     init_gdt_mp();
     
+    // Init TLB
+    init_tlb_mp();
+    
     // Load TSS
     load_tss();
     
@@ -476,6 +476,7 @@ extern void init_ipi();
 extern int register_ipi(int_handler handler);
 extern int ipi_send_startup(int apicid);
 extern int lapic_vaddr_ipi_broadcast(int self, int ipi_id);
+extern int ipi_send(int cpu_id, int ipi_id);
 
 
 /*
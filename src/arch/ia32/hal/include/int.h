@@ -134,6 +134,8 @@ extern int int_handler_dummy(struct int_context *intc, struct kernel_dispatch_in
 extern int int_handler_exception(struct int_context *intc, struct kernel_dispatch_info *kdi);
 extern int int_handler_device(struct int_context *intc, struct kernel_dispatch_info *kdi);
 
+extern void init_page_fault();
+
 
 /*
  * IDT functions
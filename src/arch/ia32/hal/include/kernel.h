@@ -22,6 +22,9 @@ extern ulong wrap_io_in(ulong port, ulong size);
 extern void wrap_io_out(ulong port, ulong size, ulong data);
 
 extern void wrap_invalidate_tlb(ulong asid, ulong vaddr, size_t size);
+extern void wrap_flush_tlb(ulong asid);
+extern void init_tlb_ipi();
+extern void wrap_send_tlb_shootdown(int cpu_id);
 
 extern void wrap_halt();
 extern void wrap_sleep();
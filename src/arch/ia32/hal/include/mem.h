@@ -128,8 +128,19 @@ extern void kernel_direct_map_array(ulong addr, size_t size, int disable_cache);
 
 /*
  * TLB
+ * Ranges above the threshold (in pages) are invalidated by a CR3 reload
  */
+#define TLB_FLUSH_THRESHOLD_DEFAULT     32
+
+extern int has_global_pages();
+extern void init_tlb_mp();
+extern void init_tlb();
+
 extern void invalidate_tlb_array(ulong vaddr, size_t size);
+extern void flush_tlb();
+extern void set_tlb_flush_threshold(ulong page_count);
+extern ulong get_tlb_flush_threshold();
+extern void test_tlb();
 
 
 /*
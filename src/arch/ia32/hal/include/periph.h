@@ -8,5 +8,8 @@
 extern void draw_char(char ch);
 extern void init_video();
 
+extern void draw_serial(char ch);
+extern void init_serial();
+
 
 #endif
@@ -181,6 +181,40 @@ int int_handler_exception(struct int_context *context, struct kernel_dispatch_in
     return 1;
 }
 
+/*
+ * Page fault
+ */
+static int int_handler_user_page_fault(struct int_context *context, struct kernel_dispatch_info *kdi)
+{
+    // The kernel only resolves faults of user programs
+    int user_mode = *get_per_cpu(int, cur_in_user_mode);
+    if (!user_mode) {
+        int_handler_dummy(context, kdi);
+        panic("Page fault in kernel mode!");
+    }
+    
+    ulong addr = 0;
+    __asm__ __volatile__
+    (
+        "movl   %%cr2, %%eax;"
+        : "=a" (addr)
+        :
+    );
+    
+    kdi->dispatch_type = kdisp_page_fault;
+    kdi->page_fault.addr = addr;
+    kdi->page_fault.error_code = context->error_code;
+    kdi->page_fault.present = context->error_code & 0x1 ? 1 : 0;
+    kdi->page_fault.write = context->error_code & 0x2 ? 1 : 0;
+    
+    return 1;
+}
+
+void init_page_fault()
+{
+    set_int_vector(VEC_PAGE_FAULT, int_handler_user_page_fault);
+}
+
 /*
  * Device
  */
@@ -78,6 +78,19 @@ void init_kernel()
     
     // TLB
     hexp->invalidate_tlb = wrap_invalidate_tlb;
+    hexp->flush_tlb = wrap_flush_tlb;
+    hexp->flush_user_tlb = NULL;
+    hexp->send_tlb_shootdown = NULL;
+    if (num_cpus > 1) {
+        init_tlb_ipi();
+        hexp->send_tlb_shootdown = wrap_send_tlb_shootdown;
+    }
+    
+    // ASID
+    hexp->asid_limit = 0;
+    
+    // Write protection
+    hexp->user_write_protect = 1;
     
     /*
      * Call kernel's entry
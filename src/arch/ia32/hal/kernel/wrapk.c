@@ -57,6 +57,33 @@ void wrap_invalidate_tlb(ulong asid, ulong vaddr, size_t size)
     invalidate_tlb_array(vaddr, size);
 }
 
+void wrap_flush_tlb(ulong asid)
+{
+    flush_tlb();
+}
+
+static int tlb_ipi_id = -1;
+
+static int tlb_ipi_handler(struct int_context *context, struct kernel_dispatch_info *kdi)
+{
+    lapic_eoi();
+    
+    // The kernel services pending shootdowns on every dispatch
+    return 1;
+}
+
+void init_tlb_ipi()
+{
+    tlb_ipi_id = register_ipi(tlb_ipi_handler);
+    kprintf("\tTLB shootdown IPI registered: %d\n", tlb_ipi_id);
+}
+
+void wrap_send_tlb_shootdown(int cpu_id)
+{
+    assert(tlb_ipi_id >= 0);
+    ipi_send(cpu_id, tlb_ipi_id);
+}
+
 void wrap_halt()
 {
     halt();
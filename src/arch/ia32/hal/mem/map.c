@@ -31,6 +31,19 @@ void init_user_hi4()
     // Setup user version specific content
     upage->value_pte[GET_PTE_INDEX(SYSCALL_PROXY_VADDR)].user = 1;
     upage->value_pte[GET_PTE_INDEX(SYSCALL_PROXY_VADDR)].rw = 0;
+    
+    // HAL mappings are the same in every address space, make them survive CR3 reloads
+    // The syscall proxy differs between kernel and user, so it can't be global
+    if (has_global_pages()) {
+        for (i = 0; i < 1024; i++) {
+            if (i == GET_PTE_INDEX(SYSCALL_PROXY_VADDR) || !kpage->value_pte[i].present) {
+                continue;
+            }
+            
+            kpage->value_pte[i].global = 1;
+            upage->value_pte[i].global = 1;
+        }
+    }
 }
 
 void init_user_page_dir(ulong page_dir_pfn)
@@ -96,6 +109,7 @@ static int user_indirect_map(
         
         // FIXME: the page should've been zeroed by kernel
         memzero((void *)PFN_TO_ADDR(alloc_pfn), PAGE_SIZE);
+        assert(!kernel->pfn_count_add(alloc_pfn, 0));
 
         page->value_pde[index].pfn = alloc_pfn;
         page->value_pde[index].present = 1;
@@ -108,7 +122,8 @@ static int user_indirect_map(
     }
     
     // PTE
-    page = (struct page_frame *)(PFN_TO_ADDR(page->value_pde[index].pfn));
+    ulong pte_pfn = page->value_pde[index].pfn;
+    page = (struct page_frame *)(PFN_TO_ADDR(pte_pfn));
     index = GET_PTE_INDEX(vaddr);
     
     if (page->value_u32[index]) {
@@ -140,6 +155,8 @@ static int user_indirect_map(
         page->value_pde[index].user = 1;
         page->value_pde[index].rw = write;
         page->value_pde[index].cache_disabled = !cacheable;
+        
+        kernel->pfn_count_add(pte_pfn, 1);
     }
     
     return 1;
@@ -172,65 +189,72 @@ int user_indirect_map_array(
     return 1;
 }
 
-static int user_indirect_unmap(ulong page_dir_pfn, ulong vaddr, ulong paddr)
+/*
+ * The number of live entries of each PTE page is kept in the PFN database,
+ * so a PTE page is freed without scanning it
+ */
+static void release_pte_page(volatile struct page_frame *page_dir, int pde_index, ulong cleared)
 {
-    //kprintf("Doing unmap!\n");
-    
-    int need_free = 1;
-    
-    // PDE
-    volatile struct page_frame *page = (struct page_frame *)PFN_TO_ADDR(page_dir_pfn);
-    int index = GET_PDE_INDEX(vaddr);
-    assert(page->value_u32[index]);
-    
-    // PTE
-    page = (struct page_frame *)(PFN_TO_ADDR(page->value_pde[index].pfn));
-    index = GET_PTE_INDEX(vaddr);
-    assert(page->value_u32[index]);
+    ulong pte_pfn = page_dir->value_pde[pde_index].pfn;
     
-    // Unmap
-    assert(page->value_pte[index].pfn == ADDR_TO_PFN(paddr));
-    page->value_u32[index] = 0;
-    
-    // Free PTE page
-    for (index = 0; index < PAGE_ENTRY_COUNT; index++) {
-        if (page->value_u32[index]) {
-            need_free = 0;
-            break;
-        }
-    }
-    
-    if (need_free) {
-        assert(kernel->pfree(ADDR_TO_PFN((ulong)page)));
+    if (kernel->pfn_count_add(pte_pfn, -(int)cleared)) {
+        return;
     }
     
-    return 1;
+    page_dir->value_u32[pde_index] = 0;
+    assert(kernel->pfree(pte_pfn));
 }
 
 int user_indirect_unmap_array(ulong page_dir_pfn, ulong vaddr, ulong paddr, size_t length)
 {
     //kprintf("To unmap, pfn: %u, vaddr: %u, paddr: %u, size: %u\n", page_dir_pfn, vaddr, paddr, length);
     
+    volatile struct page_frame *page_dir = (struct page_frame *)PFN_TO_ADDR(page_dir_pfn);
+    volatile struct page_frame *page = NULL;
+    
     ulong vstart = ALIGN_DOWN(vaddr, PAGE_SIZE);
     ulong pstart = ALIGN_DOWN(paddr, PAGE_SIZE);
     
     ulong vend = ALIGN_UP(vaddr + length, PAGE_SIZE);
     ulong page_count = (vend - vstart) >> PAGE_BITS;
     
+    int pde_index = -1;
+    int pte_index = 0;
+    ulong cleared = 0;
+    
     ulong i;
     ulong vcur = vstart;
     ulong pcur = pstart;
     for (i = 0; i < page_count; i++) {
-        int succeed = user_indirect_unmap(page_dir_pfn, vcur, pcur);
-        
-        if (!succeed) {
-            return 0;
+        // Moving on to the next PTE page, release the current one
+        if (GET_PDE_INDEX(vcur) != pde_index) {
+            if (pde_index >= 0) {
+                release_pte_page(page_dir, pde_index, cleared);
+            }
+            
+            pde_index = GET_PDE_INDEX(vcur);
+            assert(page_dir->value_u32[pde_index]);
+            
+            page = (struct page_frame *)(PFN_TO_ADDR(page_dir->value_pde[pde_index].pfn));
+            cleared = 0;
         }
         
+        // Unmap
+        pte_index = GET_PTE_INDEX(vcur);
+        assert(page->value_u32[pte_index]);
+        assert(page->value_pte[pte_index].pfn == ADDR_TO_PFN(pcur));
+        
+        page->value_u32[pte_index] = 0;
+        cleared++;
+        
         vcur += PAGE_SIZE;
         pcur += PAGE_SIZE;
     }
     
+    if (pde_index >= 0) {
+        release_pte_page(page_dir, pde_index, cleared);
+    }
+    
     return 1;
 }
 
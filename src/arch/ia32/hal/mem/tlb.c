@@ -1,8 +1,72 @@
 #include "common/include/data.h"
 #include "common/include/memory.h"
+#include "common/include/memlayout.h"
+#include "common/include/cycle.h"
+#include "hal/include/print.h"
+#include "hal/include/lib.h"
+#include "hal/include/cpu.h"
 #include "hal/include/mem.h"
 
 
+#define CPUID_EDX_PGE           (0x1 << 13)
+#define CR4_PGE                 (0x1 << 7)
+
+#define TLB_TEST_MAX_PAGES      256
+
+
+static int global_pages = 0;
+static volatile ulong flush_threshold = TLB_FLUSH_THRESHOLD_DEFAULT;
+
+
+/*
+ * Global pages
+ */
+static void enable_global_pages()
+{
+    __asm__ __volatile__
+    (
+        "movl   %%cr4, %%eax;"
+        "orl    %[pge], %%eax;"
+        "movl   %%eax, %%cr4;"
+        :
+        : [pge] "i" (CR4_PGE)
+        : "eax", "memory"
+    );
+}
+
+int has_global_pages()
+{
+    return global_pages;
+}
+
+void init_tlb_mp()
+{
+    if (global_pages) {
+        enable_global_pages();
+    }
+}
+
+void init_tlb()
+{
+    struct cpuid_reg reg;
+    
+    reg.a = 1;
+    reg.b = reg.c = reg.d = 0;
+    
+    if (cpuid(&reg) && (reg.d & CPUID_EDX_PGE)) {
+        global_pages = 1;
+        enable_global_pages();
+    }
+    
+    kprintf("TLB initialized, global pages: %s, full flush threshold: %d pages\n",
+        global_pages ? "yes" : "no", (int)flush_threshold
+    );
+}
+
+
+/*
+ * Invalidation
+ */
 static no_opt void invalidate_tlb(ulong vaddr)
 {
     __asm__ __volatile__
@@ -14,13 +78,39 @@ static no_opt void invalidate_tlb(ulong vaddr)
     );
 }
 
+void flush_tlb()
+{
+    // Global pages survive a CR3 reload, so the shared HAL mappings stay
+    __asm__ __volatile__
+    (
+        "movl   %%cr3, %%eax;"
+        "movl   %%eax, %%cr3;"
+        :
+        :
+        : "eax", "memory"
+    );
+}
+
+void set_tlb_flush_threshold(ulong page_count)
+{
+    flush_threshold = page_count;
+}
+
+ulong get_tlb_flush_threshold()
+{
+    return flush_threshold;
+}
+
 void invalidate_tlb_array(ulong vaddr, size_t size)
 {
-    ulong vstart = (vaddr / PAGE_SIZE) * PAGE_SIZE;
+    ulong vstart = ALIGN_DOWN(vaddr, PAGE_SIZE);
+    ulong vend = ALIGN_UP(vaddr + size, PAGE_SIZE);
+    ulong page_count = (vend - vstart) >> PAGE_BITS;
     
-    ulong page_count = size / PAGE_SIZE;
-    if (size % PAGE_SIZE) {
-        page_count++;
+    // Refilling the whole TLB is cheaper than invlpg past the threshold
+    if (page_count > flush_threshold) {
+        flush_tlb();
+        return;
     }
     
     ulong i;
@@ -30,3 +120,34 @@ void invalidate_tlb_array(ulong vaddr, size_t size)
         vcur += PAGE_SIZE;
     }
 }
+
+
+/*
+ * Cost of invlpg vs CR3 reload, use this to tune the threshold
+ */
+void test_tlb()
+{
+    ulong pages, i;
+    u64 start, end;
+    ulong invlpg_cycles, flush_cycles;
+    
+    kprintf("Testing TLB invalidation\n");
+    
+    for (pages = 1; pages <= TLB_TEST_MAX_PAGES; pages <<= 1) {
+        start = read_cycles();
+        for (i = 0; i < pages; i++) {
+            invalidate_tlb(PER_CPU_AREA_TOP_VADDR + i * PAGE_SIZE);
+        }
+        end = read_cycles();
+        invlpg_cycles = (ulong)(end - start);
+        
+        start = read_cycles();
+        flush_tlb();
+        end = read_cycles();
+        flush_cycles = (ulong)(end - start);
+        
+        kprintf("\t%d pages: invlpg %d cycles, CR3 reload %d cycles\n",
+            (int)pages, (int)invlpg_cycles, (int)flush_cycles
+        );
+    }
+}
@@ -0,0 +1,68 @@
+#include "common/include/data.h"
+#include "hal/include/lib.h"
+#include "hal/include/periph.h"
+
+
+/*
+ * COM1, mirrors the screen output so headless runs can be captured
+ */
+#define SERIAL_PORT     0x3f8
+
+#define SERIAL_DATA     (SERIAL_PORT + 0)
+#define SERIAL_INT      (SERIAL_PORT + 1)
+#define SERIAL_FIFO     (SERIAL_PORT + 2)
+#define SERIAL_LINE     (SERIAL_PORT + 3)
+#define SERIAL_MODEM    (SERIAL_PORT + 4)
+#define SERIAL_STATUS   (SERIAL_PORT + 5)
+
+#define SERIAL_TX_EMPTY 0x20
+#define SERIAL_SPIN     100000
+
+
+static int serial_enabled = 0;
+
+
+static void serial_out(char ch)
+{
+    int spin = SERIAL_SPIN;
+    
+    // Wait for the transmitter, give up if there's nothing on the other side
+    while (!(io_in8(SERIAL_STATUS) & SERIAL_TX_EMPTY)) {
+        if (!--spin) {
+            return;
+        }
+    }
+    
+    io_out8(SERIAL_DATA, (ulong)(u8)ch);
+}
+
+void draw_serial(char ch)
+{
+    if (!serial_enabled) {
+        return;
+    }
+    
+    if (ch == '\n') {
+        serial_out('\r');
+    }
+    serial_out(ch);
+}
+
+void init_serial()
+{
+    // Disable interrupts, we only poll
+    io_out8(SERIAL_INT, 0);
+    
+    // 115200 baud, 8N1
+    io_out8(SERIAL_LINE, 0x80);
+    io_out8(SERIAL_DATA, 0x1);
+    io_out8(SERIAL_INT, 0);
+    io_out8(SERIAL_LINE, 0x3);
+    
+    // Enable and clear FIFO, DTR and RTS set
+    io_out8(SERIAL_FIFO, 0xc7);
+    io_out8(SERIAL_MODEM, 0x3);
+    
+    // No UART if the line register doesn't read back
+    serial_enabled = io_in8(SERIAL_LINE) == 0x3 ? 1 : 0;
+}
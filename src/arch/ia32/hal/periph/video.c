@@ -2,6 +2,7 @@
 #include "common/include/bootparam.h"
 #include "hal/include/lib.h"
 #include "hal/include/print.h"
+#include "hal/include/periph.h"
 
 
 static int pixel = 0;   // video mode, 1 = pixel, 0 = text
@@ -183,6 +184,8 @@ static void tab()
 
 void draw_char(char ch)
 {
+    draw_serial(ch);
+    
     switch (ch) {
     case '\r':
     case '\n':
@@ -1,10 +1,16 @@
 #include "common/include/data.h"
+#include "common/include/atomic.h"
 #include "hal/include/print.h"
 #include "hal/include/int.h"
 #include "hal/include/time.h"
 
 
-static u64 cur_timestamp = 0;
+/*
+ * The timestamp is wider than a word on 32-bit systems,
+ * a sequence count keeps readers from seeing a torn value
+ */
+static volatile u64 cur_timestamp = 0;
+static volatile ulong timestamp_seq = 0;
 
 static int cuumu_days[] = {
     0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365
@@ -50,23 +56,38 @@ static u64 read_timestamp(struct rtc_date_time *out)
 
 void get_system_time(unsigned long *high, unsigned long *low)
 {
+    ulong seq;
+    u64 timestamp;
+    
+    do {
+        seq = timestamp_seq;
+        atomic_readbar();
+        timestamp = cur_timestamp;
+        atomic_readbar();
+    } while ((seq & 0x1) || seq != timestamp_seq);
+    
 //     kprintf("\tTimestamp: %p-%p\n",
 //             (unsigned long)(cur_timestamp >> sizeof(unsigned long) * 8),
 //             (unsigned long)cur_timestamp
 //     );
     
     if (high) {
-        *high = cur_timestamp >> (sizeof(unsigned long) * 8);
+        *high = timestamp >> (sizeof(unsigned long) * 8);
     }
     
     if (low) {
-        *low = (unsigned long)cur_timestamp;
+        *low = (unsigned long)timestamp;
     }
 }
 
 int time_interrupt_handler(struct int_context *context, struct kernel_dispatch_info *kdi)
 {
+    // Only the timer interrupt writes the timestamp
+    timestamp_seq++;
+    atomic_writebar();
     cur_timestamp++;
+    atomic_writebar();
+    timestamp_seq++;
     
     kdi->interrupt.param0 = 0;
     kdi->interrupt.param1 = 0;
@@ -48,6 +48,54 @@ static inline void atomic_inc(volatile unsigned long *target)
 }
 
 
+static inline void atomic_dec(volatile unsigned long *target)
+{
+    unsigned long value = *target;
+    *target = value - 1;
+}
+
+static inline unsigned long atomic_xadd(volatile unsigned long *target, unsigned long value)
+{
+    unsigned long old_val = *target;
+    *target = old_val + value;
+    return old_val;
+}
+
+static inline void atomic_add(volatile unsigned long *target, unsigned long value)
+{
+    atomic_xadd(target, value);
+}
+
+
+/*
+ * Exchange
+ */
+static inline unsigned long atomic_xchg(volatile unsigned long *target, unsigned long value)
+{
+    unsigned long old_val = *target;
+    *target = value;
+    return old_val;
+}
+
+
+/*
+ * Fetch and bitwise ops, the old value is returned
+ */
+static inline unsigned long atomic_or(volatile unsigned long *target, unsigned long mask)
+{
+    unsigned long old_val = *target;
+    *target = old_val | mask;
+    return old_val;
+}
+
+static inline unsigned long atomic_and(volatile unsigned long *target, unsigned long mask)
+{
+    unsigned long old_val = *target;
+    *target = old_val & mask;
+    return old_val;
+}
+
+
 /*
  * Memory barriers
  */
@@ -64,4 +112,12 @@ static inline void atomic_writebar()
 }
 
 
+/*
+ * Spin-wait hint
+ */
+static inline void atomic_pause()
+{
+}
+
+
 #endif
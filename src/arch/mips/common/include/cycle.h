@@ -0,0 +1,30 @@
+#ifndef __ARCH_MIPS_COMMON_INCLUDE_CYCLE__
+#define __ARCH_MIPS_COMMON_INCLUDE_CYCLE__
+
+
+#include "common/include/data.h"
+
+
+/*
+ * Cycle counter - CP0 Count through hardware register 2
+ * Count runs at half of the pipeline clock and wraps around in 32 bits
+ */
+static inline u64 read_cycles()
+{
+    unsigned long count;
+    
+    __asm__ __volatile__
+    (
+        ".set push;"
+        ".set mips32r2;"
+        "rdhwr %[r], $2;"
+        ".set pop;"
+        : [r]"=r"(count)
+        :
+    );
+    
+    return (u64)(u32)count;
+}
+
+
+#endif
@@ -42,6 +42,7 @@ extern int tlb_refill_kernel(ulong addr);
 extern int tlb_refill_user(ulong addr);
 
 extern void invalidate_tlb_array(ulong asid, ulong vaddr, size_t size);
+extern void flush_user_tlb();
 
 extern void init_tlb();
 
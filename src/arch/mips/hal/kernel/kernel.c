@@ -89,6 +89,15 @@ void init_kernel()
     
     // TLB
     hexp->invalidate_tlb = invalidate_tlb_array;
+    hexp->flush_tlb = NULL;
+    hexp->flush_user_tlb = flush_user_tlb;
+    hexp->send_tlb_shootdown = NULL;
+    
+    // ASID
+    hexp->asid_limit = 0x100;
+    
+    // Write protection
+    hexp->user_write_protect = 1;
     
     /*
      * Call kernel's entry
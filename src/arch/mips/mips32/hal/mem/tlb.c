@@ -56,7 +56,7 @@ void write_tlb_entry(int index, u32 hi, u32 pm, u32 lo0, u32 lo1)
     );
 }
 
-void map_tlb_entry_user(int index, u32 asid, u32 vaddr, u32 pfn0, int write0, u32 pfn1, int write1)
+void map_tlb_entry_user(int index, u32 asid, u32 vaddr, int valid0, u32 pfn0, int write0, int valid1, u32 pfn1, int write1)
 {
     struct tlb_entry tlb;
     struct tlb_entry_hi hi;
@@ -75,13 +75,13 @@ void map_tlb_entry_user(int index, u32 asid, u32 vaddr, u32 pfn0, int write0, u3
     
     tlb.lo0.value = 0;
     tlb.lo0.pfn = pfn0;
-    tlb.lo0.valid = 1;
+    tlb.lo0.valid = valid0;
     tlb.lo0.dirty = write0;
     tlb.lo0.coherent = 0x6;
     
     tlb.lo1.value = 0;
     tlb.lo1.pfn = pfn1;
-    tlb.lo1.valid = 1;
+    tlb.lo1.valid = valid1;
     tlb.lo1.dirty = write1;
     tlb.lo1.coherent = 0x6;
     
@@ -203,6 +203,14 @@ int tlb_refill_user(u32 addr)
     dir_index = tlb_probe_kernel(page_addr);
     assert(dir_index >= 0);
     
+    // No page table yet, install an invalid pair so that the access
+    // raises a TLB invalid exception and the kernel can populate the page
+    if (!page->value_pde[GET_PDE_INDEX(addr)].present) {
+        map_tlb_entry_user(dir_index, user_asid, addr, 0, 0, 0, 0, 0, 0);
+        set_asid(user_asid);
+        return 0;
+    }
+    
     // Access the page dir
     u32 table_pfn = page->value_pde[GET_PDE_INDEX(addr)].pfn;
     page_addr = PFN_TO_ADDR(table_pfn);
@@ -218,15 +226,17 @@ int tlb_refill_user(u32 addr)
     
     // Access the page table
     u32 pte_index0 = GET_PTE_INDEX(addr) & ~0x1;
+    int valid0 = page->value_pte[pte_index0].present;
     u32 page_pfn0 = page->value_pte[pte_index0].pfn;
     int write0 = page->value_pte[pte_index0].write_allow;
     
     u32 pte_index1 = pte_index0 | 0x1;
+    int valid1 = page->value_pte[pte_index1].present;
     u32 page_pfn1 = page->value_pte[pte_index1].pfn;
     int write1 = page->value_pte[pte_index1].write_allow;
     
-    // Finally map the actual page
-    map_tlb_entry_user(dir_index, user_asid, addr, page_pfn0, write0, page_pfn1, write1);
+    // Finally map the actual page, pages not present yet are left invalid
+    map_tlb_entry_user(dir_index, user_asid, addr, valid0, page_pfn0, write0, valid1, page_pfn1, write1);
     
     // Restore ASID
     set_asid(user_asid);
@@ -312,6 +322,16 @@ void invalidate_tlb_array(ulong asid, ulong vaddr, size_t size)
     }
 }
 
+void flush_user_tlb()
+{
+    int i;
+    
+    // Wired entries hold kernel mappings, everything else goes
+    for (i = reserved_tlb_entry_count; i < tlb_entry_count; i++) {
+        write_tlb_entry(i, 0, 0, 0, 0);
+    }
+}
+
 
 void init_tlb()
 {
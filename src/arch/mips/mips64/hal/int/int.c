@@ -143,14 +143,50 @@ void tlb_refill_handler(struct context *context)
     }
 }
 
-static int int_handler_tlb_refill(struct int_context *context, struct kernel_dispatch_info *kdi)
+static int int_handler_tlb_invalid(struct int_context *context, struct kernel_dispatch_info *kdi)
 {
+    // A user access hit an invalid entry installed by the refill handler,
+    // the page is not populated yet so let the kernel resolve it
+    int user_mode = *get_per_cpu(int, cur_in_user_mode);
+    if (user_mode) {
+        ulong bad_addr = 0;
+        read_cp0_bad_vaddr(bad_addr);
+        
+        kdi->dispatch_type = kdisp_page_fault;
+        kdi->page_fault.addr = bad_addr;
+        kdi->page_fault.error_code = context->error_code;
+        kdi->page_fault.present = 0;
+        kdi->page_fault.write = context->vector == INT_VECTOR_TLB_MISS_WRITE;
+        
+        return INT_HANDLE_TYPE_KERNEL;
+    }
+    
     tlb_refill_handler(context->context);
     panic("Should not get a secondary TLB miss!\n");
     return 0;
 }
 
 
+static int int_handler_tlb_read_only(struct int_context *context, struct kernel_dispatch_info *kdi)
+{
+    // A user write hit a clean entry, e.g. a copy-on-write page
+    int user_mode = *get_per_cpu(int, cur_in_user_mode);
+    if (!user_mode) {
+        panic("Write to a read-only page in kernel mode!\n");
+    }
+    
+    ulong bad_addr = 0;
+    read_cp0_bad_vaddr(bad_addr);
+    
+    kdi->dispatch_type = kdisp_page_fault;
+    kdi->page_fault.addr = bad_addr;
+    kdi->page_fault.error_code = context->error_code;
+    kdi->page_fault.present = 1;
+    kdi->page_fault.write = 1;
+    
+    return INT_HANDLE_TYPE_KERNEL;
+}
+
 /*
  * Cache error handler
  */
@@ -372,9 +408,10 @@ void init_int()
     
     
     
-    // Register TLB refill general handlers
-    set_int_vector(INT_VECTOR_TLB_MISS_READ, int_handler_tlb_refill);
-    set_int_vector(INT_VECTOR_TLB_MISS_WRITE, int_handler_tlb_refill);
+    // Register TLB invalid and modification handlers
+    set_int_vector(INT_VECTOR_TLB_MISS_READ, int_handler_tlb_invalid);
+    set_int_vector(INT_VECTOR_TLB_MISS_WRITE, int_handler_tlb_invalid);
+    set_int_vector(INT_VECTOR_TLB_READ_ONLY, int_handler_tlb_read_only);
     
 //     // QEMU doesn't support shadow register... so we can't use it right now
 //     // Obtain old SRSCtl
@@ -191,9 +191,10 @@ int tlb_refill_user(ulong addr)
     
     for (i = 0; i < PAGE_LEVELS - 1; i++) {
         // Check if mapping is valid
+        // Not mapped yet, install an invalid pair so that the access
+        // raises a TLB invalid exception and the kernel can populate the page
         if (!page->entries[index].value) {
-            panic("Doesn't support page fault yet!");
-            return 0;
+            goto __do_write;
         }
         
         // Move to next level
@@ -357,6 +358,16 @@ void invalidate_tlb_array(ulong asid, ulong vaddr, size_t size)
     }
 }
 
+void flush_user_tlb()
+{
+    int i;
+    
+    // Wired entries hold kernel mappings, everything else goes
+    for (i = reserved_tlb_entry_count; i < tlb_entry_count; i++) {
+        write_tlb_entry(i, 0, 0, 0, 0);
+    }
+}
+
 
 void init_tlb()
 {
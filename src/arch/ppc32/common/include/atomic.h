@@ -107,6 +107,107 @@ static inline void atomic_inc(volatile unsigned long *target)
 }
 
 
+static inline void atomic_dec(volatile unsigned long *target)
+{
+    register unsigned long tmp;
+    
+    __asm__ __volatile__ (
+        "1:;"
+        "lwarx %[tmp], 0, %[ptr];"
+        "addic %[tmp], %[tmp], -1;"
+        "stwcx. %[tmp], 0, %[ptr];"
+        "bne- 1b;"
+        : [tmp]"=&r"(tmp)
+        : [ptr]"r"(target)
+        : "cc"
+    );
+}
+
+static inline unsigned long atomic_xadd(volatile unsigned long *target, unsigned long value)
+{
+    register unsigned long old_val, tmp;
+    
+    __asm__ __volatile__ (
+        "1:;"
+        "lwarx %[old], 0, %[ptr];"
+        "add %[tmp], %[old], %[val];"
+        "stwcx. %[tmp], 0, %[ptr];"
+        "bne- 1b;"
+        : [old]"=&r"(old_val), [tmp]"=&r"(tmp)
+        : [ptr]"r"(target), [val]"r"(value)
+        : "cc", "memory"
+    );
+    
+    return old_val;
+}
+
+static inline void atomic_add(volatile unsigned long *target, unsigned long value)
+{
+    atomic_xadd(target, value);
+}
+
+
+/*
+ * Exchange
+ */
+static inline unsigned long atomic_xchg(volatile unsigned long *target, unsigned long value)
+{
+    register unsigned long old_val;
+    
+    __asm__ __volatile__ (
+        "1:;"
+        "lwarx %[old], 0, %[ptr];"
+        "stwcx. %[val], 0, %[ptr];"
+        "bne- 1b;"
+        : [old]"=&r"(old_val)
+        : [ptr]"r"(target), [val]"r"(value)
+        : "cc", "memory"
+    );
+    
+    return old_val;
+}
+
+
+/*
+ * Fetch and bitwise ops, the old value is returned
+ */
+static inline unsigned long atomic_or(volatile unsigned long *target, unsigned long mask)
+{
+    register unsigned long old_val, tmp;
+    
+    __asm__ __volatile__ (
+        "1:;"
+        "lwarx %[old], 0, %[ptr];"
+        "or %[tmp], %[old], %[mask];"
+        "stwcx. %[tmp], 0, %[ptr];"
+        "bne- 1b;"
+        : [old]"=&r"(old_val), [tmp]"=&r"(tmp)
+        : [ptr]"r"(target), [mask]"r"(mask)
+        : "cc", "memory"
+    );
+    
+    return old_val;
+}
+
+static inline unsigned long atomic_and(volatile unsigned long *target, unsigned long mask)
+{
+    register unsigned long old_val, tmp;
+    
+    __asm__ __volatile__ (
+        "1:;"
+        "lwarx %[old], 0, %[ptr];"
+        "and %[tmp], %[old], %[mask];"
+        "stwcx. %[tmp], 0, %[ptr];"
+        "bne- 1b;"
+        : [old]"=&r"(old_val), [tmp]"=&r"(tmp)
+        : [ptr]"r"(target), [mask]"r"(mask)
+        : "cc", "memory"
+    );
+    
+    return old_val;
+}
+
+
 /*
  * Memory barriers
  */
@@ -126,4 +227,13 @@ static inline void atomic_writebar()
 }
 
 
+/*
+ * Spin-wait hint
+ */
+static inline void atomic_pause()
+{
+    __asm__ __volatile__ ( "or 27, 27, 27;" : : );
+}
+
+
 #endif
@@ -0,0 +1,32 @@
+#ifndef __ARCH_PPC32_COMMON_INCLUDE_CYCLE__
+#define __ARCH_PPC32_COMMON_INCLUDE_CYCLE__
+
+
+#include "common/include/data.h"
+
+
+/*
+ * Cycle counter - time base
+ */
+static inline u64 read_cycles()
+{
+    unsigned long high, low, check;
+    
+    // Retry if the upper half ticked while reading the lower half
+    __asm__ __volatile__
+    (
+        "1:;"
+        "mftbu %[high];"
+        "mftb %[low];"
+        "mftbu %[check];"
+        "cmpw %[high], %[check];"
+        "bne- 1b;"
+        : [high]"=&r"(high), [low]"=&r"(low), [check]"=&r"(check)
+        :
+    );
+    
+    return ((u64)high << 32) | (u64)low;
+}
+
+
+#endif
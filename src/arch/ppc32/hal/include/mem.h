@@ -21,6 +21,7 @@ extern void fill_pht_by_page(ulong asid, ulong vaddr, ulong ppfn, ulong count, i
 extern void fill_pht_by_addr(ulong asid, ulong vaddr, ulong paddr, ulong size, int io, int priority);
 extern ulong translate_pht(ulong asid, ulong vaddr);
 extern int evict_pht(ulong asid, ulong vaddr);
+extern void flush_user_pht();
 
 extern void fill_kernel_pht(ulong vstart, ulong len, int io, int priority);
 
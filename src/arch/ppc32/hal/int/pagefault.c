@@ -12,6 +12,20 @@
 #include "hal/include/vecnum.h"
 
 
+/*
+ * Not populated yet, let the kernel resolve it
+ */
+static int user_page_fault(struct kernel_dispatch_info *kdi, ulong vaddr, ulong cause, int write)
+{
+    kdi->dispatch_type = kdisp_page_fault;
+    kdi->page_fault.addr = vaddr;
+    kdi->page_fault.error_code = cause;
+    kdi->page_fault.present = 0;
+    kdi->page_fault.write = write;
+    
+    return INT_HANDLE_TYPE_KERNEL;
+}
+
 static int isi_handler(struct int_context *context, struct kernel_dispatch_info *kdi)
 {
     ulong asid = *get_per_cpu(ulong, cur_asid);
@@ -19,6 +33,10 @@ static int isi_handler(struct int_context *context, struct kernel_dispatch_info
     
     ulong page_dir_pfn = *get_per_cpu(ulong, cur_page_dir_pfn);
     ulong paddr = get_paddr(page_dir_pfn, vaddr);
+    
+    if (!paddr && *get_per_cpu(int, cur_in_user_mode)) {
+        return user_page_fault(kdi, vaddr, 0, 0);
+    }
     assert(paddr);
     
 //     kprintf("To handle isi, vaddr @ %p, paddr @ %p, asid: %p\n",
@@ -47,6 +65,10 @@ static int dsi_handler(struct int_context *context, struct kernel_dispatch_info
     ulong page_dir_pfn = *get_per_cpu(ulong, cur_page_dir_pfn);
     ulong paddr = get_paddr(page_dir_pfn, vaddr);
     
+    if (!paddr && *get_per_cpu(int, cur_in_user_mode)) {
+        return user_page_fault(kdi, vaddr, cause, cause & 0x2000000 ? 1 : 0);
+    }
+    
     if (!paddr) {
         kprintf("DSI vaddr @ %p, page dir pfn @ %p, cause: %p, asid: %p, pc: %p, r3: %p, r13: %p\n",
                 (void *)vaddr, (void *)page_dir_pfn, (void *)cause, (void *)asid,
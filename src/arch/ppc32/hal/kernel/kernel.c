@@ -94,6 +94,15 @@ void init_kernel()
     
     // TLB
     hexp->invalidate_tlb = invalidate_tlb_array;
+    hexp->flush_tlb = NULL;
+    hexp->flush_user_tlb = flush_user_pht;
+    hexp->send_tlb_shootdown = NULL;
+    
+    // ASID, limited by the VSID hash
+    hexp->asid_limit = 0x8000;
+    
+    // Write protection, PHT entries are always filled writable
+    hexp->user_write_protect = 0;
     
     /*
      * Call kernel's entry
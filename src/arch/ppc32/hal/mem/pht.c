@@ -373,6 +373,44 @@ int evict_pht(ulong asid, ulong vaddr)
     return evicted;
 }
 
+void flush_user_pht()
+{
+    int i, j;
+    int group_count = pht_size / sizeof(struct pht_group);
+    ulong vaddr = 0;
+    
+    spin_lock_int(&pht_lock);
+    
+    // ASID 0 is the kernel
+    for (i = 0; i < group_count; i++) {
+        for (j = 0; j < 8; j++) {
+            struct pht_entry *entry = &pht[i].entries[j];
+            struct pht_attri_entry *attri_entry = &attri[i].entries[j];
+            
+            if (entry->valid && !attri_entry->persist && (entry->vsid >> 4)) {
+                entry->word0 = entry->word1 = 0;
+                attri_entry->value = 0;
+            }
+        }
+    }
+    
+    // No tlbia on 6xx/7xx, tlbie drops a whole congruence class instead
+    __asm__ __volatile__ ( "sync;" : : : "memory" );
+    for (vaddr = 0; vaddr < 0x40000; vaddr += PAGE_SIZE) {
+        __asm__ __volatile__ ( "tlbie %[vaddr];" : : [vaddr]"r"(vaddr) );
+    }
+    __asm__ __volatile__ (
+        "eieio;"
+        "tlbsync;"
+        "sync;"
+        :
+        :
+        : "memory"
+    );
+    
+    spin_unlock_int(&pht_lock);
+}
+
 
 /*
  * Kernel PHT
@@ -0,0 +1,99 @@
+/*
+ * Async URS at increasing queue depths
+ *  Every slot stats an fd of its own so the entries in flight don't contend
+ *  on a single open
+ */
+
+
+#include "common/include/data.h"
+#include "common/include/urs.h"
+#include "common/include/cycle.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/sys.h"
+#include "klibc/include/aio.h"
+#include "bench/include/bench.h"
+
+
+#define BENCH_AIO_PATH      "coreimg://init.py"
+#define BENCH_AIO_OPS       BENCH_SAMPLES
+
+
+static unsigned long samples[BENCH_AIO_OPS];
+static u64 issued[BENCH_AIO_OPS];
+
+static struct urs_ring ring;
+static struct urs_stat stats[URS_RING_MAX_DEPTH];
+static unsigned long fds[URS_RING_MAX_DEPTH];
+
+
+static void bench_aio_depth(int depth)
+{
+    int i, count;
+    int next = 0, done = 0, errors = 0;
+    unsigned long slot;
+    u64 start, end;
+    char name[32];
+    struct urs_sqe *sqe = NULL;
+    struct urs_cqe cqes[URS_RING_MAX_DEPTH];
+    
+    if (!urs_ring_init(&ring, (unsigned long)depth)) {
+        kprintf("[bench] urs async: unable to create ring\n");
+        return;
+    }
+    
+    start = read_cycles();
+    
+    while (done < BENCH_AIO_OPS) {
+        // Keep the ring full
+        while (next < BENCH_AIO_OPS && (sqe = urs_ring_get_sqe(&ring))) {
+            slot = (unsigned long)(sqe - ring.slots);
+            urs_prep_stat(sqe, fds[slot], &stats[slot], (unsigned long)next);
+            issued[next++] = read_cycles();
+        }
+        urs_ring_submit(&ring);
+        
+        count = urs_ring_reap(&ring, cqes, URS_RING_MAX_DEPTH, 1);
+        end = read_cycles();
+        
+        for (i = 0; i < count; i++) {
+            samples[cqes[i].user_data] = (unsigned long)(end - issued[cqes[i].user_data]);
+            if (cqes[i].result) {
+                errors++;
+            }
+        }
+        done += count;
+    }
+    
+    end = read_cycles();
+    urs_ring_destroy(&ring);
+    
+    ksnprintf(name, sizeof(name), "urs async stat qd %d", depth);
+    bench_report(name, samples, BENCH_AIO_OPS);
+    
+    kprintf("[bench] %s: %u cycles per op, %d errors\n",
+        name, (unsigned long)(end - start) / BENCH_AIO_OPS, errors
+    );
+}
+
+void bench_aio()
+{
+    int i, depth;
+    
+    for (i = 0; i < URS_RING_MAX_DEPTH; i++) {
+        fds[i] = kapi_urs_open(BENCH_AIO_PATH, 0);
+        if (!fds[i]) {
+            kprintf("[bench] urs async: unable to open %s\n", BENCH_AIO_PATH);
+            break;
+        }
+    }
+    
+    if (i == URS_RING_MAX_DEPTH) {
+        for (depth = 1; depth <= URS_RING_MAX_DEPTH; depth *= 2) {
+            bench_aio_depth(depth);
+        }
+    }
+    
+    while (i--) {
+        kapi_urs_close(fds[i]);
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Benchmark process
+ * Results are printed as one line per case so runs can be diffed across commits
+ */
+
+
+#include "common/include/data.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/sys.h"
+#include "bench/include/bench.h"
+
+
+/*
+ * Report
+ */
+static void sort_samples(unsigned long *samples, int count)
+{
+    int i, j;
+    unsigned long cur;
+    
+    for (i = 1; i < count; i++) {
+        cur = samples[i];
+        for (j = i - 1; j >= 0 && samples[j] > cur; j--) {
+            samples[j + 1] = samples[j];
+        }
+        samples[j + 1] = cur;
+    }
+}
+
+void bench_report(char *name, unsigned long *samples, int count)
+{
+    if (!count) {
+        kprintf("[bench] %s: no samples\n", name);
+        return;
+    }
+    
+    sort_samples(samples, count);
+    
+    kprintf("[bench] %s: min %u, median %u, p99 %u, max %u cycles (%d samples)\n",
+        name, samples[0], samples[count / 2], samples[count * 99 / 100], samples[count - 1], count
+    );
+}
+
+
+int main(int argc, char *argv[])
+{
+    kprintf("Toddler benchmark started!\n");
+    
+    bench_ipc();
+    bench_aio();
+    
+    kprintf("[bench] done\n");
+    kapi_process_started(0);
+    
+    // Block here
+    do {
+        syscall_yield();
+    } while (1);
+    
+    return 0;
+}
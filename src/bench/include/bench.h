@@ -0,0 +1,29 @@
+#ifndef __BENCH_INCLUDE_BENCH__
+#define __BENCH_INCLUDE_BENCH__
+
+
+#include "common/include/data.h"
+
+
+/*
+ * Sampling
+ */
+#define BENCH_WARMUP        16
+#define BENCH_SAMPLES       256
+
+extern void bench_report(char *name, unsigned long *samples, int count);
+
+
+/*
+ * IPC
+ */
+extern void bench_ipc();
+
+
+/*
+ * Async URS
+ */
+extern void bench_aio();
+
+
+#endif
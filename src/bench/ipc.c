@@ -0,0 +1,271 @@
+/*
+ * IPC latency
+ */
+
+
+#include "common/include/data.h"
+#include "common/include/syscall.h"
+#include "common/include/atomic.h"
+#include "common/include/cycle.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/sys.h"
+#include "klibc/include/kthread.h"
+#include "bench/include/bench.h"
+
+
+#define BENCH_URS_PATH      "coreimg://init.py"
+#define BENCH_URS_READ      64
+
+
+static unsigned long samples[BENCH_SAMPLES];
+
+
+/*
+ * Null syscall
+ */
+static void bench_null_syscall()
+{
+    int i;
+    u64 start;
+    unsigned long pong = 0;
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        start = read_cycles();
+        syscall_ping((unsigned long)i, &pong);
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    bench_report("null syscall", samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * One-way send, the handler thread simply exits
+ */
+static volatile unsigned long send_handled = 0;
+
+static asmlinkage void send_handler(msg_t *msg)
+{
+    atomic_inc(&send_handled);
+    kapi_thread_exit(NULL);
+}
+
+static void bench_send()
+{
+    int i;
+    u64 start;
+    msg_t *s = NULL;
+    unsigned long msg_num = alloc_msg_num();
+    
+    syscall_reg_msg_handler(msg_num, send_handler);
+    send_handled = 0;
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        s = syscall_msg();
+        s->mailbox_id = IPC_MAILBOX_THIS_PROCESS;
+        s->opcode = IPC_OPCODE_ACTION;
+        s->func_num = msg_num;
+        
+        start = read_cycles();
+        syscall_send();
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    // Wait for all handlers to finish before moving on
+    while (send_handled < BENCH_WARMUP + BENCH_SAMPLES) {
+        syscall_yield();
+        atomic_membar();
+    }
+    
+    syscall_unreg_msg_handler(msg_num);
+    bench_report("send", samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * Request/respond round trip
+ */
+static asmlinkage void respond_handler(msg_t *msg)
+{
+    unsigned long ret_mbox_id = msg->mailbox_id;
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = ret_mbox_id;
+    msg_param_value(r, 0);
+    
+    syscall_respond();
+    
+    // Should never reach here
+    sys_unreahable();
+}
+
+static void bench_request()
+{
+    int i;
+    u64 start;
+    msg_t *s = NULL;
+    unsigned long msg_num = alloc_msg_num();
+    
+    syscall_reg_msg_handler(msg_num, respond_handler);
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        s = syscall_msg();
+        s->mailbox_id = IPC_MAILBOX_THIS_PROCESS;
+        s->opcode = IPC_OPCODE_ACTION;
+        s->func_num = msg_num;
+        
+        start = read_cycles();
+        syscall_request();
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    syscall_unreg_msg_handler(msg_num);
+    bench_report("request/respond", samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * Notification signal followed by a wait that finds the bit already pending
+ */
+static void bench_notif()
+{
+    int i;
+    u64 start;
+    unsigned long notif_id = syscall_notif_create();
+    
+    if (!notif_id) {
+        kprintf("[bench] notif: unable to create notification\n");
+        return;
+    }
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        start = read_cycles();
+        syscall_notif_signal(notif_id, 0x1);
+        syscall_notif_wait(notif_id);
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    syscall_notif_destroy(notif_id);
+    bench_report("notif signal/wait", samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * KAPI served by the kernel
+ */
+static void bench_kapi()
+{
+    int i;
+    u64 start;
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        start = read_cycles();
+        kapi_get_heap_end();
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    bench_report("kapi", samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * URS served by the system process
+ */
+static void bench_urs()
+{
+    int i;
+    u64 start;
+    unsigned long id = 0;
+    char buf[BENCH_URS_READ];
+    
+    static unsigned long open_samples[BENCH_SAMPLES];
+    static unsigned long read_samples[BENCH_SAMPLES];
+    static unsigned long close_samples[BENCH_SAMPLES];
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        start = read_cycles();
+        id = kapi_urs_open(BENCH_URS_PATH, 0);
+        if (i >= 0) {
+            open_samples[i] = (unsigned long)(read_cycles() - start);
+        }
+        
+        if (!id) {
+            kprintf("[bench] urs: unable to open %s\n", BENCH_URS_PATH);
+            return;
+        }
+        
+        start = read_cycles();
+        kapi_urs_read(id, buf, sizeof(buf));
+        if (i >= 0) {
+            read_samples[i] = (unsigned long)(read_cycles() - start);
+        }
+        
+        start = read_cycles();
+        kapi_urs_close(id);
+        if (i >= 0) {
+            close_samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    bench_report("urs open", open_samples, BENCH_SAMPLES);
+    bench_report("urs read", read_samples, BENCH_SAMPLES);
+    bench_report("urs close", close_samples, BENCH_SAMPLES);
+}
+
+
+/*
+ * Thread create until exit is observed
+ */
+static unsigned long thread_noop(unsigned long arg)
+{
+    return arg;
+}
+
+static void bench_thread()
+{
+    int i;
+    u64 start;
+    kthread_t thread;
+    
+    for (i = -BENCH_WARMUP; i < BENCH_SAMPLES; i++) {
+        start = read_cycles();
+        
+        if (!kthread_create(&thread, thread_noop, (unsigned long)i)) {
+            kprintf("[bench] thread: unable to create thread\n");
+            return;
+        }
+        
+        while (!thread.terminated) {
+            syscall_yield();
+            atomic_membar();
+        }
+        
+        if (i >= 0) {
+            samples[i] = (unsigned long)(read_cycles() - start);
+        }
+    }
+    
+    bench_report("thread create/exit", samples, BENCH_SAMPLES);
+}
+
+
+void bench_ipc()
+{
+    bench_null_syscall();
+    bench_send();
+    bench_request();
+    bench_notif();
+    bench_kapi();
+    bench_urs();
+    bench_thread();
+}
@@ -23,6 +23,15 @@
 #endif
 #endif
 
+// Large enough for the L1 lines of all supported archs
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#ifndef cache_aligned
+#define cache_aligned   __attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
 #ifndef entry_func
 #define entry_func  __attribute__((section("entry")))
 #endif
@@ -7,6 +7,10 @@
 
 #define EI_NIDENT     16
 
+#define PF_X          0x1
+#define PF_W          0x2
+#define PF_R          0x4
+
 
 /*
  * ELF32
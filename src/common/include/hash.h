@@ -0,0 +1,49 @@
+#ifndef __COMMON_INCLUDE_HASH__
+#define __COMMON_INCLUDE_HASH__
+
+
+#include "common/include/data.h"
+
+
+/*
+ * Integer mixer - murmur3 finalizer
+ * Pointer keys are mostly aligned, so the low bits must be mixed with the high ones
+ */
+static inline u32 hash_ulong(unsigned long key)
+{
+    u32 k = (u32)key;
+    
+    if (sizeof(unsigned long) > sizeof(u32)) {
+        k ^= (u32)((key >> 16) >> 16);
+    }
+    
+    k ^= k >> 16;
+    k *= 0x85ebca6b;
+    k ^= k >> 13;
+    k *= 0xc2b2ae35;
+    k ^= k >> 16;
+    
+    return k;
+}
+
+
+/*
+ * String hash - 32-bit FNV-1a
+ */
+#define HASH_FNV_OFFSET     0x811c9dc5
+#define HASH_FNV_PRIME      0x01000193
+
+static inline u32 hash_str(const char *str)
+{
+    u32 k = HASH_FNV_OFFSET;
+    
+    while (*str) {
+        k ^= (u32)(unsigned char)*str++;
+        k *= HASH_FNV_PRIME;
+    }
+    
+    return k;
+}
+
+
+#endif
@@ -48,6 +48,14 @@ struct kernel_dispatch_info {
             ulong param1;
             ulong param2;
         } interrupt;
+        
+        struct {
+            // Filled by HAL
+            ulong addr;
+            ulong error_code;
+            int write;
+            int present;
+        } page_fault;
     };
     
     // Filled by HAL
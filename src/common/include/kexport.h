@@ -14,6 +14,7 @@ struct kernel_exports {
     ulong (*palloc_tag)(int count, int tag);
     ulong (*palloc)(int count);
     int (*pfree)(ulong pfn);
+    ulong (*pfn_count_add)(ulong pfn, int delta);
     void (*dispatch)(ulong sched_id, struct kernel_dispatch_info *int_info);
 };
 
@@ -94,6 +95,15 @@ struct hal_exports {
     
     // TLB
     void (*invalidate_tlb)(ulong asid, ulong vaddr, size_t size);
+    void (*flush_tlb)(ulong asid);
+    void (*flush_user_tlb)();
+    void (*send_tlb_shootdown)(int cpu_id);
+    
+    // ASID, 0 = no hardware ASIDs
+    ulong asid_limit;
+    
+    // 1 = read-only user mappings raise write faults, required by copy-on-write
+    int user_write_protect;
 };
 
 
@@ -29,6 +29,9 @@ struct thread_control_block {
     void *tls;
     void *msg_send;
     void *msg_recv;
+    
+    // Servers tell requests made by the kernel apart by this
+    ulong kernel_proc_id;
 } packedstruct;
 
 
@@ -37,6 +37,18 @@
 #define SYSCALL_REG_KAPI_SERVER     0x40
 #define SYSCALL_UNREG_KAPI_SERVER   0x41
 
+// Notification
+#define SYSCALL_NOTIF_CREATE        0x50
+#define SYSCALL_NOTIF_DESTROY       0x51
+#define SYSCALL_NOTIF_SIGNAL        0x52
+#define SYSCALL_NOTIF_WAIT          0x53
+#define SYSCALL_NOTIF_POLL          0x54
+#define SYSCALL_NOTIF_BIND_IRQ      0x55
+
+// Interrupt
+#define SYSCALL_INT_BIND            0x60
+#define SYSCALL_INT_WAIT            0x61
+
 
 /*
  * IPC
@@ -88,6 +100,14 @@ typedef volatile struct msg msg_t;
 typedef asmlinkage void (*msg_handler_t)(msg_t *msg);
 
 
+/*
+ * Notification
+ * A word of pending bits, an IRQ bound to a notification sets its own bit
+ */
+#define NOTIF_BITS              (sizeof(unsigned long) * 8)
+#define NOTIF_IRQ_BIT(irq)      (0x1ul << ((irq) % NOTIF_BITS))
+
+
 /*
  * KAPI
  */
@@ -135,12 +155,21 @@ typedef asmlinkage void (*msg_handler_t)(msg_t *msg);
 #define KAPI_URS_RENAME         0x6a
 #define KAPI_URS_STAT           0x6b
 #define KAPI_URS_IOCTL          0x6c
+#define KAPI_URS_MAP            0x6d
+#define KAPI_URS_PAGE_IN        0x6e
+#define KAPI_URS_ASYNC          0x6f
 
 #define KAPI_URS_REG_SUPER      0x70
 #define KAPI_URS_REG_OP         0x71
 
-// KMap
+#define KAPI_URS_LIST_BATCH     0x78
+#define KAPI_URS_DUP            0x79
+#define KAPI_URS_DCACHE_STAT    0x7a
+
+// KMap and file mapping
 #define KAPI_KMAP               0x80
+#define KAPI_FMAP               0x81
+#define KAPI_FUNMAP             0x82
 
 // Temporary stdio KAPIs, they eventually should be implemented through URS
 #define KAPI_STDIN_READ         0x1000
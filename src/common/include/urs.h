@@ -23,6 +23,7 @@ enum urs_op_type {
     uop_none,
     
     uop_lookup,
+    uop_lookup_path,
     uop_open,
     uop_release,
     
@@ -32,6 +33,7 @@ enum urs_op_type {
     uop_seek_data,
     
     uop_list,
+    uop_list_batch,
     uop_seek_list,
     
     uop_create,
@@ -41,6 +43,8 @@ enum urs_op_type {
     uop_stat,
     uop_ioctl,
     
+    uop_map,
+    
     uop_count,
 };
 
@@ -48,6 +52,9 @@ enum urs_op_type {
 /*
  * Registration
  */
+#define UREG_CACHE_WRITE_THROUGH    0x1
+#define UREG_CACHE_WRITE_BACK       0x2
+
 enum urs_reg_type {
     ureg_none,
     ureg_func,
@@ -107,5 +114,98 @@ struct urs_stat {
     u64 change_time;
 };
 
+struct urs_dcache_stat {
+    unsigned long entries;
+    unsigned long hits;
+    unsigned long neg_hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+};
+
+
+/*
+ * Batched list
+ *  Entries are packed back to back, each one is 8-byte aligned and may carry
+ *  the stat of the sub node ahead of its name
+ */
+#define ULIST_STAT          0x1
+#define ULIST_ALIGN         8
+
+// Has to fit in a message together with the header
+#define ULIST_BATCH_MAX     2048
+
+struct urs_list_entry {
+    // Whole entry, including the stat, the name and the padding
+    unsigned short size;
+    unsigned short name_len;
+    unsigned int flags;
+};
+
+#define ULIST_ALIGN_UP(s)   (((s) + ULIST_ALIGN - 1) & ~(ULIST_ALIGN - 1))
+#define ULIST_HEADER_SIZE   ULIST_ALIGN_UP(sizeof(struct urs_list_entry))
+#define ULIST_STAT_SIZE     ULIST_ALIGN_UP(sizeof(struct urs_stat))
+
+static inline unsigned long urs_list_entry_size(unsigned long name_len, unsigned int flags)
+{
+    unsigned long size = ULIST_HEADER_SIZE + name_len + 1;
+    if (flags & ULIST_STAT) {
+        size += ULIST_STAT_SIZE;
+    }
+    
+    return ULIST_ALIGN_UP(size);
+}
+
+static inline struct urs_stat *urs_list_entry_stat(struct urs_list_entry *entry)
+{
+    if (!(entry->flags & ULIST_STAT)) {
+        return NULL;
+    }
+    
+    return (struct urs_stat *)((unsigned long)entry + ULIST_HEADER_SIZE);
+}
+
+static inline char *urs_list_entry_name(struct urs_list_entry *entry)
+{
+    unsigned long offset = ULIST_HEADER_SIZE;
+    if (entry->flags & ULIST_STAT) {
+        offset += ULIST_STAT_SIZE;
+    }
+    
+    return (char *)((unsigned long)entry + offset);
+}
+
+/*
+ * Appends an entry, returns its size or 0 if it doesn't fit in the rest of
+ * the buffer. The stat is filled in later through urs_list_entry_stat
+ */
+static inline unsigned long urs_list_pack(void *buf, unsigned long count, const char *name, unsigned int flags)
+{
+    struct urs_list_entry *entry = (struct urs_list_entry *)buf;
+    unsigned long name_len = 0;
+    unsigned long size = 0;
+    char *dest = NULL;
+    
+    while (name[name_len]) {
+        name_len++;
+    }
+    
+    size = urs_list_entry_size(name_len, flags);
+    if (size > count || size > 0xffff) {
+        return 0;
+    }
+    
+    entry->size = (unsigned short)size;
+    entry->name_len = (unsigned short)name_len;
+    entry->flags = flags & ULIST_STAT;
+    
+    dest = urs_list_entry_name(entry);
+    do {
+        *dest++ = *name;
+    } while (*name++);
+    
+    return size;
+}
+
 
 #endif
@@ -1,6 +1,7 @@
 #include "common/include/data.h"
 #include "common/include/urs.h"
 #include "common/include/errno.h"
+#include "common/include/hash.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/string.h"
@@ -12,6 +13,7 @@
 
 
 #define DEVFS_BLOCK_SIZE    128
+#define DEVFS_NAME_MAX      128
 
 
 struct devfs_block {
@@ -29,9 +31,23 @@ struct devfs_data {
     struct devfs_block *tail;
 };
 
+struct devfs_dirent {
+    struct devfs_dirent *prev;
+    struct devfs_dirent *next;
+    
+    unsigned long seq;
+    struct devfs_node *node;
+};
+
 struct devfs_sub {
     unsigned long count;
     hash_t *entries;
+    
+    // Entries in the order they were created, for listing
+    struct devfs_dirent *head;
+    struct devfs_dirent *tail;
+    unsigned long next_seq;
+    unsigned long remove_gen;
 };
 
 struct devfs_node {
@@ -59,10 +75,16 @@ struct devfs_open {
     
     unsigned long data_pos;
     unsigned long sub_pos;
+    
+    // List cursor, the last entry is only trusted if nothing was removed since
+    struct devfs_dirent *list_last;
+    unsigned long list_seq;
+    unsigned long list_gen;
 };
 
 
 static unsigned long block_salloc_id;
+static unsigned long dirent_salloc_id;
 static unsigned long node_salloc_id;
 static unsigned long open_salloc_id;
 static hash_t *devfs_table;
@@ -73,14 +95,7 @@ static hash_t *devfs_table;
  */
 static unsigned int urs_hash_func(void *key, unsigned int size)
 {
-    char *str = (char *)key;
-    unsigned int k = 0;
-    
-    do {
-        k += (unsigned int)(*str);
-    } while (*str++);
-    
-    return k % size;
+    return hash_str((char *)key) % size;
 }
 
 static int urs_hash_cmp(void *cmp_key, void *node_key)
@@ -274,6 +289,9 @@ static struct devfs_node *create_node(const char *name, struct devfs_node *paren
     
     node->sub.count = 0;
     node->sub.entries = NULL;
+    node->sub.head = node->sub.tail = NULL;
+    node->sub.next_seq = 0;
+    node->sub.remove_gen = 0;
     
     node->link = NULL;
     
@@ -305,10 +323,124 @@ static struct devfs_open *create_open(unsigned long super_id, unsigned long node
     open->data_pos = 0;
     open->sub_pos = 0;
     
+    open->list_last = NULL;
+    open->list_seq = 0;
+    open->list_gen = node->sub.remove_gen;
+    
     return open;
 }
 
 
+/*
+ * Sub entries
+ *  The hash maps names to entries, the entries are also kept in the order
+ *  they were created so a list resumes right where the last one stopped
+ */
+static struct devfs_node *obtain_sub(struct devfs_node *node, const char *name)
+{
+    struct devfs_dirent *dirent = (struct devfs_dirent *)hash_obtain(node->sub.entries, (void *)name);
+    hash_release(node->sub.entries, (void *)name, dirent);
+    
+    return dirent ? dirent->node : NULL;
+}
+
+static int insert_sub(struct devfs_node *node, struct devfs_node *sub)
+{
+    struct devfs_dirent *dirent = (struct devfs_dirent *)salloc(dirent_salloc_id);
+    if (!dirent) {
+        return -1;
+    }
+    
+    if (!node->sub.entries) {
+        node->sub.entries = hash_new(0, urs_hash_func, urs_hash_cmp);
+    }
+    
+    if (hash_insert(node->sub.entries, sub->name, dirent)) {
+        sfree(dirent);
+        return -1;
+    }
+    
+    dirent->node = sub;
+    dirent->seq = node->sub.next_seq++;
+    dirent->next = NULL;
+    dirent->prev = node->sub.tail;
+    
+    if (node->sub.tail) {
+        node->sub.tail->next = dirent;
+    } else {
+        node->sub.head = dirent;
+    }
+    node->sub.tail = dirent;
+    node->sub.count++;
+    
+    return 0;
+}
+
+static void remove_sub(struct devfs_node *node, struct devfs_node *sub)
+{
+    struct devfs_dirent *dirent = (struct devfs_dirent *)hash_obtain(node->sub.entries, sub->name);
+    hash_release(node->sub.entries, sub->name, dirent);
+    assert(dirent);
+    
+    hash_remove(node->sub.entries, sub->name);
+    
+    if (dirent->prev) {
+        dirent->prev->next = dirent->next;
+    } else {
+        node->sub.head = dirent->next;
+    }
+    
+    if (dirent->next) {
+        dirent->next->prev = dirent->prev;
+    } else {
+        node->sub.tail = dirent->prev;
+    }
+    
+    // Cursors of opens on this node may point to the entry
+    node->sub.remove_gen++;
+    node->sub.count--;
+    
+    sfree(dirent);
+}
+
+static struct devfs_dirent *list_next_sub(struct devfs_open *open, struct devfs_node *node)
+{
+    struct devfs_dirent *dirent = NULL;
+    
+    if (open->list_gen == node->sub.remove_gen) {
+        return open->list_last ? open->list_last->next : node->sub.head;
+    }
+    
+    // Something was removed, resume from the first entry after the last one listed
+    for (dirent = node->sub.head; dirent && dirent->seq < open->list_seq; dirent = dirent->next);
+    
+    open->list_last = dirent ? dirent->prev : node->sub.tail;
+    open->list_gen = node->sub.remove_gen;
+    
+    return dirent;
+}
+
+static void list_advance(struct devfs_open *open, struct devfs_dirent *dirent)
+{
+    open->list_last = dirent;
+    open->list_seq = dirent->seq + 1;
+    open->sub_pos++;
+}
+
+static void list_seek(struct devfs_open *open, struct devfs_node *node, unsigned long pos)
+{
+    struct devfs_dirent *dirent = NULL;
+    unsigned long i;
+    
+    for (i = 0, dirent = node->sub.head; i < pos && dirent; i++, dirent = dirent->next);
+    
+    open->list_last = dirent ? dirent->prev : node->sub.tail;
+    open->list_seq = dirent ? dirent->seq : node->sub.next_seq;
+    open->list_gen = node->sub.remove_gen;
+    open->sub_pos = pos;
+}
+
+
 /*
  * Node
  */
@@ -329,9 +461,8 @@ static int lookup(unsigned long super_id, unsigned long node_id, unsigned long p
             return 0;
         }
         
-        next = (struct devfs_node *)hash_obtain(node->sub.entries, (void *)name);
+        next = obtain_sub(node, name);
         if (!next) {
-            hash_release(node->sub.entries, (void *)name, next);
             return 0;
         }
     } else {
@@ -376,8 +507,103 @@ static int lookup(unsigned long super_id, unsigned long node_id, unsigned long p
         }
     }
     
-    if (node_id) {
-        hash_release(node->sub.entries, (void *)name, next);
+    return 0;
+}
+
+/*
+ * Whole path lookup, stops right after a sym link or before a name that is
+ * too long, the caller takes care of the rest
+ */
+static int lookup_path(unsigned long super_id, unsigned long node_id, unsigned long proc_id, const char *path, int *is_link,
+                       unsigned long *next_id, unsigned long *consumed, void *buf, unsigned long count, unsigned long *actual)
+{
+    struct devfs_node *node = NULL, *next = NULL;
+    char name[DEVFS_NAME_MAX];
+    unsigned long pos = 0;
+    unsigned long len = 0;
+    
+    node = get_node_by_id(super_id, node_id);
+    assert(node);
+    node->ref_count--;
+    
+    if (is_link) {
+        *is_link = 0;
+    }
+    if (next_id) {
+        *next_id = 0;
+    }
+    
+    while (path[pos]) {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        // Get the next name
+        len = 0;
+        while (path[pos + len] && path[pos + len] != '/') {
+            len++;
+        }
+        
+        if (len >= DEVFS_NAME_MAX) {
+            break;
+        }
+        
+        memcpy(name, &path[pos], len);
+        name[len] = '\0';
+        
+        // Find out the next node
+        if (!node->sub.count) {
+            return 0;
+        }
+        
+        next = obtain_sub(node, name);
+        if (!next) {
+            return 0;
+        }
+        
+        pos += len;
+        
+        // Sym link, let the caller follow it
+        if (next->link) {
+            unsigned long cpy_index = 0;
+            unsigned long link_len = strlen(next->link) + 1;
+            u8 *cpy = (u8 *)buf;
+            
+            if (is_link) {
+                *is_link = 1;
+            }
+            
+            if (buf) {
+                while (cpy_index < count && cpy_index < link_len) {
+                    cpy[cpy_index] = (u8)next->link[cpy_index];
+                    cpy_index++;
+                }
+            }
+            
+            if (actual) {
+                *actual = cpy_index;
+            }
+            
+            if (consumed) {
+                *consumed = pos;
+            }
+            
+            return 0;
+        }
+        
+        node = next;
+    }
+    
+    // Set results
+    node->ref_count++;
+    
+    if (next_id) {
+        *next_id = node->id;
+    }
+    
+    if (consumed) {
+        *consumed = pos;
     }
     
     return 0;
@@ -536,10 +762,11 @@ static int seek_data(unsigned long super_id, unsigned long open_id, u64 offset,
 
 static int list(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned long *actual)
 {
+    struct devfs_dirent *dirent = NULL;
     struct devfs_node *sub = NULL;
     unsigned long len = 0;
     int result = 0;
-     
+    
     struct devfs_open *open = NULL;
     struct devfs_node *node = NULL;
     
@@ -553,20 +780,12 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
         return ECLOSED;
     }
     
-    // Sub entries have not yet been initialized
-    if (!node->sub.entries) {
-        return -1;
-    }
-    
     // No more entries
-    if (open->sub_pos >= node->sub.count) {
+    dirent = list_next_sub(open, node);
+    if (!dirent) {
         return -1;
     }
-    
-    // Obtain the sub entry
-//     kprintf("to obtain at pos: %p, entries: %p, count: %p\n", open->sub_pos, node->sub.entries, node->sub.count);
-    sub = hash_obtain_at(node->sub.entries, open->sub_pos);
-//     kprintf("obtained: %p\n", sub);
+    sub = dirent->node;
     
     // Copy the name
     if (buf) {
@@ -581,14 +800,74 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
         *actual = len;
     }
     
-    open->sub_pos++;
-    hash_release(node->sub.entries, NULL, sub);
-    
+    list_advance(open, dirent);
     node->list_time = time();
     
     return result;
 }
 
+static void fill_stat(struct devfs_node *node, struct urs_stat *stat)
+{
+    stat->num_links = node->ref_count;
+    stat->sub_count = node->sub.count;
+    stat->data_size = node->data.size;
+    stat->occupied_size = stat->data_size;
+    
+    stat->create_time = node->create_time;
+    stat->read_time = node->read_time;
+    stat->write_time = node->write_time;
+    stat->list_time = node->list_time;
+    stat->change_time = node->change_time;
+}
+
+/*
+ * Packs as many entries as fit, ELIMIT if not even the next one does
+ */
+static int list_batch(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned int flags, unsigned long *actual)
+{
+    struct devfs_dirent *dirent = NULL;
+    struct urs_stat *stat = NULL;
+    unsigned long len = 0;
+    unsigned long size = 0;
+    
+    struct devfs_open *open = NULL;
+    struct devfs_node *node = NULL;
+    
+    open = get_open_by_id(open_id);
+    if (!open) {
+        return EBADF;
+    }
+    
+    node = open->node;
+    if (!node) {
+        return ECLOSED;
+    }
+    
+    for (dirent = list_next_sub(open, node); dirent; dirent = dirent->next) {
+        size = urs_list_pack((u8 *)buf + len, count - len, dirent->node->name, flags);
+        if (!size) {
+            break;
+        }
+        
+        stat = urs_list_entry_stat((struct urs_list_entry *)((u8 *)buf + len));
+        if (stat) {
+            memzero(stat, sizeof(struct urs_stat));
+            fill_stat(dirent->node, stat);
+        }
+        
+        len += size;
+        list_advance(open, dirent);
+    }
+    
+    if (actual) {
+        *actual = len;
+    }
+    
+    node->list_time = time();
+    
+    return dirent && !len ? ELIMIT : EOK;
+}
+
 static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset, enum urs_seek_from from, u64 *newpos)
 {
     unsigned long pos = 0;
@@ -637,7 +916,7 @@ static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset,
         break;
     }
     
-    open->sub_pos = (u64)pos;
+    list_seek(open, node, pos);
     if (newpos) {
         *newpos = (u64)pos;
     }
@@ -689,13 +968,8 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
     }
     
     if (sub) {
-        if (!node->sub.entries) {
-            node->sub.entries = hash_new(0, urs_hash_func, urs_hash_cmp);
-            kprintf("New has table created @ %p\n", node->sub.entries);
-        }
-        
         kprintf("To insert into hash table, name: %s, sub: %p\n", name, sub);
-        if (hash_insert(node->sub.entries, sub->name, sub)) {
+        if (insert_sub(node, sub)) {
             if (sub->link) {
                 free(sub->link);
             }
@@ -703,8 +977,6 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
             sfree(sub);
             return -2;
         };
-        
-        node->sub.count++;
     }
     
     return 0;
@@ -743,8 +1015,7 @@ static int remove(unsigned long super_id, unsigned long open_id, int erase)
     assert(parent->sub.entries);
     assert(parent->sub.count);
     
-    hash_remove(parent->sub.entries, node->name);
-    parent->sub.count--;
+    remove_sub(parent, node);
     
     // Free this node
     node->ref_count--;
@@ -789,12 +1060,16 @@ static int rename(unsigned long super_id, unsigned long open_id, char *name)
         return -2;
     }
     
+    // The entry keeps its place in the list
+    struct devfs_dirent *dirent = (struct devfs_dirent *)hash_obtain(parent->sub.entries, node->name);
+    hash_release(parent->sub.entries, node->name, dirent);
+    
     hash_remove(parent->sub.entries, node->name);
-    if (hash_insert(parent->sub.entries, name, node)) {
+    if (hash_insert(parent->sub.entries, name, dirent)) {
         free(node->name);
         node->name = strdup(name);
     } else {
-        hash_insert(parent->sub.entries, node->name, node);
+        hash_insert(parent->sub.entries, node->name, dirent);
     }
     
     return EOK;
@@ -816,21 +1091,9 @@ static int stat(unsigned long super_id, unsigned long open_id, struct urs_stat *
     }
     
     if (stat) {
-        struct devfs_node *n = open->node;
-        
         stat->super_id = 0;
         stat->open_dispatch_id = open->id;
-        
-        stat->num_links = node->ref_count;
-        stat->sub_count = node->sub.count;
-        stat->data_size = node->data.size;
-        stat->occupied_size = stat->data_size;
-        
-        stat->create_time = node->create_time;
-        stat->read_time = node->read_time;
-        stat->write_time = node->write_time;
-        stat->list_time = node->list_time;
-        stat->change_time = node->change_time;
+        fill_stat(node, stat);
     }
     
     return EOK;
@@ -861,39 +1124,66 @@ asmlinkage void devfs_msg_handler(msg_t *msg)
         char *name = (char *)((unsigned long)msg + msg->params[4].offset);
         int is_link = 0;
         unsigned long next_id = 0;
-        
+            
         result = lookup(super_id, node_id, proc_id, name, &is_link, &next_id, NULL, 0, NULL);
-        
+            
 //         kprintf("name: %s, node: %p, is link: %d, next: %p\n", name, node_id, is_link, next_id);
-        
+            
         r = syscall_msg();
         msg_param_value(r, (unsigned long)is_link);
         msg_param_value(r, next_id);
         msg_param_buffer(r, NULL, 0);
         msg_param_value(r, 0);
+            
+        break;
+    }
         
+    case uop_lookup_path: {
+        unsigned long node_id = msg->params[2].value;
+        unsigned long proc_id = msg->params[3].value;
+        char *path = (char *)((unsigned long)msg + msg->params[4].offset);
+        unsigned long count = msg->params[5].value;
+        int is_link = 0;
+        unsigned long next_id = 0;
+        unsigned long consumed = 0;
+        u8 buf[128];
+        unsigned long actual = 0;
+            
+        if (count > sizeof(buf)) {
+            count = sizeof(buf);
+        }
+            
+        result = lookup_path(super_id, node_id, proc_id, path, &is_link, &next_id, &consumed, buf, count, &actual);
+            
+        r = syscall_msg();
+        msg_param_value(r, (unsigned long)is_link);
+        msg_param_value(r, next_id);
+        msg_param_value(r, consumed);
+        msg_param_buffer(r, buf, actual);
+        msg_param_value(r, actual);
+            
         break;
     }
-    
+        
     case uop_open: {
         unsigned long node_id = msg->params[2].value;
         unsigned long proc_id = msg->params[3].value;
         unsigned long open_id = 0;
-        
+            
         result = open(super_id, node_id, proc_id, &open_id);
-        
+            
         r = syscall_msg();
         msg_param_value(r, open_id);
-        
+            
         break;
     }
-    
+        
     case uop_release: {
         unsigned long open_id = msg->params[2].value;
         result = close(super_id, open_id);
         break;
     }
-    
+        
     // Data
     case uop_read: {
         unsigned long open_id = msg->params[2].value;
@@ -903,84 +1193,113 @@ asmlinkage void devfs_msg_handler(msg_t *msg)
         if (msg->params[3].value < count) {
             count = msg->params[3].value;
         }
-        
+            
         result = read(super_id, open_id, buf, count, &actual);
-        
+            
         r = syscall_msg();
         msg_param_buffer(r, buf, actual);
         msg_param_value(r, actual);
-        
+            
         break;
     }
-    
+        
     case uop_write: {
         unsigned long open_id = msg->params[2].value;
         void *buf = (void *)((unsigned long)msg + msg->params[3].offset);
         unsigned long count = msg->params[4].value;
         unsigned long actual = 0;
-        
+            
         result = write(super_id, open_id, buf, count, &actual);
-        
+            
         r = syscall_msg();
         msg_param_value(r, actual);
-        
+            
         break;
     }
-    
+        
     case uop_truncate: {
         unsigned long open_id = msg->params[2].value;
         result = truncate(super_id, open_id);
         break;
     }
-    
+        
     case uop_seek_data: {
         unsigned long open_id = msg->params[2].value;
         u64 offset = msg->params[3].value64;
         enum urs_seek_from from = (enum urs_seek_from)msg->params[4].value;
         u64 newpos = 0;
-        
+            
         result = seek_data(super_id, open_id, offset, from, &newpos);
-        
+            
         r = syscall_msg();
         msg_param_value64(r, newpos);
-        
+            
         break;
     }
-    
+        
     // List
     case uop_list: {
         unsigned long open_id = msg->params[2].value;
         u8 buf[64];
         unsigned long count = sizeof(buf);
         unsigned long actual = 0;
-        
+            
         if (msg->params[3].value < count) {
             count = msg->params[3].value;
         }
-        
+            
         result = list(super_id, open_id, buf, count, &actual);
-        
+            
         r = syscall_msg();
         msg_param_buffer(r, buf, actual);
         msg_param_value(r, actual);
+            
+        break;
+    }
         
+    case uop_list_batch: {
+        unsigned long open_id = msg->params[2].value;
+        unsigned long count = msg->params[3].value;
+        unsigned int flags = (unsigned int)msg->params[4].value;
+        unsigned long actual = 0;
+            
+        // Too large for the stack of a handler thread
+        u8 *buf = (u8 *)halloc();
+        if (count > ULIST_BATCH_MAX) {
+            count = ULIST_BATCH_MAX;
+        }
+            
+        if (buf) {
+            result = list_batch(super_id, open_id, buf, count, flags, &actual);
+        } else {
+            result = ENOMEM;
+        }
+            
+        r = syscall_msg();
+        msg_param_buffer(r, buf, actual);
+        msg_param_value(r, actual);
+            
+        if (buf) {
+            hfree(buf);
+        }
+            
         break;
     }
-    
+        
     case uop_seek_list: {
         unsigned long open_id = msg->params[2].value;
         u64 offset = msg->params[3].value64;
         enum urs_seek_from from = (enum urs_seek_from)msg->params[4].value;
         u64 newpos = 0;
-        
+            
         result = seek_list(super_id, open_id, offset, from, &newpos);
-        
+            
         r = syscall_msg();
         msg_param_value64(r, newpos);
-        
+            
         break;
     }
-    
+        
     // Create
     case uop_create: {
         unsigned long open_id = msg->params[2].value;
@@ -989,38 +1308,38 @@ asmlinkage void devfs_msg_handler(msg_t *msg)
         unsigned int flags = (unsigned int)msg->params[5].value;
         char *target = (void *)((unsigned long)msg + msg->params[6].offset);
         unsigned long target_open_id = msg->params[7].value;
-        
+            
         result = create(super_id, open_id, name, type, flags, target, target_open_id);
         break;
     }
-    
+        
     case uop_remove: {
         unsigned long open_id = msg->params[2].value;
         int erase = (int)msg->params[3].value;
         result = remove(super_id, open_id, erase);
         break;
     }
-    
+        
     case uop_rename: {
         unsigned long open_id = msg->params[2].value;
         char *name = (void *)((unsigned long)msg + msg->params[3].offset);
         result = rename(super_id, open_id, name);
         break;
     }
-    
+        
     // Stat
     case uop_stat: {
         unsigned long open_id = msg->params[2].value;
         struct urs_stat s;
-        
+            
         result = stat(super_id, open_id, &s);
-        
+            
         r = syscall_msg();
         msg_param_buffer(r, &s, sizeof(struct urs_stat));
-        
+            
         break;
     }
-    
+        
     default:
         break;
     }
@@ -1056,39 +1375,41 @@ static int register_devfs(char *path)
     struct urs_reg_ops ops;
     struct devfs_node *root = NULL;
     unsigned long super_id = 0;
-    
+
     // Prepare operations
     REG_OP(uop_lookup, lookup);
+    REG_OP(uop_lookup_path, lookup_path);
     REG_OP(uop_open, open);
     REG_OP(uop_release, close);
-    
+
     REG_OP(uop_read, read);
     REG_OP(uop_write, write);
     REG_OP(uop_truncate, truncate);
     REG_OP(uop_seek_data, seek_data);
-    
+
     REG_OP(uop_list, list);
+    REG_OP(uop_list_batch, list_batch);
     REG_OP(uop_seek_list, seek_list);
-    
+
     REG_OP(uop_create, create);
     REG_OP(uop_remove, remove);
     REG_OP(uop_rename, rename);
-    
+
     REG_OP(uop_stat, stat);
-    
+
     // Register the FS
     super_id = kapi_urs_reg_super(path, "devfs", 0, &ops);
     if (!super_id) {
         return -2;
     }
-    
+
     root = create_node("/", NULL);
     if (!root) {
         return -3;
     }
-    
+
     hash_insert(devfs_table, (void *)super_id, root);
-    
+
     return 0;
 }
 
@@ -1101,8 +1422,9 @@ void init_devfs()
     devfs_table = hash_new(0, NULL, NULL);
     open_salloc_id = salloc_create(sizeof(struct devfs_open), 0, NULL, NULL);
     node_salloc_id = salloc_create(sizeof(struct devfs_node), 0, NULL, NULL);
+    dirent_salloc_id = salloc_create(sizeof(struct devfs_dirent), 0, NULL, NULL);
     block_salloc_id = salloc_create(sizeof(struct devfs_block), 0, NULL, NULL);
-    
+
     register_devfs("dev://");
 }
 
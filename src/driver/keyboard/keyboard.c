@@ -2,6 +2,7 @@
 #include "klibc/include/stdio.h"
 #include "klibc/include/assert.h"
 #include "klibc/include/sys.h"
+#include "klibc/include/kthread.h"
 #include "driver/include/keyboard.h"
 #include "driver/include/console.h"
 
@@ -253,6 +254,9 @@ static int alt_hold = 0;
 static int cmd_hold = 0;
 static int fn_hold = 0;
 
+// Scroll Lock asks for the interrupt stats
+static int stats_request = 0;
+
 
 static void convert_scan_code(unsigned int scan_code, unsigned int *key, int *release)
 {
@@ -292,6 +296,9 @@ static char process_key(unsigned int scan_code)
     case CAPS_LOCK:
         caps_lock = release ? caps_lock : !caps_lock;
         break;
+    case SCROLL_LOCK:
+        stats_request = release ? stats_request : 1;
+        break;
     
     case SHIFT_L:
     case SHIFT_R:
@@ -320,7 +327,7 @@ static char process_key(unsigned int scan_code)
 }
 
 
-static asmlinkage void keyboard_interrupt_handler(msg_t *msg)
+static void handle_keyboard_interrupt(msg_t *msg)
 {
     u8 buf[sizeof(ulong)];
     int buf_size = (int)msg->params[2].value;
@@ -366,13 +373,45 @@ static asmlinkage void keyboard_interrupt_handler(msg_t *msg)
 //     } else {
 //         kprintf("Got a keyboard interrupt, scan code: %u, non-printable\n", scan_code);
 //     }
+}
+
+
+/*
+ * Persistent handler thread
+ */
+#define KEYBOARD_IRQ            1
+
+static kthread_t keyboard_thread;
+static struct interrupt_stats keyboard_stats;
+
+static unsigned long keyboard_interrupt_thread(unsigned long arg)
+{
+    msg_t *msg = NULL;
     
-    kapi_thread_exit(NULL);
+    do {
+        msg = interrupt_wait(KEYBOARD_IRQ, &keyboard_stats);
+        if (msg) {
+            handle_keyboard_interrupt(msg);
+            
+            // Report the interrupt latency on request only
+            if (stats_request) {
+                stats_request = 0;
+                interrupt_stats_report(KEYBOARD_IRQ, &keyboard_stats);
+            }
+        }
+    } while (msg);
+    
+    return 0;
 }
 
 void init_keyboard()
 {
-    // Register keyboard handler
-    kapi_interrupt_reg(1, keyboard_interrupt_handler);
+    // Bind the IRQ before the thread starts, early interrupts are queued by the kernel
+    if (!syscall_int_bind(KEYBOARD_IRQ)) {
+        kprintf("Unable to bind keyboard IRQ\n");
+        return;
+    }
+    
+    kthread_create(&keyboard_thread, keyboard_interrupt_thread, 0);
     kprintf("Keyboard handler registered\n");
 }
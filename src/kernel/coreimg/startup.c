@@ -10,6 +10,14 @@
 #include "kernel/include/coreimg.h"
 
 
+/*
+ * The benchmark process runs before the shell if STARTUP_BENCH is set,
+ * tmake sets it for headless runs. The image always carries it
+ */
+#ifndef STARTUP_BENCH
+#define STARTUP_BENCH   0
+#endif
+
 struct startup_record {
     char *name;
     char *url;
@@ -22,6 +30,9 @@ struct startup_record {
 static struct startup_record records[] = {
     { "tdlrsys.bin", "coreimg://tdlrsys.bin", process_system, 0, 0 },
     { "tdlrdrv.bin", "coreimg://tdlrdrv.bin", process_driver, 0, 0 },
+#if STARTUP_BENCH
+    { "tdlrbench.bin", "coreimg://tdlrbench.bin", process_user, 0, 0 },
+#endif
     { "tdlrshell.bin", "coreimg://tdlrshell.bin", process_user, 0, 0 },
 };
 
@@ -65,6 +76,17 @@ static void create_startup_worker(ulong param)
     }
     
     kprintf("All startup processes have been started!\n");
+    lock_stat_report();
+    dispatch_stat_report();
+    
+    for (i = 0; i < sizeof(records) / sizeof(struct startup_record); i++) {
+        struct process *p = find_process(records[i].proc_id);
+        if (p) {
+            page_fault_stat_report(p);
+            release_process(p);
+        }
+    }
+    image_page_stat_report();
     
     // Done
     terminate_thread_self(worker);
@@ -1,17 +1,28 @@
 #include "common/include/data.h"
+#include "common/include/memory.h"
+#include "common/include/hash.h"
+#include "common/include/cycle.h"
 #include "kernel/include/hal.h"
 #include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
 #include "kernel/include/sync.h"
 #include "kernel/include/ds.h"
 
 
+// Grow once the average chain length exceeds this
+#define HASHTABLE_MAX_LOAD          2
+
+// Bucket arrays larger than this come from palloc
+#define HASHTABLE_MALLOC_LIMIT      512
+
+
 static int hashtable_salloc_id;
 static int hash_node_salloc_id;
 
 
 static ulong default_hash_func(ulong key, ulong size)
 {
-    return key % size;
+    return hash_ulong(key) % size;
 }
 
 static int default_hash_cmp(ulong cmp, ulong node)
@@ -33,18 +44,60 @@ void init_hashtable()
     kprintf("\tHashtable salloc ID: %d, node salloc ID: %d\n", hashtable_salloc_id, hash_node_salloc_id);
 }
 
-void hashtable_create(hashtable_t *l, ulong bucket_count, hashtable_func_t hash_func, hashtable_cmp_t hash_cmp)
+
+/*
+ * Bucket arrays
+ */
+static hashtable_array_t *alloc_array(ulong bucket_count)
 {
     int i;
+    hashtable_array_t *a = NULL;
+    size_t size = sizeof(hashtable_array_t) + sizeof(hashtable_bucket_t) * bucket_count;
     
-    l->bucket_count = bucket_count ? bucket_count : 16;
-    l->node_count = 0;
+    if (size <= HASHTABLE_MALLOC_LIMIT) {
+        a = (hashtable_array_t *)malloc(size);
+        assert(a);
+        a->page_alloc = 0;
+    } else {
+        ulong pfn = palloc(ALIGN_UP(size, PAGE_SIZE) / PAGE_SIZE);
+        assert(pfn);
+        a = (hashtable_array_t *)PFN_TO_ADDR(pfn);
+        a->page_alloc = 1;
+    }
+    
+    a->bucket_count = bucket_count;
+    for (i = 0; i < bucket_count; i++) {
+        a->buckets[i].node_count = 0;
+        a->buckets[i].head = NULL;
+        a->buckets[i].migrated = 0;
+        spin_init(&a->buckets[i].lock);
+    }
+    
+    return a;
+}
+
+static void free_array(void *ptr)
+{
+    hashtable_array_t *a = (hashtable_array_t *)ptr;
     
-    l->buckets = (hashtable_bucket_t *)malloc(sizeof(hashtable_bucket_t) * l->bucket_count);
-    for (i = 0; i < l->bucket_count; i++) {
-        l->buckets[i].node_count = 0;
-        l->buckets[i].head = NULL;
+    if (a->page_alloc) {
+        pfree(ADDR_TO_PFN((ulong)a));
+    } else {
+        free(a);
     }
+}
+
+
+void hashtable_create(hashtable_t *l, ulong bucket_count, hashtable_func_t hash_func, hashtable_cmp_t hash_cmp)
+{
+    l->buckets = alloc_array(bucket_count ? bucket_count : 16);
+    l->old_buckets = NULL;
+    
+    l->rehash_index = 0;
+    l->rehash_done = 0;
+    l->seq = 0;
+    
+    l->node_count = 0;
     
     l->hash_func = hash_func ? hash_func : default_hash_func;
     l->hash_cmp = hash_cmp ? hash_cmp : default_hash_cmp;
@@ -60,26 +113,25 @@ hashtable_t *hashtable_new(ulong bucket_count, hashtable_func_t hash_func, hasht
     return h;
 }
 
-int hashtable_contains(hashtable_t *l, ulong key)
+
+/*
+ * Lookup - readers never take a lock, they run inside an RCU read section
+ */
+static hashtable_bucket_t *get_bucket(hashtable_t *l, hashtable_array_t *a, ulong key)
+{
+    ulong hash = l->hash_func(key, a->bucket_count);
+    return &a->buckets[hash];
+}
+
+static hashtable_node_t *find_in_bucket(hashtable_t *l, hashtable_bucket_t *bucket, ulong key)
 {
     int cmp = 0;
-    int found = 0;
-    hashtable_node_t *s = NULL;
-    
-    // Get the hash and bucket
-    ulong hash = l->hash_func(key, l->bucket_count);
-    hashtable_bucket_t *bucket = &l->buckets[hash];
-    
-    // Lock the table
-    spin_lock_int(&l->lock);
+    hashtable_node_t *s = bucket->head;
     
-    // Find the node
-    s = bucket->head;
     while (s) {
         cmp = l->hash_cmp(key, s->key);
         if (0 == cmp) {
-            found = 1;
-            break;
+            return s;
         } else if (-1 == cmp) {
             break;
         }
@@ -87,42 +139,64 @@ int hashtable_contains(hashtable_t *l, ulong key)
         s = s->next;
     }
     
-    // Unlock
-    spin_unlock_int(&l->lock);
+    return NULL;
+}
+
+static hashtable_node_t *find_node(hashtable_t *l, ulong key)
+{
+    ulong seq = 0;
+    hashtable_array_t *old = NULL;
+    hashtable_array_t *cur = NULL;
+    hashtable_node_t *s = NULL;
     
-    return found;
+    do {
+        seq = l->seq;
+        atomic_readbar();
+        
+        old = l->old_buckets;
+        cur = l->buckets;
+        
+        // A resize copies a node to the new array before unlinking it from the old one
+        if (old) {
+            s = find_in_bucket(l, get_bucket(l, old, key), key);
+            if (s) {
+                return s;
+            }
+        }
+        
+        s = find_in_bucket(l, get_bucket(l, cur, key), key);
+        if (s) {
+            return s;
+        }
+        
+        // Not found, make sure the arrays were not switched under our feet
+        atomic_readbar();
+    } while ((seq & 0x1) || seq != l->seq);
+    
+    return NULL;
 }
 
-void *hashtable_obtain(hashtable_t *l, ulong key)
+int hashtable_contains(hashtable_t *l, ulong key)
 {
-    int cmp = 0;
     int found = 0;
-    hashtable_node_t *s = NULL;
     
-    // Get the hash and bucket
-    ulong hash = l->hash_func(key, l->bucket_count);
-    hashtable_bucket_t *bucket = &l->buckets[hash];
+    rcu_read_lock();
+    found = find_node(l, key) ? 1 : 0;
+    rcu_read_unlock();
     
-    // Lock the table
-    spin_lock_int(&l->lock);
+    return found;
+}
+
+void *hashtable_obtain(hashtable_t *l, ulong key)
+{
+    hashtable_node_t *s = NULL;
     
-    // Find the node
-    s = bucket->head;
-    while (s) {
-        cmp = l->hash_cmp(key, s->key);
-        if (0 == cmp) {
-            found = 1;
-            break;
-        } else if (-1 == cmp) {
-            break;
-        }
-        
-        s = s->next;
-    }
+    // The read section lasts until hashtable_release
+    rcu_read_lock();
     
-    if (!found) {
-        // Unlock
-        spin_unlock_int(&l->lock);
+    s = find_node(l, key);
+    if (!s) {
+        rcu_read_unlock();
         return NULL;
     }
     
@@ -133,58 +207,219 @@ void hashtable_release(hashtable_t *l, ulong key, void *n)
 {
     assert(n);
     
-    // Unlock
-    spin_unlock_int(&l->lock);
+    rcu_read_unlock();
 }
 
-int hashtable_insert(hashtable_t *l, ulong key, void *n)
+
+/*
+ * Incremental resizing
+ *  Each insert or remove migrates one bucket of the old array, so the cost
+ *  of a resize is spread over the following updates
+ */
+static void switch_arrays(hashtable_t *l, hashtable_array_t *old, hashtable_array_t *cur)
 {
-    hashtable_node_t *cur = NULL;
-    hashtable_node_t *prev = NULL;
+    l->seq++;
+    atomic_writebar();
     
-    if (hashtable_contains(l, key)) {
-        return 0;
-    }
+    l->old_buckets = old;
+    l->buckets = cur;
     
-    // Allocate a node
-    hashtable_node_t *s = (hashtable_node_t *)salloc(hash_node_salloc_id);
-    assert(s);
-    s->key = key;
-    s->node = n;
+    atomic_writebar();
+    l->seq++;
+}
+
+static void start_resize(hashtable_t *l)
+{
+    hashtable_array_t *cur = NULL;
     
-    // Get the hash and bucket
-    unsigned long hash = l->hash_func(key, l->bucket_count);
-    hashtable_bucket_t *bucket = &l->buckets[hash];
+    spin_lock_int(&l->lock);
     
-    // Lock the table
-    spin_lock_int(&l->lock);;
+    cur = l->buckets;
+    if (l->old_buckets || l->node_count <= cur->bucket_count * HASHTABLE_MAX_LOAD) {
+        spin_unlock_int(&l->lock);
+        return;
+    }
     
-    // Insert into the proper position
-    cur = bucket->head;
+    l->rehash_index = 0;
+    l->rehash_done = 0;
+    switch_arrays(l, cur, alloc_array(cur->bucket_count * 2));
     
-    while (cur) {
-        if (-1 == l->hash_cmp(key, cur->key)) {
-            break;
-        }
-        
+    spin_unlock_int(&l->lock);
+}
+
+static void insert_sorted(hashtable_t *l, hashtable_bucket_t *bucket, hashtable_node_t *s)
+{
+    hashtable_node_t *cur = bucket->head;
+    hashtable_node_t *prev = NULL;
+    
+    while (cur && -1 != l->hash_cmp(s->key, cur->key)) {
         prev = cur;
         cur = cur->next;
     }
     
+    // The node must be fully set up before readers can see it
+    s->next = cur;
+    atomic_writebar();
+    
     if (prev) {
-        s->next = prev->next;
         prev->next = s;
     } else {
-        s->next = bucket->head;
         bucket->head = s;
     }
     
     bucket->node_count++;
-    l->node_count++;
+}
+
+static void rehash_step(hashtable_t *l)
+{
+    ulong index = 0;
+    int finished = 0;
+    hashtable_array_t *old = NULL;
+    hashtable_array_t *cur = NULL;
+    hashtable_bucket_t *bucket = NULL;
+    hashtable_node_t *s = NULL;
+    hashtable_node_t *next = NULL;
+    
+    // Claim a bucket to migrate
+    spin_lock_int(&l->lock);
+    
+    old = l->old_buckets;
+    cur = l->buckets;
+    if (!old || l->rehash_index >= old->bucket_count) {
+        spin_unlock_int(&l->lock);
+        return;
+    }
+    index = l->rehash_index++;
+    
+    spin_unlock_int(&l->lock);
+    
+    // Copy the nodes to the new array, lock order is always old then new
+    bucket = &old->buckets[index];
+    spin_lock_int(&bucket->lock);
+    
+    for (s = bucket->head; s; s = s->next) {
+        hashtable_node_t *copy = (hashtable_node_t *)salloc(hash_node_salloc_id);
+        hashtable_bucket_t *dest = get_bucket(l, cur, s->key);
+        assert(copy);
+        
+        copy->key = s->key;
+        copy->node = s->node;
+        
+        spin_lock_int(&dest->lock);
+        insert_sorted(l, dest, copy);
+        spin_unlock_int(&dest->lock);
+    }
+    
+    s = bucket->head;
+    bucket->head = NULL;
+    bucket->node_count = 0;
+    bucket->migrated = 1;
+    
+    spin_unlock_int(&bucket->lock);
+    
+    // Readers may still be walking the old chain
+    while (s) {
+        next = s->next;
+        rcu_retire(&s->rcu, s, sfree);
+        s = next;
+    }
+    
+    // The last migrated bucket retires the old array
+    spin_lock_int(&l->lock);
+    
+    if (++l->rehash_done == old->bucket_count) {
+        switch_arrays(l, NULL, cur);
+        finished = 1;
+    }
     
-    // Unlock
     spin_unlock_int(&l->lock);
     
+    if (finished) {
+        rcu_retire(&old->rcu, old, free_array);
+    }
+}
+
+
+/*
+ * Update - writers lock the bucket that currently holds the key
+ */
+static hashtable_bucket_t *lock_bucket(hashtable_t *l, ulong key)
+{
+    ulong seq = 0;
+    hashtable_array_t *old = NULL;
+    hashtable_bucket_t *bucket = NULL;
+    
+    do {
+        seq = l->seq;
+        if (seq & 0x1) {
+            continue;
+        }
+        atomic_readbar();
+        
+        // Keys in a bucket that has not been migrated yet stay in the old array
+        old = l->old_buckets;
+        if (old) {
+            bucket = get_bucket(l, old, key);
+            spin_lock_int(&bucket->lock);
+            
+            if (!bucket->migrated && seq == l->seq) {
+                return bucket;
+            }
+            
+            spin_unlock_int(&bucket->lock);
+            if (!bucket->migrated) {
+                continue;
+            }
+        }
+        
+        bucket = get_bucket(l, l->buckets, key);
+        spin_lock_int(&bucket->lock);
+        
+        if (seq == l->seq) {
+            return bucket;
+        }
+        
+        spin_unlock_int(&bucket->lock);
+    } while (1);
+    
+    return NULL;
+}
+
+int hashtable_insert(hashtable_t *l, ulong key, void *n)
+{
+    hashtable_bucket_t *bucket = NULL;
+    
+    // Allocate a node
+    hashtable_node_t *s = (hashtable_node_t *)salloc(hash_node_salloc_id);
+    assert(s);
+    s->key = key;
+    s->node = n;
+    
+    // The arrays must stay alive while we hold one of their locks
+    rcu_read_lock();
+    bucket = lock_bucket(l, key);
+    
+    // Check for duplicates
+    if (find_in_bucket(l, bucket, key)) {
+        spin_unlock_int(&bucket->lock);
+        rcu_read_unlock();
+        
+        sfree(s);
+        return 0;
+    }
+    
+    // Insert into the proper position
+    insert_sorted(l, bucket, s);
+    atomic_inc(&l->node_count);
+    
+    // Unlock
+    spin_unlock_int(&bucket->lock);
+    rcu_read_unlock();
+    
+    // Resize
+    start_resize(l);
+    rehash_step(l);
+    
     return 1;
 }
 
@@ -192,14 +427,12 @@ int hashtable_remove(hashtable_t *l, ulong key)
 {
     int cmp = 0;
     int found = 0;
+    hashtable_bucket_t *bucket = NULL;
     hashtable_node_t *s = NULL, *prev = NULL;
     
-    // Get the hash and bucket
-    ulong hash = l->hash_func(key, l->bucket_count);
-    hashtable_bucket_t *bucket = &l->buckets[hash];
-    
-    // Lock the table
-    spin_lock_int(&l->lock);
+    // Lock the bucket
+    rcu_read_lock();
+    bucket = lock_bucket(l, key);
     
     // Find the node
     s = bucket->head;
@@ -216,18 +449,127 @@ int hashtable_remove(hashtable_t *l, ulong key)
         s = s->next;
     }
     
+    // Unlink the node, its next pointer stays valid for concurrent readers
     if (found) {
         if (prev) {
             prev->next = s->next;
         } else {
             bucket->head = s->next;
         }
+        
+        bucket->node_count--;
+        atomic_dec(&l->node_count);
     }
     
     // Unlock
-    spin_unlock_int(&l->lock);
+    spin_unlock_int(&bucket->lock);
+    rcu_read_unlock();
+    
+    // Free the node once all readers are done with it
+    if (found) {
+        rcu_retire(&s->rcu, s, sfree);
+    }
     
-    sfree(s);
+    // Keep an ongoing resize moving
+    rehash_step(l);
     
     return found;
 }
+
+
+/*
+ * Benchmark
+ */
+#define HASHTABLE_TEST_ENTRIES      100000
+#define HASHTABLE_TEST_HISTOGRAM    8
+
+static void print_chain_stats(hashtable_t *l)
+{
+    int i;
+    ulong max_len = 0;
+    ulong used = 0;
+    ulong histogram[HASHTABLE_TEST_HISTOGRAM];
+    hashtable_array_t *a = l->buckets;
+    
+    for (i = 0; i < HASHTABLE_TEST_HISTOGRAM; i++) {
+        histogram[i] = 0;
+    }
+    
+    for (i = 0; i < a->bucket_count; i++) {
+        ulong len = a->buckets[i].node_count;
+        
+        if (len) {
+            used++;
+        }
+        if (len > max_len) {
+            max_len = len;
+        }
+        
+        histogram[len < HASHTABLE_TEST_HISTOGRAM ? len : HASHTABLE_TEST_HISTOGRAM - 1]++;
+    }
+    
+    kprintf("\tBuckets: %u, used: %u, nodes: %u, max chain: %u\n",
+            a->bucket_count, used, l->node_count, max_len);
+    
+    kprintf("\tChain length histogram:");
+    for (i = 0; i < HASHTABLE_TEST_HISTOGRAM; i++) {
+        kprintf(" [%d%s] %u", i, i == HASHTABLE_TEST_HISTOGRAM - 1 ? "+" : "", histogram[i]);
+    }
+    kprintf("\n");
+}
+
+void test_hashtable()
+{
+    int i;
+    u64 start, end;
+    ulong key;
+    hashtable_t table;
+    
+    kprintf("Testing hashtable\n");
+    
+    // Page-aligned keys are the worst case for a modulo hash
+    hashtable_create(&table, 0, NULL, NULL);
+    
+    start = read_cycles();
+    for (i = 0; i < HASHTABLE_TEST_ENTRIES; i++) {
+        key = (ulong)i * PAGE_SIZE;
+        assert(hashtable_insert(&table, key, (void *)(key + 1)));
+    }
+    end = read_cycles();
+    
+    // Finish the pending resize so that all entries are in one array
+    while (table.old_buckets) {
+        rehash_step(&table);
+    }
+    
+    kprintf("\tInsert: %u cycles per entry\n", (ulong)(end - start) / HASHTABLE_TEST_ENTRIES);
+    print_chain_stats(&table);
+    
+    // Hits
+    start = read_cycles();
+    for (i = 0; i < HASHTABLE_TEST_ENTRIES; i++) {
+        key = (ulong)i * PAGE_SIZE;
+        void *n = hashtable_obtain(&table, key);
+        assert(n == (void *)(key + 1));
+        hashtable_release(&table, key, n);
+    }
+    end = read_cycles();
+    kprintf("\tLookup hit: %u cycles per lookup\n", (ulong)(end - start) / HASHTABLE_TEST_ENTRIES);
+    
+    // Misses
+    start = read_cycles();
+    for (i = 0; i < HASHTABLE_TEST_ENTRIES; i++) {
+        key = (ulong)i * PAGE_SIZE + 1;
+        assert(!hashtable_contains(&table, key));
+    }
+    end = read_cycles();
+    kprintf("\tLookup miss: %u cycles per lookup\n", (ulong)(end - start) / HASHTABLE_TEST_ENTRIES);
+    
+    // Clean up
+    for (i = 0; i < HASHTABLE_TEST_ENTRIES; i++) {
+        assert(hashtable_remove(&table, (ulong)i * PAGE_SIZE));
+    }
+    free_array(table.buckets);
+    
+    kprintf("Successfully passed the test!\n");
+}
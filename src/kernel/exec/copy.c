@@ -1,40 +1,120 @@
+/*
+ * Cross address space copy
+ *  Each side is translated once per page, then every run that stays within
+ *  one source page and one destination page is copied by memcpy
+ *
+ *  Images are filled in page by page at fault time and msgs move through
+ *  physical windows, so only test_copy runs these for now
+ */
+
+
 #include "common/include/data.h"
+#include "common/include/cycle.h"
 #include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
 #include "kernel/include/lib.h"
+#include "kernel/include/exec.h"
 
 
-void cross_as_copy(
-    ulong src_page_dir_pfn, ulong src_start, ulong len,
-    ulong dest_page_dir_pfn, ulong dest_start)
+struct copy_cursor {
+    // 0 = kernel address space, addresses are used as is
+    ulong page_dir_pfn;
+    
+    // Last translated page
+    ulong vaddr;
+    ulong paddr;
+};
+
+
+static void init_cursor(struct copy_cursor *c, ulong page_dir_pfn)
+{
+    c->page_dir_pfn = page_dir_pfn;
+    
+    // Never page aligned, so the first lookup always translates
+    c->vaddr = 1;
+    c->paddr = 0;
+}
+
+static ulong translate(struct copy_cursor *c, ulong vaddr, ulong *left)
 {
-    ulong i;
-    ulong src_end = src_start + len;
-    
-    // Round down src start and dest start
-    src_start = ALIGN_DOWN(src_start, sizeof(ulong));
-    dest_start = ALIGN_DOWN(dest_start, sizeof(ulong));
-    src_end = ALIGN_UP(src_end, sizeof(ulong));
-    
-    // Calculate actual length
-    len = src_end - src_start;
-    
-    // Do the actual copy
-    ulong cur_src_paddr, cur_dest_paddr;
-    for (i = 0; i < len; i += sizeof(ulong)) {
-        // Get physical address
-        cur_src_paddr = hal->get_paddr(src_page_dir_pfn, src_start + i);
-        cur_dest_paddr = hal->get_paddr(dest_page_dir_pfn, dest_start + i);
-        assert(cur_src_paddr && cur_dest_paddr);
+    ulong page = ALIGN_DOWN(vaddr, PAGE_SIZE);
+    *left = page + PAGE_SIZE - vaddr;
+    
+    if (!c->page_dir_pfn) {
+        return vaddr;
+    }
+    
+    if (page != c->vaddr) {
+        c->paddr = hal->get_paddr(c->page_dir_pfn, page);
+        assert(c->paddr);
+        
+        c->vaddr = page;
+    }
+    
+    return c->paddr + (vaddr - page);
+}
+
+static void copy_runs(
+    struct copy_cursor *src, ulong src_start,
+    struct copy_cursor *dest, ulong dest_start,
+    ulong len)
+{
+    ulong src_left, dest_left, run;
+    ulong src_paddr, dest_paddr;
+    
+    while (len) {
+        src_paddr = translate(src, src_start, &src_left);
+        dest_paddr = translate(dest, dest_start, &dest_left);
         
-//         kprintf("vsrc: %p, psrc: %p, vdest: %p, pdest: %p",
-//                 (void *)(src_start + i), (void *)cur_src_paddr,
-//                 (void *)(dest_start + i), (void *)cur_dest_paddr);
+        run = len;
+        if (run > src_left) {
+            run = src_left;
+        }
+        if (run > dest_left) {
+            run = dest_left;
+        }
         
-        // Copy the value
-        ulong word = *((ulong *)cur_src_paddr);
-        *((ulong *)cur_dest_paddr) = word;
+//         kprintf("vsrc: %p, psrc: %p, vdest: %p, pdest: %p, run: %u\n",
+//                 (void *)src_start, (void *)src_paddr,
+//                 (void *)dest_start, (void *)dest_paddr, run);
         
-//         kprintf("word: %p\n", (void *)word);
+        memcpy((void *)dest_paddr, (void *)src_paddr, run);
+        
+        src_start += run;
+        dest_start += run;
+        len -= run;
+    }
+}
+
+
+void cross_as_copy(
+    ulong src_page_dir_pfn, ulong src_start, ulong len,
+    ulong dest_page_dir_pfn, ulong dest_start)
+{
+    struct copy_cursor src, dest;
+    
+    init_cursor(&src, src_page_dir_pfn);
+    init_cursor(&dest, dest_page_dir_pfn);
+    
+    copy_runs(&src, src_start, &dest, dest_start, len);
+}
+
+/*
+ * Bulk copy, translations are carried over from one vector to the next so
+ * buffers that share pages are only translated once
+ */
+void cross_as_copy_bulk(
+    ulong src_page_dir_pfn, ulong dest_page_dir_pfn,
+    struct copy_vec *vecs, int count)
+{
+    int i;
+    struct copy_cursor src, dest;
+    
+    init_cursor(&src, src_page_dir_pfn);
+    init_cursor(&dest, dest_page_dir_pfn);
+    
+    for (i = 0; i < count; i++) {
+        copy_runs(&src, vecs[i].src, &dest, vecs[i].dest, vecs[i].len);
     }
 }
 
@@ -42,33 +122,155 @@ void copy_to_user(
     ulong src_start, ulong len,
     ulong user_page_dir_pfn, ulong user_start)
 {
-    ulong i;
-    ulong src_end = src_start + len;
-    
-    // Round down src start and dest start
-    src_start = ALIGN_DOWN(src_start, sizeof(ulong));
-    user_start = ALIGN_DOWN(user_start, sizeof(ulong));
-    src_end = ALIGN_UP(src_end, sizeof(ulong));
-    
-    // Calculate actual length
-    len = src_end - src_start;
-    
-    // Do the actual copy
-    ulong cur_src_paddr, cur_dest_paddr;
-    for (i = 0; i < len; i += sizeof(ulong)) {
-        // Get physical address
-        cur_src_paddr = src_start + i;
-        cur_dest_paddr = hal->get_paddr(user_page_dir_pfn, user_start + i);
-        assert(cur_src_paddr && cur_dest_paddr);
-        
-//         kprintf("psrc: %p, vdest: %p, pdest: %p",
-//                 (void *)cur_src_paddr,
-//                 (void *)(user_start + i), (void *)cur_dest_paddr);
-        
-        // Copy the value
-        ulong word = *((ulong *)cur_src_paddr);
-        *((ulong *)cur_dest_paddr) = word;
-        
-//         kprintf("word: %p\n", (void *)word);
+    struct copy_cursor src, dest;
+    
+    init_cursor(&src, 0);
+    init_cursor(&dest, user_page_dir_pfn);
+    
+    copy_runs(&src, src_start, &dest, user_start, len);
+}
+
+
+/*
+ * Test
+ */
+#define COPY_TEST_SIZE      (1024 * 1024)
+#define COPY_TEST_PAGES     (COPY_TEST_SIZE / PAGE_SIZE)
+#define COPY_TEST_LOOPS     16
+#define COPY_TEST_VADDR     0x1000000
+#define COPY_TEST_BULK_RUN  256
+
+static ulong cycles_per_sec()
+{
+    ulong low = 0, cur = 0;
+    u64 start, end;
+    
+    // Align to a tick of the system time first
+    hal->time(NULL, &low);
+    do {
+        hal->time(NULL, &cur);
+    } while (cur == low);
+    
+    start = read_cycles();
+    do {
+        hal->time(NULL, &low);
+    } while (cur == low);
+    end = read_cycles();
+    
+    return (ulong)(end - start);
+}
+
+static ulong create_test_as(ulong *pfn_out)
+{
+    ulong page_dir_pfn = palloc(1);
+    assert(page_dir_pfn);
+    hal->init_addr_space(page_dir_pfn);
+    
+    ulong pfn = palloc(COPY_TEST_PAGES);
+    assert(pfn);
+    
+    int mapped = hal->map_user(
+        page_dir_pfn, COPY_TEST_VADDR, PFN_TO_ADDR(pfn), COPY_TEST_SIZE,
+        0, 1, 1, 0
+    );
+    assert(mapped);
+    
+    *pfn_out = pfn;
+    return page_dir_pfn;
+}
+
+static void destroy_test_as(ulong page_dir_pfn, ulong pfn)
+{
+    int unmapped = hal->unmap_user(page_dir_pfn, COPY_TEST_VADDR, PFN_TO_ADDR(pfn), COPY_TEST_SIZE);
+    assert(unmapped);
+    
+    pfree(pfn);
+    pfree(page_dir_pfn);
+}
+
+static void report_copy(char *name, ulong cycles, ulong cps)
+{
+    ulong cycles_per_mb = cycles / COPY_TEST_LOOPS;
+    
+    kprintf("\t%s: %u cycles per MB, %u MB/s\n", name, cycles_per_mb, cycles_per_mb ? cps / cycles_per_mb : 0);
+}
+
+void test_copy()
+{
+    int i;
+    u64 start, end;
+    ulong src_pfn, dest_pfn;
+    
+    int vec_count = COPY_TEST_SIZE / COPY_TEST_BULK_RUN / 2;
+    int vec_pages = ALIGN_UP(sizeof(struct copy_vec) * vec_count, PAGE_SIZE) / PAGE_SIZE;
+    ulong vec_pfn = palloc(vec_pages);
+    assert(vec_pfn);
+    struct copy_vec *vecs = (struct copy_vec *)PFN_TO_ADDR(vec_pfn);
+    
+    kprintf("Testing cross address space copy\n");
+    
+    ulong cps = cycles_per_sec();
+    kprintf("\tCycles per second: %u\n", cps);
+    
+    ulong src_page_dir_pfn = create_test_as(&src_pfn);
+    ulong dest_page_dir_pfn = create_test_as(&dest_pfn);
+    
+    u8 *src = (u8 *)PFN_TO_ADDR(src_pfn);
+    u8 *dest = (u8 *)PFN_TO_ADDR(dest_pfn);
+    for (i = 0; i < COPY_TEST_SIZE; i++) {
+        src[i] = (u8)i;
+    }
+    
+    // Aligned
+    memzero(dest, COPY_TEST_SIZE);
+    start = read_cycles();
+    for (i = 0; i < COPY_TEST_LOOPS; i++) {
+        cross_as_copy(src_page_dir_pfn, COPY_TEST_VADDR, COPY_TEST_SIZE, dest_page_dir_pfn, COPY_TEST_VADDR);
     }
+    end = read_cycles();
+    assert(!memcmp(src, dest, COPY_TEST_SIZE));
+    report_copy("Cross AS, aligned", (ulong)(end - start), cps);
+    
+    // Unaligned head and tail, the bytes around the range must be left untouched
+    memzero(dest, COPY_TEST_SIZE);
+    start = read_cycles();
+    for (i = 0; i < COPY_TEST_LOOPS; i++) {
+        cross_as_copy(src_page_dir_pfn, COPY_TEST_VADDR + 1, COPY_TEST_SIZE - 3, dest_page_dir_pfn, COPY_TEST_VADDR + 1);
+    }
+    end = read_cycles();
+    assert(!dest[0] && !dest[COPY_TEST_SIZE - 2] && !dest[COPY_TEST_SIZE - 1]);
+    assert(!memcmp(src + 1, dest + 1, COPY_TEST_SIZE - 3));
+    report_copy("Cross AS, unaligned", (ulong)(end - start), cps);
+    
+    // Kernel to user
+    memzero(dest, COPY_TEST_SIZE);
+    start = read_cycles();
+    for (i = 0; i < COPY_TEST_LOOPS; i++) {
+        copy_to_user((ulong)src, COPY_TEST_SIZE, dest_page_dir_pfn, COPY_TEST_VADDR);
+    }
+    end = read_cycles();
+    assert(!memcmp(src, dest, COPY_TEST_SIZE));
+    report_copy("To user", (ulong)(end - start), cps);
+    
+    // Bulk, every other run of the buffer
+    for (i = 0; i < vec_count; i++) {
+        vecs[i].src = COPY_TEST_VADDR + i * COPY_TEST_BULK_RUN * 2;
+        vecs[i].dest = vecs[i].src;
+        vecs[i].len = COPY_TEST_BULK_RUN;
+    }
+    
+    memzero(dest, COPY_TEST_SIZE);
+    start = read_cycles();
+    for (i = 0; i < COPY_TEST_LOOPS * 2; i++) {
+        cross_as_copy_bulk(src_page_dir_pfn, dest_page_dir_pfn, vecs, vec_count);
+    }
+    end = read_cycles();
+    assert(!memcmp(src, dest, COPY_TEST_BULK_RUN) && !dest[COPY_TEST_BULK_RUN]);
+    report_copy("Cross AS, bulk", (ulong)(end - start), cps);
+    
+    destroy_test_as(src_page_dir_pfn, src_pfn);
+    destroy_test_as(dest_page_dir_pfn, dest_pfn);
+    pfree(vec_pfn);
+    
+    kprintf("Successfully passed the test!\n");
 }
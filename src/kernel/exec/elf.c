@@ -3,17 +3,22 @@
 #include "kernel/include/hal.h"
 #include "kernel/include/lib.h"
 #include "kernel/include/mem.h"
+#include "kernel/include/proc.h"
 #include "kernel/include/exec.h"
 
 
 /*
  * Load ELF executable
+ *
+ * Segments are only registered as lazily backed regions of the process,
+ * nothing gets mapped until the program touches the pages. Read-only pages
+ * are shared with other processes, writable ones are copied on write
  */
 int load_elf_exec(
-    ulong image_start, ulong dest_page_dir_pfn,
+    ulong image_start, struct process *p,
     ulong *entry_out, ulong *vaddr_start_out, ulong *vaddr_end_out)
 {
-    ulong i, j;
+    ulong i;
     ulong vaddr_start = 0;
     ulong vaddr_end = 0;
     ulong entry = 0;
@@ -24,7 +29,7 @@ int load_elf_exec(
 //     struct elf32_program *prog_header;
     
     kprintf("\tLoad ELF image @ %p, page dir PFN %p\n",
-            (void *)image_start, (void *)dest_page_dir_pfn);
+            (void *)image_start, (void *)p->page_dir_pfn);
     
     // For every segment, map and load
     for (i = 0; i < elf_header->elf_phnum; i++) {
@@ -37,54 +42,36 @@ int load_elf_exec(
             prog_header = (void *)(image_start + elf_header->elf_phoff);
         }
         
-        // Map the segment to destination's vaddr space
+        // Register the segment, its pages are populated on first touch
         if (prog_header->program_memsz) {
-            kprintf("\t\t\tMapping ... ");
+            assert(prog_header->program_memsz >= prog_header->program_filesz);
             
             ulong s = (ulong)prog_header->program_vaddr;
-            s = ALIGN_DOWN(s, PAGE_SIZE);
+            ulong e = (ulong)prog_header->program_vaddr + (ulong)prog_header->program_memsz;
             
-            ulong e = (ulong)prog_header->program_vaddr + prog_header->program_memsz;
-            e = ALIGN_UP(e, PAGE_SIZE);
+            kprintf("\t\t\tRegion (virt @ %p to %p) ", (void *)s, (void *)e);
+            struct vm_region *r = add_vm_region(
+                p, vm_region_image, s, e,
+                prog_header->program_flags & PF_X ? 1 : 0,
+                prog_header->program_flags & PF_W ? 1 : 0
+            );
+            kprintf("%d bytes\n", prog_header->program_memsz);
             
-            for (j = s; j < e; j += PAGE_SIZE) {
-                if (hal->get_paddr(dest_page_dir_pfn, j)) {
-                    continue;
-                }
-                
-                ulong ppfn = palloc(1);
-                ulong paddr = PFN_TO_ADDR(ppfn);
+            // Program data is copied from the image when the page is faulted in
+            if (prog_header->program_filesz) {
+                kprintf("\t\t\tData ... (virt @ %p, image @ %p) ",
+                        (void *)(ulong)prog_header->program_vaddr,
+                        (void *)((ulong)image_start + (ulong)prog_header->program_offset)
+                );
                 
-                kprintf(" (virt @ %p, phys @ %p) ", (void *)j, (void *)paddr);
-                int mapped = hal->map_user(
-                    dest_page_dir_pfn, j, paddr, PAGE_SIZE,
-                    1, 1, 1, 0
+                set_vm_region_data(
+                    r, (ulong)prog_header->program_vaddr,
+                    (ulong)image_start + (ulong)prog_header->program_offset,
+                    (ulong)prog_header->program_filesz
                 );
-                assert(mapped);
                 
-                // Zero the memory
-                memzero((void *)paddr, PAGE_SIZE);
+                kprintf("%d bytes\n", prog_header->program_filesz);
             }
-            
-            kprintf("%d bytes\n", prog_header->program_memsz);
-        }
-        
-        // Copy the program data
-        if (prog_header->program_filesz) {
-            assert(prog_header->program_memsz >= prog_header->program_filesz);
-            
-            kprintf("\t\t\tCopy ... (virt @ %p, phys @ %p) ",
-                    (void *)(ulong)prog_header->program_vaddr,
-                    (void *)((ulong)image_start + (ulong)prog_header->program_offset)
-            );
-            
-            copy_to_user(
-                (ulong)image_start + (ulong)prog_header->program_offset,
-                (ulong)prog_header->program_filesz,
-                dest_page_dir_pfn, (ulong)prog_header->program_vaddr
-            );
-            
-            kprintf("%d bytes\n", prog_header->program_filesz);
         }
         
         // Get the start and end of vaddr
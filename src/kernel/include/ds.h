@@ -39,20 +39,44 @@ typedef ulong (*hashtable_func_t)(ulong key, ulong size);
 typedef int (*hashtable_cmp_t)(ulong cmp_key, ulong node_key);
 
 typedef struct hashtable_node {
-    struct hashtable_node *next;
+    struct hashtable_node * volatile next;
     ulong key;
     void *node;
+    
+    // Deferred reclamation after removal
+    rcu_head_t rcu;
 } hashtable_node_t;
 
 typedef struct hashtable_bucket {
     ulong node_count;
-    hashtable_node_t *head;
+    hashtable_node_t * volatile head;
+    
+    // Set once the bucket has been moved to the new array during a resize
+    int migrated;
+    
+    // Writers lock the bucket, readers are lock-free
+    spinlock_t lock;
 } hashtable_bucket_t;
 
-typedef struct hashtable {
+typedef struct hashtable_array {
     ulong bucket_count;
-    ulong node_count;
-    hashtable_bucket_t *buckets;
+    int page_alloc;
+    
+    rcu_head_t rcu;
+    hashtable_bucket_t buckets[];
+} hashtable_array_t;
+
+typedef struct hashtable {
+    // Buckets, old is not NULL while a resize is in progress
+    hashtable_array_t * volatile buckets;
+    hashtable_array_t * volatile old_buckets;
+    
+    // Resize progress, and seq is odd while the arrays are being switched
+    ulong rehash_index;
+    ulong rehash_done;
+    volatile ulong seq;
+    
+    volatile ulong node_count;
     
     hashtable_func_t hash_func;
     hashtable_cmp_t hash_cmp;
@@ -68,6 +92,7 @@ extern void *hashtable_obtain(hashtable_t *l, ulong key);
 extern void hashtable_release(hashtable_t *l, ulong key, void *n);
 extern int hashtable_insert(hashtable_t *l, ulong key, void *n);
 extern int hashtable_remove(hashtable_t *l, ulong key);
+extern void test_hashtable();
 
 
 #endif
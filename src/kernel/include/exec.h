@@ -3,31 +3,42 @@
 
 
 #include "common/include/data.h"
+#include "kernel/include/proc.h"
 
 
 /*
  * ELF
  */
 extern int load_elf_exec(
-    ulong image_start, ulong dest_page_dir_pfn,
+    ulong image_start, struct process *p,
     ulong *entry_out, ulong *vaddr_start_out, ulong *vaddr_end_out);
 
 /*
  * Copy
  */
+struct copy_vec {
+    ulong src;
+    ulong dest;
+    ulong len;
+};
+
 extern void cross_as_copy(
     ulong src_page_dir_pfn, ulong src_start, ulong len,
     ulong dest_page_dir_pfn, ulong dest_start);
+extern void cross_as_copy_bulk(
+    ulong src_page_dir_pfn, ulong dest_page_dir_pfn,
+    struct copy_vec *vecs, int count);
 extern void copy_to_user(
     ulong src_start, ulong len,
     ulong user_page_dir_pfn, ulong user_start);
+extern void test_copy();
 
 
 /*
  * Load executable
  */
 extern int load_exec(
-    ulong image_start, ulong dest_page_dir_pfn,
+    ulong image_start, struct process *p,
     ulong *entry_out, ulong *vaddr_start_out, ulong *vaddr_end_out
 );
 
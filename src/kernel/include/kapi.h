@@ -58,6 +58,8 @@ extern asmlinkage void shrink_heap_handler(struct kernel_msg_handler_arg *arg);
  * KMap
  */
 extern asmlinkage void kmap_handler(struct kernel_msg_handler_arg *arg);
+extern asmlinkage void fmap_handler(struct kernel_msg_handler_arg *arg);
+extern asmlinkage void funmap_handler(struct kernel_msg_handler_arg *arg);
 
 
 #endif
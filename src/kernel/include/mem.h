@@ -22,10 +22,14 @@ struct pfndb_entry {
             u16 swappable   : 1;
         };
     };
+    
+    // Live entries if the page holds a page table
+    u16 count;
 } packedstruct;
 
 extern struct pfndb_entry *get_pfn_entry_by_pfn(ulong pfn);
 extern struct pfndb_entry *get_pfn_entry_by_paddr(ulong paddr);
+extern ulong pfn_count_add(ulong pfn, int delta);
 extern void reserve_pfndb_mem(ulong start, ulong size);
 extern void init_pfndb();
 
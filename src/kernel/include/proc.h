@@ -5,6 +5,7 @@
 #include "common/include/data.h"
 #include "common/include/context.h"
 #include "common/include/proc.h"
+#include "common/include/kdisp.h"
 #include "kernel/include/ds.h"
 #include "kernel/include/sync.h"
 #include "common/include/syscall.h"
@@ -77,7 +78,7 @@ struct sched_list {
     struct sched *head;
     struct sched *tail;
     
-    spinlock_t lock;
+    mcslock_t lock;
 };
 
 
@@ -232,6 +233,51 @@ struct dynamic_area {
     struct dynamic_block_list free;
 };
 
+enum vm_region_type {
+    // Zero filled on first touch
+    vm_region_anon,
+    
+    // Filled from a segment of an executable image
+    vm_region_image,
+    
+    // A mapped URS node, filled from the core image if the node sits in it,
+    // otherwise read in from the URS server
+    vm_region_file,
+};
+
+struct vm_region {
+    struct vm_region *next;
+    enum vm_region_type type;
+    
+    // Page aligned virtual range
+    ulong start;
+    ulong end;
+    
+    int exec;
+    int write;
+    
+    // Image backed data, [data_vaddr, data_vaddr + data_size) comes from data_addr
+    ulong data_vaddr;
+    ulong data_addr;
+    ulong data_size;
+    
+    // URS open of a file region that pages are read through, 0 if none
+    ulong file_id;
+    ulong file_size;
+};
+
+struct vm_region_list {
+    struct vm_region *head;
+    struct vm_region *heap;
+    int count;
+    
+    // Stats
+    ulong fault_count;
+    ulong resident_count;
+    ulong shared_count;
+    ulong cow_count;
+};
+
 struct process {
     // Process list
     struct process *next;
@@ -241,8 +287,10 @@ struct process {
     ulong proc_id;
     ulong parent_id;
     
-    // ASID
+    // ASID and the CPUs that may hold TLB entries of it
     ulong asid;
+    volatile ulong asid_gen;
+    volatile ulong tlb_cpu_mask;
     
     // Name and URL
     char *name;
@@ -262,6 +310,9 @@ struct process {
     // Dynamic area map
     struct dynamic_area dynamic;
     
+    // Lazily populated regions
+    struct vm_region_list vm;
+    
     // Thread list
     struct {
         struct thread_list present;
@@ -276,6 +327,9 @@ struct process {
     list_t msgs;
     hashtable_t msg_handlers;
     
+    // References, the process table holds one
+    volatile ulong ref_count;
+    
     // Lock
     spinlock_t lock;
 };
@@ -284,7 +338,7 @@ struct process_list {
     ulong count;
     struct process *next;
     
-    spinlock_t lock;
+    rwlock_t lock;
 };
 
 
@@ -307,6 +361,9 @@ extern struct process *create_process(
     ulong parent_id, char *name, char *url,
     enum process_type type, int priority
 );
+extern struct process *find_process(ulong proc_id);
+extern void hold_process(struct process *p);
+extern void release_process(struct process *p);
 extern int load_image(struct process *p, char *url);
 
 
@@ -362,11 +419,55 @@ extern void sched();
 /*
  * TLB management
  */
+#define TLB_BATCH_MAX_RANGES    8
+#define TLB_FULL_FLUSH_PAGES    64
+
+struct tlb_range {
+    ulong addr;
+    size_t size;
+};
+
+struct tlb_batch {
+    struct process *proc;
+    
+    int full;
+    int range_count;
+    ulong page_count;
+    struct tlb_range ranges[TLB_BATCH_MAX_RANGES];
+};
+
 extern void init_tlb_mgmt();
-extern void trigger_tlb_shootdown(ulong asid, ulong addr, size_t size);
+extern void tlb_mark_cpu(struct process *p, int cpu_id);
+
+extern void tlb_batch_begin(struct tlb_batch *batch, struct process *p);
+extern void tlb_batch_add(struct tlb_batch *batch, ulong addr, size_t size);
+extern void tlb_batch_flush(struct tlb_batch *batch);
+
+extern void trigger_tlb_shootdown(struct process *p, ulong addr, size_t size);
 extern void service_tlb_shootdown();
 
 
+/*
+ * Demand paging
+ */
+extern void init_vm();
+extern void create_vm_regions(struct process *p);
+extern struct vm_region *add_vm_region(
+    struct process *p, enum vm_region_type type,
+    ulong start, ulong end, int exec, int write
+);
+extern void set_vm_region_data(struct vm_region *r, ulong data_vaddr, ulong data_addr, ulong data_size);
+extern void set_vm_region_file(struct vm_region *r, ulong file_id, ulong file_size);
+extern struct vm_region *remove_vm_region(struct process *p, enum vm_region_type type, ulong start);
+extern void unmap_vm_region(struct process *p, struct vm_region *r);
+extern struct vm_region *find_file_region(struct process *p, ulong vaddr);
+
+extern ulong fault_in_user(struct process *p, ulong vaddr);
+extern int dispatch_page_fault(struct kernel_dispatch_info *disp_info);
+extern void page_fault_stat_report(struct process *p);
+extern void image_page_stat_report();
+
+
 /*
  * Heap management
  */
@@ -380,9 +481,8 @@ extern ulong shrink_heap(struct process *p, ulong amount);
  * ASID management
  */
 extern void init_asid();
-extern void asid_release();
-extern ulong asid_alloc();
-extern ulong asid_recycle();
+extern void asid_alloc(struct process *p);
+extern void asid_switch(struct process *p, int cpu_id);
 
 
 /*
@@ -401,5 +501,9 @@ extern void init_process_monitor();
  */
 extern unsigned long kmap(struct process *p, enum kmap_region region);
 
+extern unsigned long fmap(struct process *p, unsigned long open_id, int exec, unsigned long *size);
+extern int funmap(struct process *p, unsigned long vaddr);
+extern int page_in_file(struct kernel_dispatch_info *disp_info);
+
 
 #endif
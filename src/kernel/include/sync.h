@@ -15,18 +15,37 @@ typedef struct {
 
 
 /*
- * Spin lock
+ * Lock statistics
+ * Set LOCK_STAT to 1 to collect per-lock contention counters
+ */
+#define LOCK_STAT   0
+
+typedef struct lock_stat {
+    char *name;
+    struct lock_stat *next;
+    
+    // Updated by the lock holder only
+    ulong acquired;
+    ulong contended;
+    ulong spins;
+    ulong max_hold;
+    u64 hold_start;
+} lock_stat_t;
+
+
+/*
+ * Spin lock - ticket based
+ * The interrupt state is saved by the holder outside the ticket words
  */
 typedef struct {
-    union {
-        volatile ulong value;
-        struct {
-            volatile ulong locked       : 1;
-            volatile ulong int_enabled  : 1;
-        };
-    };
+    volatile ulong next;
+    volatile ulong owner;
+    
+    int int_enabled;
+    lock_stat_t *stat;
 } spinlock_t;
 
+#define SPINLOCK_INIT   { 0, 0, 0, NULL }
 
 extern void spin_init(spinlock_t *lock);
 extern void spin_lock(spinlock_t *lock);
@@ -34,20 +53,117 @@ extern void spin_unlock(spinlock_t *lock);
 extern void spin_lock_int(spinlock_t *lock);
 extern void spin_unlock_int(spinlock_t *lock);
 
+extern void spin_stat(spinlock_t *lock, lock_stat_t *stat, char *name);
+
 
 /*
- * Spin-based readers-writer lock
+ * MCS lock - interrupts are always disabled while held
+ * Each waiter spins on its own per-CPU node, a node fills a cache line so
+ * that the spinning never shares one with another CPU
  */
+#define MCS_MAX_NESTING 4
+
+struct mcs_node {
+    struct mcs_node * volatile next;
+    volatile ulong locked;
+} cache_aligned;
+
 typedef struct {
-    union {
-        volatile ulong value;
-        struct {
-            volatile ulong locked       : 1;
-            volatile ulong int_enabled  : 1;
-            volatile ulong counter      : sizeof(ulong) * 8 - 2;
-        };
-    };
+    struct mcs_node * volatile tail;
+    struct mcs_node *holder;
+    
+    int int_enabled;
+    lock_stat_t *stat;
+} mcslock_t;
+
+extern void init_mcs();
+extern void mcs_init(mcslock_t *lock);
+extern void mcs_lock_int(mcslock_t *lock);
+extern void mcs_unlock_int(mcslock_t *lock);
+
+extern void mcs_stat(mcslock_t *lock, lock_stat_t *stat, char *name);
+
+extern void lock_stat_report();
+
+
+/*
+ * Spin-based readers-writer lock, writer-preferring
+ * Readers hold the interrupt state themselves, the writer saves it in the lock
+ */
+#define RWLOCK_WRITER       0x1
+#define RWLOCK_READER       0x2
+
+typedef struct {
+    volatile ulong value;
+    volatile ulong writers;
+    
+    int int_enabled;
 } rwlock_t;
 
+#define RWLOCK_INIT     { 0, 0, 0 }
+
+extern void rwlock_init(rwlock_t *lock);
+
+extern void read_lock(rwlock_t *lock);
+extern void read_unlock(rwlock_t *lock);
+extern void write_lock(rwlock_t *lock);
+extern void write_unlock(rwlock_t *lock);
+
+extern int read_lock_int(rwlock_t *lock);
+extern void read_unlock_int(rwlock_t *lock, int enabled);
+extern void write_lock_int(rwlock_t *lock);
+extern void write_unlock_int(rwlock_t *lock);
+
+
+/*
+ * Sequence lock
+ * Readers never block writers and retry if a write happened in between
+ */
+typedef struct {
+    volatile ulong seq;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT    { 0, SPINLOCK_INIT }
+
+extern void seq_init(seqlock_t *lock);
+extern ulong seq_read_begin(seqlock_t *lock);
+extern int seq_read_retry(seqlock_t *lock, ulong seq);
+extern void seq_write_lock(seqlock_t *lock);
+extern void seq_write_unlock(seqlock_t *lock);
+
+
+/*
+ * Per-CPU counter
+ * Cheap to update on hot paths, the slots are only summed up on read
+ */
+typedef struct {
+    int offset;
+} percpu_counter_t;
+
+extern void init_percpu_counter();
+extern void percpu_counter_create(percpu_counter_t *counter);
+extern void percpu_counter_add(percpu_counter_t *counter, ulong value);
+extern void percpu_counter_inc(percpu_counter_t *counter);
+extern ulong percpu_counter_read(percpu_counter_t *counter);
+
+
+/*
+ * Read-copy-update
+ */
+typedef void (*rcu_callback_t)(void *ptr);
+
+typedef struct rcu_head {
+    struct rcu_head *next;
+    void *ptr;
+    rcu_callback_t func;
+} rcu_head_t;
+
+extern void init_rcu();
+extern void rcu_read_lock();
+extern void rcu_read_unlock();
+extern void rcu_retire(rcu_head_t *head, void *ptr, rcu_callback_t func);
+extern void rcu_reclaim();
+
 
 #endif
@@ -13,6 +13,7 @@
  * Dispatch
  */
 extern void init_dispatch();
+extern void dispatch_stat_report();
 extern void set_syscall_return(struct thread *t, unsigned long return0, unsigned long return1);
 extern int dispatch_syscall(struct kernel_dispatch_info *disp_info);
 extern int dispatch_interrupt(struct kernel_dispatch_info *disp_info);
@@ -48,6 +49,21 @@ extern void reg_kapi_server_worker(struct kernel_dispatch_info *disp_info);
 extern void unreg_kapi_server_worker(struct kernel_dispatch_info *disp_info);
 
 
+/*
+ * Notification
+ */
+extern void init_notif();
+extern int signal_notif(ulong notif_id, ulong bits);
+
+extern void notif_create_worker(struct kernel_dispatch_info *disp_info);
+extern void notif_destroy_worker(struct kernel_dispatch_info *disp_info);
+extern void notif_signal_worker(struct kernel_dispatch_info *disp_info);
+extern int notif_wait_worker(struct kernel_dispatch_info *disp_info);
+extern void notif_poll_worker(struct kernel_dispatch_info *disp_info);
+extern void notif_bind_irq_worker(struct kernel_dispatch_info *disp_info);
+extern void destroy_process_notifs(struct process *p);
+
+
 /*
  * Ksys - invoking system calls from kernel
  */
@@ -65,7 +81,12 @@ extern void ksys_unreachable();
  */
 extern void init_interrupt();
 extern void reg_interrupt(struct process *p, unsigned long irq, unsigned long thread_entry);
+extern int reg_interrupt_notif(struct process *p, unsigned long irq, unsigned long notif_id);
+extern void unreg_interrupt_notif(unsigned long irq, unsigned long notif_id);
+extern int reg_interrupt_thread(struct process *p, unsigned long irq);
 extern void unreg_interrupt(struct process *p, unsigned long irq);
+extern void int_bind_worker(struct kernel_dispatch_info *disp_info);
+extern int int_wait_worker(struct kernel_dispatch_info *disp_info);
 extern void interrupt_worker(struct kernel_dispatch_info *disp_info);
 
 
@@ -125,6 +125,8 @@ void init_kapi()
     
     // KMap
     register_kapi(KAPI_KMAP, kmap_handler);
+    register_kapi(KAPI_FMAP, fmap_handler);
+    register_kapi(KAPI_FUNMAP, funmap_handler);
     
     kprintf("KAPI Initialized\n");
 }
@@ -33,3 +33,60 @@ asmlinkage void kmap_handler(struct kernel_msg_handler_arg *arg)
     // Wait for this thread to be terminated
     ksys_unreachable();
 }
+
+
+/*
+ * File mapping
+ */
+asmlinkage void fmap_handler(struct kernel_msg_handler_arg *arg)
+{
+    struct thread *t = arg->sender_thread;
+    struct process *p = t->proc;
+    msg_t *s = arg->msg;
+    
+    // Do FMap, this waits for the URS server
+    unsigned long open_id = s->params[0].value;
+    int exec = (int)s->params[1].value;
+    unsigned long size = 0;
+    unsigned long vaddr = fmap(p, open_id, exec, &size);
+    
+    // Reply
+    msg_t *m = create_response_msg(t);
+    set_msg_param_value(m, size);
+    set_msg_param_value(m, vaddr);
+    
+    // Resume caller thread
+    run_thread(t);
+    
+    // Clean up
+    terminate_thread_self(arg->handler_thread);
+    sfree(arg);
+    
+    // Wait for this thread to be terminated
+    ksys_unreachable();
+}
+
+asmlinkage void funmap_handler(struct kernel_msg_handler_arg *arg)
+{
+    struct thread *t = arg->sender_thread;
+    struct process *p = t->proc;
+    msg_t *s = arg->msg;
+    
+    // Do FUnmap
+    unsigned long vaddr = s->params[0].value;
+    int result = funmap(p, vaddr);
+    
+    // Reply
+    msg_t *m = create_response_msg(t);
+    set_msg_param_value(m, (unsigned long)result);
+    
+    // Resume caller thread
+    run_thread(t);
+    
+    // Clean up
+    terminate_thread_self(arg->handler_thread);
+    sfree(arg);
+    
+    // Wait for this thread to be terminated
+    ksys_unreachable();
+}
@@ -1,11 +1,13 @@
 /*
  * KAPI Handling - Process
  */
+#include "common/include/errno.h"
 #include "kernel/include/hal.h"
 #include "kernel/include/mem.h"
 #include "kernel/include/proc.h"
 #include "kernel/include/kapi.h"
 #include "kernel/include/coreimg.h"
+#include "kernel/include/syscall.h"
 
 
 /*
@@ -33,7 +35,26 @@ asmlinkage void process_started_handler(struct kernel_msg_handler_arg *arg)
  */
 asmlinkage void process_exit_handler(struct kernel_msg_handler_arg *arg)
 {
-
+    struct thread *t = arg->sender_thread;
+    int mon_err = EOK;
+    
+    // Notify process monitor
+    mon_err = check_process_terminate_before(t->proc_id);
+    assert(mon_err == EOK);
+    
+    // Nobody can signal or wait on what the process leaves behind
+    destroy_process_notifs(t->proc);
+    
+    // Notify process monitor, user-mode servers drop what the process left with them
+    mon_err = check_process_terminate_after(t->proc_id);
+    assert(mon_err == EOK);
+    
+    // Clean up, the sender is not resumed
+    terminate_thread_self(arg->handler_thread);
+    sfree(arg);
+    
+    // Wait for this thread to be terminated
+    ksys_unreachable();
 }
 
 
@@ -8,7 +8,7 @@
 
 
 struct hal_exports *hal;
-spinlock_t kprintf_lock = { {0} };
+spinlock_t kprintf_lock = SPINLOCK_INIT;
 
 
 /*
@@ -29,6 +29,11 @@ static int wrap_pfree(ulong pfn)
     return pfree(pfn);
 }
 
+static ulong wrap_pfn_count_add(ulong pfn, int delta)
+{
+    return pfn_count_add(pfn, delta);
+}
+
 
 /*
  * Dispatch
@@ -43,6 +48,9 @@ static void dispatch(ulong sched_id, struct kernel_dispatch_info *disp_info)
     // TLB shootdown
     service_tlb_shootdown();
     
+    // Free objects retired by RCU writers
+    rcu_reclaim();
+    
     if (need_dispatch) {
         // Need a private stack for MIPS kernel dispatch as a TLB miss handler can overwrite the data in kernel stack
 //         kprintf("dispatch kernel @ %x, type: %x, syscall num: %x\n", disp_info, disp_info->dispatch_type, disp_info->syscall.num);
@@ -60,6 +68,9 @@ static void dispatch(ulong sched_id, struct kernel_dispatch_info *disp_info)
         case kdisp_interrupt:
             dispatch_interrupt(disp_info);
             break;
+        case kdisp_page_fault:
+            dispatch_page_fault(disp_info);
+            break;
         default:
             break;
         }
@@ -79,6 +90,7 @@ static void init_kexp()
     hal->kernel->palloc_tag = wrap_palloc_tag;
     hal->kernel->palloc = wrap_palloc;
     hal->kernel->pfree = wrap_pfree;
+    hal->kernel->pfn_count_add = wrap_pfn_count_add;
 }
 
 /*
@@ -101,9 +113,17 @@ void asmlinkage _start(struct hal_exports *hal_exp)
     init_malloc();
     test_malloc();
     
+    // Init MCS lock nodes
+    init_mcs();
+    
+    // Init per-CPU counters
+    init_percpu_counter();
+    
     // Init built-in data structions
     //init_list();
+    init_rcu();
     init_hashtable();
+    //test_hashtable();
     
     // Init URS
 //     init_urs();
@@ -116,6 +136,8 @@ void asmlinkage _start(struct hal_exports *hal_exp)
     init_thread();
     init_dalloc();
     init_tlb_mgmt();
+    init_vm();
+    //test_copy();
     
     // Init dispatch, syscall, interrupt, and exception
     init_dispatch();
@@ -123,6 +145,7 @@ void asmlinkage _start(struct hal_exports *hal_exp)
     
     // Init IPC and KAPI
     init_ipc();
+    init_notif();
     init_kapi();
     
     // Init namespace dispatcher
@@ -58,15 +58,44 @@ char *strdup(const char *s)
  */
 void memcpy(void *dest, void *src, size_t count)
 {
-    size_t i;
-    
     u8 *s = (u8 *)src;
     u8 *d = (u8 *)dest;
     
-    for (i = 0; i < count; i++) {
-        *(d++) = *(s++);
+    // Copy by words if both sides can be aligned at the same time
+    if (!(((ulong)s ^ (ulong)d) & (sizeof(ulong) - 1))) {
+        while (count && ((ulong)d & (sizeof(ulong) - 1))) {
+            *(d++) = *(s++);
+            count--;
+        }
+        
+        ulong *ws = (ulong *)s;
+        ulong *wd = (ulong *)d;
+        
+        while (count >= sizeof(ulong) * 4) {
+            wd[0] = ws[0];
+            wd[1] = ws[1];
+            wd[2] = ws[2];
+            wd[3] = ws[3];
+            
+            ws += 4;
+            wd += 4;
+            count -= sizeof(ulong) * 4;
+        }
+        
+        while (count >= sizeof(ulong)) {
+            *(wd++) = *(ws++);
+            count -= sizeof(ulong);
+        }
+        
+        s = (u8 *)ws;
+        d = (u8 *)wd;
     }
     
+    // Unaligned data and the tail
+    while (count) {
+        *(d++) = *(s++);
+        count--;
+    }
 }
 
 void memset(void *src, int value, size_t size)
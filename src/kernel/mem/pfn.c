@@ -18,6 +18,19 @@ struct pfndb_entry *get_pfn_entry_by_paddr(ulong paddr)
     return &pfndb[pfn];
 }
 
+/*
+ * Not atomic, callers serialize changes to the count of the same PFN
+ */
+ulong pfn_count_add(ulong pfn, int delta)
+{
+    struct pfndb_entry *entry = &pfndb[pfn];
+    
+    assert(delta >= 0 || entry->count >= (u16)-delta);
+    entry->count += delta;
+    
+    return entry->count;
+}
+
 void reserve_pfndb_mem(ulong start, ulong size)
 {
     ulong i;
@@ -33,6 +46,7 @@ void reserve_pfndb_mem(ulong start, ulong size)
         entry->kernel = 1;
         entry->swappable = 0;
         entry->tag = 9;
+        entry->count = 0;
         
         kprintf(".");
     }
@@ -77,6 +91,7 @@ void init_pfndb()
             entry->zeroed = 0;
             entry->kernel = 1;
             entry->swappable = 0;
+            entry->count = 0;
             
             // Show progress
             if (0 == count++ % (total_entries / 10)) {
@@ -95,6 +110,7 @@ void init_pfndb()
             entry->zeroed = 0;
             entry->kernel = cur.kernel;
             entry->swappable = cur.swappable;
+            entry->count = 0;
             
             // Show progress
             if (0 == count++ % (total_entries / 10)) {
@@ -118,6 +134,7 @@ void init_pfndb()
         entry->zeroed = 0;
         entry->kernel = 1;
         entry->swappable = 0;
+        entry->count = 0;
         
         kprintf(".");
     }
@@ -1,43 +1,207 @@
 /*
  * Kernel ASID manager
+ *
+ * ASIDs are handed out in generations. Once the hardware ASID space runs out
+ * a new generation starts, and each CPU flushes its user TLB entries once, on
+ * its next context switch. A process with an ASID of an old generation gets a
+ * new one when it is switched in, so reuse never needs a global shootdown.
+ * ASIDs active on a CPU at rollover are carried over into the new generation.
  */
 
 
 #include "common/include/data.h"
+#include "common/include/memory.h"
 #include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
 #include "kernel/include/sync.h"
 #include "kernel/include/proc.h"
 
 
+#define ASID_FIRST          1
+#define ASID_BITS_PER_WORD  (sizeof(ulong) * 8)
+
+
 static spinlock_t lock;
-static ulong cur_asid = 1;
+
+static ulong asid_limit = 0;
+static volatile ulong generation = 1;
+static ulong cur_asid = ASID_FIRST;
+static ulong *asid_map;
+
+struct asid_reserved {
+    ulong asid;
+    ulong gen;
+};
+
+static volatile ulong *active;
+static struct asid_reserved *reserved;
+static volatile int *flush_pending;
 
 
 void init_asid()
 {
+    int i;
+    
     spin_init(&lock);
+    asid_limit = hal->asid_limit;
+    
+    if (!asid_limit) {
+        kprintf("\tNo hardware ASID\n");
+        return;
+    }
+    
+    size_t map_size = ALIGN_UP(asid_limit, ASID_BITS_PER_WORD) / 8;
+    ulong pfn = palloc(ALIGN_UP(map_size, PAGE_SIZE) / PAGE_SIZE);
+    assert(pfn);
+    asid_map = (ulong *)PFN_TO_ADDR(pfn);
+    memzero(asid_map, map_size);
+    
+    active = (volatile ulong *)malloc(sizeof(ulong) * hal->num_cpus);
+    reserved = (struct asid_reserved *)malloc(sizeof(struct asid_reserved) * hal->num_cpus);
+    flush_pending = (volatile int *)malloc(sizeof(int) * hal->num_cpus);
+    assert(active && reserved && flush_pending);
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        active[i] = 0;
+        reserved[i].asid = 0;
+        reserved[i].gen = 0;
+        flush_pending[i] = 0;
+    }
+    
+    kprintf("\tASID limit: %u\n", asid_limit);
 }
 
-void asid_release()
+
+/*
+ * ASID map
+ */
+static int test_and_set_asid(ulong asid)
 {
+    ulong word = asid / ASID_BITS_PER_WORD;
+    ulong bit = 0x1ul << (asid % ASID_BITS_PER_WORD);
+    
+    if (asid_map[word] & bit) {
+        return 1;
+    }
+    
+    asid_map[word] |= bit;
+    return 0;
 }
 
-ulong asid_alloc()
+static void new_generation()
 {
+    int i;
     ulong asid = 0;
     
+    generation++;
+    memzero(asid_map, ALIGN_UP(asid_limit, ASID_BITS_PER_WORD) / 8);
+    cur_asid = ASID_FIRST;
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        // Active ASIDs always belong to the generation that just ended
+        asid = atomic_xchg(&active[i], 0);
+        if (asid) {
+            reserved[i].asid = asid;
+            reserved[i].gen = generation - 1;
+        }
+        
+        // A CPU that hasn't switched since the last rollover keeps its reservation
+        if (reserved[i].asid) {
+            test_and_set_asid(reserved[i].asid);
+        }
+        
+        flush_pending[i] = 1;
+    }
+    
+    //kprintf("[ASID] New generation: %u\n", generation);
+}
+
+static ulong new_asid(struct process *p)
+{
+    int i;
+    ulong asid = p->asid;
+    
+    if (asid) {
+        // Still running somewhere at rollover
+        for (i = 0; i < hal->num_cpus; i++) {
+            if (reserved[i].asid == asid && reserved[i].gen == p->asid_gen) {
+                reserved[i].gen = generation;
+                return asid;
+            }
+        }
+        
+        // The old one happens to be free in this generation
+        if (!test_and_set_asid(asid)) {
+            return asid;
+        }
+    }
+    
+    do {
+        for (; cur_asid < asid_limit; cur_asid++) {
+            if (!test_and_set_asid(cur_asid)) {
+                return cur_asid++;
+            }
+        }
+        
+        new_generation();
+    } while (1);
+    
+    return 0;
+}
+
+
+/*
+ * Alloc and switch
+ */
+void asid_alloc(struct process *p)
+{
+    p->asid = 0;
+    p->asid_gen = 0;
+    
     spin_lock_int(&lock);
     
-    asid = cur_asid;
-    cur_asid++;
+    if (asid_limit) {
+        p->asid = new_asid(p);
+        p->asid_gen = generation;
+    } else {
+        p->asid = cur_asid++;
+    }
     
-    atomic_membar();
     spin_unlock_int(&lock);
-    
-    return asid;
 }
 
-ulong asid_recycle()
+void asid_switch(struct process *p, int cpu_id)
 {
-    return 0;
+    ulong old_active = 0;
+    
+    if (!asid_limit || !p->asid) {
+        return;
+    }
+    
+    // Fast path - a rollover in between zeroes the active ASID and the CAS fails
+    old_active = active[cpu_id];
+    if (old_active && p->asid_gen == generation) {
+        atomic_readbar();
+        if (atomic_cas(&active[cpu_id], old_active, p->asid)) {
+            return;
+        }
+    }
+    
+    spin_lock_int(&lock);
+    
+    if (p->asid_gen != generation) {
+        p->asid = new_asid(p);
+        atomic_membar();
+        p->asid_gen = generation;
+    }
+    
+    if (flush_pending[cpu_id]) {
+        flush_pending[cpu_id] = 0;
+        hal->flush_user_tlb();
+    }
+    
+    active[cpu_id] = p->asid;
+    
+    spin_unlock_int(&lock);
 }
@@ -0,0 +1,248 @@
+/*
+ * FMap - Map URS nodes to user process
+ *
+ * The URS server decides how a node is mapped. Nodes that sit in the core
+ * image are mapped like image segments and share the cached image pages,
+ * other nodes get an open of their own in URS and every page is read in
+ * through it by a worker when the page is first touched
+ */
+
+#include "common/include/data.h"
+#include "common/include/errno.h"
+#include "common/include/syscall.h"
+#include "common/include/kdisp.h"
+#include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
+#include "kernel/include/proc.h"
+#include "kernel/include/kapi.h"
+
+
+// Has to fit in a message together with the header
+#define FMAP_PAGE_IN_CHUNK  2048
+
+
+/*
+ * URS requests, must be called from a kernel thread
+ */
+static msg_t *create_urs_msg(ulong kapi_num)
+{
+    msg_t *msg = create_request_msg();
+    
+    msg->mailbox_id = IPC_MAILBOX_KERNEL;
+    msg->opcode = IPC_OPCODE_KAPI;
+    msg->func_num = kapi_num;
+    
+    return msg;
+}
+
+static int request_map(ulong open_id, ulong proc_id, ulong *map_id, ulong *size, ulong *image_offset)
+{
+    msg_t *s = create_urs_msg(KAPI_URS_MAP);
+    set_msg_param_value(s, open_id);
+    set_msg_param_value(s, proc_id);
+    
+    msg_t *r = ksys_request();
+    
+    *map_id = r->params[0].value;
+    *size = r->params[1].value;
+    *image_offset = r->params[2].value;
+    
+    int result = (int)r->params[r->param_count - 1].value;
+    return result;
+}
+
+static ulong request_page_in(ulong map_id, ulong offset, void *buf, ulong count)
+{
+    msg_t *s = create_urs_msg(KAPI_URS_PAGE_IN);
+    set_msg_param_value(s, map_id);
+    set_msg_param_value(s, offset);
+    set_msg_param_value(s, count);
+    
+    msg_t *r = ksys_request();
+    
+    int result = (int)r->params[r->param_count - 1].value;
+    if (result) {
+        return 0;
+    }
+    
+    ulong len = r->params[1].value;
+    if (len > count) {
+        len = count;
+    }
+    
+    memcpy(buf, (void *)((ulong)r + r->params[0].offset), len);
+    return len;
+}
+
+static void request_close(ulong map_id)
+{
+    msg_t *s = create_urs_msg(KAPI_URS_CLOSE);
+    set_msg_param_value(s, map_id);
+    
+    ksys_request();
+}
+
+
+/*
+ * Map and unmap
+ */
+unsigned long fmap(struct process *p, unsigned long open_id, int exec, unsigned long *size)
+{
+    ulong map_id = 0;
+    ulong image_offset = 0;
+    ulong file_size = 0;
+    struct vm_region *r = NULL;
+    
+    int error = request_map(open_id, p->proc_id, &map_id, &file_size, &image_offset);
+    if (error || !file_size) {
+        if (map_id) {
+            request_close(map_id);
+        }
+        return 0;
+    }
+    
+    // Mappings are read-only, nothing is ever written back
+    ulong vaddr = dalloc(p, file_size);
+    r = add_vm_region(p, vm_region_file, vaddr, vaddr + file_size, exec, 0);
+    
+    if (map_id) {
+        set_vm_region_file(r, map_id, file_size);
+    } else {
+        set_vm_region_data(r, vaddr, hal->coreimg_load_addr + image_offset, file_size);
+    }
+    
+    if (size) {
+        *size = file_size;
+    }
+    
+    return vaddr;
+}
+
+int funmap(struct process *p, unsigned long vaddr)
+{
+    struct vm_region *r = remove_vm_region(p, vm_region_file, vaddr);
+    if (!r) {
+        return EINVAL;
+    }
+    
+    unmap_vm_region(p, r);
+    dfree(p, vaddr);
+    
+    if (r->file_id) {
+        request_close(r->file_id);
+    }
+    
+    free(r);
+    return EOK;
+}
+
+
+/*
+ * Page in
+ */
+static ulong read_page(struct process *p, ulong page)
+{
+    struct vm_region *r = NULL;
+    ulong file_id, offset, len, done, actual;
+    int exec;
+    
+    spin_lock_int(&p->lock);
+    
+    r = find_file_region(p, page);
+    if (!r) {
+        spin_unlock_int(&p->lock);
+        return 0;
+    }
+    
+    file_id = r->file_id;
+    offset = page - r->start;
+    len = r->file_size > offset ? r->file_size - offset : 0;
+    exec = r->exec;
+    
+    spin_unlock_int(&p->lock);
+    
+    if (len > PAGE_SIZE) {
+        len = PAGE_SIZE;
+    }
+    
+    ulong paddr = PFN_TO_ADDR(palloc(1));
+    assert(paddr);
+    memzero((void *)paddr, PAGE_SIZE);
+    
+    // The file may have shrunk since it was mapped, the rest reads as zeros
+    for (done = 0; done < len; done += actual) {
+        actual = len - done;
+        if (actual > FMAP_PAGE_IN_CHUNK) {
+            actual = FMAP_PAGE_IN_CHUNK;
+        }
+        
+        actual = request_page_in(file_id, offset + done, (void *)(paddr + done), actual);
+        if (!actual) {
+            break;
+        }
+    }
+    
+    // The region may be gone, or another thread may have read the page in first
+    spin_lock_int(&p->lock);
+    
+    r = find_file_region(p, page);
+    if (r && r->file_id == file_id && !hal->get_paddr(p->page_dir_pfn, page)) {
+        int mapped = hal->map_user(
+            p->page_dir_pfn, page, paddr, PAGE_SIZE,
+            exec, 0, 1, 0
+        );
+        assert(mapped);
+        
+        p->vm.resident_count++;
+    } else {
+        pfree(ADDR_TO_PFN(paddr));
+        paddr = hal->get_paddr(p->page_dir_pfn, page);
+    }
+    
+    spin_unlock_int(&p->lock);
+    
+    return paddr;
+}
+
+static void page_in_worker_thread(ulong param)
+{
+    struct kernel_dispatch_info *disp_info = (struct kernel_dispatch_info *)param;
+    struct thread *worker = disp_info->worker;
+    struct process *p = disp_info->proc;
+    struct thread *t = disp_info->thread;
+    ulong addr = disp_info->page_fault.addr;
+    ulong page = ALIGN_DOWN(addr, PAGE_SIZE);
+    
+    if (read_page(p, page)) {
+        hal->invalidate_tlb(p->asid, page, PAGE_SIZE);
+        run_thread(t);
+    } else {
+        kprintf("Unable to read in page @ %p, process: %s\n", (void *)addr, p->name);
+        terminate_thread(t);
+    }
+    
+    free(disp_info);
+    terminate_thread_self(worker);
+    
+    // Wait for this thread to be terminated
+    ksys_unreachable();
+}
+
+int page_in_file(struct kernel_dispatch_info *disp_info)
+{
+    struct kernel_dispatch_info *dup_disp_info = malloc(sizeof(struct kernel_dispatch_info));
+    assert(dup_disp_info);
+    memcpy(dup_disp_info, disp_info, sizeof(struct kernel_dispatch_info));
+    
+    int is_in_wait = wait_thread(disp_info->thread);
+    assert(is_in_wait);
+    
+    struct thread *worker = create_thread(kernel_proc, (ulong)&page_in_worker_thread, (ulong)dup_disp_info, -1, 0, 0);
+    assert(worker);
+    
+    dup_disp_info->worker = worker;
+    run_thread(worker);
+    
+    return 1;
+}
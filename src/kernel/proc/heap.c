@@ -8,37 +8,22 @@
 #include "kernel/include/proc.h"
 
 
+/*
+ * Heap pages are populated on demand, growing only extends the heap region
+ */
 static void do_grow_heap(struct process *p, ulong amount)
 {
     ulong old_vpfn = ADDR_TO_PFN(p->memory.heap_end);
     ulong new_vpfn = ADDR_TO_PFN(p->memory.heap_end + amount);
     
-    ulong cur_vpfn;
-    ulong cur_vaddr;
-    ulong cur_paddr;
-    
     if (new_vpfn <= old_vpfn) {
         return;
     }
     
 //     kprintf("old_vpfn: %p, new_vpfn: %p\n", old_vpfn, new_vpfn);
     
-    for (cur_vpfn = old_vpfn + 1; cur_vpfn <= new_vpfn; cur_vpfn++) {
-        cur_vaddr = PFN_TO_ADDR(cur_vpfn);
-        cur_paddr = PFN_TO_ADDR(palloc(1));
-        assert(cur_paddr);
-        
-        //kprintf("Mapping %p -> %p\n", cur_vaddr, cur_paddr);
-        
-        int succeed = hal->map_user(
-            p->page_dir_pfn,
-            cur_vaddr, cur_paddr, PAGE_SIZE,
-            0, 1, 1, 0
-        );
-        assert(succeed);
-    }
-    
-    //kprintf("grow done!\n");
+    assert(p->vm.heap);
+    p->vm.heap->end = PFN_TO_ADDR(new_vpfn + 1);
     
     p->memory.heap_end += amount;
 }
@@ -51,25 +36,38 @@ static void do_shrink_heap(struct process *p, ulong amount)
     ulong cur_vpfn;
     ulong cur_vaddr;
     ulong cur_paddr;
+    ulong unmapped = 0;
     
     if (new_vpfn >= old_vpfn) {
         return;
     }
     
+    assert(p->vm.heap);
+    p->vm.heap->end = PFN_TO_ADDR(new_vpfn + 1);
+    
     for (cur_vpfn = old_vpfn; cur_vpfn > new_vpfn; cur_vpfn--) {
         cur_vaddr = PFN_TO_ADDR(cur_vpfn);
         cur_paddr = hal->get_paddr(p->page_dir_pfn, cur_vaddr);
-        assert(cur_paddr);
+        
+        // Never touched
+        if (!cur_paddr) {
+            continue;
+        }
         
         int succeed = hal->unmap_user(
             p->page_dir_pfn,
             cur_vaddr, cur_paddr, PAGE_SIZE
         );
         assert(succeed);
+        
+        p->vm.resident_count--;
+        unmapped++;
     }
     
     // TLB shootdown
-    trigger_tlb_shootdown(p->asid, PFN_TO_ADDR((new_vpfn + 1)), PAGE_SIZE * (int)(old_vpfn - new_vpfn));
+    if (unmapped) {
+        trigger_tlb_shootdown(p, PFN_TO_ADDR((new_vpfn + 1)), PAGE_SIZE * (int)(old_vpfn - new_vpfn));
+    }
     
     p->memory.heap_end -= amount;
 }
@@ -20,26 +20,44 @@ struct monitor_dispatch_info {
 
 
 static struct monitor_dispatch_info dispatch_info[pm_type_count];
+static seqlock_t dispatch_info_lock;
 
 
-static msg_t *create_dispatch_msg(enum proc_monitor_type type)
+/*
+ * The table is read on every process creation and termination,
+ * while written only when a monitor registers
+ */
+static void read_dispatch_info(enum proc_monitor_type type, struct monitor_dispatch_info *info)
+{
+    ulong seq;
+    
+    do {
+        seq = seq_read_begin(&dispatch_info_lock);
+        *info = dispatch_info[type];
+    } while (seq_read_retry(&dispatch_info_lock, seq));
+}
+
+static msg_t *create_dispatch_msg(struct monitor_dispatch_info *info)
 {
     msg_t *msg = create_request_msg();
     
-    msg->mailbox_id = dispatch_info[type].proc_id;
-    msg->opcode = dispatch_info[type].opcode;
-    msg->func_num = dispatch_info[type].func_num;
+    msg->mailbox_id = info->proc_id;
+    msg->opcode = info->opcode;
+    msg->func_num = info->func_num;
     
     return msg;
 }
 
 int check_process_create_before(unsigned long parent_proc_id)
 {
-    if (!dispatch_info[pm_create_before].proc_id) {
+    struct monitor_dispatch_info info;
+    
+    read_dispatch_info(pm_create_before, &info);
+    if (!info.proc_id) {
         return EOK;
     }
     
-    msg_t *s = create_dispatch_msg(pm_create_before);
+    msg_t *s = create_dispatch_msg(&info);
     set_msg_param_value(s, parent_proc_id);
     
     msg_t *r = ksys_request();
@@ -50,11 +68,14 @@ int check_process_create_before(unsigned long parent_proc_id)
 
 int check_process_create_after(unsigned long parent_proc_id, unsigned long proc_id)
 {
-    if (!dispatch_info[pm_create_after].proc_id) {
+    struct monitor_dispatch_info info;
+    
+    read_dispatch_info(pm_create_after, &info);
+    if (!info.proc_id) {
         return EOK;
     }
     
-    msg_t *s = create_dispatch_msg(pm_create_after);
+    msg_t *s = create_dispatch_msg(&info);
     set_msg_param_value(s, parent_proc_id);
     set_msg_param_value(s, proc_id);
     
@@ -66,11 +87,14 @@ int check_process_create_after(unsigned long parent_proc_id, unsigned long proc_
 
 int check_process_terminate_before(unsigned long proc_id)
 {
-    if (!dispatch_info[pm_terminate_before].proc_id) {
+    struct monitor_dispatch_info info;
+    
+    read_dispatch_info(pm_terminate_before, &info);
+    if (!info.proc_id) {
         return EOK;
     }
     
-    msg_t *s = create_dispatch_msg(pm_terminate_before);
+    msg_t *s = create_dispatch_msg(&info);
     set_msg_param_value(s, proc_id);
     
     msg_t *r = ksys_request();
@@ -81,11 +105,14 @@ int check_process_terminate_before(unsigned long proc_id)
 
 int check_process_terminate_after(unsigned long proc_id)
 {
-    if (!dispatch_info[pm_terminate_after].proc_id) {
+    struct monitor_dispatch_info info;
+    
+    read_dispatch_info(pm_terminate_after, &info);
+    if (!info.proc_id) {
         return EOK;
     }
     
-    msg_t *s = create_dispatch_msg(pm_terminate_after);
+    msg_t *s = create_dispatch_msg(&info);
     set_msg_param_value(s, proc_id);
     
     msg_t *r = ksys_request();
@@ -99,12 +126,16 @@ int register_process_monitor(enum proc_monitor_type type, unsigned long proc_id,
 {
     //kprintf("Reg proc monitor, type: %d, proc id: %x, func_num: %x, opcode: %x\n", type, proc_id, func_num, opcode);
     
+    seq_write_lock(&dispatch_info_lock);
+    
     assert(dispatch_info[type].proc_id == 0);
     
     dispatch_info[type].proc_id = proc_id;
     dispatch_info[type].func_num = func_num;
     dispatch_info[type].opcode = opcode;
     
+    seq_write_unlock(&dispatch_info_lock);
+    
     return EOK;
 }
 
@@ -112,6 +143,9 @@ int register_process_monitor(enum proc_monitor_type type, unsigned long proc_id,
 void init_process_monitor()
 {
     int i;
+    
+    seq_init(&dispatch_info_lock);
+    
     for (i = 0; i < pm_type_count; i++) {
         dispatch_info[i].proc_id = 0;
         dispatch_info[i].func_num = 0;
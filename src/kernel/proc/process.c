@@ -17,6 +17,7 @@
 static int proc_salloc_id;
 
 static struct process_list processes;
+static hashtable_t process_table;
 struct process *kernel_proc;
 
 
@@ -76,6 +77,9 @@ struct process *create_process(
     // Init dynamic area
     create_dalloc(p);
     
+    // Init demand paging regions
+    create_vm_regions(p);
+    
     // Memory
     p->memory.entry_point = 0;
     
@@ -99,16 +103,29 @@ struct process *create_process(
     // ASID
     if (type == process_kernel) {
         p->asid = 0;
+        p->asid_gen = 0;
     } else {
-        p->asid = asid_alloc();
+        asid_alloc(p);
     }
+    p->tlb_cpu_mask = 0;
+    
+    // The reference of the process table
+    p->ref_count = 1;
     
     // Insert the process into process list
+    write_lock_int(&processes.lock);
+    
     p->prev = NULL;
     p->next = processes.next;
     processes.next = p;
     processes.count++;
     
+    write_unlock_int(&processes.lock);
+    
+    // Make the process reachable by its ID
+    int inserted = hashtable_insert(&process_table, p->proc_id, p);
+    assert(inserted);
+    
     // Notify process monitor
     mon_err = check_process_create_after(parent_id, p->proc_id);
     assert(mon_err == EOK);
@@ -123,13 +140,50 @@ struct process *create_process(
     return p;
 }
 
+/*
+ * Returns the process with a reference held, or NULL if no live process has
+ * the ID. The caller drops the reference by release_process
+ */
+struct process *find_process(ulong proc_id)
+{
+    ulong refs = 0;
+    struct process *p = (struct process *)hashtable_obtain(&process_table, proc_id);
+    if (!p) {
+        return NULL;
+    }
+    
+    // Pin the process while still in the read section, a process without any reference is going away
+    do {
+        refs = p->ref_count;
+        if (!refs) {
+            hashtable_release(&process_table, proc_id, p);
+            return NULL;
+        }
+    } while (!atomic_cas(&p->ref_count, refs, refs + 1));
+    
+    hashtable_release(&process_table, proc_id, p);
+    
+    return p;
+}
+
+void hold_process(struct process *p)
+{
+    assert(p->ref_count);
+    atomic_inc(&p->ref_count);
+}
+
+void release_process(struct process *p)
+{
+    atomic_dec(&p->ref_count);
+}
+
 int load_image(struct process *p, char *url)
 {
     // Load image
     ulong img = (ulong)get_core_file_addr_by_name(url); // FIXME: should use namespace service
     ulong entry = 0, vaddr_start = 0, vaddr_end = 0;
     //int succeed = hal->load_exe(img, p->page_dir_pfn, &entry, &vaddr_start, &vaddr_end);
-    int succeed = load_exec(img, p->page_dir_pfn, &entry, &vaddr_start, &vaddr_end);
+    int succeed = load_exec(img, p, &entry, &vaddr_start, &vaddr_end);
     
     if (!succeed) {
         return 0;
@@ -143,14 +197,8 @@ int load_image(struct process *p, char *url)
         heap_start *= PAGE_SIZE;
     }
     
-    // Map the initial page for heap
-    ulong heap_paddr = PFN_TO_ADDR(palloc(1));
-    succeed = hal->map_user(
-        p->page_dir_pfn,
-        heap_start, heap_paddr, PAGE_SIZE,
-        0, 1, 1, 0
-    );
-    assert(succeed);
+    // Register the initial page for heap, it grows along with heap end
+    p->vm.heap = add_vm_region(p, vm_region_anon, heap_start, heap_start + PAGE_SIZE, 0, 1);
     
     // Set memory layout
     p->memory.entry_point = entry;
@@ -173,6 +221,10 @@ void init_process()
     // Init process list
     processes.count = 0;
     processes.next = NULL;
+    rwlock_init(&processes.lock);
+    
+    // Init process table
+    hashtable_create(&process_table, 0, NULL, NULL);
     
     // Create the kernel process
     kernel_proc = create_process(-1, "kernel", "coreimg://tdlrkrnl.bin", process_kernel, 0);
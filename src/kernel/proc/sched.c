@@ -21,6 +21,9 @@ static struct sched_list idle_queue;
 static struct sched_list run_queue;
 static struct sched_list exit_queue;
 
+static lock_stat_t ready_queue_stat;
+static lock_stat_t stall_queue_stat;
+
 
 static ulong gen_sched_id(struct sched *s)
 {
@@ -43,12 +46,12 @@ static void init_list(struct sched_list *l)
     l->head = NULL;
     l->tail = NULL;
     
-    spin_init(&l->lock);
+    mcs_init(&l->lock);
 }
 
 static void push_back(struct sched_list *l, struct sched *s)
 {
-    spin_lock_int(&l->lock);
+    mcs_lock_int(&l->lock);
     
     s->next = NULL;
     s->prev = NULL;
@@ -78,7 +81,7 @@ static void push_back(struct sched_list *l, struct sched *s)
 //         kprintf("\n");
 //     }
     
-    spin_unlock_int(&l->lock);
+    mcs_unlock_int(&l->lock);
 }
 
 static void inline do_remove(struct sched_list *l, struct sched *s)
@@ -118,18 +121,18 @@ static void inline do_remove(struct sched_list *l, struct sched *s)
 
 static void remove(struct sched_list *l, struct sched *s)
 {
-    spin_lock_int(&l->lock);
+    mcs_lock_int(&l->lock);
     
     do_remove(l, s);
     
-    spin_unlock_int(&l->lock);
+    mcs_unlock_int(&l->lock);
 }
 
 static struct sched *pop_front(struct sched_list *l)
 {
     struct sched *s = NULL;
     
-    spin_lock_int(&l->lock);
+    mcs_lock_int(&l->lock);
     
     if (l->count) {
         assert(l->head);
@@ -138,7 +141,7 @@ static struct sched *pop_front(struct sched_list *l)
         do_remove(l, s);
     }
     
-    spin_unlock_int(&l->lock);
+    mcs_unlock_int(&l->lock);
     
     return s;
 }
@@ -162,6 +165,10 @@ void init_sched()
     init_list(&stall_queue);
     init_list(&exit_queue);
     
+    // Contention statistics of the busiest queues
+    mcs_stat(&ready_queue.lock, &ready_queue_stat, "sched ready queue");
+    mcs_stat(&stall_queue.lock, &stall_queue_stat, "sched stall queue");
+    
     // Done
     kprintf("\tScheduler salloc ID: %d\n", sched_salloc_id);
 }
@@ -394,6 +401,9 @@ void sched()
     // Then tell HAL to do a context switch
     struct process *p = s->proc;
     struct thread *t = s->thread;
+    int cpu_id = hal->get_cur_cpu_id();
+    asid_switch(p, cpu_id);
+    tlb_mark_cpu(p, cpu_id);
     hal->switch_context(s->sched_id, &s->thread->context, p->page_dir_pfn, p->user_mode, p->asid, t->memory.block_base + t->memory.tcb_start_offset);
 }
 
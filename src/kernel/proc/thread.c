@@ -251,6 +251,7 @@ struct thread *create_thread(
     tcb->tls = (void *)(t->memory.block_base + t->memory.tls_start_offset);
     tcb->proc_id = p->proc_id;
     tcb->thread_id = t->thread_id;
+    tcb->kernel_proc_id = kernel_proc ? kernel_proc->proc_id : p->proc_id;
     
     // Prepare the param
     ulong *param_ptr = (ulong *)(t->memory.stack_top_paddr - sizeof(ulong));
@@ -338,7 +339,7 @@ static void destroy_thread(struct process *p, struct thread *t)
         assert(t->memory.block_base != 0xeffbe000);
         
         // TLB shootdown first
-        trigger_tlb_shootdown(p->asid, t->memory.block_base, t->memory.block_size);
+        trigger_tlb_shootdown(p, t->memory.block_base, t->memory.block_size);
         
         // Msg send
         vaddr = t->memory.block_base + t->memory.msg_send_offset;
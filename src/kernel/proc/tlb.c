@@ -1,116 +1,260 @@
 #include "common/include/data.h"
 #include "common/include/atomic.h"
+#include "common/include/memory.h"
 #include "kernel/include/hal.h"
 #include "kernel/include/sync.h"
 #include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
 #include "kernel/include/syscall.h"
 #include "kernel/include/proc.h"
 
 
+/*
+ * A shootdown request is queued on every target CPU
+ * Targets are interrupted by an IPI if the HAL supports it, otherwise
+ * the request is picked up on their next kernel dispatch
+ */
+struct tlb_shootdown_record;
+
+struct tlb_shootdown_node {
+    struct tlb_shootdown_node *next;
+    struct tlb_shootdown_record *record;
+};
+
 struct tlb_shootdown_record {
-    int valid;
-    
     ulong asid;
-    ulong addr;
-    size_t size;
+    struct tlb_batch batch;
     
-    volatile ulong response_count;
-    volatile char *response_records;
+    volatile ulong pending;
+    struct tlb_shootdown_node nodes[];
+};
+
+struct tlb_shootdown_queue {
+    spinlock_t lock;
+    struct tlb_shootdown_node * volatile head;
 };
 
 
-static spinlock_t tlb_record_lock;
-static volatile struct tlb_shootdown_record *records;
+static struct tlb_shootdown_queue *queues;
+static ulong all_cpu_mask;
 
 
 void init_tlb_mgmt()
 {
-    int i, j;
+    int i;
+    
+    assert(hal->num_cpus <= sizeof(ulong) * 8);
     
-    records = malloc(sizeof(struct tlb_shootdown_record) * hal->num_cpus);
+    queues = malloc(sizeof(struct tlb_shootdown_queue) * hal->num_cpus);
+    assert(queues);
+    
+    all_cpu_mask = 0;
     for (i = 0; i < hal->num_cpus; i++) {
-        records[i].valid = 0;
-        records[i].response_count = 0;
+        spin_init(&queues[i].lock);
+        queues[i].head = NULL;
+        all_cpu_mask |= 0x1ul << i;
+    }
+    
+    atomic_membar();
+}
+
+void tlb_mark_cpu(struct process *p, int cpu_id)
+{
+    ulong bit = 0x1ul << cpu_id;
+    
+    if (!(p->tlb_cpu_mask & bit)) {
+        atomic_or(&p->tlb_cpu_mask, bit);
+    }
+}
+
+
+/*
+ * Local invalidation
+ */
+static void invalidate_batch(ulong asid, struct tlb_batch *batch)
+{
+    int i;
+    
+    if (batch->full) {
+        hal->flush_tlb(asid);
+        return;
+    }
+    
+    for (i = 0; i < batch->range_count; i++) {
+        hal->invalidate_tlb(asid, batch->ranges[i].addr, batch->ranges[i].size);
+    }
+}
+
+
+/*
+ * Batching
+ */
+void tlb_batch_begin(struct tlb_batch *batch, struct process *p)
+{
+    batch->proc = p;
+    batch->full = 0;
+    batch->range_count = 0;
+    batch->page_count = 0;
+}
+
+void tlb_batch_add(struct tlb_batch *batch, ulong addr, size_t size)
+{
+    ulong start = ALIGN_DOWN(addr, PAGE_SIZE);
+    ulong end = ALIGN_UP(addr + size, PAGE_SIZE);
+    
+    if (batch->full || start == end) {
+        return;
+    }
+    
+    batch->page_count += (end - start) / PAGE_SIZE;
+    
+    // Too many pages or ranges, flush the entire ASID instead if the HAL can
+    if (hal->flush_tlb &&
+        (batch->page_count > TLB_FULL_FLUSH_PAGES || batch->range_count == TLB_BATCH_MAX_RANGES)
+    ) {
+        batch->full = 1;
+        return;
+    }
+    
+    // Out of slots, merge into the last range
+    if (batch->range_count == TLB_BATCH_MAX_RANGES) {
+        struct tlb_range *last = &batch->ranges[TLB_BATCH_MAX_RANGES - 1];
+        ulong last_end = last->addr + last->size;
         
-        records[i].response_records = malloc(sizeof(char) * hal->num_cpus);
-        for (j = 0; j < hal->num_cpus; j++) {
-            records[i].response_records[j] = 0;
+        if (start < last->addr) {
+            last->addr = start;
         }
-        
-        spin_init(&tlb_record_lock);
+        if (end > last_end) {
+            last_end = end;
+        }
+        last->size = last_end - last->addr;
+        return;
     }
     
-    atomic_membar();
+    batch->ranges[batch->range_count].addr = start;
+    batch->ranges[batch->range_count].size = end - start;
+    batch->range_count++;
 }
 
-void trigger_tlb_shootdown(ulong asid, ulong addr, size_t size)
+void tlb_batch_flush(struct tlb_batch *batch)
 {
     int i;
-    int cpu_count = hal->num_cpus;
     int cur_cpu_id = -1;
+    ulong asid = batch->proc->asid;
+    ulong cpu_mask = 0;
+    ulong target_count = 0;
+    struct tlb_shootdown_record *record = NULL;
     
-    //kprintf("[TLB] cpu count: %d\n", cpu_count);
-    
-    spin_lock_int(&tlb_record_lock);
+    if (!batch->full && !batch->range_count) {
+        return;
+    }
     
+    // Invalidate myself
     cur_cpu_id = hal->get_cur_cpu_id();
+    invalidate_batch(asid, batch);
     
-    // Invalidate myself
-    hal->invalidate_tlb(asid, addr, size);
-    
-    // Prepare to invalidate others
-    records[cur_cpu_id].asid = asid;
-    records[cur_cpu_id].addr = addr;
-    records[cur_cpu_id].size = size;
-    records[cur_cpu_id].response_count = 1;
-    for (i = 0; i < cpu_count; i++) {
-        records[cur_cpu_id].response_records[i] = 0;
+    // Only interrupt the CPUs that have run the ASID, kernel mappings are everywhere
+    cpu_mask = asid ? batch->proc->tlb_cpu_mask : all_cpu_mask;
+    cpu_mask &= ~(0x1ul << cur_cpu_id);
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        if (cpu_mask & (0x1ul << i)) {
+            target_count++;
+        }
+    }
+    
+    if (!target_count) {
+        tlb_batch_begin(batch, batch->proc);
+        return;
     }
-    records[cur_cpu_id].response_records[cur_cpu_id] = 1;
     
+    // Build the record
+    record = malloc(sizeof(struct tlb_shootdown_record) + sizeof(struct tlb_shootdown_node) * hal->num_cpus);
+    assert(record);
+    
+    record->asid = asid;
+    memcpy(&record->batch, batch, sizeof(struct tlb_batch));
+    record->pending = target_count;
     atomic_membar();
-    records[cur_cpu_id].valid = 1;
     
-    spin_unlock_int(&tlb_record_lock);
+    // Queue it on every target
+    for (i = 0; i < hal->num_cpus; i++) {
+        if (!(cpu_mask & (0x1ul << i))) {
+            continue;
+        }
+        
+        struct tlb_shootdown_queue *q = &queues[i];
+        struct tlb_shootdown_node *node = &record->nodes[i];
+        node->record = record;
+        
+        spin_lock_int(&q->lock);
+        node->next = q->head;
+        q->head = node;
+        spin_unlock_int(&q->lock);
+    }
     
-    if (cpu_count > 1) {
-        // Send IPI to all CPUs including myself
+    // Then kick them
+    if (hal->send_tlb_shootdown) {
+        for (i = 0; i < hal->num_cpus; i++) {
+            if (cpu_mask & (0x1ul << i)) {
+                hal->send_tlb_shootdown(i);
+            }
+        }
     }
     
-    //kprintf("[TLB] TLB shootdown triggered, addr: %u, size: %u\n", addr, size);
+    //kprintf("[TLB] TLB shootdown triggered, targets: %u\n", target_count);
     
-    while (records[cur_cpu_id].response_count < cpu_count) {
+    while (record->pending) {
         //hal->yield();
         ksys_yield();
     }
     
     atomic_membar();
+    free(record);
     
-    records[cur_cpu_id].valid = 0;
-    atomic_membar();
+    tlb_batch_begin(batch, batch->proc);
     
-    //kprintf("[TLB] TLB shootdown done, addr: %u, size: %u\n", addr, size);
+    //kprintf("[TLB] TLB shootdown done\n");
+}
+
+void trigger_tlb_shootdown(struct process *p, ulong addr, size_t size)
+{
+    struct tlb_batch batch;
+    
+    tlb_batch_begin(&batch, p);
+    tlb_batch_add(&batch, addr, size);
+    tlb_batch_flush(&batch);
 }
 
 
+/*
+ * Service requests from other CPUs
+ */
 void service_tlb_shootdown()
 {
-    int i;
-    int cur_cpu_id = hal->get_cur_cpu_id();
+    struct tlb_shootdown_queue *q = &queues[hal->get_cur_cpu_id()];
+    struct tlb_shootdown_node *node = NULL;
+    struct tlb_shootdown_node *next = NULL;
     
-    for (i = 0; i < hal->num_cpus; i++) {
-        if (!records[i].valid) {
-            continue;
-        }
-        
-        if (records[i].response_records[cur_cpu_id]) {
-            continue;
-        }
+    if (!q->head) {
+        return;
+    }
+    
+    spin_lock_int(&q->lock);
+    node = q->head;
+    q->head = NULL;
+    spin_unlock_int(&q->lock);
+    
+    while (node) {
+        // The record may be freed once pending drops, read everything first
+        struct tlb_shootdown_record *record = node->record;
+        next = node->next;
         
-        hal->invalidate_tlb(records[i].asid, records[i].addr, records[i].size);
-        records[i].response_records[cur_cpu_id] = 1;
+        invalidate_batch(record->asid, &record->batch);
         atomic_membar();
-        atomic_inc(&records[i].response_count);
+        atomic_dec(&record->pending);
+        
+        node = next;
         
         //kprintf("[TLB] TLB shootdown serviced!\n");
     }
@@ -0,0 +1,529 @@
+/*
+ * Demand paging
+ *
+ * Image segments and the heap are registered as regions when a process is
+ * loaded, physical pages are only allocated when a page is first touched.
+ * Mapped URS nodes are regions too, see fmap.c
+ */
+
+
+#include "common/include/data.h"
+#include "common/include/atomic.h"
+#include "common/include/kdisp.h"
+#include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
+#include "kernel/include/ds.h"
+#include "kernel/include/proc.h"
+
+
+/*
+ * Shared image pages
+ *  Pages entirely filled from the core image are cached by their image
+ *  address and mapped read-only into every process that loads the image.
+ *  The PFN count of a cached page is the number of mappings, plus one for
+ *  the cache itself, so a non-zero count means the page must not be written.
+ *  Processes share these pages while each holds only its own lock, so every
+ *  change of a share count goes through image_page_lock
+ */
+static hashtable_t image_pages;
+static volatile ulong image_page_count = 0;
+static spinlock_t image_page_lock = SPINLOCK_INIT;
+
+static int write_protect = 0;
+
+
+void init_vm()
+{
+    kprintf("Initializing demand paging\n");
+    
+    hashtable_create(&image_pages, 0, NULL, NULL);
+    
+    // Writable pages can only be shared if the HAL traps writes to them
+    write_protect = hal->user_write_protect;
+    
+    kprintf("\tCopy-on-write: %s\n", write_protect ? "enabled" : "disabled");
+}
+
+static int can_share(struct vm_region *r, ulong vaddr)
+{
+    if (r->type == vm_region_anon) {
+        return 0;
+    }
+    
+    if (r->write && !write_protect) {
+        return 0;
+    }
+    
+    // Partially filled pages differ from the image
+    return vaddr >= r->data_vaddr && vaddr + PAGE_SIZE <= r->data_vaddr + r->data_size;
+}
+
+static ulong share_count_add(ulong pfn, int delta)
+{
+    ulong count = 0;
+    
+    spin_lock_int(&image_page_lock);
+    count = pfn_count_add(pfn, delta);
+    spin_unlock_int(&image_page_lock);
+    
+    return count;
+}
+
+/*
+ * Drop the share of a mapping, returns 0 if the page was private to it
+ */
+static int share_count_put(ulong pfn)
+{
+    int shared = 0;
+    
+    spin_lock_int(&image_page_lock);
+    if (pfn_count_add(pfn, 0)) {
+        pfn_count_add(pfn, -1);
+        shared = 1;
+    }
+    spin_unlock_int(&image_page_lock);
+    
+    return shared;
+}
+
+static ulong get_image_page(struct vm_region *r, ulong vaddr)
+{
+    ulong key = r->data_addr + (vaddr - r->data_vaddr);
+    ulong paddr = 0;
+    ulong pfn = 0;
+    
+    do {
+        paddr = (ulong)hashtable_obtain(&image_pages, key);
+        if (paddr) {
+            share_count_add(ADDR_TO_PFN(paddr), 1);
+            hashtable_release(&image_pages, key, (void *)paddr);
+            return paddr;
+        }
+        
+        // Not cached yet, fill a new page
+        pfn = palloc(1);
+        assert(pfn);
+        
+        paddr = PFN_TO_ADDR(pfn);
+        memcpy((void *)paddr, (void *)key, PAGE_SIZE);
+        
+        share_count_add(pfn, 1);
+        if (hashtable_insert(&image_pages, key, (void *)paddr)) {
+            atomic_inc(&image_page_count);
+            share_count_add(pfn, 1);
+            return paddr;
+        }
+        
+        // Someone else cached it first
+        share_count_add(pfn, -1);
+        pfree(pfn);
+    } while (1);
+}
+
+
+/*
+ * Region management
+ */
+void create_vm_regions(struct process *p)
+{
+    p->vm.head = NULL;
+    p->vm.heap = NULL;
+    p->vm.count = 0;
+    
+    p->vm.fault_count = 0;
+    p->vm.resident_count = 0;
+    p->vm.shared_count = 0;
+    p->vm.cow_count = 0;
+}
+
+struct vm_region *add_vm_region(
+    struct process *p, enum vm_region_type type,
+    ulong start, ulong end, int exec, int write)
+{
+    struct vm_region *r = (struct vm_region *)malloc(sizeof(struct vm_region));
+    assert(r);
+    
+    r->type = type;
+    r->start = ALIGN_DOWN(start, PAGE_SIZE);
+    r->end = ALIGN_UP(end, PAGE_SIZE);
+    r->exec = exec;
+    r->write = write;
+    
+    r->data_vaddr = 0;
+    r->data_addr = 0;
+    r->data_size = 0;
+    
+    r->file_id = 0;
+    r->file_size = 0;
+    
+    spin_lock_int(&p->lock);
+    
+    r->next = p->vm.head;
+    p->vm.head = r;
+    p->vm.count++;
+    
+    spin_unlock_int(&p->lock);
+    
+    return r;
+}
+
+void set_vm_region_data(struct vm_region *r, ulong data_vaddr, ulong data_addr, ulong data_size)
+{
+    assert(r->type == vm_region_image || r->type == vm_region_file);
+    assert(data_vaddr >= r->start && data_vaddr + data_size <= r->end);
+    
+    r->data_vaddr = data_vaddr;
+    r->data_addr = data_addr;
+    r->data_size = data_size;
+}
+
+void set_vm_region_file(struct vm_region *r, ulong file_id, ulong file_size)
+{
+    assert(r->type == vm_region_file);
+    assert(r->start + file_size <= r->end);
+    
+    r->file_id = file_id;
+    r->file_size = file_size;
+}
+
+struct vm_region *remove_vm_region(struct process *p, enum vm_region_type type, ulong start)
+{
+    struct vm_region *r, *prev = NULL;
+    
+    spin_lock_int(&p->lock);
+    
+    for (r = p->vm.head; r; prev = r, r = r->next) {
+        if (r->type == type && r->start == start) {
+            if (prev) {
+                prev->next = r->next;
+            } else {
+                p->vm.head = r->next;
+            }
+            
+            p->vm.count--;
+            break;
+        }
+    }
+    
+    spin_unlock_int(&p->lock);
+    
+    return r;
+}
+
+/*
+ * Unmap the resident pages of a removed region, pages are only freed once
+ * no other CPU may still hold a translation to them
+ */
+#define UNMAP_BATCH_PAGES   64
+
+void unmap_vm_region(struct process *p, struct vm_region *r)
+{
+    ulong pfns[UNMAP_BATCH_PAGES];
+    ulong batch_start = r->start;
+    ulong vaddr, paddr;
+    int count = 0;
+    int i;
+    
+    for (vaddr = r->start; vaddr < r->end; vaddr += PAGE_SIZE) {
+        spin_lock_int(&p->lock);
+        
+        paddr = hal->get_paddr(p->page_dir_pfn, vaddr);
+        if (paddr) {
+            int succeed = hal->unmap_user(p->page_dir_pfn, vaddr, paddr, PAGE_SIZE);
+            assert(succeed);
+            
+            pfns[count++] = ADDR_TO_PFN(paddr);
+            p->vm.resident_count--;
+        }
+        
+        spin_unlock_int(&p->lock);
+        
+        if (count == UNMAP_BATCH_PAGES || (count && vaddr + PAGE_SIZE == r->end)) {
+            trigger_tlb_shootdown(p, batch_start, vaddr + PAGE_SIZE - batch_start);
+            
+            // Shared image pages only drop the reference of this mapping
+            for (i = 0; i < count; i++) {
+                if (share_count_put(pfns[i])) {
+                    p->vm.shared_count--;
+                } else {
+                    pfree(pfns[i]);
+                }
+            }
+            
+            batch_start = vaddr + PAGE_SIZE;
+            count = 0;
+        }
+    }
+}
+
+/*
+ * A file region that pages have to be read in for, caller must hold the process lock
+ */
+struct vm_region *find_file_region(struct process *p, ulong vaddr)
+{
+    struct vm_region *r;
+    
+    for (r = p->vm.head; r; r = r->next) {
+        if (vaddr >= r->start && vaddr < r->end) {
+            return r->type == vm_region_file && r->file_id ? r : NULL;
+        }
+    }
+    
+    return NULL;
+}
+
+
+/*
+ * Fault resolution, caller must hold the process lock
+ */
+static void fill_page(struct process *p, ulong vaddr, ulong paddr)
+{
+    struct vm_region *r;
+    ulong s, e;
+    
+    memzero((void *)paddr, PAGE_SIZE);
+    
+    // A page may be shared by the tail of one segment and the head of the next
+    for (r = p->vm.head; r; r = r->next) {
+        if (r->type == vm_region_anon || !r->data_size) {
+            continue;
+        }
+        
+        s = vaddr > r->data_vaddr ? vaddr : r->data_vaddr;
+        e = r->data_vaddr + r->data_size;
+        if (e > vaddr + PAGE_SIZE) {
+            e = vaddr + PAGE_SIZE;
+        }
+        
+        if (s < e) {
+            memcpy((void *)(paddr + s - vaddr), (void *)(r->data_addr + s - r->data_vaddr), e - s);
+        }
+    }
+}
+
+static ulong split_cow_page(struct process *p, ulong vaddr, ulong old_paddr, int exec)
+{
+    ulong paddr = PFN_TO_ADDR(palloc(1));
+    assert(paddr);
+    
+    memcpy((void *)paddr, (void *)old_paddr, PAGE_SIZE);
+    
+    int succeed = hal->unmap_user(p->page_dir_pfn, vaddr, old_paddr, PAGE_SIZE);
+    assert(succeed);
+    
+    succeed = hal->map_user(
+        p->page_dir_pfn, vaddr, paddr, PAGE_SIZE,
+        exec, 1, 1, 0
+    );
+    assert(succeed);
+    
+    // The cache still holds the shared page
+    share_count_add(ADDR_TO_PFN(old_paddr), -1);
+    
+    p->vm.shared_count--;
+    p->vm.cow_count++;
+    
+    return paddr;
+}
+
+static ulong do_fault_in(struct process *p, ulong vaddr, int write, int *split)
+{
+    struct vm_region *r;
+    struct vm_region *only = NULL;
+    int count = 0;
+    int exec = 0;
+    int writable = 0;
+    
+    // Find out all the regions that cover this page
+    for (r = p->vm.head; r; r = r->next) {
+        if (vaddr >= r->start && vaddr < r->end) {
+            count++;
+            only = r;
+            exec |= r->exec;
+            writable |= r->write;
+        }
+    }
+    
+    if (!count || (write && !writable)) {
+        return 0;
+    }
+    
+    // Already populated, either by another thread or shared read-only
+    ulong paddr = hal->get_paddr(p->page_dir_pfn, vaddr);
+    if (paddr) {
+        if (write && share_count_add(ADDR_TO_PFN(paddr), 0)) {
+            *split = 1;
+            paddr = split_cow_page(p, vaddr, paddr, exec);
+        }
+        
+        return paddr;
+    }
+    
+    // Only the URS server has the data of the page
+    if (count == 1 && only->type == vm_region_file && only->file_id) {
+        return 0;
+    }
+    
+    // Map the shared copy read-only, unless the page is about to be written
+    if (count == 1 && can_share(only, vaddr) && !write) {
+        paddr = get_image_page(only, vaddr);
+        
+        int mapped = hal->map_user(
+            p->page_dir_pfn, vaddr, paddr, PAGE_SIZE,
+            exec, 0, 1, 0
+        );
+        assert(mapped);
+        
+        p->vm.resident_count++;
+        p->vm.shared_count++;
+        
+        return paddr;
+    }
+    
+    // Allocate and fill a private page
+    paddr = PFN_TO_ADDR(palloc(1));
+    assert(paddr);
+    fill_page(p, vaddr, paddr);
+    
+    int mapped = hal->map_user(
+        p->page_dir_pfn, vaddr, paddr, PAGE_SIZE,
+        exec, writable, 1, 0
+    );
+    assert(mapped);
+    
+    p->vm.resident_count++;
+    
+//     kprintf("Page fault resolved @ %p -> %p, proc: %s\n", (void *)vaddr, (void *)paddr, p->name);
+    
+    return paddr;
+}
+
+ulong fault_in_user(struct process *p, ulong vaddr)
+{
+    ulong page = ALIGN_DOWN(vaddr, PAGE_SIZE);
+    ulong paddr = hal->get_paddr(p->page_dir_pfn, page);
+    int split = 0;
+    
+    if (!paddr) {
+        spin_lock_int(&p->lock);
+        paddr = do_fault_in(p, page, 0, &split);
+        spin_unlock_int(&p->lock);
+    }
+    
+    if (!paddr) {
+        return 0;
+    }
+    
+    return paddr + (vaddr - page);
+}
+
+
+/*
+ * Dispatch page fault
+ */
+static void cow_shootdown_worker_thread(ulong param)
+{
+    struct kernel_dispatch_info *disp_info = (struct kernel_dispatch_info *)param;
+    struct thread *worker = disp_info->worker;
+    ulong page = ALIGN_DOWN(disp_info->page_fault.addr, PAGE_SIZE);
+    
+    // Other CPUs must drop the read-only translation before the writer resumes
+    trigger_tlb_shootdown(disp_info->proc, page, PAGE_SIZE);
+    run_thread(disp_info->thread);
+    
+    free(disp_info);
+    terminate_thread_self(worker);
+}
+
+int dispatch_page_fault(struct kernel_dispatch_info *disp_info)
+{
+    struct process *p = disp_info->proc;
+    struct thread *t = disp_info->thread;
+    ulong addr = disp_info->page_fault.addr;
+    ulong page = ALIGN_DOWN(addr, PAGE_SIZE);
+    int split = 0;
+    
+    spin_lock_int(&p->lock);
+    
+    p->vm.fault_count++;
+    
+    // Reading the page in has to wait for the URS server, leave it to a worker
+    if (!disp_info->page_fault.write && find_file_region(p, page) && !hal->get_paddr(p->page_dir_pfn, page)) {
+        spin_unlock_int(&p->lock);
+        return page_in_file(disp_info);
+    }
+    
+    ulong paddr = do_fault_in(p, page, disp_info->page_fault.write, &split);
+    
+    spin_unlock_int(&p->lock);
+    
+    if (!paddr) {
+        kprintf("Unable to resolve page fault @ %p, process: %s, write: %d\n",
+                (void *)addr, p->name, disp_info->page_fault.write);
+        terminate_thread(t);
+        return 0;
+    }
+    
+    // The HAL may have cached an invalid or read-only translation for this page
+    hal->invalidate_tlb(p->asid, page, PAGE_SIZE);
+    
+    // Only the shootdown needs to wait for other CPUs, do it in a worker
+    if (split && (p->tlb_cpu_mask & ~(0x1ul << hal->get_cur_cpu_id()))) {
+        struct kernel_dispatch_info *dup_disp_info = malloc(sizeof(struct kernel_dispatch_info));
+        assert(dup_disp_info);
+        memcpy(dup_disp_info, disp_info, sizeof(struct kernel_dispatch_info));
+        
+        int is_in_wait = wait_thread(t);
+        assert(is_in_wait);
+        
+        struct thread *worker = create_thread(kernel_proc, (ulong)&cow_shootdown_worker_thread, (ulong)dup_disp_info, -1, 0, 0);
+        assert(worker);
+        
+        dup_disp_info->worker = worker;
+        run_thread(worker);
+    }
+    
+    return 1;
+}
+
+
+/*
+ * Stats
+ */
+void page_fault_stat_report(struct process *p)
+{
+    struct vm_region *r, *prev;
+    ulong vaddr;
+    ulong reserved = 0;
+    int dup;
+    
+    spin_lock_int(&p->lock);
+    
+    // Count the pages an eager loader would have populated
+    for (r = p->vm.head; r; r = r->next) {
+        for (vaddr = r->start; vaddr < r->end; vaddr += PAGE_SIZE) {
+            dup = 0;
+            for (prev = p->vm.head; prev != r; prev = prev->next) {
+                if (vaddr >= prev->start && vaddr < prev->end) {
+                    dup = 1;
+                    break;
+                }
+            }
+            
+            if (!dup) {
+                reserved++;
+            }
+        }
+    }
+    
+    kprintf("Demand paging of %s: faults %u, resident pages %u (shared %u), COW splits %u, eager pages %u\n",
+            p->name, p->vm.fault_count, p->vm.resident_count, p->vm.shared_count, p->vm.cow_count, reserved);
+    
+    spin_unlock_int(&p->lock);
+}
+
+void image_page_stat_report()
+{
+    kprintf("Shared image pages: %u\n", image_page_count);
+}
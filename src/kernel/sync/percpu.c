@@ -0,0 +1,71 @@
+/*
+ * Per-CPU counters
+ *
+ * Each CPU owns a page of counter slots, a counter is an offset into it.
+ * Writers only touch the slot of the CPU they run on, readers sum up all slots.
+ */
+
+
+#include "common/include/data.h"
+#include "common/include/memory.h"
+#include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/lib.h"
+#include "kernel/include/sync.h"
+
+
+#define PERCPU_COUNTER_SLOTS    (PAGE_SIZE / sizeof(ulong))
+
+
+static volatile ulong **slots;
+static volatile ulong next_offset = 0;
+
+
+void init_percpu_counter()
+{
+    int i;
+    
+    slots = (volatile ulong **)malloc(sizeof(ulong *) * hal->num_cpus);
+    assert(slots);
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        ulong pfn = palloc(1);
+        assert(pfn);
+        
+        slots[i] = (volatile ulong *)PFN_TO_ADDR(pfn);
+        memzero((void *)slots[i], PAGE_SIZE);
+    }
+    
+    kprintf("\tPer-CPU counters initialized, slots: %d\n", (int)PERCPU_COUNTER_SLOTS);
+}
+
+void percpu_counter_create(percpu_counter_t *counter)
+{
+    ulong offset = atomic_xadd(&next_offset, 1);
+    assert(offset < PERCPU_COUNTER_SLOTS);
+    
+    counter->offset = (int)offset;
+}
+
+void percpu_counter_add(percpu_counter_t *counter, ulong value)
+{
+    // The thread may migrate after the CPU ID is read, the slot update is still atomic
+    atomic_add(&slots[hal->get_cur_cpu_id()][counter->offset], value);
+}
+
+void percpu_counter_inc(percpu_counter_t *counter)
+{
+    atomic_inc(&slots[hal->get_cur_cpu_id()][counter->offset]);
+}
+
+ulong percpu_counter_read(percpu_counter_t *counter)
+{
+    int i;
+    ulong sum = 0;
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        sum += slots[i][counter->offset];
+    }
+    
+    return sum;
+}
@@ -0,0 +1,184 @@
+/*
+ * Read-copy-update
+ *
+ * Readers run with local interrupts disabled and never block, so a reader
+ * always starts and finishes on the same CPU. A retired object is reclaimed
+ * once every CPU has been observed outside of a read section since the
+ * object was retired.
+ */
+
+
+#include "common/include/data.h"
+#include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/sync.h"
+
+
+struct rcu_cpu {
+    volatile ulong nesting;
+    volatile ulong quiescent;
+    int int_enabled;
+};
+
+struct rcu_snapshot {
+    ulong quiescent;
+    int busy;
+};
+
+struct rcu_batch {
+    rcu_head_t *head;
+    rcu_head_t *tail;
+};
+
+
+static struct rcu_cpu *cpus;
+static struct rcu_snapshot *snapshot;
+
+static struct rcu_batch pending;
+static struct rcu_batch waiting;
+static volatile int has_retired = 0;
+
+static spinlock_t rcu_lock;
+
+
+void init_rcu()
+{
+    int i;
+    
+    cpus = (struct rcu_cpu *)malloc(sizeof(struct rcu_cpu) * hal->num_cpus);
+    snapshot = (struct rcu_snapshot *)malloc(sizeof(struct rcu_snapshot) * hal->num_cpus);
+    assert(cpus && snapshot);
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        cpus[i].nesting = 0;
+        cpus[i].quiescent = 0;
+        cpus[i].int_enabled = 0;
+    }
+    
+    pending.head = pending.tail = NULL;
+    waiting.head = waiting.tail = NULL;
+    
+    spin_init(&rcu_lock);
+    
+    kprintf("\tRCU initialized for %d CPUs\n", hal->num_cpus);
+}
+
+
+/*
+ * Read side
+ */
+void rcu_read_lock()
+{
+    int enabled = hal->disable_local_interrupt();
+    struct rcu_cpu *cpu = &cpus[hal->get_cur_cpu_id()];
+    
+    if (!cpu->nesting++) {
+        cpu->int_enabled = enabled;
+    }
+    
+    // Make the nesting count visible before any protected pointer is loaded
+    atomic_membar();
+}
+
+void rcu_read_unlock()
+{
+    struct rcu_cpu *cpu = &cpus[hal->get_cur_cpu_id()];
+    
+    assert(cpu->nesting);
+    atomic_membar();
+    
+    if (!--cpu->nesting) {
+        cpu->quiescent++;
+        hal->restore_local_interrupt(cpu->int_enabled);
+    }
+}
+
+
+/*
+ * Reclamation
+ */
+static void snapshot_cpus()
+{
+    int i;
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        snapshot[i].quiescent = cpus[i].quiescent;
+        atomic_readbar();
+        
+        // The CPU is outside of any read section, no need to wait for it
+        snapshot[i].busy = cpus[i].nesting ? 1 : 0;
+    }
+}
+
+static int grace_period_elapsed()
+{
+    int i;
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        if (snapshot[i].busy && cpus[i].quiescent == snapshot[i].quiescent) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+void rcu_reclaim()
+{
+    rcu_head_t *done = NULL;
+    rcu_head_t *next = NULL;
+    
+    if (!has_retired) {
+        return;
+    }
+    
+    spin_lock_int(&rcu_lock);
+    
+    // Detach the waiting batch once all CPUs went through a quiescent state
+    if (waiting.head && grace_period_elapsed()) {
+        done = waiting.head;
+        waiting.head = waiting.tail = NULL;
+    }
+    
+    // Start a new grace period for objects retired in the meantime
+    if (!waiting.head && pending.head) {
+        waiting = pending;
+        pending.head = pending.tail = NULL;
+        
+        atomic_membar();
+        snapshot_cpus();
+    }
+    
+    has_retired = waiting.head ? 1 : 0;
+    
+    spin_unlock_int(&rcu_lock);
+    
+    // Free the objects outside of the lock
+    while (done) {
+        next = done->next;
+        done->func(done->ptr);
+        done = next;
+    }
+}
+
+void rcu_retire(rcu_head_t *head, void *ptr, rcu_callback_t func)
+{
+    head->next = NULL;
+    head->ptr = ptr;
+    head->func = func;
+    
+    spin_lock_int(&rcu_lock);
+    
+    if (pending.tail) {
+        pending.tail->next = head;
+    } else {
+        pending.head = head;
+    }
+    pending.tail = head;
+    
+    has_retired = 1;
+    
+    spin_unlock_int(&rcu_lock);
+    
+    rcu_reclaim();
+}
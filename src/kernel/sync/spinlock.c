@@ -4,58 +4,146 @@
 
 
 #include "common/include/data.h"
+#include "common/include/cycle.h"
 #include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
 #include "kernel/include/sync.h"
 
 
+/*
+ * Lock statistics
+ */
+static lock_stat_t *stat_list = NULL;
+static spinlock_t stat_lock = SPINLOCK_INIT;
+
+static void stat_register(lock_stat_t *stat, char *name)
+{
+    stat->name = name;
+    stat->acquired = 0;
+    stat->contended = 0;
+    stat->spins = 0;
+    stat->max_hold = 0;
+    stat->hold_start = 0;
+    
+    spin_lock_int(&stat_lock);
+    stat->next = stat_list;
+    stat_list = stat;
+    spin_unlock_int(&stat_lock);
+}
+
+static void stat_acquired(lock_stat_t *stat, ulong spins)
+{
+    stat->acquired++;
+    if (spins) {
+        stat->contended++;
+        stat->spins += spins;
+    }
+    
+    stat->hold_start = read_cycles();
+}
+
+static void stat_released(lock_stat_t *stat)
+{
+    ulong hold = (ulong)(read_cycles() - stat->hold_start);
+    if (hold > stat->max_hold) {
+        stat->max_hold = hold;
+    }
+}
+
+void lock_stat_report()
+{
+    lock_stat_t *stat = NULL;
+    
+    if (!LOCK_STAT) {
+        return;
+    }
+    
+    kprintf("Lock statistics\n");
+    
+    for (stat = stat_list; stat; stat = stat->next) {
+        kprintf("\t%s: acquired %u, contended %u, spins %u, max hold %u cycles\n",
+            stat->name, stat->acquired, stat->contended, stat->spins, stat->max_hold
+        );
+    }
+}
+
+
 /*
  * Spin lock
  */
 void spin_init(spinlock_t *lock)
 {
-    lock->value = 0;
+    lock->next = 0;
+    lock->owner = 0;
+    lock->int_enabled = 0;
+    lock->stat = NULL;
 }
 
-void spin_lock(spinlock_t *lock)
+void spin_stat(spinlock_t *lock, lock_stat_t *stat, char *name)
 {
-    do {
-        do {
-        } while (lock->value);
-    } while (!atomic_cas(&lock->value, 0, 1));
+    if (LOCK_STAT) {
+        stat_register(stat, name);
+        lock->stat = stat;
+    }
+}
+
+static void ticket_lock(spinlock_t *lock)
+{
+    ulong ticket, spins = 0;
+    
+    // Take a ticket
+    ticket = atomic_xadd(&lock->next, 1);
+    
+    // Wait for our turn
+    while (lock->owner != ticket) {
+        atomic_pause();
+        spins++;
+    }
+    
+    if (lock->stat) {
+        stat_acquired(lock->stat, spins);
+    }
     
     //kprintf("Locked: %p\n", lock);
 }
 
-void spin_unlock(spinlock_t *lock)
+static void ticket_unlock(spinlock_t *lock)
 {
-    assert(lock->locked);
-    lock->value = 0;
+    assert(lock->next != lock->owner);
+    
+    if (lock->stat) {
+        stat_released(lock->stat);
+    }
+    
+    // Only the holder writes the owner field
+    lock->owner = lock->owner + 1;
     
     //kprintf("Unlocked: %p\n", lock);
 }
 
+void spin_lock(spinlock_t *lock)
+{
+    ticket_lock(lock);
+}
+
+void spin_unlock(spinlock_t *lock)
+{
+    ticket_unlock(lock);
+}
+
 void spin_lock_int(spinlock_t *lock)
 {
     int enabled = hal->disable_local_interrupt();
     
-    do {
-        do {
-        } while (lock->value);
-    } while (!atomic_cas(&lock->value, 0, 1));
-    
-    spinlock_t newlock;
-    newlock.locked = 1;
-    newlock.int_enabled = enabled;
-    
-    assert(atomic_cas(&lock->value, 1, newlock.value));
+    ticket_lock(lock);
+    lock->int_enabled = enabled;
 }
 
 void spin_unlock_int(spinlock_t *lock)
 {
     int enabled = lock->int_enabled;
     
-    assert(lock->locked);
-    lock->value = 0;
+    ticket_unlock(lock);
     
 //     if (enabled) {
 //         kprintf("spin store: %d\n", enabled);
@@ -66,50 +154,247 @@ void spin_unlock_int(spinlock_t *lock)
 
 
 /*
- * Readers-writer lock
+ * MCS lock
  */
-void read_lock(rwlock_t *lock)
+struct mcs_cpu {
+    int depth;
+    struct mcs_node nodes[MCS_MAX_NESTING];
+} cache_aligned;
+
+static struct mcs_cpu *mcs_cpus = NULL;
+
+void init_mcs()
 {
-    rwlock_t old_val, new_val;
+    int i;
+    ulong size = sizeof(struct mcs_cpu) * hal->num_cpus;
+    
+    // Padded nodes outgrow malloc, pages also keep them cache-line aligned
+    ulong pfn = palloc((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    assert(pfn);
+    
+    mcs_cpus = (struct mcs_cpu *)PFN_TO_ADDR(pfn);
+    
+    for (i = 0; i < hal->num_cpus; i++) {
+        mcs_cpus[i].depth = 0;
+    }
     
+    kprintf("\tMCS lock nodes initialized for %d CPUs\n", hal->num_cpus);
+}
+
+void mcs_init(mcslock_t *lock)
+{
+    lock->tail = NULL;
+    lock->holder = NULL;
+    lock->int_enabled = 0;
+    lock->stat = NULL;
+}
+
+void mcs_stat(mcslock_t *lock, lock_stat_t *stat, char *name)
+{
+    if (LOCK_STAT) {
+        stat_register(stat, name);
+        lock->stat = stat;
+    }
+}
+
+void mcs_lock_int(mcslock_t *lock)
+{
+    int enabled = hal->disable_local_interrupt();
+    struct mcs_cpu *cpu = &mcs_cpus[hal->get_cur_cpu_id()];
+    struct mcs_node *node = NULL;
+    struct mcs_node *pred = NULL;
+    ulong spins = 0;
+    
+    assert(cpu->depth < MCS_MAX_NESTING);
+    node = &cpu->nodes[cpu->depth++];
+    node->next = NULL;
+    node->locked = 1;
+    
+    // Enqueue
     do {
-        do {
-        } while (lock->locked);
+        pred = lock->tail;
+    } while (!atomic_cas(&lock->tail, (ulong)pred, (ulong)node));
+    
+    // Spin on our own node until the predecessor hands the lock over
+    if (pred) {
+        pred->next = node;
+        while (node->locked) {
+            atomic_pause();
+            spins++;
+        }
+    }
+    
+    lock->holder = node;
+    lock->int_enabled = enabled;
+    
+    if (lock->stat) {
+        stat_acquired(lock->stat, spins);
+    }
+}
+
+void mcs_unlock_int(mcslock_t *lock)
+{
+    struct mcs_cpu *cpu = &mcs_cpus[hal->get_cur_cpu_id()];
+    struct mcs_node *node = lock->holder;
+    int enabled = lock->int_enabled;
+    
+    // Nodes are reused in stack order
+    assert(cpu->depth && node == &cpu->nodes[cpu->depth - 1]);
+    
+    if (lock->stat) {
+        stat_released(lock->stat);
+    }
+    
+    if (!node->next) {
+        // No successor
+        if (atomic_cas(&lock->tail, (ulong)node, 0)) {
+            cpu->depth--;
+            hal->restore_local_interrupt(enabled);
+            return;
+        }
         
-        old_val.value = lock->value;
-        new_val.locked = 0;
-        new_val.counter = old_val.counter + 1;
-    } while(!atomic_cas(&lock->value, old_val.value, new_val.value));
+        // A successor is linking itself in
+        while (!node->next) {
+            atomic_pause();
+        }
+    }
+    
+    node->next->locked = 0;
+    
+    cpu->depth--;
+    hal->restore_local_interrupt(enabled);
 }
 
-void write_lock(rwlock_t *lock)
+
+/*
+ * Readers-writer lock
+ */
+void rwlock_init(rwlock_t *lock)
+{
+    lock->value = 0;
+    lock->writers = 0;
+    lock->int_enabled = 0;
+}
+
+void read_lock(rwlock_t *lock)
 {
-    rwlock_t new_val;
+    ulong old_val;
     
     do {
-        do {
-        } while (lock->value);
+        // Waiting writers go first
+        while (lock->writers || (lock->value & RWLOCK_WRITER)) {
+            atomic_pause();
+        }
         
-        new_val.locked = 1;
-        new_val.counter = 0;
-    } while(!atomic_cas(&lock->value, 0, new_val.value));
+        old_val = lock->value & ~RWLOCK_WRITER;
+    } while (!atomic_cas(&lock->value, old_val, old_val + RWLOCK_READER));
 }
 
 void read_unlock(rwlock_t *lock)
 {
-    rwlock_t old_val, new_val;
+    ulong old_val;
     
     do {
-        do {
-        } while (lock->locked);
-        
-        old_val.value = lock->value;
-        new_val.locked = 0;
-        new_val.counter = old_val.counter - 1;
-    } while(!atomic_cas(&lock->value, old_val.value, new_val.value));
+        old_val = lock->value;
+        assert(old_val >= RWLOCK_READER);
+    } while (!atomic_cas(&lock->value, old_val, old_val - RWLOCK_READER));
+}
+
+void write_lock(rwlock_t *lock)
+{
+    // Announce the writer so that new readers back off
+    atomic_inc(&lock->writers);
+    
+    // Wait for the readers to drain
+    do {
+        while (lock->value) {
+            atomic_pause();
+        }
+    } while (!atomic_cas(&lock->value, 0, RWLOCK_WRITER));
+    
+    atomic_dec(&lock->writers);
 }
 
 void write_unlock(rwlock_t *lock)
 {
+    assert(lock->value == RWLOCK_WRITER);
     lock->value = 0;
 }
+
+int read_lock_int(rwlock_t *lock)
+{
+    int enabled = hal->disable_local_interrupt();
+    
+    read_lock(lock);
+    return enabled;
+}
+
+void read_unlock_int(rwlock_t *lock, int enabled)
+{
+    read_unlock(lock);
+    hal->restore_local_interrupt(enabled);
+}
+
+void write_lock_int(rwlock_t *lock)
+{
+    int enabled = hal->disable_local_interrupt();
+    
+    write_lock(lock);
+    lock->int_enabled = enabled;
+}
+
+void write_unlock_int(rwlock_t *lock)
+{
+    int enabled = lock->int_enabled;
+    
+    write_unlock(lock);
+    hal->restore_local_interrupt(enabled);
+}
+
+
+/*
+ * Sequence lock
+ */
+void seq_init(seqlock_t *lock)
+{
+    lock->seq = 0;
+    spin_init(&lock->lock);
+}
+
+ulong seq_read_begin(seqlock_t *lock)
+{
+    ulong seq;
+    
+    // An odd sequence means a writer is in progress
+    do {
+        seq = lock->seq;
+        if (seq & 0x1) {
+            atomic_pause();
+        }
+    } while (seq & 0x1);
+    
+    atomic_readbar();
+    return seq;
+}
+
+int seq_read_retry(seqlock_t *lock, ulong seq)
+{
+    atomic_readbar();
+    return lock->seq != seq;
+}
+
+void seq_write_lock(seqlock_t *lock)
+{
+    spin_lock_int(&lock->lock);
+    
+    lock->seq++;
+    atomic_writebar();
+}
+
+void seq_write_unlock(seqlock_t *lock)
+{
+    atomic_writebar();
+    lock->seq++;
+    
+    spin_unlock_int(&lock->lock);
+}
@@ -2,6 +2,7 @@
  * Kernel interrupt handler
  */
 #include "common/include/kdisp.h"
+#include "common/include/cycle.h"
 #include "kernel/include/hal.h"
 #include "kernel/include/proc.h"
 #include "kernel/include/mem.h"
@@ -11,9 +12,36 @@
 #include "kernel/include/syscall.h"
 
 
+/*
+ * Interrupts that arrive while a persistent handler thread is busy are queued,
+ * once the queue is full they are merged into the most recent entry
+ */
+#define INT_HDLR_QUEUE_SIZE     8
+
+struct int_payload {
+    unsigned long vector;
+    unsigned long param0;
+    unsigned long param1;
+    unsigned long param2;
+    
+    unsigned long count;
+    u64 stamp;
+};
+
 struct int_hdlr_record {
     struct process *process;
     unsigned long handler_entry;
+    unsigned long notif_id;
+    
+    // Persistent handler thread
+    int persistent;
+    struct thread *waiter;
+    int queue_head;
+    int queue_count;
+    struct int_payload queue[INT_HDLR_QUEUE_SIZE];
+    spinlock_t lock;
+    
+    rcu_head_t rcu;
 };
 
 
@@ -43,6 +71,8 @@ void reg_interrupt(struct process *p, unsigned long irq, unsigned long thread_en
     struct int_hdlr_record *record = (struct int_hdlr_record *)salloc(interrupt_handler_record_salloc_id);
     record->process = p;
     record->handler_entry = thread_entry;
+    record->notif_id = 0;
+    record->persistent = 0;
     
     // Register the msg handler
     hashtable_insert(&interrupt_handlers, irq, record);
@@ -50,18 +80,205 @@ void reg_interrupt(struct process *p, unsigned long irq, unsigned long thread_en
     kprintf("Interrupt handler registered, IRQ: %x, process: %s\n", irq, p->name);
 }
 
+int reg_interrupt_notif(struct process *p, unsigned long irq, unsigned long notif_id)
+{
+    // Allocate a record
+    struct int_hdlr_record *record = (struct int_hdlr_record *)salloc(interrupt_handler_record_salloc_id);
+    if (!record) {
+        return 0;
+    }
+    
+    record->process = p;
+    record->handler_entry = 0;
+    record->notif_id = notif_id;
+    record->persistent = 0;
+    
+    // Register the notification, the IRQ may already be taken
+    if (!hashtable_insert(&interrupt_handlers, irq, record)) {
+        sfree(record);
+        return 0;
+    }
+    
+    kprintf("Interrupt notification registered, IRQ: %x, process: %s\n", irq, p->name);
+    return 1;
+}
+
+void unreg_interrupt_notif(unsigned long irq, unsigned long notif_id)
+{
+    struct int_hdlr_record *handler = (struct int_hdlr_record *)hashtable_obtain(&interrupt_handlers, irq);
+    if (!handler) {
+        return;
+    }
+    
+    // The IRQ may have been bound to something else since
+    if (handler->notif_id != notif_id || !hashtable_remove(&interrupt_handlers, irq)) {
+        hashtable_release(&interrupt_handlers, irq, handler);
+        return;
+    }
+    
+    hashtable_release(&interrupt_handlers, irq, handler);
+    
+    // Interrupt workers may still be reading the record
+    rcu_retire(&handler->rcu, handler, sfree);
+}
+
+int reg_interrupt_thread(struct process *p, unsigned long irq)
+{
+    // Allocate a record
+    struct int_hdlr_record *record = (struct int_hdlr_record *)salloc(interrupt_handler_record_salloc_id);
+    if (!record) {
+        return 0;
+    }
+    
+    record->process = p;
+    record->handler_entry = 0;
+    record->notif_id = 0;
+    
+    // No thread is waiting until the handler thread calls int_wait
+    record->persistent = 1;
+    record->waiter = NULL;
+    record->queue_head = 0;
+    record->queue_count = 0;
+    spin_init(&record->lock);
+    
+    // Register the record, the IRQ may already be taken
+    if (!hashtable_insert(&interrupt_handlers, irq, record)) {
+        sfree(record);
+        return 0;
+    }
+    
+    kprintf("Interrupt thread registered, IRQ: %x, process: %s\n", irq, p->name);
+    return 1;
+}
+
 void unreg_interrupt(struct process *p, unsigned long irq)
 {
     struct int_hdlr_record *handler = (struct int_hdlr_record *)hashtable_obtain(&interrupt_handlers, irq);
     if (!handler) {
         return;
     }
+    
+    // Only the owner may unregister, and the IRQ may have been bound to something else since
+    if (handler->process != p || !hashtable_remove(&interrupt_handlers, irq)) {
+        hashtable_release(&interrupt_handlers, irq, handler);
+        return;
+    }
+    
     hashtable_release(&interrupt_handlers, irq, handler);
     
-    // Unregister the msg handler
-    hashtable_remove(&interrupt_handlers, irq);
+    // Release the persistent handler thread with nothing delivered
+    if (handler->persistent) {
+        struct thread *waiter = NULL;
+        
+        spin_lock_int(&handler->lock);
+        waiter = handler->waiter;
+        handler->waiter = NULL;
+        spin_unlock_int(&handler->lock);
+        
+        if (waiter) {
+            set_syscall_return(waiter, 0, 0);
+            run_thread(waiter);
+        }
+    }
+    
+    // Interrupt workers may still be reading the record
+    rcu_retire(&handler->rcu, handler, sfree);
+}
+
+
+/*
+ * Persistent handler thread
+ */
+static void deliver_interrupt(struct int_hdlr_record *record, unsigned long irq, struct thread *t)
+{
+    struct int_payload *payload = &record->queue[record->queue_head];
+    msg_t *m = create_response_msg(t);
+    
+    set_msg_param_value(m, irq);
+    set_msg_param_value(m, payload->vector);
+    set_msg_param_value(m, payload->param0);
+    set_msg_param_value(m, payload->param1);
+    set_msg_param_value(m, payload->param2);
+    set_msg_param_value(m, payload->count);
+    set_msg_param_value64(m, payload->stamp);
+    
+    record->queue_head = (record->queue_head + 1) % INT_HDLR_QUEUE_SIZE;
+    record->queue_count--;
+    
+    set_syscall_return(t, 1, 0);
+}
+
+static void queue_interrupt(struct int_hdlr_record *record, struct kernel_dispatch_info *disp_info)
+{
+    struct int_payload *payload = NULL;
+    struct thread *waiter = NULL;
+    
+    spin_lock_int(&record->lock);
+    
+    if (record->queue_count < INT_HDLR_QUEUE_SIZE) {
+        payload = &record->queue[(record->queue_head + record->queue_count) % INT_HDLR_QUEUE_SIZE];
+        payload->count = 0;
+        payload->stamp = read_cycles();
+        record->queue_count++;
+    } else {
+        // Coalesce into the newest entry, the stamp of the first interrupt is kept
+        payload = &record->queue[(record->queue_head + record->queue_count - 1) % INT_HDLR_QUEUE_SIZE];
+    }
+    
+    payload->vector = disp_info->interrupt.vector;
+    payload->param0 = disp_info->interrupt.param0;
+    payload->param1 = disp_info->interrupt.param1;
+    payload->param2 = disp_info->interrupt.param2;
+    payload->count++;
+    
+    // Hand the interrupt to the handler thread if it is waiting
+    if (record->waiter) {
+        waiter = record->waiter;
+        record->waiter = NULL;
+        deliver_interrupt(record, disp_info->interrupt.irq, waiter);
+    }
+    
+    spin_unlock_int(&record->lock);
     
-    sfree(handler);
+    if (waiter) {
+        run_thread(waiter);
+    }
+}
+
+void int_bind_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong irq = disp_info->syscall.param0;
+    
+    set_syscall_return(disp_info->thread, reg_interrupt_thread(disp_info->proc, irq), 0);
+}
+
+int int_wait_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong irq = disp_info->syscall.param0;
+    int blocked = 0;
+    
+    struct int_hdlr_record *record = (struct int_hdlr_record *)hashtable_obtain(&interrupt_handlers, irq);
+    if (!record) {
+        return 0;
+    }
+    
+    if (record->persistent && record->process == disp_info->proc) {
+        spin_lock_int(&record->lock);
+        
+        if (record->queue_count) {
+            deliver_interrupt(record, irq, disp_info->thread);
+        } else if (!record->waiter) {
+            wait_thread(disp_info->thread);
+            record->waiter = disp_info->thread;
+            blocked = 1;
+        }
+        
+        spin_unlock_int(&record->lock);
+    }
+    
+    hashtable_release(&interrupt_handlers, irq, record);
+    
+    return blocked;
 }
 
 
@@ -70,43 +287,59 @@ void unreg_interrupt(struct process *p, unsigned long irq)
  */
 void interrupt_worker(struct kernel_dispatch_info *disp_info)
 {
+    struct process *p = NULL;
+    unsigned long entry = 0;
+    unsigned long notif_id = 0;
+    
     // Get the handler
     struct int_hdlr_record *handler = (struct int_hdlr_record *)hashtable_obtain(&interrupt_handlers, disp_info->interrupt.irq);
     
 //     kprintf("IRQ: %d, handler: %p\n", disp_info->interrupt.irq, handler);
     
-    // Create a new handler thread
-    if (handler) {
-        struct thread *t;
-        msg_t *m;
-        
-        assert(handler->process);
-        assert(handler->handler_entry);
-        
-        //kprintf("Thread created, proc: %s, entry: %p\n", handler->process->name, handler->handler_entry);
-        
-        t = create_thread(handler->process, handler->handler_entry, 0, -1, 0, 0);
-        set_thread_arg(t, t->memory.block_base + t->memory.msg_recv_offset);
-        
-        // Setup a message
-        m = create_response_msg(t); //(msg_t *)t->memory.msg_recv_paddr;
-//         m->func_num = 0;
-//         m->mailbox_id = 0;
-//         m->msg_size = sizeof(msg_t);
-//         m->opcode = 0;
-//         m->param_count = 0;
-        
-        set_msg_param_value(m, disp_info->interrupt.irq);
-        set_msg_param_value(m, disp_info->interrupt.vector);
-        set_msg_param_value(m, disp_info->interrupt.param0);
-        set_msg_param_value(m, disp_info->interrupt.param1);
-        set_msg_param_value(m, disp_info->interrupt.param2);
-        
-        // Run the thread
-        run_thread(t);
+    if (!handler) {
+        return;
     }
     
-    if (handler) {
+    // Persistent handler thread, queue the interrupt without creating a thread
+    if (handler->persistent) {
+        queue_interrupt(handler, disp_info);
         hashtable_release(&interrupt_handlers, disp_info->interrupt.irq, handler);
+        return;
     }
+    
+    // Copy out the record so that the read section stays short
+    p = handler->process;
+    entry = handler->handler_entry;
+    notif_id = handler->notif_id;
+    hashtable_release(&interrupt_handlers, disp_info->interrupt.irq, handler);
+    
+    // Bound to a notification, simply set the IRQ's bit
+    if (notif_id) {
+        signal_notif(notif_id, NOTIF_IRQ_BIT(disp_info->interrupt.irq));
+        return;
+    }
+    
+    // Create a new handler thread
+    struct thread *t;
+    msg_t *m;
+    
+    assert(p);
+    assert(entry);
+    
+    //kprintf("Thread created, proc: %s, entry: %p\n", p->name, entry);
+    
+    t = create_thread(p, entry, 0, -1, 0, 0);
+    set_thread_arg(t, t->memory.block_base + t->memory.msg_recv_offset);
+    
+    // Setup a message
+    m = create_response_msg(t);
+    
+    set_msg_param_value(m, disp_info->interrupt.irq);
+    set_msg_param_value(m, disp_info->interrupt.vector);
+    set_msg_param_value(m, disp_info->interrupt.param0);
+    set_msg_param_value(m, disp_info->interrupt.param1);
+    set_msg_param_value(m, disp_info->interrupt.param2);
+    
+    // Run the thread
+    run_thread(t);
 }
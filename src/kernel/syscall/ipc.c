@@ -110,12 +110,20 @@ static struct process *get_process_by_mailbox_id(struct process *src_p,
             p = src_p;
             break;
         default:
+            // Mailbox IDs come from user space, make sure it names a live process
             if (mailbox_id) {
-                p = (struct process *)mailbox_id;
+                p = find_process(mailbox_id);
             }
+            
+            // Already held by find_process
+            return p;
         }
     }
     
+    if (p) {
+        hold_process(p);
+    }
+    
     return p;
 }
 
@@ -198,14 +206,15 @@ static void transfer_msg(msg_t *s, int sender_blocked, struct process *src_p, st
 //     kprintf("Msg duplicated!\n");
     
     // Transfer the msg
-    if (hashtable_contains(&dest_p->msg_handlers, s->func_num)) {
-//         kprintf("To create thread!\n");
+    void *entry_point = hashtable_obtain(&dest_p->msg_handlers, s->func_num);
+    if (entry_point) {
+        // The entry is a plain value, no need to hold the read section while creating the thread
+        hashtable_release(&dest_p->msg_handlers, s->func_num, entry_point);
         
-        // Create a new thread to handle the msg
-        void *entry_point = hashtable_obtain(&dest_p->msg_handlers, s->func_num);
 //         kprintf("entry point: %p\n", entry_point);
+        
+        // Create a new thread to handle the msg
         struct thread *t = create_thread(dest_p, (ulong)entry_point, 0, -1, PAGE_SIZE, PAGE_SIZE);
-        hashtable_release(&dest_p->msg_handlers, s->func_num, entry_point);
         
 //         kprintf("To create thread!\n");
         
@@ -241,6 +250,8 @@ static void transfer_msg(msg_t *s, int sender_blocked, struct process *src_p, st
         
         kprintf("Pushed to msg queue!\n");
     }
+    
+    release_process(dest_p);
 }
 
 void send_worker(struct kernel_dispatch_info *disp_info)
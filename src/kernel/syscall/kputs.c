@@ -30,7 +30,12 @@ void kputs_worker_thread(ulong param)
     
     // Copy to buffer
     do {
-        paddr = hal->get_paddr(p->page_dir_pfn, vaddr);
+        // The string may live in a page the process hasn't touched yet
+        paddr = fault_in_user(p, vaddr);
+        if (!paddr) {
+            break;
+        }
+        
         char *c = (char *)paddr;
         
         if (*c) {
@@ -0,0 +1,309 @@
+/*
+ * System call workers - Notification
+ *
+ * A notification is a word of pending bits with at most one waiter.
+ * Signaling ORs bits into the word and wakes up the waiter if there is one,
+ * no message or thread is allocated on the way.
+ *
+ * IDs are never reused, so a signaler holding the ID of a destroyed
+ * notification finds nothing rather than whatever took its memory.
+ */
+#include "common/include/kdisp.h"
+#include "common/include/atomic.h"
+#include "kernel/include/hal.h"
+#include "kernel/include/mem.h"
+#include "kernel/include/proc.h"
+#include "kernel/include/sync.h"
+#include "kernel/include/ds.h"
+#include "kernel/include/syscall.h"
+
+
+#define NOTIF_MAX_IRQS  4
+
+struct notification {
+    // All notifications, for teardown when the owner exits
+    struct notification *prev;
+    struct notification *next;
+    
+    ulong notif_id;
+    struct process *owner;
+    
+    volatile ulong bits;
+    struct thread *waiter;
+    
+    // IRQs bound to this notification, no more once dead
+    int dead;
+    int irq_count;
+    ulong irqs[NOTIF_MAX_IRQS];
+    
+    spinlock_t lock;
+    rcu_head_t rcu;
+};
+
+
+static int notif_salloc_id;
+static hashtable_t notifications;
+static volatile ulong next_notif_id = 1;
+
+static struct notification *notif_list = NULL;
+static spinlock_t notif_list_lock = SPINLOCK_INIT;
+
+
+/*
+ * Initialize
+ */
+void init_notif()
+{
+    notif_salloc_id = salloc_create(sizeof(struct notification), 0, 0, NULL, NULL);
+    hashtable_create(&notifications, 0, NULL, NULL);
+    
+    kprintf("\tNotification salloc ID: %d\n", notif_salloc_id);
+}
+
+
+/*
+ * Signal
+ */
+static void do_signal(struct notification *n, ulong bits)
+{
+    struct thread *waiter = NULL;
+    
+    spin_lock_int(&n->lock);
+    
+    n->bits |= bits;
+    if (n->waiter) {
+        waiter = n->waiter;
+        n->waiter = NULL;
+        
+        set_syscall_return(waiter, n->bits, 0);
+        n->bits = 0;
+    }
+    
+    spin_unlock_int(&n->lock);
+    
+    if (waiter) {
+        run_thread(waiter);
+    }
+}
+
+int signal_notif(ulong notif_id, ulong bits)
+{
+    struct notification *n = (struct notification *)hashtable_obtain(&notifications, notif_id);
+    if (!n) {
+        return 0;
+    }
+    
+    do_signal(n, bits);
+    hashtable_release(&notifications, notif_id, n);
+    
+    return 1;
+}
+
+
+/*
+ * Workers
+ */
+void notif_create_worker(struct kernel_dispatch_info *disp_info)
+{
+    struct notification *n = (struct notification *)salloc(notif_salloc_id);
+    if (!n) {
+        return;
+    }
+    
+    n->notif_id = atomic_xadd(&next_notif_id, 1);
+    n->owner = disp_info->proc;
+    n->bits = 0;
+    n->waiter = NULL;
+    n->dead = 0;
+    n->irq_count = 0;
+    spin_init(&n->lock);
+    
+    if (!hashtable_insert(&notifications, n->notif_id, n)) {
+        sfree(n);
+        return;
+    }
+    
+    spin_lock_int(&notif_list_lock);
+    n->prev = NULL;
+    n->next = notif_list;
+    if (notif_list) {
+        notif_list->prev = n;
+    }
+    notif_list = n;
+    spin_unlock_int(&notif_list_lock);
+    
+    set_syscall_return(disp_info->thread, n->notif_id, 0);
+}
+
+static int destroy_notif(struct process *p, ulong notif_id)
+{
+    struct thread *waiter = NULL;
+    int i;
+    
+    struct notification *n = (struct notification *)hashtable_obtain(&notifications, notif_id);
+    if (!n) {
+        return 0;
+    }
+    
+    if (n->owner != p || !hashtable_remove(&notifications, notif_id)) {
+        hashtable_release(&notifications, notif_id, n);
+        return 0;
+    }
+    
+    // Release the waiter with no bits set
+    spin_lock_int(&n->lock);
+    waiter = n->waiter;
+    n->waiter = NULL;
+    n->dead = 1;
+    spin_unlock_int(&n->lock);
+    
+    hashtable_release(&notifications, notif_id, n);
+    
+    if (waiter) {
+        set_syscall_return(waiter, 0, 0);
+        run_thread(waiter);
+    }
+    
+    // No more binds once dead, the IRQs can be let go
+    for (i = 0; i < n->irq_count; i++) {
+        unreg_interrupt_notif(n->irqs[i], notif_id);
+    }
+    
+    spin_lock_int(&notif_list_lock);
+    if (n->prev) {
+        n->prev->next = n->next;
+    } else {
+        notif_list = n->next;
+    }
+    if (n->next) {
+        n->next->prev = n->prev;
+    }
+    spin_unlock_int(&notif_list_lock);
+    
+    // Signalers may still be holding the object
+    rcu_retire(&n->rcu, n, sfree);
+    
+    return 1;
+}
+
+void destroy_process_notifs(struct process *p)
+{
+    struct notification *n = NULL;
+    ulong notif_id = 0;
+    
+    do {
+        notif_id = 0;
+        
+        spin_lock_int(&notif_list_lock);
+        for (n = notif_list; n; n = n->next) {
+            if (n->owner == p) {
+                notif_id = n->notif_id;
+                break;
+            }
+        }
+        spin_unlock_int(&notif_list_lock);
+        
+        if (notif_id) {
+            destroy_notif(p, notif_id);
+        }
+    } while (notif_id);
+}
+
+void notif_destroy_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong notif_id = disp_info->syscall.param0;
+    
+    if (destroy_notif(disp_info->proc, notif_id)) {
+        set_syscall_return(disp_info->thread, 1, 0);
+    }
+}
+
+void notif_signal_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong notif_id = disp_info->syscall.param0;
+    ulong bits = disp_info->syscall.param1;
+    
+    set_syscall_return(disp_info->thread, signal_notif(notif_id, bits), 0);
+}
+
+int notif_wait_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong notif_id = disp_info->syscall.param0;
+    int blocked = 0;
+    
+    struct notification *n = (struct notification *)hashtable_obtain(&notifications, notif_id);
+    if (!n) {
+        return 0;
+    }
+    
+    spin_lock_int(&n->lock);
+    
+    // Only the owner may wait, and only one thread at a time
+    if (n->owner == disp_info->proc && !n->waiter) {
+        if (n->bits) {
+            set_syscall_return(disp_info->thread, n->bits, 0);
+            n->bits = 0;
+        } else {
+            wait_thread(disp_info->thread);
+            n->waiter = disp_info->thread;
+            blocked = 1;
+        }
+    }
+    
+    spin_unlock_int(&n->lock);
+    
+    hashtable_release(&notifications, notif_id, n);
+    
+    return blocked;
+}
+
+void notif_poll_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong notif_id = disp_info->syscall.param0;
+    
+    struct notification *n = (struct notification *)hashtable_obtain(&notifications, notif_id);
+    if (!n) {
+        return;
+    }
+    
+    spin_lock_int(&n->lock);
+    
+    if (n->owner == disp_info->proc) {
+        set_syscall_return(disp_info->thread, n->bits, 0);
+        n->bits = 0;
+    }
+    
+    spin_unlock_int(&n->lock);
+    
+    hashtable_release(&notifications, notif_id, n);
+}
+
+void notif_bind_irq_worker(struct kernel_dispatch_info *disp_info)
+{
+    ulong notif_id = disp_info->syscall.param0;
+    ulong irq = disp_info->syscall.param1;
+    int bound = 0;
+    
+    struct notification *n = (struct notification *)hashtable_obtain(&notifications, notif_id);
+    if (!n) {
+        return;
+    }
+    
+    // Destroy waits for the lock, so a binding made here is always let go
+    spin_lock_int(&n->lock);
+    
+    if (n->owner == disp_info->proc && !n->dead && n->irq_count < NOTIF_MAX_IRQS) {
+        bound = reg_interrupt_notif(disp_info->proc, irq, notif_id);
+        if (bound) {
+            n->irqs[n->irq_count++] = irq;
+        }
+    }
+    
+    spin_unlock_int(&n->lock);
+    
+    hashtable_release(&notifications, notif_id, n);
+    
+    if (bound) {
+        set_syscall_return(disp_info->thread, 1, 0);
+    }
+}
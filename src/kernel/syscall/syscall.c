@@ -15,6 +15,9 @@
 
 static int kernel_dispatch_salloc_id;
 
+static percpu_counter_t syscall_count;
+static percpu_counter_t interrupt_count;
+
 
 /*
  * Init
@@ -23,6 +26,16 @@ void init_dispatch()
 {
     kernel_dispatch_salloc_id = salloc_create(sizeof(struct kernel_dispatch_info), 0, 0, NULL, NULL);
     kprintf("\tKernel dispatch node salloc ID: %d\n", kernel_dispatch_salloc_id);
+    
+    percpu_counter_create(&syscall_count);
+    percpu_counter_create(&interrupt_count);
+}
+
+void dispatch_stat_report()
+{
+    kprintf("Dispatch statistics: syscalls %u, interrupts %u\n",
+        percpu_counter_read(&syscall_count), percpu_counter_read(&interrupt_count)
+    );
 }
 
 
@@ -58,6 +71,8 @@ int dispatch_syscall(struct kernel_dispatch_info *disp_info)
     struct thread *t = NULL;
     struct kernel_dispatch_info *dup_disp_info = NULL;
     
+    percpu_counter_inc(&syscall_count);
+    
     // First clear the return values
     set_syscall_return(disp_info->thread, 0, 0);
     
@@ -125,6 +140,34 @@ int dispatch_syscall(struct kernel_dispatch_info *disp_info)
         unreg_kapi_server_worker(disp_info);
         break;
     
+    // Notification
+    case SYSCALL_NOTIF_CREATE:
+        notif_create_worker(disp_info);
+        break;
+    case SYSCALL_NOTIF_DESTROY:
+        notif_destroy_worker(disp_info);
+        break;
+    case SYSCALL_NOTIF_SIGNAL:
+        notif_signal_worker(disp_info);
+        break;
+    case SYSCALL_NOTIF_WAIT:
+        resched = notif_wait_worker(disp_info);
+        break;
+    case SYSCALL_NOTIF_POLL:
+        notif_poll_worker(disp_info);
+        break;
+    case SYSCALL_NOTIF_BIND_IRQ:
+        notif_bind_irq_worker(disp_info);
+        break;
+        
+    // Interrupt
+    case SYSCALL_INT_BIND:
+        int_bind_worker(disp_info);
+        break;
+    case SYSCALL_INT_WAIT:
+        resched = int_wait_worker(disp_info);
+        break;
+        
     // Invalid syscall
     default:
         break;
@@ -146,6 +189,8 @@ int dispatch_syscall(struct kernel_dispatch_info *disp_info)
  */
 int dispatch_interrupt(struct kernel_dispatch_info *disp_info)
 {
+    percpu_counter_inc(&interrupt_count);
+    
     // Do the actual dispatch
     interrupt_worker(disp_info);
     
@@ -0,0 +1,76 @@
+#ifndef __KLIBC_INCLUDE_AIO__
+#define __KLIBC_INCLUDE_AIO__
+
+
+#include "common/include/data.h"
+#include "common/include/urs.h"
+#include "klibc/include/kthread.h"
+
+
+/*
+ * Async URS
+ */
+#define URS_RING_MAX_DEPTH      64
+#define URS_ASYNC_DATA_MAX      2048
+
+struct urs_sqe {
+    enum urs_op_type op;
+    unsigned long user_data;
+    
+    unsigned long fd;
+    void *buf;
+    unsigned long count;
+    
+    // Open only
+    char *path;
+    unsigned int flags;
+};
+
+struct urs_cqe {
+    unsigned long user_data;
+    int result;
+    
+    // Bytes transferred, or the fd for open
+    unsigned long actual;
+};
+
+struct urs_ring {
+    unsigned long depth;
+    unsigned long msg_num;
+    unsigned long notif_id;
+    
+    // Submitted, in flight and not yet reaped entries
+    unsigned long outstanding;
+    
+    // Entries stay in their slot until they complete
+    struct urs_sqe slots[URS_RING_MAX_DEPTH];
+    unsigned char free_slots[URS_RING_MAX_DEPTH];
+    unsigned long free_count;
+    
+    // Prepared but not submitted slots
+    unsigned char sq[URS_RING_MAX_DEPTH];
+    unsigned long sq_count;
+    
+    struct urs_cqe cq[URS_RING_MAX_DEPTH];
+    unsigned long cq_head;
+    unsigned long cq_count;
+    
+    kthread_mutex_t lock;
+};
+
+
+extern int urs_ring_init(struct urs_ring *ring, unsigned long depth);
+extern void urs_ring_destroy(struct urs_ring *ring);
+
+extern struct urs_sqe *urs_ring_get_sqe(struct urs_ring *ring);
+extern void urs_prep_open(struct urs_sqe *sqe, char *path, unsigned int flags, unsigned long user_data);
+extern void urs_prep_read(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data);
+extern void urs_prep_write(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data);
+extern void urs_prep_list(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data);
+extern void urs_prep_stat(struct urs_sqe *sqe, unsigned long fd, struct urs_stat *stat, unsigned long user_data);
+
+extern int urs_ring_submit(struct urs_ring *ring);
+extern int urs_ring_reap(struct urs_ring *ring, struct urs_cqe *cqes, int max, int wait);
+
+
+#endif
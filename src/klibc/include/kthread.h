@@ -53,4 +53,22 @@ extern int kthread_mutex_trylock(kthread_mutex_t *mutex);
 extern int kthread_mutex_unlock(kthread_mutex_t *mutex);
 
 
+/*
+ * Reader-writer lock
+ */
+#define KTHREAD_RWLOCK_INIT { 0 }
+
+typedef struct kthread_rwlock {
+    volatile unsigned long value;
+} kthread_rwlock_t;
+
+extern void kthread_rwlock_init(kthread_rwlock_t *rwlock);
+extern void kthread_rwlock_destroy(kthread_rwlock_t *rwlock);
+
+extern void kthread_rwlock_rdlock(kthread_rwlock_t *rwlock);
+extern void kthread_rwlock_wrlock(kthread_rwlock_t *rwlock);
+extern void kthread_rwlock_rdunlock(kthread_rwlock_t *rwlock);
+extern void kthread_rwlock_wrunlock(kthread_rwlock_t *rwlock);
+
+
 #endif
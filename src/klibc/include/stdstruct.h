@@ -50,9 +50,15 @@ typedef struct hash_bucket {
 } hash_bucket_t;
 
 typedef struct hash {
+    // Buckets are kept in chunks, the array is a directory of them
     unsigned int bucket_count;
     unsigned int node_count;
-    hash_bucket_t *buckets;
+    hash_bucket_t **buckets;
+    
+    // Incremental resizing, old buckets are drained one by one on each update
+    unsigned int old_bucket_count;
+    unsigned int rehash_index;
+    hash_bucket_t **old_buckets;
     
     hash_func_t hash_func;
     hash_cmp_t hash_cmp;
@@ -68,6 +74,7 @@ extern void *hash_obtain_at(hash_t *l, unsigned long index);
 extern void hash_release(hash_t *l, void *key, void *value);
 extern int hash_insert(hash_t *l, void *key, void *value);
 extern int hash_remove(hash_t *l, void *key);
+extern void test_hash();
 
 
 #endif
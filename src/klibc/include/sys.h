@@ -53,6 +53,13 @@ extern int syscall_unreg_msg_handler(unsigned long msg_num);
 extern int syscall_reg_kapi_server(unsigned long kapi_num);
 extern int syscall_unreg_kapi_server(unsigned long kapi_num);
 
+extern unsigned long syscall_notif_create();
+extern int syscall_notif_destroy(unsigned long notif_id);
+extern int syscall_notif_signal(unsigned long notif_id, unsigned long bits);
+extern unsigned long syscall_notif_wait(unsigned long notif_id);
+extern unsigned long syscall_notif_poll(unsigned long notif_id);
+extern int syscall_notif_bind_irq(unsigned long notif_id, unsigned long irq);
+
 /*
  * User message
  */
@@ -78,6 +85,7 @@ extern void kapi_process_exit(int err_code);
 extern int kpai_process_kill(unsigned long process_id);
 extern void kapi_process_started(unsigned long code);
 extern unsigned long kapi_process_id();
+extern unsigned long kapi_kernel_proc_id();
 extern int kapi_process_monitor(enum proc_monitor_type type, unsigned long func_num, unsigned long opcode);
 
 /*
@@ -96,17 +104,20 @@ extern int kapi_urs_reg_op(unsigned long super_id, enum urs_op_type op, unsigned
 
 extern unsigned long kapi_urs_open(char *name, unsigned int flags);
 extern int kapi_urs_close(unsigned long fd);
+extern unsigned long kapi_urs_dup(unsigned long fd);
 
 extern size_t kapi_urs_read(unsigned long fd, void *buf, size_t count);
 extern size_t kapi_urs_write(unsigned long fd, void *buf, size_t count);
 
 extern size_t kapi_urs_list(unsigned long fd, void *buf, size_t count);
+extern int kapi_urs_list_batch(unsigned long fd, void *buf, size_t count, unsigned int flags, size_t *actual);
 
 extern int kapi_urs_create(unsigned long fd, char *name, enum urs_create_type type, unsigned int flags, char *target);
 extern int kapi_urs_remove(unsigned long fd, int erase);
 extern int kapi_urs_rename(unsigned long fd, char *name);
 
 extern int kapi_urs_stat(unsigned long fd, struct urs_stat *stat);
+extern int kapi_urs_dcache_stat(struct urs_dcache_stat *stat);
 
 /*
  * Interrupt
@@ -114,6 +125,20 @@ extern int kapi_urs_stat(unsigned long fd, struct urs_stat *stat);
 extern int kapi_interrupt_reg(unsigned long irq, void *handler_entry);
 extern int kapi_interrupt_unreg(unsigned long irq);
 
+struct interrupt_stats {
+    unsigned long delivered;
+    unsigned long coalesced;
+    
+    unsigned long latency_last;
+    unsigned long latency_min;
+    unsigned long latency_max;
+};
+
+extern int syscall_int_bind(unsigned long irq);
+extern msg_t *syscall_int_wait(unsigned long irq);
+extern msg_t *interrupt_wait(unsigned long irq, struct interrupt_stats *stats);
+extern void interrupt_stats_report(unsigned long irq, struct interrupt_stats *stats);
+
 /*
  * Heap
  */
@@ -136,6 +161,8 @@ extern unsigned long kapi_stderr_write(unsigned long console_id, void *buf, unsi
  * KMap
  */
 extern void *kapi_kmap(enum kmap_region region);
+extern void *kapi_fmap(unsigned long fd, int exec, size_t *size);
+extern int kapi_funmap(void *addr);
 
 
 #endif
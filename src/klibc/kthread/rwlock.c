@@ -0,0 +1,74 @@
+#include "common/include/data.h"
+#include "common/include/atomic.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/sys.h"
+#include "klibc/include/kthread.h"
+
+
+/*
+ * The low bits count the readers, a waiting writer keeps new readers out so
+ * that a steady stream of them can't starve it
+ */
+#define RWLOCK_WRITER   (0x1ul << (sizeof(unsigned long) * 8 - 1))
+#define RWLOCK_WAITING  (0x1ul << (sizeof(unsigned long) * 8 - 2))
+
+
+void kthread_rwlock_init(kthread_rwlock_t *rwlock)
+{
+    rwlock->value = 0;
+}
+
+void kthread_rwlock_destroy(kthread_rwlock_t *rwlock)
+{
+    rwlock->value = 0;
+}
+
+
+void kthread_rwlock_rdlock(kthread_rwlock_t *rwlock)
+{
+    unsigned long value;
+    
+    do {
+        value = rwlock->value;
+        while (value & (RWLOCK_WRITER | RWLOCK_WAITING)) {
+            sys_yield();
+            atomic_membar();
+            value = rwlock->value;
+        }
+    } while (!atomic_cas(&rwlock->value, value, value + 1));
+}
+
+void kthread_rwlock_wrlock(kthread_rwlock_t *rwlock)
+{
+    unsigned long value;
+    
+    do {
+        value = rwlock->value;
+        
+        // Neither readers nor a writer, other writers may be waiting though
+        if (!(value & ~RWLOCK_WAITING)) {
+            if (atomic_cas(&rwlock->value, value, RWLOCK_WRITER)) {
+                break;
+            }
+            continue;
+        }
+        
+        if (!(value & RWLOCK_WAITING)) {
+            atomic_or(&rwlock->value, RWLOCK_WAITING);
+        }
+        
+        sys_yield();
+        atomic_membar();
+    } while (1);
+}
+
+void kthread_rwlock_rdunlock(kthread_rwlock_t *rwlock)
+{
+    atomic_dec(&rwlock->value);
+}
+
+void kthread_rwlock_wrunlock(kthread_rwlock_t *rwlock)
+{
+    // Waiting writers set their bit again
+    atomic_and(&rwlock->value, ~RWLOCK_WRITER);
+}
@@ -4,6 +4,7 @@
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/kthread.h"
+#include "klibc/include/stdstruct.h"
 
 
 extern int main(int argc, char *argv[]);
@@ -18,6 +19,7 @@ static void klib_init()
     init_salloc();
     init_malloc();
     //test_malloc();
+    //test_hash();
 }
 
 asmlinkage void _start()
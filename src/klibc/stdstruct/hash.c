@@ -1,10 +1,25 @@
 #include "common/include/data.h"
+#include "common/include/hash.h"
+#include "common/include/cycle.h"
+#include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/kthread.h"
 #include "klibc/include/assert.h"
 #include "klibc/include/stdstruct.h"
 
 
+// Grow once the average chain length exceeds this
+#define HASH_MAX_LOAD           2
+
+// Blocks larger than this come from halloc
+#define HASH_MALLOC_LIMIT       512
+
+// A chunk of buckets is at most one halloc, the directory of chunks too
+#define HASH_CHUNK_BUCKETS      (HALLOC_CHUNK_SIZE / sizeof(hash_bucket_t))
+#define HASH_MAX_CHUNKS         (HALLOC_CHUNK_SIZE / sizeof(hash_bucket_t *))
+#define HASH_MAX_BUCKETS        (HASH_MAX_CHUNKS * HASH_CHUNK_BUCKETS)
+
+
 static int hash_salloc_id;
 static int hash_node_salloc_id;
 
@@ -17,8 +32,7 @@ static void init_hash()
 
 static unsigned int default_hash_func(void *key, unsigned int size)
 {
-    unsigned int k = (unsigned int)(unsigned long)key;
-    return k % size;
+    return hash_ulong((unsigned long)key) % size;
 }
 
 static int default_hash_cmp(void *cmp_key, void *node_key)
@@ -35,10 +49,95 @@ static int default_hash_cmp(void *cmp_key, void *node_key)
     }
 }
 
-void hash_create(hash_t *l, unsigned int bucket_count, hash_func_t hash_func, hash_cmp_t hash_cmp)
+
+/*
+ * Bucket arrays
+ *  A single halloc caps how many buckets fit in one block, so large arrays
+ *  are split into chunks of HASH_CHUNK_BUCKETS and reached via a directory
+ */
+static void *alloc_block(size_t size)
 {
-    int i;
+    if (size <= HASH_MALLOC_LIMIT) {
+        return malloc(size);
+    }
+    
+    assert(size <= HALLOC_CHUNK_SIZE);
+    return halloc();
+}
+
+static void free_block(void *block, size_t size)
+{
+    if (size <= HASH_MALLOC_LIMIT) {
+        free(block);
+    } else {
+        hfree(block);
+    }
+}
+
+static unsigned int get_chunk_count(unsigned int count)
+{
+    return (count + HASH_CHUNK_BUCKETS - 1) / HASH_CHUNK_BUCKETS;
+}
+
+static unsigned int get_chunk_size(unsigned int count)
+{
+    return count < HASH_CHUNK_BUCKETS ? count : HASH_CHUNK_BUCKETS;
+}
+
+static inline hash_bucket_t *bucket_at(hash_bucket_t **buckets, unsigned int index)
+{
+    return &buckets[index / HASH_CHUNK_BUCKETS][index % HASH_CHUNK_BUCKETS];
+}
+
+static void free_buckets(hash_bucket_t **buckets, unsigned int count)
+{
+    unsigned int c;
+    unsigned int chunks = get_chunk_count(count);
+    unsigned int chunk_size = get_chunk_size(count);
+    
+    for (c = 0; c < chunks; c++) {
+        if (buckets[c]) {
+            free_block(buckets[c], sizeof(hash_bucket_t) * chunk_size);
+        }
+    }
+    
+    free_block(buckets, sizeof(hash_bucket_t *) * chunks);
+}
+
+static hash_bucket_t **alloc_buckets(unsigned int count)
+{
+    unsigned int i, c;
+    unsigned int chunks = get_chunk_count(count);
+    unsigned int chunk_size = get_chunk_size(count);
+    hash_bucket_t **buckets = NULL;
+    
+    buckets = (hash_bucket_t **)alloc_block(sizeof(hash_bucket_t *) * chunks);
+    if (!buckets) {
+        return NULL;
+    }
+    
+    for (c = 0; c < chunks; c++) {
+        buckets[c] = NULL;
+    }
     
+    for (c = 0; c < chunks; c++) {
+        buckets[c] = (hash_bucket_t *)alloc_block(sizeof(hash_bucket_t) * chunk_size);
+        if (!buckets[c]) {
+            free_buckets(buckets, count);
+            return NULL;
+        }
+        
+        for (i = 0; i < chunk_size; i++) {
+            buckets[c][i].node_count = 0;
+            buckets[c][i].head = NULL;
+        }
+    }
+    
+    return buckets;
+}
+
+void hash_create(hash_t *l, unsigned int bucket_count, hash_func_t hash_func, hash_cmp_t hash_cmp)
+{
     if (!hash_node_salloc_id) {
         init_hash();
     }
@@ -49,12 +148,11 @@ void hash_create(hash_t *l, unsigned int bucket_count, hash_func_t hash_func, ha
     
     l->bucket_count = bucket_count ? bucket_count : 16;
     l->node_count = 0;
+    l->buckets = alloc_buckets(l->bucket_count);
     
-    l->buckets = (hash_bucket_t *)malloc(sizeof(hash_bucket_t) * l->bucket_count);
-    for (i = 0; i < l->bucket_count; i++) {
-        l->buckets[i].node_count = 0;
-        l->buckets[i].head = NULL;
-    }
+    l->old_bucket_count = 0;
+    l->rehash_index = 0;
+    l->old_buckets = NULL;
     
     l->hash_func = hash_func ? hash_func : default_hash_func;
     l->hash_cmp = hash_cmp ? hash_cmp : default_hash_cmp;
@@ -76,33 +174,147 @@ hash_t *hash_new(unsigned int bucket_count, hash_func_t hash_func, hash_cmp_t ha
     return h;
 }
 
-int hash_contains(hash_t *l, void *key)
+
+/*
+ * Incremental resizing, must be called with the table locked
+ */
+static void insert_sorted(hash_t *l, hash_bucket_t *bucket, hash_node_t *s)
 {
-    int cmp = 0;
-    int found = 0;
-    hash_node_t *s = NULL;
+    hash_node_t *cur = bucket->head;
+    hash_node_t *prev = NULL;
     
-    // Get the hash and bucket
-    unsigned long hash = l->hash_func(key, l->bucket_count);
-    hash_bucket_t *bucket = &l->buckets[hash];
+    while (cur) {
+        if (-1 == l->hash_cmp(s->key, cur->key)) {
+            break;
+        }
+        
+        prev = cur;
+        cur = cur->next;
+    }
     
-    // Lock the table
-    kthread_mutex_lock(&l->lock);
+    if (prev) {
+        s->next = prev->next;
+        prev->next = s;
+    } else {
+        s->next = bucket->head;
+        bucket->head = s;
+    }
     
-    // Find the node
+    bucket->node_count++;
+}
+
+static void rehash_step(hash_t *l)
+{
+    hash_bucket_t *bucket = NULL;
+    hash_node_t *s = NULL, *next = NULL;
+    
+    if (!l->old_buckets) {
+        return;
+    }
+    
+    // Move all the nodes of one old bucket
+    bucket = bucket_at(l->old_buckets, l->rehash_index);
     s = bucket->head;
     while (s) {
-        cmp = l->hash_cmp(key, s->key);
-        if (0 == cmp) {
-            found = 1;
-            break;
-        } else if (-1 == cmp) {
-            break;
+        next = s->next;
+        insert_sorted(l, bucket_at(l->buckets, l->hash_func(s->key, l->bucket_count)), s);
+        s = next;
+    }
+    
+    bucket->head = NULL;
+    bucket->node_count = 0;
+    
+    // Done with the old array
+    if (++l->rehash_index == l->old_bucket_count) {
+        free_buckets(l->old_buckets, l->old_bucket_count);
+        l->old_buckets = NULL;
+        l->old_bucket_count = 0;
+        l->rehash_index = 0;
+    }
+}
+
+static void start_resize(hash_t *l)
+{
+    hash_bucket_t **buckets = NULL;
+    unsigned int count = l->bucket_count * 2;
+    
+    if (
+        l->old_buckets ||
+        l->node_count <= l->bucket_count * HASH_MAX_LOAD ||
+        count > HASH_MAX_BUCKETS
+    ) {
+        return;
+    }
+    
+    buckets = alloc_buckets(count);
+    if (!buckets) {
+        return;
+    }
+    
+    l->old_buckets = l->buckets;
+    l->old_bucket_count = l->bucket_count;
+    l->rehash_index = 0;
+    
+    l->buckets = buckets;
+    l->bucket_count = count;
+}
+
+
+/*
+ * Lookup, must be called with the table locked
+ */
+static hash_bucket_t *get_bucket(hash_t *l, void *key, hash_node_t **out, hash_node_t **prev_out)
+{
+    int cmp = 0;
+    int i;
+    hash_bucket_t *bucket = NULL;
+    hash_node_t *s = NULL, *prev = NULL;
+    
+    for (i = 0; i < 2; i++) {
+        // The old array only holds the buckets that have not been moved yet
+        if (!i) {
+            if (!l->old_buckets) {
+                continue;
+            }
+            bucket = bucket_at(l->old_buckets, l->hash_func(key, l->old_bucket_count));
+        } else {
+            bucket = bucket_at(l->buckets, l->hash_func(key, l->bucket_count));
         }
         
-        s = s->next;
+        prev = NULL;
+        s = bucket->head;
+        while (s) {
+            cmp = l->hash_cmp(key, s->key);
+            if (0 == cmp) {
+                if (out) {
+                    *out = s;
+                }
+                if (prev_out) {
+                    *prev_out = prev;
+                }
+                return bucket;
+            } else if (-1 == cmp) {
+                break;
+            }
+            
+            prev = s;
+            s = s->next;
+        }
     }
     
+    return NULL;
+}
+
+int hash_contains(hash_t *l, void *key)
+{
+    int found = 0;
+    
+    // Lock the table
+    kthread_mutex_lock(&l->lock);
+    
+    // Find the node
+    found = get_bucket(l, key, NULL, NULL) ? 1 : 0;
+    
     // Unlock
     kthread_mutex_unlock(&l->lock);
     
@@ -111,32 +323,13 @@ int hash_contains(hash_t *l, void *key)
 
 void *hash_obtain(hash_t *l, void *key)
 {
-    int cmp = 0;
-    int found = 0;
     hash_node_t *s = NULL;
     
-    // Get the hash and bucket
-    unsigned long hash = l->hash_func(key, l->bucket_count);
-    hash_bucket_t *bucket = &l->buckets[hash];
-    
     // Lock the table
     kthread_mutex_lock(&l->lock);
     
     // Find the node
-    s = bucket->head;
-    while (s) {
-        cmp = l->hash_cmp(key, s->key);
-        if (0 == cmp) {
-            found = 1;
-            break;
-        } else if (-1 == cmp) {
-            break;
-        }
-        
-        s = s->next;
-    }
-    
-    if (!found) {
+    if (!get_bucket(l, key, &s, NULL)) {
         // Unlock
         kthread_mutex_unlock(&l->lock);
         return NULL;
@@ -155,8 +348,14 @@ void *hash_obtain_at(hash_t *l, unsigned long index)
     // Lock the table
     kthread_mutex_lock(&l->lock);
     
-    for (i = 0; i < l->bucket_count; i++) {
-        bucket = &l->buckets[i];
+    // Old buckets come first, followed by the current ones
+    for (i = 0; i < l->old_bucket_count + l->bucket_count; i++) {
+        if (i < l->old_bucket_count) {
+            bucket = bucket_at(l->old_buckets, i);
+        } else {
+            bucket = bucket_at(l->buckets, i - l->old_bucket_count);
+        }
+        
         count += bucket->node_count;
         if (count > index) {
             count -= bucket->node_count;
@@ -186,53 +385,39 @@ void hash_release(hash_t *l, void *key, void *n)
     kthread_mutex_unlock(&l->lock);
 }
 
+
+/*
+ * Update
+ */
 int hash_insert(hash_t *l, void *key, void *n)
 {
-    hash_node_t *cur = NULL;
-    hash_node_t *prev = NULL;
+    hash_node_t *s = NULL;
+    
+    // Lock the table
+    kthread_mutex_lock(&l->lock);
     
-    if (hash_contains(l, key)) {
+    if (get_bucket(l, key, NULL, NULL)) {
+        kthread_mutex_unlock(&l->lock);
         return -1;
     }
     
     // Allocate a node
-    hash_node_t *s = (hash_node_t *)salloc(hash_node_salloc_id);
+    s = (hash_node_t *)salloc(hash_node_salloc_id);
     if (!s) {
+        kthread_mutex_unlock(&l->lock);
         return -2;
     }
     s->key = key;
     s->node = n;
     
-    // Get the hash and bucket
-    unsigned long hash = l->hash_func(key, l->bucket_count);
-    hash_bucket_t *bucket = &l->buckets[hash];
-    
-    // Lock the table
-    kthread_mutex_lock(&l->lock);
-    
-    // Insert into the proper position
-    cur = bucket->head;
-    
-    while (cur) {
-        if (-1 == l->hash_cmp(key, cur->key)) {
-            break;
-        }
-        
-        prev = cur;
-        cur = cur->next;
-    }
-    
-    if (prev) {
-        s->next = prev->next;
-        prev->next = s;
-    } else {
-        s->next = bucket->head;
-        bucket->head = s;
-    }
-    
-    bucket->node_count++;
+    // New nodes always go to the current array
+    insert_sorted(l, bucket_at(l->buckets, l->hash_func(key, l->bucket_count)), s);
     l->node_count++;
     
+    // Resize
+    start_resize(l);
+    rehash_step(l);
+    
     // Unlock
     kthread_mutex_unlock(&l->lock);
     
@@ -241,44 +426,125 @@ int hash_insert(hash_t *l, void *key, void *n)
 
 int hash_remove(hash_t *l, void *key)
 {
-    int cmp = 0;
-    int found = 0;
     hash_node_t *s = NULL, *prev = NULL;
-    
-    // Get the hash and bucket
-    ulong hash = l->hash_func(key, l->bucket_count);
-    hash_bucket_t *bucket = &l->buckets[hash];
+    hash_bucket_t *bucket = NULL;
     
     // Lock the table
     kthread_mutex_lock(&l->lock);
     
     // Find the node
-    s = bucket->head;
-    while (s) {
-        cmp = l->hash_cmp(key, s->key);
-        if (0 == cmp) {
-            found = 1;
-            break;
-        } else if (-1 == cmp) {
-            break;
-        }
-        
-        prev = s;
-        s = s->next;
-    }
-    
-    if (found) {
+    bucket = get_bucket(l, key, &s, &prev);
+    if (bucket) {
         if (prev) {
             prev->next = s->next;
         } else {
             bucket->head = s->next;
         }
+        
+        bucket->node_count--;
+        l->node_count--;
     }
     
+    // Keep an ongoing resize moving
+    rehash_step(l);
+    
     // Unlock
     kthread_mutex_unlock(&l->lock);
     
-    sfree(s);
+    if (bucket) {
+        sfree(s);
+    }
     
-    return found;
+    return bucket ? 1 : 0;
+}
+
+
+/*
+ * Benchmark, the same keys as the kernel hashtable test
+ */
+#define HASH_TEST_ENTRIES       100000
+#define HASH_TEST_HISTOGRAM     8
+
+static void print_chain_stats(hash_t *l)
+{
+    unsigned int i;
+    unsigned long len = 0;
+    unsigned long max_len = 0;
+    unsigned long used = 0;
+    unsigned long histogram[HASH_TEST_HISTOGRAM];
+    
+    for (i = 0; i < HASH_TEST_HISTOGRAM; i++) {
+        histogram[i] = 0;
+    }
+    
+    for (i = 0; i < l->bucket_count; i++) {
+        len = bucket_at(l->buckets, i)->node_count;
+        
+        if (len) {
+            used++;
+        }
+        if (len > max_len) {
+            max_len = len;
+        }
+        
+        histogram[len < HASH_TEST_HISTOGRAM ? len : HASH_TEST_HISTOGRAM - 1]++;
+    }
+    
+    kprintf("\tBuckets: %u, used: %u, nodes: %u, max chain: %u\n",
+            l->bucket_count, used, l->node_count, max_len);
+    
+    kprintf("\tChain length histogram:");
+    for (i = 0; i < HASH_TEST_HISTOGRAM; i++) {
+        kprintf(" [%d%s] %u", i, i == HASH_TEST_HISTOGRAM - 1 ? "+" : "", histogram[i]);
+    }
+    kprintf("\n");
+}
+
+void test_hash()
+{
+    unsigned long i;
+    unsigned long key;
+    u64 start, end;
+    hash_t table;
+    
+    kprintf("Testing klibc hash\n");
+    
+    // Page-aligned keys are the worst case for a modulo hash
+    hash_create(&table, 0, NULL, NULL);
+    
+    start = read_cycles();
+    for (i = 0; i < HASH_TEST_ENTRIES; i++) {
+        key = i * 4096;
+        assert(!hash_insert(&table, (void *)key, (void *)(key + 1)));
+    }
+    end = read_cycles();
+    
+    // Finish the pending resize so that all entries are in one array
+    kthread_mutex_lock(&table.lock);
+    while (table.old_buckets) {
+        rehash_step(&table);
+    }
+    kthread_mutex_unlock(&table.lock);
+    
+    kprintf("\tInsert: %u cycles per entry\n", (unsigned long)(end - start) / HASH_TEST_ENTRIES);
+    print_chain_stats(&table);
+    
+    // Hits
+    start = read_cycles();
+    for (i = 0; i < HASH_TEST_ENTRIES; i++) {
+        key = i * 4096;
+        void *n = hash_obtain(&table, (void *)key);
+        assert(n == (void *)(key + 1));
+        hash_release(&table, (void *)key, n);
+    }
+    end = read_cycles();
+    kprintf("\tLookup hit: %u cycles per lookup\n", (unsigned long)(end - start) / HASH_TEST_ENTRIES);
+    
+    // Clean up
+    for (i = 0; i < HASH_TEST_ENTRIES; i++) {
+        assert(hash_remove(&table, (void *)(i * 4096)));
+    }
+    free_buckets(table.buckets, table.bucket_count);
+    
+    kprintf("Successfully passed the test!\n");
 }
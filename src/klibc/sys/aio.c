@@ -0,0 +1,254 @@
+/*
+ * Async URS
+ *  Entries are sent to URS as one-way messages, each completion comes back
+ *  as a message of its own and is queued in the ring until it is reaped
+ *
+ *  Operations on the same fd are not ordered against each other, wait for
+ *  one to complete before submitting the next if the order matters
+ */
+
+
+#include "common/include/data.h"
+#include "common/include/syscall.h"
+#include "common/include/urs.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/string.h"
+#include "klibc/include/sys.h"
+#include "klibc/include/kthread.h"
+#include "klibc/include/aio.h"
+
+
+/*
+ * Completion
+ */
+static asmlinkage void completion_handler(msg_t *msg)
+{
+    struct urs_ring *ring = (struct urs_ring *)msg->params[0].value;
+    unsigned long slot = msg->params[1].value;
+    unsigned long actual = msg->params[2].value;
+    int result = (int)msg->params[3].value;
+    void *data = (void *)((unsigned long)msg + msg->params[4].offset);
+    unsigned long len = (unsigned long)msg->params[4].size;
+    
+    struct urs_sqe *sqe = &ring->slots[slot];
+    struct urs_cqe *cqe = NULL;
+    
+    // Data goes straight to the caller's buffer
+    if (len && sqe->buf) {
+        if (len > sqe->count) {
+            len = sqe->count;
+        }
+        memcpy(sqe->buf, data, len);
+    }
+    
+    kthread_mutex_lock(&ring->lock);
+    
+    // Never overflows, no more than depth entries are outstanding
+    cqe = &ring->cq[(ring->cq_head + ring->cq_count) % ring->depth];
+    cqe->user_data = sqe->user_data;
+    cqe->result = result;
+    cqe->actual = actual;
+    ring->cq_count++;
+    
+    ring->free_slots[ring->free_count++] = (unsigned char)slot;
+    
+    kthread_mutex_unlock(&ring->lock);
+    
+    syscall_notif_signal(ring->notif_id, 0x1);
+    kapi_thread_exit(NULL);
+}
+
+
+/*
+ * Ring
+ */
+int urs_ring_init(struct urs_ring *ring, unsigned long depth)
+{
+    unsigned long i;
+    
+    if (!depth || depth > URS_RING_MAX_DEPTH) {
+        return 0;
+    }
+    
+    memzero(ring, sizeof(struct urs_ring));
+    
+    ring->notif_id = syscall_notif_create();
+    if (!ring->notif_id) {
+        return 0;
+    }
+    
+    ring->msg_num = alloc_msg_num();
+    syscall_reg_msg_handler(ring->msg_num, completion_handler);
+    
+    ring->depth = depth;
+    for (i = 0; i < depth; i++) {
+        ring->free_slots[i] = (unsigned char)(depth - i - 1);
+    }
+    ring->free_count = depth;
+    
+    kthread_mutex_init(&ring->lock);
+    
+    return 1;
+}
+
+void urs_ring_destroy(struct urs_ring *ring)
+{
+    // Completions that are still in flight would have nowhere to go
+    while (ring->outstanding) {
+        struct urs_cqe cqes[URS_RING_MAX_DEPTH];
+        urs_ring_submit(ring);
+        urs_ring_reap(ring, cqes, URS_RING_MAX_DEPTH, 1);
+    }
+    
+    syscall_unreg_msg_handler(ring->msg_num);
+    syscall_notif_destroy(ring->notif_id);
+    kthread_mutex_destroy(&ring->lock);
+}
+
+
+/*
+ * Submission
+ */
+struct urs_sqe *urs_ring_get_sqe(struct urs_ring *ring)
+{
+    struct urs_sqe *sqe = NULL;
+    unsigned long slot;
+    
+    kthread_mutex_lock(&ring->lock);
+    
+    if (ring->outstanding < ring->depth && ring->free_count) {
+        slot = ring->free_slots[--ring->free_count];
+        ring->sq[ring->sq_count++] = (unsigned char)slot;
+        ring->outstanding++;
+        
+        sqe = &ring->slots[slot];
+        memzero(sqe, sizeof(struct urs_sqe));
+    }
+    
+    kthread_mutex_unlock(&ring->lock);
+    
+    return sqe;
+}
+
+void urs_prep_open(struct urs_sqe *sqe, char *path, unsigned int flags, unsigned long user_data)
+{
+    sqe->op = uop_open;
+    sqe->path = path;
+    sqe->flags = flags;
+    sqe->user_data = user_data;
+}
+
+void urs_prep_read(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data)
+{
+    sqe->op = uop_read;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->count = count;
+    sqe->user_data = user_data;
+}
+
+void urs_prep_write(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data)
+{
+    sqe->op = uop_write;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->count = count;
+    sqe->user_data = user_data;
+}
+
+void urs_prep_list(struct urs_sqe *sqe, unsigned long fd, void *buf, unsigned long count, unsigned long user_data)
+{
+    sqe->op = uop_list;
+    sqe->fd = fd;
+    sqe->buf = buf;
+    sqe->count = count;
+    sqe->user_data = user_data;
+}
+
+void urs_prep_stat(struct urs_sqe *sqe, unsigned long fd, struct urs_stat *stat, unsigned long user_data)
+{
+    sqe->op = uop_stat;
+    sqe->fd = fd;
+    sqe->buf = stat;
+    sqe->count = sizeof(struct urs_stat);
+    sqe->user_data = user_data;
+}
+
+static void send_sqe(struct urs_ring *ring, unsigned long slot)
+{
+    struct urs_sqe *sqe = &ring->slots[slot];
+    msg_t *s = kapi_msg(KAPI_URS_ASYNC);
+    
+    msg_param_value(s, (unsigned long)ring);
+    msg_param_value(s, slot);
+    msg_param_value(s, ring->msg_num);
+    msg_param_value(s, (unsigned long)sqe->op);
+    msg_param_value(s, sqe->fd);
+    msg_param_value(s, sqe->count);
+    msg_param_value(s, (unsigned long)sqe->flags);
+    
+    // Data the server needs to see, the reply brings back the rest
+    if (sqe->op == uop_open) {
+        msg_param_buffer(s, sqe->path, (size_t)(strlen(sqe->path) + 1));
+    } else if (sqe->op == uop_write) {
+        msg_param_buffer(s, sqe->buf, (size_t)(sqe->count > URS_ASYNC_DATA_MAX ? URS_ASYNC_DATA_MAX : sqe->count));
+    } else {
+        msg_param_buffer(s, NULL, 0);
+    }
+    
+    syscall_send();
+}
+
+int urs_ring_submit(struct urs_ring *ring)
+{
+    unsigned char slots[URS_RING_MAX_DEPTH];
+    unsigned long count, i;
+    
+    kthread_mutex_lock(&ring->lock);
+    count = ring->sq_count;
+    memcpy(slots, ring->sq, count);
+    ring->sq_count = 0;
+    kthread_mutex_unlock(&ring->lock);
+    
+    // A slot can't be reused before its completion arrives
+    for (i = 0; i < count; i++) {
+        send_sqe(ring, slots[i]);
+    }
+    
+    return (int)count;
+}
+
+
+/*
+ * Reap
+ */
+int urs_ring_reap(struct urs_ring *ring, struct urs_cqe *cqes, int max, int wait)
+{
+    int count = 0;
+    int in_flight = 0;
+    
+    do {
+        kthread_mutex_lock(&ring->lock);
+        
+        while (count < max && ring->cq_count) {
+            cqes[count++] = ring->cq[ring->cq_head];
+            ring->cq_head = (ring->cq_head + 1) % ring->depth;
+            ring->cq_count--;
+            ring->outstanding--;
+        }
+        
+        // Prepared entries that were never submitted won't complete
+        in_flight = ring->outstanding > ring->sq_count;
+        
+        kthread_mutex_unlock(&ring->lock);
+        
+        if (count || !wait || !in_flight) {
+            break;
+        }
+        
+        // Completions signal after queueing, so a bit set in between is not lost
+        syscall_notif_wait(ring->notif_id);
+    } while (1);
+    
+    return count;
+}
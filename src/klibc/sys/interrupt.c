@@ -1,5 +1,8 @@
 #include "common/include/data.h"
 #include "common/include/syscall.h"
+#include "common/include/proc.h"
+#include "common/include/cycle.h"
+#include "klibc/include/stdio.h"
 #include "klibc/include/string.h"
 #include "klibc/include/sys.h"
 
@@ -26,3 +29,65 @@ int kapi_interrupt_unreg(unsigned long irq)
     
     return 1;
 }
+
+
+/*
+ * Persistent handler thread
+ */
+int syscall_int_bind(unsigned long irq)
+{
+    unsigned long succeed = 0;
+    do_syscall(SYSCALL_INT_BIND, irq, 0, &succeed, NULL);
+    return (int)succeed;
+}
+
+msg_t *syscall_int_wait(unsigned long irq)
+{
+    unsigned long succeed = 0;
+    struct thread_control_block *tcb = NULL;
+    
+    do_syscall(SYSCALL_INT_WAIT, irq, 0, &succeed, NULL);
+    if (!succeed) {
+        return NULL;
+    }
+    
+    tcb = get_tcb();
+    return tcb->msg_recv;
+}
+
+/*
+ * Wait for the next interrupt and account its latency
+ * The stamp is taken by the kernel on the CPU that received the interrupt,
+ * so the latency is only meaningful with synchronized cycle counters
+ */
+msg_t *interrupt_wait(unsigned long irq, struct interrupt_stats *stats)
+{
+    msg_t *m = syscall_int_wait(irq);
+    unsigned long latency = 0;
+    
+    if (!m || !stats) {
+        return m;
+    }
+    
+    latency = (unsigned long)(read_cycles() - m->params[6].value64);
+    
+    stats->delivered++;
+    stats->coalesced += m->params[5].value - 1;
+    stats->latency_last = latency;
+    if (!stats->latency_min || latency < stats->latency_min) {
+        stats->latency_min = latency;
+    }
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    
+    return m;
+}
+
+void interrupt_stats_report(unsigned long irq, struct interrupt_stats *stats)
+{
+    kprintf("IRQ %u: %u delivered, %u coalesced, latency last %u, min %u, max %u cycles\n",
+        irq, stats->delivered, stats->coalesced,
+        stats->latency_last, stats->latency_min, stats->latency_max
+    );
+}
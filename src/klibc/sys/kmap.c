@@ -17,3 +17,34 @@ void *kapi_kmap(enum kmap_region region)
     
     return (void *)kapi_return_value(r);
 }
+
+
+/*
+ * File mapping
+ */
+void *kapi_fmap(unsigned long fd, int exec, size_t *size)
+{
+    msg_t *s = kapi_msg(KAPI_FMAP);
+    msg_t *r = NULL;
+    
+    msg_param_value(s, fd);
+    msg_param_value(s, (unsigned long)exec);
+    r = syscall_request();
+    
+    if (size) {
+        *size = (size_t)r->params[0].value;
+    }
+    
+    return (void *)kapi_return_value(r);
+}
+
+int kapi_funmap(void *addr)
+{
+    msg_t *s = kapi_msg(KAPI_FUNMAP);
+    msg_t *r = NULL;
+    
+    msg_param_value(s, (unsigned long)addr);
+    r = syscall_request();
+    
+    return (int)kapi_return_value(r);
+}
@@ -47,6 +47,12 @@ unsigned long kapi_process_id()
     return tcb->proc_id;
 }
 
+unsigned long kapi_kernel_proc_id()
+{
+    struct thread_control_block *tcb = get_tcb();
+    return tcb->kernel_proc_id;
+}
+
 
 /*
  * Process monitor
@@ -122,3 +122,45 @@ int syscall_unreg_kapi_server(unsigned long kapi_num)
     int succeed = do_syscall(SYSCALL_UNREG_KAPI_SERVER, kapi_num, 0, NULL, NULL);
     return succeed;
 }
+
+unsigned long syscall_notif_create()
+{
+    unsigned long notif_id = 0;
+    do_syscall(SYSCALL_NOTIF_CREATE, 0, 0, &notif_id, NULL);
+    return notif_id;
+}
+
+int syscall_notif_destroy(unsigned long notif_id)
+{
+    unsigned long succeed = 0;
+    do_syscall(SYSCALL_NOTIF_DESTROY, notif_id, 0, &succeed, NULL);
+    return (int)succeed;
+}
+
+int syscall_notif_signal(unsigned long notif_id, unsigned long bits)
+{
+    unsigned long succeed = 0;
+    do_syscall(SYSCALL_NOTIF_SIGNAL, notif_id, bits, &succeed, NULL);
+    return (int)succeed;
+}
+
+unsigned long syscall_notif_wait(unsigned long notif_id)
+{
+    unsigned long bits = 0;
+    do_syscall(SYSCALL_NOTIF_WAIT, notif_id, 0, &bits, NULL);
+    return bits;
+}
+
+unsigned long syscall_notif_poll(unsigned long notif_id)
+{
+    unsigned long bits = 0;
+    do_syscall(SYSCALL_NOTIF_POLL, notif_id, 0, &bits, NULL);
+    return bits;
+}
+
+int syscall_notif_bind_irq(unsigned long notif_id, unsigned long irq)
+{
+    unsigned long succeed = 0;
+    do_syscall(SYSCALL_NOTIF_BIND_IRQ, notif_id, irq, &succeed, NULL);
+    return (int)succeed;
+}
@@ -69,6 +69,19 @@ int kapi_urs_close(unsigned long fd)
     return result;
 }
 
+unsigned long kapi_urs_dup(unsigned long fd)
+{
+    msg_t *s = kapi_msg(KAPI_URS_DUP);
+    msg_t *r;
+    unsigned long result = 0;
+    
+    msg_param_value(s, fd);
+    r = syscall_request();
+    result = kapi_return_value(r);
+    
+    return result;
+}
+
 size_t kapi_urs_read(unsigned long fd, void *buf, size_t count)
 {
     // Setup the msg
@@ -144,6 +157,36 @@ size_t kapi_urs_list(unsigned long fd, void *buf, size_t count)
     return result;
 }
 
+int kapi_urs_list_batch(unsigned long fd, void *buf, size_t count, unsigned int flags, size_t *actual)
+{
+    msg_t *s = kapi_msg(KAPI_URS_LIST_BATCH);
+    msg_t *r = NULL;
+    int result = -1;
+    
+    msg_param_value(s, fd);
+    msg_param_value(s, (unsigned long)count);
+    msg_param_value(s, (unsigned long)flags);
+    
+    r = syscall_request();
+    void *data = (void *)((unsigned long)r + r->params[0].offset);
+    size_t len = (size_t)r->params[1].value;
+    if (len > count) {
+        len = count;
+    }
+    if (buf && len) {
+        memcpy(buf, data, len);
+    } else {
+        len = 0;
+    }
+    
+    if (actual) {
+        *actual = len;
+    }
+    
+    result = (int)kapi_return_value(r);
+    return result;
+}
+
 int kapi_urs_create(unsigned long fd, char *name, enum urs_create_type type, unsigned int flags, char *target)
 {
     // Setup the msg
@@ -231,6 +274,27 @@ int kapi_urs_stat(unsigned long fd, struct urs_stat *stat)
     return result;
 }
 
+int kapi_urs_dcache_stat(struct urs_dcache_stat *stat)
+{
+    // Setup the msg
+    kapi_msg(KAPI_URS_DCACHE_STAT);
+    msg_t *r = NULL;
+    struct urs_dcache_stat *ret = NULL;
+    int result = -1;
+    
+    // Issue the KAPI and obtain the result
+    r = syscall_request();
+    
+    // Setup the result
+    ret = (struct urs_dcache_stat *)((unsigned long)r + r->params[0].offset);
+    if (ret && stat) {
+        memcpy(stat, ret, sizeof(struct urs_dcache_stat));
+    }
+    result = (int)kapi_return_value(r);
+    
+    return result;
+}
+
 //  int link(char *old, char *new);
 //  int unlink(char *name);
 
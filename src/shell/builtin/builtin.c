@@ -27,6 +27,7 @@ static struct builtin_cmd builtin_cmd_list[] = {
     { "rm", rm },
     { "mv", mv },
     { "date", date },
+    { "dcstat", dcstat },
 };
 
 
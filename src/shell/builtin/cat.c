@@ -1,40 +1,79 @@
 #include "common/include/data.h"
 #include "common/include/errno.h"
 #include "klibc/include/stdio.h"
+#include "klibc/include/string.h"
 #include "klibc/include/sys.h"
 #include "shell/include/shell.h"
 
 
-static int do_cat(char *name)
+#define CAT_CHUNK_SIZE  64
+
+
+static void print_chunk(char *buf, size_t s)
 {
-    char buf[64 + 1];
     size_t j;
+    
+    for (j = 0; j < s; j++) {
+        switch (buf[j]) {
+        case '%':
+            buf[j] = '#';
+            break;
+        case '\0':
+            buf[j] = '.';
+            break;
+        default:
+            break;
+        }
+    }
+    buf[s] = '\0';
+    kprintf("%s", buf);
+}
+
+static int cat_mapped(unsigned long id)
+{
+    char buf[CAT_CHUNK_SIZE + 1];
+    size_t size = 0;
+    size_t i, s;
+    
+    // Map the file instead of reading it through URS message by message
+    char *data = (char *)kapi_fmap(id, 0, &size);
+    if (!data) {
+        return -1;
+    }
+    
+    for (i = 0; i < size; i += s) {
+        s = size - i;
+        if (s > CAT_CHUNK_SIZE) {
+            s = CAT_CHUNK_SIZE;
+        }
+        
+        memcpy(buf, data + i, s);
+        print_chunk(buf, s);
+    }
+    
+    kapi_funmap(data);
+    return 0;
+}
+
+static int do_cat(char *name)
+{
+    char buf[CAT_CHUNK_SIZE + 1];
     int err = EOK;
     
     unsigned long id = open_path(name, 0);
 //     kprintf("Open: %p\n", id);
     
     if (id) {
-        size_t s = 0;
-        do {
-            s = kapi_urs_read(id, buf, sizeof(buf) - 1);
-            if (s) {
-                for (j = 0; j < s; j++) {
-                    switch (buf[j]) {
-                    case '%':
-                        buf[j] = '#';
-                        break;
-                    case '\0':
-                        buf[j] = '.';
-                        break;
-                    default:
-                        break;
-                    }
+        // Empty files and files that cannot be mapped are read instead
+        if (cat_mapped(id)) {
+            size_t s = 0;
+            do {
+                s = kapi_urs_read(id, buf, CAT_CHUNK_SIZE);
+                if (s) {
+                    print_chunk(buf, s);
                 }
-                buf[s] = '\0';
-                kprintf("%s", buf);
-            }
-        } while (s);
+            } while (s);
+        }
         kprintf("\n");
         
         err = kapi_urs_close(id);
@@ -0,0 +1,24 @@
+#include "common/include/data.h"
+#include "common/include/errno.h"
+#include "common/include/urs.h"
+#include "klibc/include/stdio.h"
+#include "klibc/include/sys.h"
+#include "shell/include/shell.h"
+
+
+int dcstat(int argc, char **argv)
+{
+    struct urs_dcache_stat stat;
+    
+    int err = kapi_urs_dcache_stat(&stat);
+    if (err) {
+        return err;
+    }
+    
+    kprintf("Path lookup cache\n");
+    kprintf("\tEntries: %u\n", stat.entries);
+    kprintf("\tHits: %u, negative hits: %u, misses: %u\n", stat.hits, stat.neg_hits, stat.misses);
+    kprintf("\tEvictions: %u, invalidations: %u\n", stat.evictions, stat.invalidations);
+    
+    return EOK;
+}
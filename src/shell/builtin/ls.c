@@ -7,6 +7,10 @@
 #include "shell/include/shell.h"
 
 
+// Entries of a whole directory usually arrive in one go
+#define LS_BATCH_SIZE   1024
+
+
 static int check_flag(int argc, char **argv, char flag)
 {
     int i, j;
@@ -28,15 +32,23 @@ static int check_flag(int argc, char **argv, char flag)
     return 0;
 }
 
-static void print_detailed_entry(char *path, char *name)
+static void print_detailed_entry(char *path, struct urs_list_entry *entry)
 {
-    kprintf("%s\n", name);
+    struct urs_stat *stat = urs_list_entry_stat(entry);
+    
+    if (stat) {
+        kprintf("%u\t%s\n", (unsigned long)stat->data_size, urs_list_entry_name(entry));
+    } else {
+        kprintf("%s\n", urs_list_entry_name(entry));
+    }
 }
 
 static int do_ls(char *path, int flag_list)
 {
     int err = EOK;
-    char buf[64];
+    u64 buf[LS_BATCH_SIZE / sizeof(u64)];
+    size_t len = 0, pos = 0;
+    struct urs_list_entry *entry = NULL;
     unsigned long id = open_path(path, 0);
 //     kprintf("Open: %p\n", id);
     
@@ -47,17 +59,21 @@ static int do_ls(char *path, int flag_list)
         kprintf("Total entries: %lu\n", stat.sub_count);
     }
     
-    int last = 0;
     do {
-        last = kapi_urs_list(id, buf, sizeof(buf));
-        if (!last) {
+        len = 0;
+        if (kapi_urs_list_batch(id, buf, sizeof(buf), flag_list ? ULIST_STAT : 0, &len)) {
+            break;
+        }
+        
+        for (pos = 0; pos < len; pos += entry->size) {
+            entry = (struct urs_list_entry *)((unsigned long)buf + pos);
             if (flag_list) {
-                print_detailed_entry(path, buf);
+                print_detailed_entry(path, entry);
             } else {
-                kprintf("%s ", buf);
+                kprintf("%s ", urs_list_entry_name(entry));
             }
         }
-    } while (!last);
+    } while (len);
     
     if (!flag_list) {
         kprintf("\n");
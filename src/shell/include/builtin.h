@@ -18,5 +18,6 @@ extern int pwd(int argc, char **argv);
 extern int rm(int argc, char **argv);
 extern int mv(int argc, char **argv);
 extern int date(int argc, char **argv);
+extern int dcstat(int argc, char **argv);
 
 #endif
@@ -4,6 +4,7 @@
 #include "common/include/errno.h"
 #include "common/include/urs.h"
 #include "common/include/ua.h"
+#include "common/include/hash.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/string.h"
@@ -14,6 +15,9 @@
 #include "system/include/urs.h"
 
 
+#define COREIMG_NAME_MAX    128
+
+
 struct coreimg_data {
     unsigned long size;
     u8 *data;
@@ -64,14 +68,7 @@ static int open_salloc_id;
  */
 static unsigned int urs_hash_func(void *key, unsigned int size)
 {
-    char *str = (char *)key;
-    unsigned int k = 0;
-    
-    do {
-        k += (unsigned int)(*str);
-    } while (*str++);
-    
-    return k % size;
+    return hash_str((char *)key) % size;
 }
 
 static int urs_hash_cmp(void *cmp_key, void *node_key)
@@ -164,6 +161,79 @@ static int lookup(unsigned long super_id, unsigned long node_id, unsigned long p
     return 0;
 }
 
+/*
+ * Whole path lookup, there are no links in the core image so this only stops
+ * early at a name that is too long
+ */
+static int lookup_path(unsigned long super_id, unsigned long node_id, unsigned long proc_id, const char *path, int *is_link,
+                       unsigned long *next_id, unsigned long *consumed, void *buf, unsigned long count, unsigned long *actual)
+{
+    struct coreimg_node *node = NULL, *next = NULL;
+    char name[COREIMG_NAME_MAX];
+    unsigned long pos = 0;
+    unsigned long len = 0;
+    
+    node = get_node_by_id(super_id, node_id);
+    assert(node);
+    node->ref_count--;
+    
+    if (is_link) {
+        *is_link = 0;
+    }
+    if (next_id) {
+        *next_id = 0;
+    }
+    
+    while (path[pos]) {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        // Get the next name
+        len = 0;
+        while (path[pos + len] && path[pos + len] != '/') {
+            len++;
+        }
+        
+        if (len >= COREIMG_NAME_MAX) {
+            break;
+        }
+        
+        memcpy(name, &path[pos], len);
+        name[len] = '\0';
+        
+        // Find out the next node
+        if (!node->sub.count) {
+            return 0;
+        }
+        
+        next = (struct coreimg_node *)hash_obtain(node->sub.entries, (void *)name);
+        if (!next) {
+            hash_release(node->sub.entries, (void *)name, next);
+            return 0;
+        }
+        hash_release(node->sub.entries, (void *)name, next);
+        
+        pos += len;
+        
+        node = next;
+    }
+    
+    // Set results
+    node->ref_count++;
+    
+    if (next_id) {
+        *next_id = node->id;
+    }
+    
+    if (consumed) {
+        *consumed = pos;
+    }
+    
+    return 0;
+}
+
 static int open(unsigned long super_id, unsigned long node_id, unsigned long proc_id, unsigned long *open_id)
 {
     struct coreimg_node *node = get_node_by_id(super_id, node_id);
@@ -295,12 +365,25 @@ static int seek_data(unsigned long super_id, unsigned long open_id, u64 offset,
     return 0;
 }
 
+/*
+ * Only the root has sub entries, they are the file nodes in image order so
+ * a list position indexes them directly
+ */
+static struct coreimg_node *list_sub(struct coreimg_node *node, unsigned long pos)
+{
+    if (node != &root_node || pos >= node->sub.count) {
+        return NULL;
+    }
+    
+    return &file_nodes[pos];
+}
+
 static int list(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned long *actual)
 {
     struct coreimg_node *sub = NULL;
     unsigned long len = 0;
     int result = 0;
-     
+    
     struct coreimg_open *open = NULL;
     struct coreimg_node *node = NULL;
     
@@ -314,21 +397,12 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
         return ECLOSED;
     }
     
-    // Sub entries have not yet been initialized
-    if (!node->sub.entries) {
-        return -1;
-    }
-    
     // No more entries
-    if (open->sub_pos >= node->sub.count) {
+    sub = list_sub(node, open->sub_pos);
+    if (!sub) {
         return -1;
     }
     
-    // Obtain the sub entry
-//     kprintf("to obtain at pos: %p, entries: %p, count: %p\n", open->sub_pos, node->sub.entries, node->sub.count);
-    sub = hash_obtain_at(node->sub.entries, open->sub_pos);
-//     kprintf("obtained: %p\n", sub);
-    
     // Copy the name
     if (buf) {
         len = strlen(sub->name) + 1;
@@ -343,13 +417,77 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
     }
     
     open->sub_pos++;
-    hash_release(node->sub.entries, NULL, sub);
-    
     node->list_time = time();
     
     return result;
 }
 
+static void fill_stat(struct coreimg_node *node, struct urs_stat *stat)
+{
+    stat->user_id = UA_USER_ID_SYSTEM;
+    stat->group_id = UA_GROUP_ID_SYSTEM;
+    stat->perm = UA_OWNER_PERM_ALL | UA_GROUP_PERM_ALL | UA_OTHER_PERM_NONE;
+    
+    stat->num_links = node->ref_count;
+    stat->sub_count = node->sub.count;
+    stat->data_size = node->data.size;
+    stat->occupied_size = stat->data_size;
+    
+    stat->create_time = node->create_time;
+    stat->read_time = node->read_time;
+    stat->write_time = node->write_time;
+    stat->list_time = node->list_time;
+    stat->change_time = node->change_time;
+}
+
+/*
+ * Packs as many entries as fit, ELIMIT if not even the next one does
+ */
+static int list_batch(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned int flags, unsigned long *actual)
+{
+    struct coreimg_node *sub = NULL;
+    struct urs_stat *stat = NULL;
+    unsigned long len = 0;
+    unsigned long size = 0;
+    
+    struct coreimg_open *open = NULL;
+    struct coreimg_node *node = NULL;
+    
+    open = get_open_by_id(open_id);
+    if (!open) {
+        return EBADF;
+    }
+    
+    node = open->node;
+    if (!node) {
+        return ECLOSED;
+    }
+    
+    for (sub = list_sub(node, open->sub_pos); sub; sub = list_sub(node, open->sub_pos)) {
+        size = urs_list_pack((u8 *)buf + len, count - len, sub->name, flags);
+        if (!size) {
+            break;
+        }
+        
+        stat = urs_list_entry_stat((struct urs_list_entry *)((u8 *)buf + len));
+        if (stat) {
+            memzero(stat, sizeof(struct urs_stat));
+            fill_stat(sub, stat);
+        }
+        
+        len += size;
+        open->sub_pos++;
+    }
+    
+    if (actual) {
+        *actual = len;
+    }
+    
+    node->list_time = time();
+    
+    return sub && !len ? ELIMIT : EOK;
+}
+
 static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset, enum urs_seek_from from, u64 *newpos)
 {
     unsigned long pos = 0;
@@ -424,21 +562,34 @@ static int stat(unsigned long super_id, unsigned long open_id, struct urs_stat *
     if (stat) {
         stat->super_id = 0;
         stat->open_dispatch_id = open->id;
-        
-        stat->user_id = UA_USER_ID_SYSTEM;
-        stat->group_id = UA_GROUP_ID_SYSTEM;
-        stat->perm = UA_OWNER_PERM_ALL | UA_GROUP_PERM_ALL | UA_OTHER_PERM_NONE;
-        
-        stat->num_links = node->ref_count;
-        stat->sub_count = node->sub.count;
-        stat->data_size = node->data.size;
-        stat->occupied_size = stat->data_size;
-        
-        stat->create_time = node->create_time;
-        stat->read_time = node->read_time;
-        stat->write_time = node->write_time;
-        stat->list_time = node->list_time;
-        stat->change_time = node->change_time;
+        fill_stat(node, stat);
+    }
+    
+    return EOK;
+}
+
+static int map(unsigned long super_id, unsigned long open_id, unsigned long *image_offset)
+{
+    struct coreimg_open *open = NULL;
+    struct coreimg_node *node = NULL;
+    
+    open = get_open_by_id(open_id);
+    if (!open) {
+        return EBADF;
+    }
+    
+    node = open->node;
+    if (!node) {
+        return ECLOSED;
+    }
+    
+    if (!node->data.data) {
+        return ENOENT;
+    }
+    
+    // File data is never modified, the kernel can share the pages of the image
+    if (image_offset) {
+        *image_offset = (unsigned long)node->data.data - (unsigned long)header;
     }
     
     return EOK;
@@ -505,6 +656,7 @@ void init_coreimgfs()
     unsigned long super_id = 0;
     
     OP_FUNC(uop_lookup, lookup);
+    OP_FUNC(uop_lookup_path, lookup_path);
     OP_FUNC(uop_open, open);
     OP_FUNC(uop_release, close);
     
@@ -512,11 +664,13 @@ void init_coreimgfs()
     OP_FUNC(uop_seek_data, seek_data);
     
     OP_FUNC(uop_list, list);
+    OP_FUNC(uop_list_batch, list_batch);
     OP_FUNC(uop_seek_list, seek_list);
     
     OP_FUNC(uop_stat, stat);
+    OP_FUNC(uop_map, map);
     
     // Register the FS
-    super_id = urs_register("coreimg://", "coreimgfs", 0, &ops);
+    super_id = urs_register("coreimg://", "coreimgfs", UREG_CACHE_WRITE_THROUGH, &ops);
     assert(super_id);
 }
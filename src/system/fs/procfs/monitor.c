@@ -7,6 +7,7 @@
 #include "klibc/include/stdstruct.h"
 #include "klibc/include/assert.h"
 #include "klibc/include/sys.h"
+#include "system/include/urs.h"
 
 
 /*
@@ -92,6 +93,9 @@ static asmlinkage void on_process_terminate_after(msg_t *msg)
     unsigned long ret_mbox_id = msg->mailbox_id;
     int errno = EOK;
     
+    // Opens left behind by the process go with its fd table
+    urs_close_process(msg->params[0].value);
+    
     // Setup the reply msg
     msg_t *r = syscall_msg();
     r->mailbox_id = ret_mbox_id;
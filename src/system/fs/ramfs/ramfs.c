@@ -1,6 +1,9 @@
 #include "common/include/data.h"
 #include "common/include/urs.h"
 #include "common/include/errno.h"
+#include "common/include/hash.h"
+#include "common/include/cycle.h"
+#include "common/include/atomic.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/string.h"
@@ -12,29 +15,63 @@
 #include "system/include/urs.h"
 
 
-#define RAMFS_BLOCK_SIZE    128
+#define RAMFS_NAME_MAX      128
 
+// File data is stored in heap chunks indexed by a radix tree
+#define RAMFS_CHUNK_SIZE    HALLOC_CHUNK_SIZE
+#define RAMFS_RADIX_BITS    6
+#define RAMFS_RADIX_FANOUT  (0x1 << RAMFS_RADIX_BITS)
+#define RAMFS_RADIX_MASK    (RAMFS_RADIX_FANOUT - 1)
 
-struct ramfs_block {
-    struct ramfs_block *prev;
-    struct ramfs_block *next;
-    
-    u8 data[RAMFS_BLOCK_SIZE];
+
+struct ramfs_radix {
+    void *slots[RAMFS_RADIX_FANOUT];
 };
 
 struct ramfs_data {
-    unsigned long block_count;
+    unsigned long chunk_count;
     unsigned long size;
     
-    struct ramfs_block *head;
-    struct ramfs_block *tail;
+    // Height 1 means the root holds chunks directly, 0 means no data at all
+    int height;
+    struct ramfs_radix *root;
+};
+
+struct ramfs_dirent {
+    struct ramfs_dirent *prev;
+    struct ramfs_dirent *next;
+    
+    unsigned long seq;
+    struct ramfs_node *node;
 };
 
 struct ramfs_sub {
     unsigned long count;
     hash_t *entries;
+    
+    // Entries in the order they were created, for listing
+    struct ramfs_dirent *head;
+    struct ramfs_dirent *tail;
+    unsigned long next_seq;
+    unsigned long remove_gen;
 };
 
+/*
+ * Locking
+ *  Every operation runs in the handler thread of its request, so the same
+ *  node may be used by several threads at once
+ *
+ *  - ID, parent, link, user, group, perm and create time never change once
+ *    the node is in the tree, they are read without a lock
+ *  - The node lock guards the data and the sub entries. Names of the sub
+ *    entries are hash keys, so a name is guarded by the lock of the parent
+ *  - Ref and open counts are atomic, access times are best effort and may be
+ *    written by readers
+ *  - The open lock guards the positions and the list cursor of the open
+ *
+ *  Lock order: open, then parent, then node. Remove takes the parent and then
+ *  the node for write, rename only needs the parent
+ */
 struct ramfs_node {
     unsigned long id;
     char *name;
@@ -43,8 +80,8 @@ struct ramfs_node {
     unsigned long group_id;
     unsigned int perm;
     
-    unsigned long ref_count;
-    unsigned long open_count;
+    volatile unsigned long ref_count;
+    volatile unsigned long open_count;
     
     time_t create_time;
     time_t read_time;
@@ -56,18 +93,27 @@ struct ramfs_node {
     struct ramfs_data data;
     struct ramfs_sub sub;
     char *link;
+    
+    kthread_rwlock_t lock;
 };
 
 struct ramfs_open {
     unsigned long id;
     struct ramfs_node *node;
+    kthread_mutex_t lock;
     
     unsigned long data_pos;
     unsigned long sub_pos;
+    
+    // List cursor, the last entry is only trusted if nothing was removed since
+    struct ramfs_dirent *list_last;
+    unsigned long list_seq;
+    unsigned long list_gen;
 };
 
 
-static unsigned long block_salloc_id;
+static unsigned long radix_salloc_id;
+static unsigned long dirent_salloc_id;
 static unsigned long node_salloc_id;
 static unsigned long open_salloc_id;
 static hash_t *ramfs_table;
@@ -78,14 +124,7 @@ static hash_t *ramfs_table;
  */
 static unsigned int urs_hash_func(void *key, unsigned int size)
 {
-    char *str = (char *)key;
-    unsigned int k = 0;
-    
-    do {
-        k += (unsigned int)(*str);
-    } while (*str++);
-    
-    return k % size;
+    return hash_str((char *)key) % size;
 }
 
 static int urs_hash_cmp(void *cmp_key, void *node_key)
@@ -99,157 +138,222 @@ static int urs_hash_cmp(void *cmp_key, void *node_key)
 
 /*
  * Data
+ *  Chunks that have never been written are holes and read back as zeros
  */
-static int seek_data_block(struct ramfs_data *data, unsigned long pos, unsigned long *real_pos, struct ramfs_block **cur_block, unsigned long *cur_offset)
+static struct ramfs_radix *new_radix()
 {
-    struct ramfs_block *block = data->head;
-    unsigned long offset = 0;
-    
-    if (pos > data->size) {
-        pos = data->size;
+    struct ramfs_radix *node = (struct ramfs_radix *)salloc(radix_salloc_id);
+    if (node) {
+        memzero(node, sizeof(struct ramfs_radix));
     }
     
-    offset = pos;
-    while (offset >= RAMFS_BLOCK_SIZE) {
-        offset -= RAMFS_BLOCK_SIZE;
-        assert(block);
-        block = block->next;
+    return node;
+}
+
+static u8 *get_chunk(struct ramfs_data *data, unsigned long index, int alloc)
+{
+    int h;
+    struct ramfs_radix *node = NULL;
+    void **slot = NULL;
+    
+    // Grow the tree until it covers the index
+    while (!data->height || (index >> (RAMFS_RADIX_BITS * data->height))) {
+        if (!alloc) {
+            return NULL;
+        }
+        
+        node = new_radix();
+        if (!node) {
+            return NULL;
+        }
+        
+        node->slots[0] = data->root;
+        data->root = node;
+        data->height++;
     }
     
-    if (real_pos) {
-        *real_pos = pos;
+    // Walk down
+    node = data->root;
+    for (h = data->height - 1; h > 0; h--) {
+        slot = &node->slots[(index >> (RAMFS_RADIX_BITS * h)) & RAMFS_RADIX_MASK];
+        if (!*slot) {
+            if (!alloc) {
+                return NULL;
+            }
+            
+            *slot = new_radix();
+            if (!*slot) {
+                return NULL;
+            }
+        }
+        
+        node = (struct ramfs_radix *)*slot;
     }
-    if (cur_block) {
-        *cur_block = block;
+    
+    slot = &node->slots[index & RAMFS_RADIX_MASK];
+    if (!*slot && alloc) {
+        *slot = halloc();
+        if (*slot) {
+            memzero(*slot, RAMFS_CHUNK_SIZE);
+            data->chunk_count++;
+        }
     }
-    if (cur_offset) {
-        *cur_offset = offset;
+    
+    return (u8 *)*slot;
+}
+
+/*
+ * Free all the chunks from index first on, returns 1 if the node became empty
+ */
+static int trim_radix(struct ramfs_data *data, struct ramfs_radix *node, int height, unsigned long first)
+{
+    int i;
+    int empty = 1;
+    unsigned long span = 0x1ul << (RAMFS_RADIX_BITS * (height - 1));
+    unsigned long start = 0;
+    
+    for (i = 0; i < RAMFS_RADIX_FANOUT; i++, start += span) {
+        if (!node->slots[i]) {
+            continue;
+        }
+        
+        // Entirely before the cut
+        if (start + span <= first) {
+            empty = 0;
+            continue;
+        }
+        
+        if (height == 1) {
+            hfree(node->slots[i]);
+            node->slots[i] = NULL;
+            data->chunk_count--;
+        } else if (trim_radix(data, node->slots[i], height - 1, first > start ? first - start : 0)) {
+            sfree(node->slots[i]);
+            node->slots[i] = NULL;
+        } else {
+            empty = 0;
+        }
     }
     
-    return 0;
+    return empty;
 }
 
 static unsigned long read_data_block(struct ramfs_data *data, unsigned long pos, u8 *buf, unsigned long count)
 {
-    int index = 0;
-    unsigned long cur_pos = pos;
-    
-    struct ramfs_block *block;
+    unsigned long index = 0;
     unsigned long offset = 0;
-    if (seek_data_block(data, pos, &cur_pos, &block, &offset)) {
+    unsigned long len = 0;
+    unsigned long done = 0;
+    u8 *chunk = NULL;
+    
+    if (pos >= data->size) {
         return 0;
     }
     
-    while (cur_pos < data->size && (unsigned long)index < count && block) {
-        // Copy data
-        buf[index] = block->data[offset];
-        index++;
-        offset++;
-        cur_pos++;
+    if (count > data->size - pos) {
+        count = data->size - pos;
+    }
+    
+    while (done < count) {
+        index = pos / RAMFS_CHUNK_SIZE;
+        offset = pos % RAMFS_CHUNK_SIZE;
         
-        // Move to next data block
-        if (offset == RAMFS_BLOCK_SIZE) {
-            block = block->next;
-            offset = 0;
+        len = RAMFS_CHUNK_SIZE - offset;
+        if (len > count - done) {
+            len = count - done;
         }
+        
+        chunk = get_chunk(data, index, 0);
+        if (chunk) {
+            memcpy(buf + done, chunk + offset, len);
+        } else {
+            memzero(buf + done, len);
+        }
+        
+        done += len;
+        pos += len;
     }
     
-//     kprintf("data read: %s, size: %p\n", (char *)buf, index);
-    return index;
+//     kprintf("data read: %s, size: %p\n", (char *)buf, done);
+    return done;
 }
 
 static unsigned long write_data_block(struct ramfs_data *data, unsigned long pos, u8 *buf, unsigned long count)
 {
-    int index = 0;
-    unsigned long cur_pos = pos;
-    
-    struct ramfs_block *block;
+    unsigned long index = 0;
     unsigned long offset = 0;
-    if (seek_data_block(data, pos, &cur_pos, &block, &offset)) {
-        return 0;
-    }
+    unsigned long len = 0;
+    unsigned long done = 0;
+    u8 *chunk = NULL;
     
 //     kprintf("write, buf: %s, count: %p\n", buf, count);
     
-    while ((unsigned long)index < count) {
-        // Allocate a new block if necessary
-        if (!block) {
-            block = (struct ramfs_block *)salloc(block_salloc_id);
-            offset = 0;
-            
-            block->next = NULL;
-            block->prev = data->tail;
-            
-            if (data->tail) {
-                data->tail->next = block;
-            }
-            
-            data->tail = block;
-            if (!data->head) {
-                data->head = block;
-            }
-            
-            data->block_count++;
-        }
+    while (done < count) {
+        index = pos / RAMFS_CHUNK_SIZE;
+        offset = pos % RAMFS_CHUNK_SIZE;
         
-        // Copy data
-        block->data[offset] = buf[index];
-        index++;
-        offset++;
-        cur_pos++;
-        data->size++;
+        len = RAMFS_CHUNK_SIZE - offset;
+        if (len > count - done) {
+            len = count - done;
+        }
         
-        // Move to next data block
-        if (offset == RAMFS_BLOCK_SIZE) {
-            block = block->next;
-            offset = 0;
+        // Out of memory, report what has been written so far
+        chunk = get_chunk(data, index, 1);
+        if (!chunk) {
+            break;
         }
+        
+        memcpy(chunk + offset, buf + done, len);
+        
+        done += len;
+        pos += len;
+    }
+    
+    if (pos > data->size) {
+        data->size = pos;
     }
     
-    return index;
+    return done;
 }
 
 static int truncate_data_block(struct ramfs_data *data, unsigned long pos)
 {
-    unsigned long cur_pos = pos;
-    struct ramfs_block *block;
-    unsigned long offset = 0;
-    if (seek_data_block(data, pos, &cur_pos, &block, &offset)) {
-        return 0;
+    unsigned long first = (pos + RAMFS_CHUNK_SIZE - 1) / RAMFS_CHUNK_SIZE;
+    u8 *chunk = NULL;
+    
+    // Clear the tail of the last chunk so that extending the file later reads zeros
+    if (pos % RAMFS_CHUNK_SIZE) {
+        chunk = get_chunk(data, pos / RAMFS_CHUNK_SIZE, 0);
+        if (chunk) {
+            memzero(chunk + pos % RAMFS_CHUNK_SIZE, RAMFS_CHUNK_SIZE - pos % RAMFS_CHUNK_SIZE);
+        }
     }
     
-    // Mark cur block as the last block
-    data->tail = block;
-    block->next = NULL;
-    
-    // Free following blocks
-    block = block->next;
-    while (block) {
-        struct ramfs_block *next = block->next;
-        sfree(block);
-        data->block_count--;
-        block = next;
+    // Free following chunks
+    if (data->root && trim_radix(data, data->root, data->height, first)) {
+        sfree(data->root);
+        data->root = NULL;
+        data->height = 0;
     }
     
     // Set file size
-    data->size = cur_pos;
+    data->size = pos;
     
     return 0;
 }
 
 static void free_data_block(struct ramfs_data *data)
 {
-    // Free all blocks
-    struct ramfs_block *block = data->head;
-    while (block) {
-        struct ramfs_block *next = block->next;
-        sfree(block);
-        block = next;
+    // Free all chunks
+    if (data->root) {
+        trim_radix(data, data->root, data->height, 0);
+        sfree(data->root);
     }
     
     // Reset data
-    data->block_count = 0;
-    data->head = data->tail = NULL;
+    data->chunk_count = 0;
+    data->height = 0;
+    data->root = NULL;
     data->size = 0;
 }
 
@@ -269,18 +373,23 @@ static struct ramfs_node *create_node(const char *name, struct ramfs_node *paren
     node->id = (unsigned long)node;
     node->name = strdup(name);
     node->ref_count = 0;
+    node->open_count = 0;
     
     node->parent = parent;
     
-    node->data.block_count = 0;
+    node->data.chunk_count = 0;
     node->data.size = 0;
-    node->data.head = NULL;
-    node->data.tail = NULL;
+    node->data.height = 0;
+    node->data.root = NULL;
     
     node->sub.count = 0;
     node->sub.entries = NULL;
+    node->sub.head = node->sub.tail = NULL;
+    node->sub.next_seq = 0;
+    node->sub.remove_gen = 0;
     
     node->link = NULL;
+    kthread_rwlock_init(&node->lock);
     
     node->create_time = time();
     node->read_time = 0;
@@ -306,46 +415,141 @@ static struct ramfs_open *create_open(unsigned long super_id, unsigned long node
     
     open->id = (unsigned long)open;
     open->node = node;
+    kthread_mutex_init(&open->lock);
     
     open->data_pos = 0;
     open->sub_pos = 0;
     
+    open->list_last = NULL;
+    open->list_seq = 0;
+    open->list_gen = node->sub.remove_gen;
+    
     return open;
 }
 
 
 /*
- * Node
+ * Sub entries
+ *  The hash maps names to entries, the entries are also kept in the order
+ *  they were created so a list resumes right where the last one stopped
  */
-static int lookup(unsigned long super_id, unsigned long node_id, unsigned long proc_id, const char *name, int *is_link,
-                  unsigned long *next_id, void *buf, unsigned long count, unsigned long *actual)
+static struct ramfs_node *obtain_sub(struct ramfs_node *node, const char *name)
 {
-    struct ramfs_node *node = NULL, *next = NULL;
+    struct ramfs_dirent *dirent = (struct ramfs_dirent *)hash_obtain(node->sub.entries, (void *)name);
+    hash_release(node->sub.entries, (void *)name, dirent);
     
-//     kprintf("Lookup received, super_id: %p, node_id: %lu, name: %s\n", super_id, node_id, name);
+    return dirent ? dirent->node : NULL;
+}
+
+static int insert_sub(struct ramfs_node *node, struct ramfs_node *sub)
+{
+    struct ramfs_dirent *dirent = (struct ramfs_dirent *)salloc(dirent_salloc_id);
+    if (!dirent) {
+        return -1;
+    }
     
-    // Find out the next node
-    if (node_id) {
-        node = get_node_by_id(super_id, node_id);
-        assert(node);
-        
-        node->ref_count--;
-        if (!node->sub.count) {
-            return 0;
-        }
-        
-        next = (struct ramfs_node *)hash_obtain(node->sub.entries, (void *)name);
-        if (!next) {
-            hash_release(node->sub.entries, (void *)name, next);
-            return 0;
-        }
+    if (!node->sub.entries) {
+        node->sub.entries = hash_new(0, urs_hash_func, urs_hash_cmp);
+    }
+    
+    if (hash_insert(node->sub.entries, sub->name, dirent)) {
+        sfree(dirent);
+        return -1;
+    }
+    
+    dirent->node = sub;
+    dirent->seq = node->sub.next_seq++;
+    dirent->next = NULL;
+    dirent->prev = node->sub.tail;
+    
+    if (node->sub.tail) {
+        node->sub.tail->next = dirent;
     } else {
-        node = (struct ramfs_node *)hash_obtain(ramfs_table, (void *)super_id);
-        hash_release(ramfs_table, (void *)super_id, node);
-        next = node;
-        assert(next);
+        node->sub.head = dirent;
+    }
+    node->sub.tail = dirent;
+    node->sub.count++;
+    
+    return 0;
+}
+
+static void remove_sub(struct ramfs_node *node, struct ramfs_node *sub)
+{
+    struct ramfs_dirent *dirent = (struct ramfs_dirent *)hash_obtain(node->sub.entries, sub->name);
+    hash_release(node->sub.entries, sub->name, dirent);
+    assert(dirent);
+    
+    hash_remove(node->sub.entries, sub->name);
+    
+    if (dirent->prev) {
+        dirent->prev->next = dirent->next;
+    } else {
+        node->sub.head = dirent->next;
+    }
+    
+    if (dirent->next) {
+        dirent->next->prev = dirent->prev;
+    } else {
+        node->sub.tail = dirent->prev;
+    }
+    
+    // Cursors of opens on this node may point to the entry
+    node->sub.remove_gen++;
+    node->sub.count--;
+    
+    sfree(dirent);
+}
+
+static struct ramfs_dirent *list_next_sub(struct ramfs_open *open, struct ramfs_node *node)
+{
+    struct ramfs_dirent *dirent = NULL;
+    
+    if (open->list_gen == node->sub.remove_gen) {
+        return open->list_last ? open->list_last->next : node->sub.head;
     }
     
+    // Something was removed, resume from the first entry after the last one listed
+    for (dirent = node->sub.head; dirent && dirent->seq < open->list_seq; dirent = dirent->next);
+    
+    open->list_last = dirent ? dirent->prev : node->sub.tail;
+    open->list_gen = node->sub.remove_gen;
+    
+    return dirent;
+}
+
+static void list_advance(struct ramfs_open *open, struct ramfs_dirent *dirent)
+{
+    open->list_last = dirent;
+    open->list_seq = dirent->seq + 1;
+    open->sub_pos++;
+}
+
+static void list_seek(struct ramfs_open *open, struct ramfs_node *node, unsigned long pos)
+{
+    struct ramfs_dirent *dirent = NULL;
+    unsigned long i;
+    
+    for (i = 0, dirent = node->sub.head; i < pos && dirent; i++, dirent = dirent->next);
+    
+    open->list_last = dirent ? dirent->prev : node->sub.tail;
+    open->list_seq = dirent ? dirent->seq : node->sub.next_seq;
+    open->list_gen = node->sub.remove_gen;
+    open->sub_pos = pos;
+}
+
+
+/*
+ * Node
+ */
+
+/*
+ * Reports next as the result of a lookup, the caller must hold the lock of
+ * the parent of next so that a concurrent remove can not free it meanwhile.
+ * A regular node gets a reference for the caller, a link has its target copied
+ */
+static void set_lookup_result(struct ramfs_node *next, int *is_link, unsigned long *next_id,
+                              void *buf, unsigned long count, unsigned long *actual)
+{
     // Sym link
     if (next->link) {
         unsigned long cpy_index = 0;
@@ -370,7 +574,7 @@ static int lookup(unsigned long super_id, unsigned long node_id, unsigned long p
     
     // Regular node
     else {
-        next->ref_count++;
+        atomic_inc(&next->ref_count);
         
         if (is_link) {
             *is_link = 0;
@@ -380,9 +584,123 @@ static int lookup(unsigned long super_id, unsigned long node_id, unsigned long p
             *next_id = next->id;
         }
     }
+}
+
+static int lookup(unsigned long super_id, unsigned long node_id, unsigned long proc_id, const char *name, int *is_link,
+                  unsigned long *next_id, void *buf, unsigned long count, unsigned long *actual)
+{
+    struct ramfs_node *node = NULL, *next = NULL;
     
+//     kprintf("Lookup received, super_id: %p, node_id: %lu, name: %s\n", super_id, node_id, name);
+    
+    // Find out the next node
     if (node_id) {
-        hash_release(node->sub.entries, (void *)name, next);
+        node = get_node_by_id(super_id, node_id);
+        assert(node);
+        
+        kthread_rwlock_rdlock(&node->lock);
+        next = node->sub.count ? obtain_sub(node, name) : NULL;
+        if (next) {
+            set_lookup_result(next, is_link, next_id, buf, count, actual);
+        }
+        kthread_rwlock_rdunlock(&node->lock);
+        
+        // The reference of the caller moves on to the next node
+        atomic_dec(&node->ref_count);
+    } else {
+        node = (struct ramfs_node *)hash_obtain(ramfs_table, (void *)super_id);
+        hash_release(ramfs_table, (void *)super_id, node);
+        assert(node);
+        
+        // Root is never removed
+        set_lookup_result(node, is_link, next_id, buf, count, actual);
+    }
+    
+    return 0;
+}
+
+/*
+ * Whole path lookup, resolves as many components as possible starting at
+ * node_id. Stops right after a sym link, and also before a name that is too
+ * long, so the caller resolves the rest one component at a time.
+ * Locks are coupled down the path, the lock of the next node is taken before
+ * the current one is dropped, so no node on the way can be removed
+ */
+static int lookup_path(unsigned long super_id, unsigned long node_id, unsigned long proc_id, const char *path, int *is_link,
+                       unsigned long *next_id, unsigned long *consumed, void *buf, unsigned long count, unsigned long *actual)
+{
+    struct ramfs_node *start = NULL, *node = NULL, *next = NULL;
+    char name[RAMFS_NAME_MAX];
+    unsigned long pos = 0;
+    unsigned long len = 0;
+    
+    start = get_node_by_id(super_id, node_id);
+    assert(start);
+    
+    if (is_link) {
+        *is_link = 0;
+    }
+    if (next_id) {
+        *next_id = 0;
+    }
+    
+    node = start;
+    kthread_rwlock_rdlock(&node->lock);
+    
+    while (path[pos]) {
+        if (path[pos] == '/') {
+            pos++;
+            continue;
+        }
+        
+        // Get the next name
+        len = 0;
+        while (path[pos + len] && path[pos + len] != '/') {
+            len++;
+        }
+        
+        if (len >= RAMFS_NAME_MAX) {
+            break;
+        }
+        
+        memcpy(name, &path[pos], len);
+        name[len] = '\0';
+        
+        // Find out the next node
+        next = node->sub.count ? obtain_sub(node, name) : NULL;
+        if (!next) {
+            kthread_rwlock_rdunlock(&node->lock);
+            atomic_dec(&start->ref_count);
+            return 0;
+        }
+        
+        pos += len;
+        
+        // Sym link, let the caller follow it
+        if (next->link) {
+            set_lookup_result(next, is_link, next_id, buf, count, actual);
+            kthread_rwlock_rdunlock(&node->lock);
+            atomic_dec(&start->ref_count);
+            
+            if (consumed) {
+                *consumed = pos;
+            }
+            
+            return 0;
+        }
+        
+        kthread_rwlock_rdlock(&next->lock);
+        kthread_rwlock_rdunlock(&node->lock);
+        node = next;
+    }
+    
+    // Set results, the reference of the caller moves on to the last node
+    set_lookup_result(node, is_link, next_id, buf, count, actual);
+    kthread_rwlock_rdunlock(&node->lock);
+    atomic_dec(&start->ref_count);
+    
+    if (consumed) {
+        *consumed = pos;
     }
     
     return 0;
@@ -404,6 +722,7 @@ static int open(unsigned long super_id, unsigned long node_id, unsigned long pro
         *open_id = open->id;
     }
     
+    atomic_inc(&node->open_count);
     node->change_time = time();
     
     return EOK;
@@ -416,10 +735,13 @@ static int close(unsigned long super_id, unsigned long open_id)
         return EBADF;
     }
     
-    open->node->change_time = time();
+    // The node is gone if it was removed through this open
+    if (open->node) {
+        open->node->change_time = time();
+        atomic_dec(&open->node->open_count);
+    }
     
-    // FIXME: Lock needed
-    open->node->open_count--;
+    kthread_mutex_destroy(&open->lock);
     sfree(open);
     
     return EOK;
@@ -428,20 +750,34 @@ static int close(unsigned long super_id, unsigned long open_id)
 static int read(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned long *actual)
 {
     unsigned long result = 0;
+    struct ramfs_node *node = NULL;
     
     struct ramfs_open *open = get_open_by_id(open_id);
     if (!open) {
         return EBADF;
     }
     
-    result = read_data_block(&open->node->data, (unsigned long)open->data_pos, buf, count);
+    kthread_mutex_lock(&open->lock);
+    
+    node = open->node;
+    if (!node) {
+        kthread_mutex_unlock(&open->lock);
+        return ECLOSED;
+    }
+    
+    // Readers of the same node go in parallel
+    kthread_rwlock_rdlock(&node->lock);
+    result = read_data_block(&node->data, (unsigned long)open->data_pos, buf, count);
+    kthread_rwlock_rdunlock(&node->lock);
+    
     open->data_pos += result;
+    kthread_mutex_unlock(&open->lock);
     
     if (actual) {
         *actual = result;
     }
     
-    open->node->read_time = time();
+    node->read_time = time();
     
     return 0;
 }
@@ -449,20 +785,33 @@ static int read(unsigned long super_id, unsigned long open_id, void *buf, unsign
 static int write(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned long *actual)
 {
     unsigned long result = 0;
+    struct ramfs_node *node = NULL;
     
     struct ramfs_open *open = get_open_by_id(open_id);
     if (!open) {
         return EBADF;
     }
     
-    result = write_data_block(&open->node->data, (unsigned long)open->data_pos, buf, count);
+    kthread_mutex_lock(&open->lock);
+    
+    node = open->node;
+    if (!node) {
+        kthread_mutex_unlock(&open->lock);
+        return ECLOSED;
+    }
+    
+    kthread_rwlock_wrlock(&node->lock);
+    result = write_data_block(&node->data, (unsigned long)open->data_pos, buf, count);
+    kthread_rwlock_wrunlock(&node->lock);
+    
     open->data_pos += result;
+    kthread_mutex_unlock(&open->lock);
     
     if (actual) {
         *actual = result;
     }
     
-    open->node->write_time = time();
+    node->write_time = time();
     
     return 0;
 }
@@ -470,15 +819,28 @@ static int write(unsigned long super_id, unsigned long open_id, void *buf, unsig
 static int truncate(unsigned long super_id, unsigned long open_id)
 {
     int result = 0;
+    struct ramfs_node *node = NULL;
     
     struct ramfs_open *open = get_open_by_id(open_id);
     if (!open) {
         return EBADF;
     }
     
-    result = truncate_data_block(&open->node->data, (unsigned long)open->data_pos);
+    kthread_mutex_lock(&open->lock);
     
-    open->node->write_time = time();
+    node = open->node;
+    if (!node) {
+        kthread_mutex_unlock(&open->lock);
+        return ECLOSED;
+    }
+    
+    kthread_rwlock_wrlock(&node->lock);
+    result = truncate_data_block(&node->data, (unsigned long)open->data_pos);
+    kthread_rwlock_wrunlock(&node->lock);
+    
+    kthread_mutex_unlock(&open->lock);
+    
+    node->write_time = time();
     
     return result;
 }
@@ -495,23 +857,21 @@ static int seek_data(unsigned long super_id, unsigned long open_id, u64 offset,
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
+    // Seeking past the end is allowed, writing there leaves a hole
     switch (from) {
     case seek_from_begin:
         pos = (unsigned long)offset;
-        if (pos > node->data.size) {
-            pos = node->data.size;
-        }
         break;
     case seek_from_cur_fwd:
         pos = open->data_pos + (unsigned long)offset;
-        if (pos > node->data.size) {
-            pos = node->data.size;
-        }
         break;
     case seek_from_cur_bwd:
         if (open->data_pos > (unsigned long)offset) {
@@ -521,17 +881,21 @@ static int seek_data(unsigned long super_id, unsigned long open_id, u64 offset,
         }
         break;
     case seek_from_end:
+        kthread_rwlock_rdlock(&node->lock);
         if (node->data.size > (unsigned long)offset) {
             pos = node->data.size - (unsigned long)offset;
         } else {
             pos = 0;
         }
+        kthread_rwlock_rdunlock(&node->lock);
         break;
     default:
         break;
     }
     
     open->data_pos = (u64)pos;
+    kthread_mutex_unlock(&open->lock);
+    
     if (newpos) {
         *newpos = (u64)pos;
     }
@@ -541,10 +905,11 @@ static int seek_data(unsigned long super_id, unsigned long open_id, u64 offset,
 
 static int list(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned long *actual)
 {
+    struct ramfs_dirent *dirent = NULL;
     struct ramfs_node *sub = NULL;
     unsigned long len = 0;
     int result = 0;
-     
+    
     struct ramfs_open *open = NULL;
     struct ramfs_node *node = NULL;
     
@@ -553,25 +918,24 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
-    // Sub entries have not yet been initialized
-    if (!node->sub.entries) {
-        return -1;
-    }
+    kthread_rwlock_rdlock(&node->lock);
     
     // No more entries
-    if (open->sub_pos >= node->sub.count) {
+    dirent = list_next_sub(open, node);
+    if (!dirent) {
+        kthread_rwlock_rdunlock(&node->lock);
+        kthread_mutex_unlock(&open->lock);
         return -1;
     }
-    
-    // Obtain the sub entry
-//     kprintf("to obtain at pos: %p, entries: %p, count: %p\n", open->sub_pos, node->sub.entries, node->sub.count);
-    sub = hash_obtain_at(node->sub.entries, open->sub_pos);
-//     kprintf("obtained: %p\n", sub);
+    sub = dirent->node;
     
     // Copy the name
     if (buf) {
@@ -586,14 +950,91 @@ static int list(unsigned long super_id, unsigned long open_id, void *buf, unsign
         *actual = len;
     }
     
-    open->sub_pos++;
-    hash_release(node->sub.entries, NULL, sub);
+    list_advance(open, dirent);
+    
+    kthread_rwlock_rdunlock(&node->lock);
+    kthread_mutex_unlock(&open->lock);
     
     node->list_time = time();
     
     return result;
 }
 
+static void fill_stat(struct ramfs_node *node, struct urs_stat *stat)
+{
+    stat->user_id = node->user_id;
+    stat->group_id = node->group_id;
+    stat->perm = node->perm;
+    
+    stat->num_links = node->ref_count;
+    stat->sub_count = node->sub.count;
+    stat->data_size = node->data.size;
+    stat->occupied_size = stat->data_size;
+    
+    stat->create_time = node->create_time;
+    stat->read_time = node->read_time;
+    stat->write_time = node->write_time;
+    stat->list_time = node->list_time;
+    stat->change_time = node->change_time;
+}
+
+/*
+ * Packs as many entries as fit, ELIMIT if not even the next one does.
+ * Sizes and times of the sub nodes are read without their locks
+ */
+static int list_batch(unsigned long super_id, unsigned long open_id, void *buf, unsigned long count, unsigned int flags, unsigned long *actual)
+{
+    struct ramfs_dirent *dirent = NULL;
+    struct urs_stat *stat = NULL;
+    unsigned long len = 0;
+    unsigned long size = 0;
+    
+    struct ramfs_open *open = NULL;
+    struct ramfs_node *node = NULL;
+    
+    open = get_open_by_id(open_id);
+    if (!open) {
+        return EBADF;
+    }
+    
+    kthread_mutex_lock(&open->lock);
+    
+    node = open->node;
+    if (!node) {
+        kthread_mutex_unlock(&open->lock);
+        return ECLOSED;
+    }
+    
+    kthread_rwlock_rdlock(&node->lock);
+    
+    for (dirent = list_next_sub(open, node); dirent; dirent = dirent->next) {
+        size = urs_list_pack((u8 *)buf + len, count - len, dirent->node->name, flags);
+        if (!size) {
+            break;
+        }
+        
+        stat = urs_list_entry_stat((struct urs_list_entry *)((u8 *)buf + len));
+        if (stat) {
+            memzero(stat, sizeof(struct urs_stat));
+            fill_stat(dirent->node, stat);
+        }
+        
+        len += size;
+        list_advance(open, dirent);
+    }
+    
+    kthread_rwlock_rdunlock(&node->lock);
+    kthread_mutex_unlock(&open->lock);
+    
+    if (actual) {
+        *actual = len;
+    }
+    
+    node->list_time = time();
+    
+    return dirent && !len ? ELIMIT : EOK;
+}
+
 static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset, enum urs_seek_from from, u64 *newpos)
 {
     unsigned long pos = 0;
@@ -606,11 +1047,16 @@ static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset,
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
+    kthread_rwlock_rdlock(&node->lock);
+    
     switch (from) {
     case seek_from_begin:
         pos = (unsigned long)offset;
@@ -642,7 +1088,11 @@ static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset,
         break;
     }
     
-    open->sub_pos = (u64)pos;
+    list_seek(open, node, pos);
+    
+    kthread_rwlock_rdunlock(&node->lock);
+    kthread_mutex_unlock(&open->lock);
+    
     if (newpos) {
         *newpos = (u64)pos;
     }
@@ -653,6 +1103,7 @@ static int seek_list(unsigned long super_id, unsigned long open_id, u64 offset,
 static int create(unsigned long super_id, unsigned long open_id, char *name, enum urs_create_type type, unsigned int flags, char *target, unsigned long target_open_id)
 {
     struct ramfs_node *sub = NULL;
+    int error = 0;
     
     struct ramfs_open *open = NULL;
     struct ramfs_node *node = NULL;
@@ -662,11 +1113,17 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
+    // Node structs are never freed, the node lock is all that is needed from here on
+    kthread_mutex_unlock(&open->lock);
+    
     switch (type) {
     case ucreate_node:
         sub = create_node(name, node);
@@ -680,9 +1137,8 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
         if (!target_open) {
             return EBADF;
         }
-        sub = open->node;
-        assert(sub);
-        sub->ref_count++;
+        sub = node;
+        atomic_inc(&sub->ref_count);
         break;
     }
     case ucreate_dyn_link:
@@ -694,13 +1150,13 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
     }
     
     if (sub) {
-        if (!node->sub.entries) {
-            node->sub.entries = hash_new(0, urs_hash_func, urs_hash_cmp);
-            kprintf("New has table created @ %p\n", node->sub.entries);
-        }
-        
         kprintf("To insert into hash table, name: %s, sub: %p\n", name, sub);
-        if (hash_insert(node->sub.entries, sub->name, sub)) {
+        
+        kthread_rwlock_wrlock(&node->lock);
+        error = insert_sub(node, sub);
+        kthread_rwlock_wrunlock(&node->lock);
+        
+        if (error) {
             if (sub->link) {
                 free(sub->link);
             }
@@ -708,8 +1164,6 @@ static int create(unsigned long super_id, unsigned long open_id, char *name, enu
             sfree(sub);
             return -2;
         };
-        
-        node->sub.count++;
     }
     
     return 0;
@@ -726,8 +1180,11 @@ static int remove(unsigned long super_id, unsigned long open_id, int erase)
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
@@ -736,11 +1193,19 @@ static int remove(unsigned long super_id, unsigned long open_id, int erase)
     // Get the parent and make sure this is not root
     parent = node->parent;
     if (!parent) {
+        kthread_mutex_unlock(&open->lock);
         return -2;
     }
     
+    // Parent first, then the node
+    kthread_rwlock_wrlock(&parent->lock);
+    kthread_rwlock_wrlock(&node->lock);
+    
     // Make sure this node does not have any sub entries
     if (node->sub.count) {
+        kthread_rwlock_wrunlock(&node->lock);
+        kthread_rwlock_wrunlock(&parent->lock);
+        kthread_mutex_unlock(&open->lock);
         return -1;
     }
     
@@ -748,13 +1213,11 @@ static int remove(unsigned long super_id, unsigned long open_id, int erase)
     assert(parent->sub.entries);
     assert(parent->sub.count);
     
-    hash_remove(parent->sub.entries, node->name);
-    parent->sub.count--;
-    
-    // Free this node
-    node->ref_count--;
+    remove_sub(parent, node);
+    kthread_rwlock_wrunlock(&parent->lock);
     
-    if (!node->ref_count) {
+    // Free this node, other opens may still be reading it
+    if (atomic_xadd(&node->ref_count, (unsigned long)-1) == 1) {
         if (node->sub.entries) {
             sfree(node->sub.entries);
         }
@@ -765,10 +1228,14 @@ static int remove(unsigned long super_id, unsigned long open_id, int erase)
         free(node->name);
     }
     
+    kthread_rwlock_wrunlock(&node->lock);
+    
     // Emptify open
     open->node = NULL;
     open->data_pos = open->sub_pos = 0;
     
+    kthread_mutex_unlock(&open->lock);
+    
     return EOK;
 }
 
@@ -784,25 +1251,45 @@ static int rename(unsigned long super_id, unsigned long open_id, char *name)
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
     parent = node->parent;
     if (!parent) {
+        kthread_mutex_unlock(&open->lock);
         return -2;
     }
     
+    // The name is a key in the parent, so the lock of the parent covers it
+    kthread_rwlock_wrlock(&parent->lock);
+    
+    // The entry keeps its place in the list
+    struct ramfs_dirent *dirent = (struct ramfs_dirent *)hash_obtain(parent->sub.entries, node->name);
+    hash_release(parent->sub.entries, node->name, dirent);
+    
+    // The key is the name of the node, the name in the msg goes away after this
+    char *new_name = strdup(name);
+    int error = EOK;
+    
     hash_remove(parent->sub.entries, node->name);
-    if (hash_insert(parent->sub.entries, name, node)) {
+    if (!hash_insert(parent->sub.entries, new_name, dirent)) {
         free(node->name);
-        node->name = strdup(name);
+        node->name = new_name;
     } else {
-        hash_insert(parent->sub.entries, node->name, node);
+        free(new_name);
+        hash_insert(parent->sub.entries, node->name, dirent);
+        error = -2;
     }
     
-    return EOK;
+    kthread_rwlock_wrunlock(&parent->lock);
+    kthread_mutex_unlock(&open->lock);
+    
+    return error;
 }
 
 static int stat(unsigned long super_id, unsigned long open_id, struct urs_stat *stat)
@@ -815,8 +1302,11 @@ static int stat(unsigned long super_id, unsigned long open_id, struct urs_stat *
         return EBADF;
     }
     
+    kthread_mutex_lock(&open->lock);
+    
     node = open->node;
     if (!node) {
+        kthread_mutex_unlock(&open->lock);
         return ECLOSED;
     }
     
@@ -824,26 +1314,16 @@ static int stat(unsigned long super_id, unsigned long open_id, struct urs_stat *
         stat->super_id = 0;
         stat->open_dispatch_id = open->id;
         
-        stat->user_id = node->user_id;
-        stat->group_id = node->group_id;
-        stat->perm = node->perm;
-        
-        stat->num_links = node->ref_count;
-        stat->sub_count = node->sub.count;
-        stat->data_size = node->data.size;
-        stat->occupied_size = stat->data_size;
-        
-        stat->create_time = node->create_time;
-        stat->read_time = node->read_time;
-        stat->write_time = node->write_time;
-        stat->list_time = node->list_time;
-        stat->change_time = node->change_time;
+        kthread_rwlock_rdlock(&node->lock);
+        fill_stat(node, stat);
+        kthread_rwlock_rdunlock(&node->lock);
     }
     
+    kthread_mutex_unlock(&open->lock);
+    
     return EOK;
 }
 
-
 // /*
 //  * Message handler
 //  */
@@ -1107,6 +1587,7 @@ int register_ramfs(char *path)
     unsigned long super_id = 0;
     
     OP_FUNC(uop_lookup, lookup);
+    OP_FUNC(uop_lookup_path, lookup_path);
     OP_FUNC(uop_open, open);
     OP_FUNC(uop_release, close);
     
@@ -1116,6 +1597,7 @@ int register_ramfs(char *path)
     OP_FUNC(uop_seek_data, seek_data);
     
     OP_FUNC(uop_list, list);
+    OP_FUNC(uop_list_batch, list_batch);
     OP_FUNC(uop_seek_list, seek_list);
     
     OP_FUNC(uop_create, create);
@@ -1125,7 +1607,7 @@ int register_ramfs(char *path)
     OP_FUNC(uop_stat, stat);
     
     // Register the FS
-    super_id = urs_register(path, "ramfs", 0, &ops);
+    super_id = urs_register(path, "ramfs", UREG_CACHE_WRITE_BACK, &ops);
     if (!super_id) {
         return -2;
     }
@@ -1149,7 +1631,8 @@ void init_ramfs()
     ramfs_table = hash_new(0, NULL, NULL);
     open_salloc_id = salloc_create(sizeof(struct ramfs_open), 0, NULL, NULL);
     node_salloc_id = salloc_create(sizeof(struct ramfs_node), 0, NULL, NULL);
-    block_salloc_id = salloc_create(sizeof(struct ramfs_block), 0, NULL, NULL);
+    dirent_salloc_id = salloc_create(sizeof(struct ramfs_dirent), 0, NULL, NULL);
+    radix_salloc_id = salloc_create(sizeof(struct ramfs_radix), 0, NULL, NULL);
     
     register_ramfs("ramfs://");
 }
@@ -1206,3 +1689,262 @@ void test_ramfs()
 //     buf[127] = '\0';
 //     kprintf("count: %lu, str: %s\n", size, buf);
 }
+
+
+/*
+ * I/O benchmark, 4 KB requests on a 64 MB file
+ */
+#define RAMFS_BENCH_FILE_SHIFT  26
+#define RAMFS_BENCH_IO_SHIFT    12
+#define RAMFS_BENCH_FILE_SIZE   (0x1ul << RAMFS_BENCH_FILE_SHIFT)
+#define RAMFS_BENCH_IO_SIZE     (0x1ul << RAMFS_BENCH_IO_SHIFT)
+#define RAMFS_BENCH_IO_COUNT    (0x1ul << (RAMFS_BENCH_FILE_SHIFT - RAMFS_BENCH_IO_SHIFT))
+
+// No process has ID 0, the fds of the benchmark get a table of their own
+#define RAMFS_BENCH_PROC_ID     0
+
+static unsigned long bench_rand(unsigned long *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) % RAMFS_BENCH_IO_COUNT;
+}
+
+static void bench_report_io(char *name, u64 cycles)
+{
+    // The op count is a power of 2, so no 64-bit division is needed
+    kprintf("[ramfs] %s: %u cycles per 4 KB op (%u ops)\n",
+            name, (unsigned long)(cycles >> (RAMFS_BENCH_FILE_SHIFT - RAMFS_BENCH_IO_SHIFT)), RAMFS_BENCH_IO_COUNT);
+}
+
+static int bench_io(unsigned long f, unsigned long index, u8 *buf, int write)
+{
+    int err = 0;
+    u64 pos = 0;
+    unsigned long actual = 0;
+    
+    err = urs_seek_data(RAMFS_BENCH_PROC_ID, f, (u64)index * RAMFS_BENCH_IO_SIZE, seek_from_begin, &pos);
+    if (!err) {
+        if (write) {
+            err = urs_write_node(RAMFS_BENCH_PROC_ID, f, buf, RAMFS_BENCH_IO_SIZE, &actual);
+        } else {
+            err = urs_read_node(RAMFS_BENCH_PROC_ID, f, buf, RAMFS_BENCH_IO_SIZE, &actual);
+        }
+    }
+    
+    return err || actual != RAMFS_BENCH_IO_SIZE;
+}
+
+void test_ramfs_io()
+{
+    unsigned long i;
+    unsigned long seed = 1;
+    unsigned long actual = 0;
+    unsigned long dir = 0, f = 0;
+    u64 start, cycles;
+    u64 pos = 0;
+    
+    static u8 buf[RAMFS_BENCH_IO_SIZE];
+    
+    kprintf("[ramfs] I/O benchmark, file size: %u MB\n", RAMFS_BENCH_FILE_SIZE >> 20);
+    
+    dir = urs_open_node("ramfs://", 0, RAMFS_BENCH_PROC_ID);
+    assert(dir);
+    urs_create_node(RAMFS_BENCH_PROC_ID, dir, "bench", ucreate_node, 0, "");
+    urs_close_node(RAMFS_BENCH_PROC_ID, dir);
+    
+    f = urs_open_node("ramfs://bench", 0, RAMFS_BENCH_PROC_ID);
+    assert(f);
+    
+    for (i = 0; i < RAMFS_BENCH_IO_SIZE; i++) {
+        buf[i] = (u8)i;
+    }
+    
+    // Sequential write, this also allocates the file
+    start = read_cycles();
+    for (i = 0; i < RAMFS_BENCH_IO_COUNT; i++) {
+        if (bench_io(f, i, buf, 1)) {
+            kprintf("[ramfs] Unable to write @ %u\n", i);
+            return;
+        }
+    }
+    cycles = read_cycles() - start;
+    bench_report_io("seq write", cycles);
+    
+    // Sequential read
+    start = read_cycles();
+    for (i = 0; i < RAMFS_BENCH_IO_COUNT; i++) {
+        assert(!bench_io(f, i, buf, 0));
+    }
+    cycles = read_cycles() - start;
+    bench_report_io("seq read", cycles);
+    
+    // Random read
+    start = read_cycles();
+    for (i = 0; i < RAMFS_BENCH_IO_COUNT; i++) {
+        assert(!bench_io(f, bench_rand(&seed), buf, 0));
+    }
+    cycles = read_cycles() - start;
+    bench_report_io("rand read", cycles);
+    
+    // Random write
+    start = read_cycles();
+    for (i = 0; i < RAMFS_BENCH_IO_COUNT; i++) {
+        assert(!bench_io(f, bench_rand(&seed), buf, 1));
+    }
+    cycles = read_cycles() - start;
+    bench_report_io("rand write", cycles);
+    
+    // Writing past the end leaves a hole that reads back as zeros
+    assert(!bench_io(f, RAMFS_BENCH_IO_COUNT + RAMFS_CHUNK_SIZE / RAMFS_BENCH_IO_SIZE, buf, 1));
+    assert(!bench_io(f, RAMFS_BENCH_IO_COUNT, buf, 0));
+    for (i = 0; i < RAMFS_BENCH_IO_SIZE; i++) {
+        assert(!buf[i]);
+    }
+    
+    // Drop all the data
+    urs_seek_data(RAMFS_BENCH_PROC_ID, f, 0, seek_from_begin, &pos);
+    urs_truncate_node(RAMFS_BENCH_PROC_ID, f);
+    assert(!urs_read_node(RAMFS_BENCH_PROC_ID, f, buf, RAMFS_BENCH_IO_SIZE, &actual) && !actual);
+    
+    urs_close_node(RAMFS_BENCH_PROC_ID, f);
+    kprintf("[ramfs] I/O benchmark done\n");
+}
+
+
+/*
+ * Multi-threaded read benchmark, 4 KB random reads by 1 to 8 threads
+ *  Reads go through URS, so the page cache and the ramfs node locks are both
+ *  on the path. Readers either share one file, each through an fd of its own,
+ *  or read a file each. The files are larger than the page cache together
+ */
+#define RAMFS_MT_FILE_SHIFT     20
+#define RAMFS_MT_OP_SHIFT       12
+#define RAMFS_MT_OPS            (0x1ul << RAMFS_MT_OP_SHIFT)
+#define RAMFS_MT_IO_COUNT       (0x1ul << (RAMFS_MT_FILE_SHIFT - RAMFS_BENCH_IO_SHIFT))
+#define RAMFS_MT_MAX_THREADS    8
+
+struct ramfs_mt_reader {
+    unsigned long fd;
+    unsigned long errors;
+    kthread_t thread;
+    u8 buf[RAMFS_BENCH_IO_SIZE];
+};
+
+static struct ramfs_mt_reader mt_readers[RAMFS_MT_MAX_THREADS];
+static volatile int mt_go;
+
+static unsigned long mt_reader_thread(unsigned long arg)
+{
+    struct ramfs_mt_reader *reader = &mt_readers[arg];
+    unsigned long seed = arg + 1;
+    unsigned long i;
+    
+    while (!mt_go) {
+        syscall_yield();
+        atomic_membar();
+    }
+    
+    for (i = 0; i < RAMFS_MT_OPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        if (bench_io(reader->fd, (seed >> 8) % RAMFS_MT_IO_COUNT, reader->buf, 0)) {
+            reader->errors++;
+        }
+    }
+    
+    return 0;
+}
+
+static void bench_mt_read(char *name, int thread_count, int shared)
+{
+    int i;
+    unsigned long errors = 0;
+    unsigned long cycles;
+    char path[32];
+    u64 start;
+    
+    for (i = 0; i < thread_count; i++) {
+        ksnprintf(path, sizeof(path), "ramfs://mt%d", shared ? 0 : i);
+        mt_readers[i].errors = 0;
+        mt_readers[i].fd = urs_open_node(path, 0, RAMFS_BENCH_PROC_ID);
+        assert(mt_readers[i].fd);
+    }
+    
+    mt_go = 0;
+    atomic_membar();
+    
+    for (i = 0; i < thread_count; i++) {
+        assert(kthread_create(&mt_readers[i].thread, mt_reader_thread, (unsigned long)i));
+    }
+    
+    start = read_cycles();
+    mt_go = 1;
+    atomic_membar();
+    
+    for (i = 0; i < thread_count; i++) {
+        while (!mt_readers[i].thread.terminated) {
+            syscall_yield();
+            atomic_membar();
+        }
+        
+        errors += mt_readers[i].errors;
+        urs_close_node(RAMFS_BENCH_PROC_ID, mt_readers[i].fd);
+    }
+    
+    // Aggregate throughput, the op count is a power of 2
+    cycles = (unsigned long)((read_cycles() - start) >> RAMFS_MT_OP_SHIFT);
+    
+    kprintf("[ramfs] %s, %d threads: %u cycles per 4 KB read, %u errors\n",
+            name, thread_count, cycles / (unsigned long)thread_count, errors);
+}
+
+void test_ramfs_mt()
+{
+    int i, thread_count;
+    unsigned long j;
+    unsigned long dir = 0, f = 0;
+    char name[16];
+    char path[32];
+    
+    kprintf("[ramfs] Multi-threaded read benchmark, file size: %u KB\n", (0x1ul << RAMFS_MT_FILE_SHIFT) >> 10);
+    
+    dir = urs_open_node("ramfs://", 0, RAMFS_BENCH_PROC_ID);
+    assert(dir);
+    
+    for (i = 0; i < RAMFS_MT_MAX_THREADS; i++) {
+        ksnprintf(name, sizeof(name), "mt%d", i);
+        ksnprintf(path, sizeof(path), "ramfs://mt%d", i);
+        urs_create_node(RAMFS_BENCH_PROC_ID, dir, name, ucreate_node, 0, "");
+        
+        // Fill the file
+        f = urs_open_node(path, 0, RAMFS_BENCH_PROC_ID);
+        assert(f);
+        for (j = 0; j < RAMFS_MT_IO_COUNT; j++) {
+            assert(!bench_io(f, j, mt_readers[0].buf, 1));
+        }
+        urs_close_node(RAMFS_BENCH_PROC_ID, f);
+    }
+    
+    urs_close_node(RAMFS_BENCH_PROC_ID, dir);
+    
+    for (thread_count = 1; thread_count <= RAMFS_MT_MAX_THREADS; thread_count *= 2) {
+        bench_mt_read("same file", thread_count, 1);
+    }
+    
+    for (thread_count = 1; thread_count <= RAMFS_MT_MAX_THREADS; thread_count *= 2) {
+        bench_mt_read("file each", thread_count, 0);
+    }
+    
+    urs_pcache_stat_report();
+    
+    // Drop the files
+    for (i = 0; i < RAMFS_MT_MAX_THREADS; i++) {
+        ksnprintf(path, sizeof(path), "ramfs://mt%d", i);
+        f = urs_open_node(path, 0, RAMFS_BENCH_PROC_ID);
+        assert(f);
+        
+        // Removing also closes the fd
+        assert(!urs_remove_node(RAMFS_BENCH_PROC_ID, f, 1));
+    }
+    
+    kprintf("[ramfs] Multi-threaded read benchmark done\n");
+}
@@ -18,6 +18,8 @@ extern void init_ramfs();
 extern int register_ramfs(char *path);
 extern int unregister_ramfs(char *path);
 extern void test_ramfs();
+extern void test_ramfs_io();
+extern void test_ramfs_mt();
 
 
 /*
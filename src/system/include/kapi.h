@@ -19,15 +19,23 @@ extern asmlinkage void urs_reg_op_handler(msg_t *s);
 
 extern asmlinkage void urs_open_handler(msg_t *s);
 extern asmlinkage void urs_close_handler(msg_t *s);
+extern asmlinkage void urs_dup_handler(msg_t *s);
 extern asmlinkage void urs_read_handler(msg_t *s);
 extern asmlinkage void urs_write_handler(msg_t *s);
 extern asmlinkage void urs_list_handler(msg_t *s);
+extern asmlinkage void urs_list_batch_handler(msg_t *s);
 
 extern asmlinkage void urs_create_handler(msg_t *s);
 extern asmlinkage void urs_remove_handler(msg_t *s);
 extern asmlinkage void urs_rename_handler(msg_t *s);
 
 extern asmlinkage void urs_stat_handler(msg_t *s);
+extern asmlinkage void urs_dcache_stat_handler(msg_t *s);
+
+extern asmlinkage void urs_map_handler(msg_t *s);
+extern asmlinkage void urs_page_in_handler(msg_t *s);
+
+extern asmlinkage void urs_async_handler(msg_t *s);
 
 
 #endif
@@ -6,6 +6,7 @@
 #include "common/include/syscall.h"
 #include "common/include/urs.h"
 #include "klibc/include/stdstruct.h"
+#include "klibc/include/kthread.h"
 
 
 enum urs_disp_type {
@@ -14,6 +15,8 @@ enum urs_disp_type {
     udisp_msg,
 };
 
+struct urs_cfile;
+
 struct urs_disp {
     enum urs_disp_type type;
     
@@ -27,12 +30,23 @@ struct urs_disp {
     };
 };
 
+enum urs_cache_policy {
+    ucache_none,
+    ucache_write_through,
+    ucache_write_back,
+};
+
 struct urs_super {
     unsigned long id;
     
     char *path;
     char *name;
-    unsigned long ref_count;
+    volatile unsigned long ref_count;
+    
+    enum urs_cache_policy cache;
+    
+    // Bumped by every path lookup cache invalidation on this super
+    volatile unsigned long dcache_seq;
     
     struct urs_disp ops[uop_count];
 };
@@ -46,12 +60,24 @@ struct urs_node {
 };
 
 struct urs_open {
-    unsigned long id;
     char *path;
     
+    // Every fd of the open holds a reference, so does every request in flight
+    volatile unsigned long ref_count;
+    int removed;
+    
     struct urs_super *super;
     struct urs_node *node;
     unsigned long open_dispatch_id;
+    
+    // Page cache, NULL if the node is not cached
+    struct urs_cfile *cfile;
+    unsigned long data_pos;
+    unsigned long ra_next;
+    unsigned long ra_window;
+    
+    // Positional reads seek and read as one
+    kthread_mutex_t pos_lock;
 };
 
 
@@ -65,21 +91,33 @@ extern int urs_unregister(char *path);
 // );
 
 extern unsigned long urs_open_node(char *path, unsigned int flags, unsigned long process_id);
-extern int urs_close_node(unsigned long id);
+extern int urs_close_node(unsigned long proc_id, unsigned long fd);
+extern unsigned long urs_dup_node(unsigned long proc_id, unsigned long fd);
+extern void urs_close_process(unsigned long proc_id);
+
+extern int urs_read_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual);
+extern int urs_write_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual);
+extern int urs_truncate_node(unsigned long proc_id, unsigned long fd);
+extern int urs_seek_data(unsigned long proc_id, unsigned long fd, u64 offset, enum urs_seek_from from, u64 *newpos);
+
+extern int urs_list_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual);
+extern int urs_list_batch_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned int flags, unsigned long *actual);
+extern int urs_seek_list(unsigned long proc_id, unsigned long fd, u64 offset, enum urs_seek_from from, u64 *newpos);
+
+extern int urs_create_node(unsigned long proc_id, unsigned long fd, char *name, enum urs_create_type type, unsigned int flags, char *target);
+extern int urs_remove_node(unsigned long proc_id, unsigned long fd, int erase);
+extern int urs_rename_node(unsigned long proc_id, unsigned long fd, char *name);
 
-extern int urs_read_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual);
-extern int urs_write_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual);
-extern int urs_truncate_node(unsigned long id);
-extern int urs_seek_data(unsigned long id, u64 offset, enum urs_seek_from from, u64 *newpos);
+extern int urs_stat_node(unsigned long proc_id, unsigned long fd, struct urs_stat *stat);
 
-extern int urs_list_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual);
-extern int urs_seek_list(unsigned long id, u64 offset, enum urs_seek_from from, u64 *newpos);
+extern int urs_map_node(unsigned long caller_proc_id, unsigned long proc_id, unsigned long fd, unsigned long *map_id, unsigned long *size, unsigned long *image_offset);
+extern int urs_read_node_at(unsigned long proc_id, unsigned long fd, u64 offset, void *buf, unsigned long count, unsigned long *actual);
 
-extern int urs_create_node(unsigned long id, char *name, enum urs_create_type type, unsigned int flags, char *target);
-extern int urs_remove_node(unsigned long id, int erase);
-extern int urs_rename_node(unsigned long id, char *name);
+extern void urs_dcache_stat(struct urs_dcache_stat *stat);
+extern void urs_dcache_stat_report();
+extern void urs_pcache_stat_report();
 
-extern int urs_stat_node(unsigned long id, struct urs_stat *stat);
+extern void test_urs_fd();
 
 
 #endif
@@ -14,15 +14,23 @@ void init_kapi()
     
     kapi_reg(KAPI_URS_OPEN, urs_open_handler);
     kapi_reg(KAPI_URS_CLOSE, urs_close_handler);
+    kapi_reg(KAPI_URS_DUP, urs_dup_handler);
     kapi_reg(KAPI_URS_READ, urs_read_handler);
     kapi_reg(KAPI_URS_WRITE, urs_write_handler);
     kapi_reg(KAPI_URS_LIST, urs_list_handler);
+    kapi_reg(KAPI_URS_LIST_BATCH, urs_list_batch_handler);
     
     kapi_reg(KAPI_URS_CREATE, urs_create_handler);
     kapi_reg(KAPI_URS_REMOVE, urs_remove_handler);
     kapi_reg(KAPI_URS_RENAME, urs_rename_handler);
     
     kapi_reg(KAPI_URS_STAT, urs_stat_handler);
+    kapi_reg(KAPI_URS_DCACHE_STAT, urs_dcache_stat_handler);
+    
+    kapi_reg(KAPI_URS_MAP, urs_map_handler);
+    kapi_reg(KAPI_URS_PAGE_IN, urs_page_in_handler);
+    
+    kapi_reg(KAPI_URS_ASYNC, urs_async_handler);
 }
 
 
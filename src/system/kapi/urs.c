@@ -3,9 +3,11 @@
  */
 
 #include "common/include/syscall.h"
+#include "common/include/errno.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/sys.h"
+#include "klibc/include/aio.h"
 #include "system/include/urs.h"
 #include "system/include/kapi.h"
 
@@ -82,7 +84,22 @@ asmlinkage void urs_close_handler(msg_t *s)
 {
     unsigned long reply_mbox_id = s->mailbox_id;
     ulong open_id = s->params[0].value;
-    int result = (int)urs_close_node(open_id);
+    int result = (int)urs_close_node(s->sender_proc_id, open_id);
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_mbox_id;
+    msg_param_value(r, (ulong)result);
+    
+    syscall_respond();
+    sys_unreahable();
+}
+
+asmlinkage void urs_dup_handler(msg_t *s)
+{
+    unsigned long reply_mbox_id = s->mailbox_id;
+    ulong open_id = s->params[0].value;
+    
+    unsigned long result = urs_dup_node(s->sender_proc_id, open_id);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -103,7 +120,7 @@ asmlinkage void urs_read_handler(msg_t *s)
     }
     ulong len = 0;
     
-    int result = (int)urs_read_node(open_id, read_buf, buf_size, &len);
+    int result = (int)urs_read_node(s->sender_proc_id, open_id, read_buf, buf_size, &len);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -123,7 +140,7 @@ asmlinkage void urs_write_handler(msg_t *s)
     int buf_size = (int)s->params[2].value;
     ulong len = 0;
     
-    int result = (int)urs_write_node(open_id, write_buf, buf_size, &len);
+    int result = (int)urs_write_node(s->sender_proc_id, open_id, write_buf, buf_size, &len);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -145,7 +162,7 @@ asmlinkage void urs_list_handler(msg_t *s)
     }
     ulong len = 0;
     
-    int result = (int)urs_list_node(open_id, name_buf, buf_size, &len);
+    int result = (int)urs_list_node(s->sender_proc_id, open_id, name_buf, buf_size, &len);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -157,6 +174,38 @@ asmlinkage void urs_list_handler(msg_t *s)
     sys_unreahable();
 }
 
+asmlinkage void urs_list_batch_handler(msg_t *s)
+{
+    unsigned long reply_mbox_id = s->mailbox_id;
+    ulong open_id = s->params[0].value;
+    ulong count = s->params[1].value;
+    unsigned int flags = (unsigned int)s->params[2].value;
+    if (count > ULIST_BATCH_MAX) {
+        count = ULIST_BATCH_MAX;
+    }
+    ulong len = 0;
+    int result = ENOMEM;
+    
+    // Too large for the stack of a handler thread
+    u8 *buf = (u8 *)halloc();
+    if (buf) {
+        result = urs_list_batch_node(s->sender_proc_id, open_id, buf, count, flags, &len);
+    }
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_mbox_id;
+    msg_param_buffer(r, buf, len);
+    msg_param_value(r, len);
+    msg_param_value(r, (ulong)result);
+    
+    if (buf) {
+        hfree(buf);
+    }
+    
+    syscall_respond();
+    sys_unreahable();
+}
+
 asmlinkage void urs_create_handler(msg_t *s)
 {
     unsigned long reply_mbox_id = s->mailbox_id;
@@ -166,7 +215,7 @@ asmlinkage void urs_create_handler(msg_t *s)
     unsigned int flags = (unsigned int)s->params[3].value;
     char *target = s->params[4].offset ? (char *)((ulong)s + s->params[4].offset) : NULL;
     
-    int result = (int)urs_create_node(open_id, name, type, flags, target);
+    int result = (int)urs_create_node(s->sender_proc_id, open_id, name, type, flags, target);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -182,7 +231,7 @@ asmlinkage void urs_remove_handler(msg_t *s)
     ulong open_id = s->params[0].value;
     int erase = (int)s->params[1].value;
     
-    int result = (int)urs_remove_node(open_id, erase);
+    int result = (int)urs_remove_node(s->sender_proc_id, open_id, erase);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -198,7 +247,7 @@ asmlinkage void urs_rename_handler(msg_t *s)
     ulong open_id = s->params[0].value;
     char *name = (char *)((ulong)s + s->params[1].offset);
     
-    int result = (int)urs_rename_node(open_id, name);
+    int result = (int)urs_rename_node(s->sender_proc_id, open_id, name);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -214,7 +263,7 @@ asmlinkage void urs_stat_handler(msg_t *s)
     ulong open_id = s->params[0].value;
     struct urs_stat stat;
     
-    int result = (int)urs_stat_node(open_id, &stat);
+    int result = (int)urs_stat_node(s->sender_proc_id, open_id, &stat);
     
     msg_t *r = syscall_msg();
     r->mailbox_id = reply_mbox_id;
@@ -224,3 +273,163 @@ asmlinkage void urs_stat_handler(msg_t *s)
     syscall_respond();
     sys_unreahable();
 }
+
+asmlinkage void urs_dcache_stat_handler(msg_t *s)
+{
+    unsigned long reply_mbox_id = s->mailbox_id;
+    struct urs_dcache_stat stat;
+    
+    urs_dcache_stat(&stat);
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_mbox_id;
+    msg_param_buffer(r, &stat, sizeof(struct urs_dcache_stat));
+    msg_param_value(r, (ulong)EOK);
+    
+    syscall_respond();
+    sys_unreahable();
+}
+
+
+/*
+ * File mapping, requested by the kernel
+ */
+#define URS_PAGE_IN_MAX     2048
+
+asmlinkage void urs_map_handler(msg_t *s)
+{
+    unsigned long reply_mbox_id = s->mailbox_id;
+    ulong open_id = s->params[0].value;
+    ulong proc_id = s->params[1].value;
+    ulong map_id = 0, size = 0, image_offset = 0;
+    
+    int result = urs_map_node(s->sender_proc_id, proc_id, open_id, &map_id, &size, &image_offset);
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_mbox_id;
+    msg_param_value(r, map_id);
+    msg_param_value(r, size);
+    msg_param_value(r, image_offset);
+    msg_param_value(r, (ulong)result);
+    
+    syscall_respond();
+    sys_unreahable();
+}
+
+asmlinkage void urs_page_in_handler(msg_t *s)
+{
+    unsigned long reply_mbox_id = s->mailbox_id;
+    ulong map_id = s->params[0].value;
+    ulong offset = s->params[1].value;
+    ulong count = s->params[2].value;
+    if (count > URS_PAGE_IN_MAX) {
+        count = URS_PAGE_IN_MAX;
+    }
+    ulong len = 0;
+    int result = ENOMEM;
+    
+    // Too large for the stack of a handler thread
+    u8 *buf = (u8 *)halloc();
+    if (buf) {
+        result = urs_read_node_at(s->sender_proc_id, map_id, (u64)offset, buf, count, &len);
+    }
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_mbox_id;
+    msg_param_buffer(r, buf, len);
+    msg_param_value(r, len);
+    msg_param_value(r, (ulong)result);
+    
+    if (buf) {
+        hfree(buf);
+    }
+    
+    syscall_respond();
+    sys_unreahable();
+}
+
+
+/*
+ * Async operations
+ *  Every request runs in a handler thread of its own and the completion is
+ *  sent back as a one-way message, so requests finish in any order
+ */
+asmlinkage void urs_async_handler(msg_t *s)
+{
+    unsigned long reply_proc_id = s->sender_proc_id;
+    ulong ring = s->params[0].value;
+    ulong slot = s->params[1].value;
+    ulong msg_num = s->params[2].value;
+    enum urs_op_type op = (enum urs_op_type)s->params[3].value;
+    ulong open_id = s->params[4].value;
+    ulong count = s->params[5].value;
+    unsigned int flags = (unsigned int)s->params[6].value;
+    void *in_buf = (void *)((ulong)s + s->params[7].offset);
+    ulong in_size = (ulong)s->params[7].size;
+    
+    struct urs_stat stat;
+    u8 *buf = NULL;
+    ulong len = 0;
+    ulong actual = 0;
+    int result = EINVAL;
+    
+    if (count > URS_ASYNC_DATA_MAX) {
+        count = URS_ASYNC_DATA_MAX;
+    }
+    
+    switch (op) {
+    case uop_open:
+        actual = urs_open_node((char *)in_buf, flags, reply_proc_id);   // FIXME: should be proc_id
+        result = actual ? EOK : ENOENT;
+        break;
+    case uop_read:
+    case uop_list:
+        // Too large for the stack of a handler thread
+        buf = (u8 *)halloc();
+        if (!buf) {
+            result = ENOMEM;
+            break;
+        }
+        
+        if (op == uop_read) {
+            result = urs_read_node(reply_proc_id, open_id, buf, count, &actual);
+        } else {
+            result = urs_list_node(reply_proc_id, open_id, buf, count, &actual);
+        }
+        len = actual;
+        break;
+    case uop_write:
+        if (count > in_size) {
+            count = in_size;
+        }
+        result = urs_write_node(reply_proc_id, open_id, in_buf, count, &actual);
+        break;
+    case uop_stat:
+        result = urs_stat_node(reply_proc_id, open_id, &stat);
+        if (!result) {
+            buf = (u8 *)&stat;
+            len = sizeof(struct urs_stat);
+        }
+        break;
+    default:
+        break;
+    }
+    
+    msg_t *r = syscall_msg();
+    r->mailbox_id = reply_proc_id;
+    r->opcode = IPC_OPCODE_ACTION;
+    r->func_num = msg_num;
+    msg_param_value(r, ring);
+    msg_param_value(r, slot);
+    msg_param_value(r, actual);
+    msg_param_value(r, (ulong)result);
+    msg_param_buffer(r, buf, len);
+    
+    syscall_send();
+    
+    if (buf && buf != (u8 *)&stat) {
+        hfree(buf);
+    }
+    
+    kapi_thread_exit(NULL);
+}
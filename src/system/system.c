@@ -36,6 +36,11 @@ int main(int argc, char *argv[])
     
     // FS tests
     //test_ramfs();
+    //test_ramfs_io();
+    //test_ramfs_mt();
+    //test_urs_fd();
+    //urs_dcache_stat_report();
+    //urs_pcache_stat_report();
     
 //     u64 t = get_systime();
 //     unsigned long time_high = 0, time_low = 0;
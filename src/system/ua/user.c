@@ -1,5 +1,6 @@
 #include "common/include/data.h"
 #include "common/include/ua.h"
+#include "common/include/hash.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/string.h"
@@ -37,14 +38,7 @@ static struct ua_builtin_user_info builtin_users[] = {
  */
 static unsigned int ua_user_hash_func(void *key, unsigned int size)
 {
-    char *str = (char *)key;
-    unsigned int k = 0;
-    
-    do {
-        k += (unsigned int)(*str);
-    } while (*str++);
-    
-    return k % size;
+    return hash_str((char *)key) % size;
 }
 
 static int ua_user_hash_cmp(void *cmp_key, void *node_key)
@@ -5,12 +5,15 @@
 #include "common/include/data.h"
 #include "common/include/syscall.h"
 #include "common/include/errno.h"
+#include "common/include/hash.h"
+#include "common/include/atomic.h"
 #include "klibc/include/stdio.h"
 #include "klibc/include/stdlib.h"
 #include "klibc/include/string.h"
 #include "klibc/include/stdstruct.h"
 #include "klibc/include/assert.h"
 #include "klibc/include/sys.h"
+#include "klibc/include/kthread.h"
 #include "system/include/urs.h"
 
 
@@ -18,315 +21,1629 @@ static int super_salloc_id;
 static int node_salloc_id;
 static int open_salloc_id;
 
-static hash_t *super_table;
-static hash_t *open_table;
-
 
 /*
- * Hash table
+ * Path lookup cache
+ *  Maps (super, parent dispatch ID, name) to the child dispatch ID, so repeated
+ *  lookups of the same path do not go through the file system at all.
+ *  A child ID of 0 is a negative entry, recording that the name does not exist.
+ *  Entries are kept in LRU order and the oldest one is evicted once the cache
+ *  is full. Links are never cached as their targets have to be followed.
+ *  A name may also span several components if it was resolved by a single
+ *  whole-path lookup, such entries are never negative
  */
-static unsigned int urs_hash_func(void *key, unsigned int size)
-{
-    char *str = (char *)key;
-    unsigned int k = 0;
+#define DCACHE_MAX_ENTRIES  256
+
+struct urs_dentry_key {
+    unsigned long super_id;
+    unsigned long parent_id;
+    char *name;
+};
+
+struct urs_dentry {
+    struct urs_dentry_key key;
+    unsigned long next_id;
+    int multi;
+    
+    struct urs_dentry *prev;
+    struct urs_dentry *next;
+};
+
+struct urs_dcache {
+    hash_t *table;
     
-    do {
-        k += (unsigned int)(*str);
-    } while (*str++);
+    unsigned long count;
+    struct urs_dentry *head;    // Most recently used
+    struct urs_dentry *tail;    // Least recently used
     
-    return k % size;
-}
+    unsigned long hit_count;
+    unsigned long neg_hit_count;
+    unsigned long miss_count;
+    unsigned long evict_count;
+    unsigned long invalidate_count;
+    
+    kthread_mutex_t lock;
+};
 
-static int urs_hash_cmp(void *cmp_key, void *node_key)
+static int dentry_salloc_id;
+static struct urs_dcache dcache;
+
+static int has_separator(char *name)
 {
-    char *cmp_ch = (char *)cmp_key;
-    char *node_ch = (char *)node_key;
+    for (; *name; name++) {
+        if (*name == '/') {
+            return 1;
+        }
+    }
     
-    return strcmp(cmp_ch, node_ch);
+    return 0;
 }
 
+static unsigned int dcache_hash_func(void *key, unsigned int size)
+{
+    struct urs_dentry_key *k = (struct urs_dentry_key *)key;
+    u32 h = hash_str(k->name);
+    
+    h ^= hash_ulong(k->super_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hash_ulong(k->parent_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    
+    return h % size;
+}
 
-/*
- * Init URS
- */
-void init_urs()
+static int dcache_hash_cmp(void *cmp_key, void *node_key)
 {
-    super_table = hash_new(0, urs_hash_func, urs_hash_cmp);
-    open_table = hash_new(0, urs_hash_func, urs_hash_cmp);
+    struct urs_dentry_key *cmp = (struct urs_dentry_key *)cmp_key;
+    struct urs_dentry_key *node = (struct urs_dentry_key *)node_key;
     
-    super_salloc_id = salloc_create(sizeof(struct urs_super), 0, NULL, NULL);
-    node_salloc_id = salloc_create(sizeof(struct urs_node), 0, NULL, NULL);
-    open_salloc_id = salloc_create(sizeof(struct urs_open), 0, NULL, NULL);
+    if (cmp->super_id != node->super_id) {
+        return cmp->super_id > node->super_id ? 1 : -1;
+    }
+    
+    if (cmp->parent_id != node->parent_id) {
+        return cmp->parent_id > node->parent_id ? 1 : -1;
+    }
+    
+    return strcmp(cmp->name, node->name);
 }
 
+static void init_dcache()
+{
+    dentry_salloc_id = salloc_create(sizeof(struct urs_dentry), 0, NULL, NULL);
+    
+    dcache.table = hash_new(0, dcache_hash_func, dcache_hash_cmp);
+    dcache.count = 0;
+    dcache.head = NULL;
+    dcache.tail = NULL;
+    
+    dcache.hit_count = 0;
+    dcache.neg_hit_count = 0;
+    dcache.miss_count = 0;
+    dcache.evict_count = 0;
+    dcache.invalidate_count = 0;
+    
+    kthread_mutex_init(&dcache.lock);
+}
 
 /*
- * Super
+ * LRU list, must be called with the cache locked
  */
-#define DEFAULT_NAMESPACE           "vfs://"
-#define DEFAULT_NAMESPACE_LENGTH    (sizeof(DEFAULT_NAMESPACE) - 1)
-
-static struct urs_super *get_super_by_id(unsigned long id)
+static void dcache_detach(struct urs_dentry *d)
 {
-    return (struct urs_super *)id;
+    if (d->prev) {
+        d->prev->next = d->next;
+    } else {
+        dcache.head = d->next;
+    }
+    
+    if (d->next) {
+        d->next->prev = d->prev;
+    } else {
+        dcache.tail = d->prev;
+    }
+    
+    d->prev = d->next = NULL;
 }
 
-static char *normalize_path(char *path)
+static void dcache_push_front(struct urs_dentry *d)
 {
-    char *copy = NULL;
+    d->prev = NULL;
+    d->next = dcache.head;
     
-    int len = strlen(path);
-    if (!len) {
-        return NULL;
+    if (dcache.head) {
+        dcache.head->prev = d;
     }
+    dcache.head = d;
     
-    if (len >= 3 && path[len - 1] == '/' && (path[len - 2] != '/' || path[len - 3] != ':')) {
-        len--;
+    if (!dcache.tail) {
+        dcache.tail = d;
     }
+}
+
+static void dcache_drop(struct urs_dentry *d)
+{
+    dcache_detach(d);
+    hash_remove(dcache.table, &d->key);
+    dcache.count--;
     
-    if (path[0] == '/') {
-        len += DEFAULT_NAMESPACE_LENGTH;   // vfs://
+    free(d->key.name);
+    sfree(d);
+}
+
+/*
+ * Lookup and update
+ */
+static int dcache_lookup(struct urs_super *super, unsigned long parent_id, char *name, unsigned long *next_id)
+{
+    struct urs_dentry_key key;
+    struct urs_dentry *d = NULL;
+    
+    key.super_id = super->id;
+    key.parent_id = parent_id;
+    key.name = name;
+    
+    kthread_mutex_lock(&dcache.lock);
+    
+    d = (struct urs_dentry *)hash_obtain(dcache.table, &key);
+    if (!d) {
+        dcache.miss_count++;
+        kthread_mutex_unlock(&dcache.lock);
+        return 0;
     }
     
-    copy = (char *)calloc(len + 1, sizeof(char));
-    if (path[0] == '/') {
-        memcpy(copy, DEFAULT_NAMESPACE, 6);
-        memcpy(copy + DEFAULT_NAMESPACE_LENGTH, path, len - DEFAULT_NAMESPACE_LENGTH);
+    *next_id = d->next_id;
+    hash_release(dcache.table, &key, d);
+    
+    if (d->next_id) {
+        dcache.hit_count++;
     } else {
-        memcpy(copy, path, len);
+        dcache.neg_hit_count++;
     }
-    copy[len] = '\0';
     
-//     kprintf("len: %d\n", len);
-//     kprintf(path);
-//     kprintf("Path normalized: %s -> %s @ %p\n", path, copy, copy);
+    // Move to the front of the LRU list
+    if (dcache.head != d) {
+        dcache_detach(d);
+        dcache_push_front(d);
+    }
     
-    return copy;
+    kthread_mutex_unlock(&dcache.lock);
+    
+    return 1;
 }
 
-static struct urs_super *match_super(char *path)
+/*
+ * Takes the seq of the super from before the lookup was dispatched, a result
+ * that raced with an invalidation may already be stale and is not cached
+ */
+static unsigned long dcache_seq(struct urs_super *super)
 {
-    int found = 0;
-    struct urs_super *super = NULL;
+    unsigned long seq = super->dcache_seq;
+    atomic_membar();
     
-    int cur_pos = 0;
-    char *copy = normalize_path(path);
-    if (!copy) {
-        return NULL;
+    return seq;
+}
+
+static void dcache_insert(struct urs_super *super, unsigned long seq, unsigned long parent_id, char *name, unsigned long next_id)
+{
+    struct urs_dentry *d = (struct urs_dentry *)salloc(dentry_salloc_id);
+    if (!d) {
+        return;
     }
-    cur_pos = strlen(copy) - 1;
     
-    do {
-//         kprintf("copy: %s\n", copy);
-        if (hash_contains(super_table, copy)) {
-            found = 1;
-            break;
-        }
-        
-        do {
-            cur_pos--;
-        } while (cur_pos > 0 && copy[cur_pos] != '/');
-        
-        if (cur_pos && copy[cur_pos] == '/') {
-            copy[cur_pos + 1] = '\0';
-        } else {
-            copy[cur_pos] = '\0';
-        }
-    } while (cur_pos > 0);
+    d->key.super_id = super->id;
+    d->key.parent_id = parent_id;
+    d->key.name = strdup(name);
+    d->next_id = next_id;
+    d->multi = has_separator(name);
     
-    if (!found) {
-        free(copy);
-        return NULL;
+    kthread_mutex_lock(&dcache.lock);
+    
+    // Someone else may have filled in the same entry, or changed the names meanwhile
+    if (super->dcache_seq != seq || hash_insert(dcache.table, &d->key, d)) {
+        kthread_mutex_unlock(&dcache.lock);
+        
+        free(d->key.name);
+        sfree(d);
+        return;
     }
     
-    super = (struct urs_super *)hash_obtain(super_table, copy);
-    assert(super);
-    super->ref_count++;
-    hash_release(super_table, copy, super);
+    dcache_push_front(d);
+    dcache.count++;
     
-//     kprintf("Super matched: %s ~ %s @ %p\n", copy, super->path, super);
+    // Evict the least recently used entry
+    if (dcache.count > DCACHE_MAX_ENTRIES) {
+        dcache_drop(dcache.tail);
+        dcache.evict_count++;
+    }
     
-    return super;
+    kthread_mutex_unlock(&dcache.lock);
 }
 
-static struct urs_super *obtain_super(char *path)
+/*
+ * Invalidation
+ */
+static void dcache_invalidate(struct urs_super *super, unsigned long parent_id, char *name)
 {
-    struct urs_super *super = NULL;
+    struct urs_dentry_key key;
+    struct urs_dentry *d = NULL;
     
-    char *copy = normalize_path(path);
-    if (!copy) {
-        return NULL;
-    }
+    key.super_id = super->id;
+    key.parent_id = parent_id;
+    key.name = name;
     
-    super = (struct urs_super *)hash_obtain(super_table, copy);
-    if (!super) {
-        free(copy);
-        return NULL;
-    }
+    kthread_mutex_lock(&dcache.lock);
     
-    super->ref_count++;
-    hash_release(super_table, copy, super);
-    free(copy);
+    // Lookups dispatched before this point must not cache their results
+    super->dcache_seq++;
     
-    return super;
-}
-
-static struct urs_super *release_super(struct urs_super *s)
-{
-    s->ref_count--;
+    d = (struct urs_dentry *)hash_obtain(dcache.table, &key);
+    if (d) {
+        hash_release(dcache.table, &key, d);
+        dcache_drop(d);
+        dcache.invalidate_count++;
+    }
+    
+    kthread_mutex_unlock(&dcache.lock);
 }
 
-unsigned long urs_register(char *path, char *name, unsigned int flags, struct urs_reg_ops *ops)
+static void dcache_invalidate_node(struct urs_super *super, unsigned long node_id, int subs, int negs)
 {
-    int i;
-    struct urs_super *super = NULL;
-    
-    char *copy = normalize_path(path);
-    if (!copy) {
-        return 0;
-    }
+    struct urs_dentry *d = NULL, *next = NULL;
     
-    super = obtain_super(copy);
-    if (super) {
-        release_super(super);
-        free(copy);
-        return 0;
-    }
+    kthread_mutex_lock(&dcache.lock);
     
-    super = (struct urs_super *)salloc(super_salloc_id);
-    super->id = (unsigned long)super;
-    super->path = copy;
-    super->ref_count = 1;
+    super->dcache_seq++;
     
-    // Set up op
-    for (i = 0; i < uop_count; i++) {
-        if (ops && ops->entries[i].type == ureg_func) {
-            super->ops[i].type = udisp_func;
-            super->ops[i].func = ops->entries[i].func;
+    // The cache is bounded, so a full scan is cheap compared to a lookup round trip
+    for (d = dcache.head; d; d = next) {
+        next = d->next;
+        
+        if (d->key.super_id != super->id) {
+            continue;
         }
         
-        else if (ops && ops->entries[i].type == ureg_msg) {
-            super->ops[i].type = udisp_msg;
-            super->ops[i].mbox_id = ops->mbox_id;
-            super->ops[i].msg_opcode = ops->entries[i].msg_opcode;
-            super->ops[i].msg_func_num = ops->entries[i].msg_func_num;
+        // A multi-component entry may pass through the node
+        if (
+            d->next_id == node_id || d->multi ||
+            (subs && d->key.parent_id == node_id) ||
+            (negs && !d->next_id)
+        ) {
+            dcache_drop(d);
+            dcache.invalidate_count++;
         }
+    }
+    
+    kthread_mutex_unlock(&dcache.lock);
+}
+
+static void dcache_invalidate_super(struct urs_super *super)
+{
+    struct urs_dentry *d = NULL, *next = NULL;
+    
+    kthread_mutex_lock(&dcache.lock);
+    
+    super->dcache_seq++;
+    
+    for (d = dcache.head; d; d = next) {
+        next = d->next;
         
-        else {
-            super->ops[i].type = udisp_none;
+        if (d->key.super_id == super->id) {
+            dcache_drop(d);
+            dcache.invalidate_count++;
         }
     }
     
-    hash_insert(super_table, copy, super);
-    return super->id;
+    kthread_mutex_unlock(&dcache.lock);
 }
 
-int urs_unregister(char *path)
+void urs_dcache_stat(struct urs_dcache_stat *stat)
 {
-    return 0;
+    kthread_mutex_lock(&dcache.lock);
+    
+    stat->entries = dcache.count;
+    stat->hits = dcache.hit_count;
+    stat->neg_hits = dcache.neg_hit_count;
+    stat->misses = dcache.miss_count;
+    stat->evictions = dcache.evict_count;
+    stat->invalidations = dcache.invalidate_count;
+    
+    kthread_mutex_unlock(&dcache.lock);
 }
 
-// int urs_register_op(
-//     unsigned long id, enum urs_op_type op, void *func,
-//     unsigned long mbox_id, unsigned long msg_opcode, unsigned long msg_func_num)
-// {
-//     struct urs_super *super = get_super_by_id(id);
-//     if (!super) {
-//         return -1;
-//     }
-//     
-//     if (func) {
-//         super->ops[op].type = udisp_func;
-//         super->ops[op].func = func;
-//     }
-//     
-//     else {
-//         super->ops[op].type = udisp_msg;
-//         super->ops[op].mbox_id = mbox_id;
-//         super->ops[op].msg_opcode = msg_opcode;
-//         super->ops[op].msg_func_num = msg_func_num;
-//     }
-//     
-//     return 0;
-// }
+void urs_dcache_stat_report()
+{
+    kthread_mutex_lock(&dcache.lock);
+    
+    kprintf("URS path lookup cache: entries %u, hits %u, negative hits %u, misses %u, evictions %u, invalidations %u\n",
+            dcache.count, dcache.hit_count, dcache.neg_hit_count, dcache.miss_count,
+            dcache.evict_count, dcache.invalidate_count);
+    
+    kthread_mutex_unlock(&dcache.lock);
+}
 
 
 /*
- * Dispatch
+ * Mount table
+ *  A compressed radix trie of the normalized super paths, so the longest
+ *  registered prefix of a path is found in a single walk.
+ *  Updates are serialized by the lock while lookups take none. A new node is
+ *  fully set up before it is linked in, and a node that has to be split is
+ *  replaced by a copy instead of being changed in place. Labels point into
+ *  the super paths, which are never freed, and replaced or emptied nodes are
+ *  kept around for readers that may still be walking through them
  */
-static msg_t *create_dispatch_msg(struct urs_super *super, enum urs_op_type op, unsigned long id)
-{
-    msg_t *msg = syscall_msg();
+struct urs_mount_node {
+    char *label;
+    int label_len;
     
-    msg->mailbox_id = super->ops[op].mbox_id;
-    msg->opcode = super->ops[op].msg_opcode;
-    msg->func_num = super->ops[op].msg_func_num;
+    struct urs_super *volatile super;
     
-    msg_param_value(msg, (unsigned long)op);
-    msg_param_value(msg, super->id);
-    msg_param_value(msg, id);   // This can be either node id or open id
+    struct urs_mount_node *volatile child;
+    struct urs_mount_node *volatile sibling;
+};
+
+static int mount_salloc_id;
+static struct urs_mount_node *mount_root;
+static kthread_mutex_t mount_lock;
+
+static struct urs_mount_node *new_mount_node(char *label, int label_len, struct urs_super *super)
+{
+    struct urs_mount_node *node = (struct urs_mount_node *)salloc(mount_salloc_id);
+    assert(node);
     
-    return msg;
+    node->label = label;
+    node->label_len = label_len;
+    node->super = super;
+    node->child = NULL;
+    node->sibling = NULL;
+    
+    return node;
 }
 
-static int dispatch_lookup(struct urs_super *super, unsigned long node_id, unsigned long proc_id, char *next, int *is_link,
-                           unsigned long *next_id, void *buf, unsigned long count, unsigned long *actual)
+static void init_mount()
 {
-    int result = 0;
-    enum urs_op_type op = uop_lookup;
-    
-//     kprintf("To dispatch lookup @ %s\n", next);
+    mount_salloc_id = salloc_create(sizeof(struct urs_mount_node), 0, NULL, NULL);
+    mount_root = new_mount_node("", 0, NULL);
+    kthread_mutex_init(&mount_lock);
+}
+
+static int is_mount_boundary(char *path, int pos)
+{
+    // A super only covers whole path components
+    return !path[pos] || path[pos] == '/' || (pos && path[pos - 1] == '/');
+}
+
+static int match_label(struct urs_mount_node *node, char *path)
+{
+    int len = 0;
     
-    if (super->ops[op].type == udisp_none) {
-        if (is_link) {
-            *is_link = 0;
-        }
-        if (next_id) {
-            *next_id = 0;
-        }
-        
-        return -1;
+    while (len < node->label_len && path[len] == node->label[len]) {
+        len++;
     }
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, proc_id, next, is_link, next_id, buf, count, actual);
-    }
+    return len;
+}
+
+static struct urs_mount_node *walk_mount(char *path, int *pos_out, struct urs_super **longest)
+{
+    struct urs_mount_node *node = mount_root;
+    struct urs_mount_node *next = NULL;
+    struct urs_super *super = NULL;
+    int pos = 0;
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        ulong len = 0;
+    do {
+        super = node->super;
+        if (longest && super && is_mount_boundary(path, pos)) {
+            *longest = super;
+        }
         
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_value(s, proc_id);
-        msg_param_buffer(s, next, (size_t)(strlen(next) + 1));
-        msg_param_value(s, count);
+        if (!path[pos]) {
+            break;
+        }
         
-        r = syscall_request();
-        if (is_link) {
-            *is_link = (int)r->params[0].value;
+        for (next = node->child; next && next->label[0] != path[pos]; next = next->sibling);
+        if (!next || match_label(next, &path[pos]) != next->label_len) {
+            break;
         }
-        if (next_id) {
+        
+        pos += next->label_len;
+        node = next;
+    } while (1);
+    
+    *pos_out = pos;
+    return node;
+}
+
+static struct urs_super *lookup_mount(char *path)
+{
+    struct urs_super *super = NULL;
+    int pos = 0;
+    
+    walk_mount(path, &pos, &super);
+    return super;
+}
+
+static struct urs_super *lookup_mount_exact(char *path)
+{
+    int pos = 0;
+    struct urs_mount_node *node = walk_mount(path, &pos, NULL);
+    
+    return path[pos] ? NULL : node->super;
+}
+
+static int insert_mount(char *path, struct urs_super *super)
+{
+    struct urs_mount_node *node = mount_root;
+    struct urs_mount_node *volatile *link = NULL;
+    struct urs_mount_node *next = NULL, *split = NULL, *tail = NULL;
+    int pos = 0;
+    int len = 0;
+    
+    while (path[pos]) {
+        // Find the child that starts with the next char
+        for (link = &node->child; *link && (*link)->label[0] != path[pos]; link = &(*link)->sibling);
+        next = *link;
+        
+        // No such child, add a leaf
+        if (!next) {
+            next = new_mount_node(&path[pos], strlen(&path[pos]), super);
+            next->sibling = node->child;
+            
+            atomic_writebar();
+            node->child = next;
+            return 0;
+        }
+        
+        len = match_label(next, &path[pos]);
+        
+        // Whole label matched, move down
+        if (len == next->label_len) {
+            pos += len;
+            node = next;
+            continue;
+        }
+        
+        // Split the label, the old node is replaced by a copy under the new one
+        tail = new_mount_node(next->label + len, next->label_len - len, next->super);
+        tail->child = next->child;
+        
+        split = new_mount_node(next->label, len, path[pos + len] ? NULL : super);
+        split->child = tail;
+        split->sibling = next->sibling;
+        
+        if (path[pos + len]) {
+            tail->sibling = new_mount_node(&path[pos + len], strlen(&path[pos + len]), super);
+        }
+        
+        atomic_writebar();
+        *link = split;
+        return 0;
+    }
+    
+    // The path ends at an existing node
+    if (node->super) {
+        return -1;
+    }
+    
+    atomic_writebar();
+    node->super = super;
+    return 0;
+}
+
+static struct urs_super *remove_mount(char *path)
+{
+    int pos = 0;
+    struct urs_super *super = NULL;
+    struct urs_mount_node *node = walk_mount(path, &pos, NULL);
+    
+    if (path[pos]) {
+        return NULL;
+    }
+    
+    // The node itself stays in the trie
+    super = node->super;
+    node->super = NULL;
+    
+    return super;
+}
+
+
+/*
+ * Page cache
+ *  File data of cacheable supers is cached in pages keyed by
+ *  (super, node, page index), all I/O of a node goes through URS so the cache
+ *  stays coherent across opens. The file size is obtained by stat when a node
+ *  is first cached and tracked by URS from then on.
+ *  Write-through supers forward every write and update the cached copy,
+ *  write-back supers only mark pages dirty. Dirty pages are written back on
+ *  eviction, close, truncate and stat, a page that fails to be written back
+ *  stays dirty and the failure is reported by the next flush of the file.
+ *  The whole cache is bounded by a page budget and evicted in LRU order.
+ *  Each file has a lock that serializes its I/O, pcache.lock only guards the
+ *  shared lists and is never held across a dispatch. Lock order is file, then
+ *  cache, and pages are only dropped with the lock of their file held
+ */
+#define PCACHE_PAGE_SIZE        4096
+#define PCACHE_MAX_PAGES        256
+#define PCACHE_MAX_READ_AHEAD   16
+
+struct urs_page_key {
+    unsigned long super_id;
+    unsigned long node_id;
+    unsigned long index;
+};
+
+struct urs_cfile {
+    // Index is always 0
+    struct urs_page_key key;
+    
+    unsigned long size;
+    unsigned long open_count;
+    
+    // An open that dirty pages can be written back through
+    struct urs_open *writer;
+    
+    struct urs_page *pages;
+    
+    // Write-back failure on eviction, not reported yet
+    int error;
+    
+    // Files with a writer, flushed before their super lists stats
+    int dirty_linked;
+    unsigned long flush_seq;
+    struct urs_cfile *dirty_prev;
+    struct urs_cfile *dirty_next;
+    
+    kthread_mutex_t lock;
+};
+
+struct urs_page {
+    struct urs_page_key key;
+    struct urs_cfile *file;
+    
+    // Dirty range within the page, empty if start == end
+    unsigned long dirty_start;
+    unsigned long dirty_end;
+    
+    u8 *data;
+    
+    // Global LRU list
+    struct urs_page *prev;
+    struct urs_page *next;
+    
+    // Pages of the same file
+    struct urs_page *file_prev;
+    struct urs_page *file_next;
+};
+
+struct urs_pcache {
+    hash_t *table;
+    hash_t *files;
+    
+    struct urs_cfile *dirty_files;
+    unsigned long flush_seq;
+    
+    unsigned long count;
+    struct urs_page *head;
+    struct urs_page *tail;
+    
+    volatile unsigned long hit_count;
+    volatile unsigned long miss_count;
+    volatile unsigned long read_ahead_count;
+    volatile unsigned long evict_count;
+    volatile unsigned long write_back_count;
+    
+    kthread_mutex_t lock;
+};
+
+static int page_salloc_id;
+static int page_data_salloc_id;
+static int cfile_salloc_id;
+static struct urs_pcache pcache;
+
+static int cmp_ulong(unsigned long a, unsigned long b)
+{
+    if (a == b) {
+        return 0;
+    }
+    
+    return a > b ? 1 : -1;
+}
+
+static unsigned int pcache_hash_func(void *key, unsigned int size)
+{
+    struct urs_page_key *k = (struct urs_page_key *)key;
+    u32 h = hash_ulong(k->index);
+    
+    h ^= hash_ulong(k->node_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hash_ulong(k->super_id) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    
+    return h % size;
+}
+
+static int pcache_hash_cmp(void *cmp_key, void *node_key)
+{
+    struct urs_page_key *cmp = (struct urs_page_key *)cmp_key;
+    struct urs_page_key *node = (struct urs_page_key *)node_key;
+    
+    if (cmp->super_id != node->super_id) {
+        return cmp_ulong(cmp->super_id, node->super_id);
+    }
+    
+    if (cmp->node_id != node->node_id) {
+        return cmp_ulong(cmp->node_id, node->node_id);
+    }
+    
+    return cmp_ulong(cmp->index, node->index);
+}
+
+static void init_pcache()
+{
+    page_salloc_id = salloc_create(sizeof(struct urs_page), 0, NULL, NULL);
+    page_data_salloc_id = salloc_create(PCACHE_PAGE_SIZE, 0, NULL, NULL);
+    cfile_salloc_id = salloc_create(sizeof(struct urs_cfile), 0, NULL, NULL);
+    
+    pcache.table = hash_new(0, pcache_hash_func, pcache_hash_cmp);
+    pcache.files = hash_new(0, pcache_hash_func, pcache_hash_cmp);
+    
+    pcache.count = 0;
+    pcache.head = NULL;
+    pcache.tail = NULL;
+    
+    pcache.dirty_files = NULL;
+    pcache.flush_seq = 0;
+    
+    pcache.hit_count = 0;
+    pcache.miss_count = 0;
+    pcache.read_ahead_count = 0;
+    pcache.evict_count = 0;
+    pcache.write_back_count = 0;
+    
+    kthread_mutex_init(&pcache.lock);
+}
+
+
+/*
+ * Descriptor tables
+ *  Every process has a flat table of its own. An fd is the slot index with
+ *  the generation of the slot above it, so a stale fd never reaches an open
+ *  that took over the slot later
+ */
+#define URS_FD_INDEX_BITS   12
+#define URS_FD_INDEX_MASK   ((0x1ul << URS_FD_INDEX_BITS) - 1)
+#define URS_FD_GEN_MAX      (~0ul >> URS_FD_INDEX_BITS)
+#define URS_FD_INLINE       16
+
+struct urs_fd {
+    unsigned long gen;
+    unsigned long next_free;
+    struct urs_open *open;
+};
+
+#define URS_FD_MAX          (HALLOC_CHUNK_SIZE / sizeof(struct urs_fd))
+
+struct urs_fd_table {
+    unsigned long proc_id;
+    
+    // One for the hash entry, plus one for each request that is using it
+    volatile unsigned long ref_count;
+    
+    // The process is gone, no more fds are handed out
+    int closed;
+    
+    // Slots below used have been handed out at least once
+    unsigned long capacity;
+    unsigned long used;
+    
+    // Index + 1 of the first free slot, 0 if none
+    unsigned long free_head;
+    
+    // Most processes never outgrow the inline slots
+    struct urs_fd *fds;
+    struct urs_fd inline_fds[URS_FD_INLINE];
+    
+    kthread_mutex_t lock;
+};
+
+static int fd_table_salloc_id;
+static hash_t *fd_tables;
+static kthread_mutex_t fd_tables_lock = KTHREAD_MUTEX_INIT;
+
+static void init_fd_tables()
+{
+    fd_table_salloc_id = salloc_create(sizeof(struct urs_fd_table), 0, NULL, NULL);
+    fd_tables = hash_new(0, NULL, NULL);
+}
+
+/*
+ * Returns the table with a reference taken, drop it with put_fd_table
+ */
+static struct urs_fd_table *get_fd_table(unsigned long proc_id, int alloc)
+{
+    // The hash stays locked until released, so the table can't go away in between
+    struct urs_fd_table *t = (struct urs_fd_table *)hash_obtain(fd_tables, (void *)proc_id);
+    if (t) {
+        atomic_inc(&t->ref_count);
+        hash_release(fd_tables, (void *)proc_id, t);
+    }
+    
+    if (t || !alloc) {
+        return t;
+    }
+    
+    kthread_mutex_lock(&fd_tables_lock);
+    
+    // Another thread of the same process may have been faster
+    t = (struct urs_fd_table *)hash_obtain(fd_tables, (void *)proc_id);
+    if (t) {
+        atomic_inc(&t->ref_count);
+        hash_release(fd_tables, (void *)proc_id, t);
+    } else {
+        t = (struct urs_fd_table *)salloc(fd_table_salloc_id);
+        if (t) {
+            memzero(t, sizeof(struct urs_fd_table));
+            t->proc_id = proc_id;
+            t->ref_count = 2;
+            t->capacity = URS_FD_INLINE;
+            t->fds = t->inline_fds;
+            kthread_mutex_init(&t->lock);
+            
+            if (hash_insert(fd_tables, (void *)proc_id, t)) {
+                sfree(t);
+                t = NULL;
+            }
+        }
+    }
+    
+    kthread_mutex_unlock(&fd_tables_lock);
+    
+    return t;
+}
+
+static void put_fd_table(struct urs_fd_table *t)
+{
+    if (atomic_xadd(&t->ref_count, (unsigned long)-1) != 1) {
+        return;
+    }
+    
+    // Only a closed table loses its last reference, all its slots are empty by now
+    if (t->fds != t->inline_fds) {
+        hfree(t->fds);
+    }
+    sfree(t);
+}
+
+static int grow_fd_table(struct urs_fd_table *t)
+{
+    struct urs_fd *fds = NULL;
+    
+    if (t->fds != t->inline_fds) {
+        return 0;
+    }
+    
+    fds = (struct urs_fd *)halloc();
+    if (!fds) {
+        return 0;
+    }
+    
+    memcpy(fds, t->inline_fds, sizeof(t->inline_fds));
+    t->fds = fds;
+    t->capacity = URS_FD_MAX;
+    
+    return 1;
+}
+
+static unsigned long alloc_fd(struct urs_fd_table *t, struct urs_open *o)
+{
+    unsigned long index = 0;
+    unsigned long fd = 0;
+    
+    kthread_mutex_lock(&t->lock);
+    
+    if (t->closed) {
+        kthread_mutex_unlock(&t->lock);
+        return 0;
+    } else if (t->free_head) {
+        index = t->free_head - 1;
+        t->free_head = t->fds[index].next_free;
+    } else if (t->used < t->capacity || grow_fd_table(t)) {
+        index = t->used++;
+        t->fds[index].gen = 1;
+    } else {
+        kthread_mutex_unlock(&t->lock);
+        return 0;
+    }
+    
+    t->fds[index].open = o;
+    atomic_inc(&o->ref_count);
+    fd = (t->fds[index].gen << URS_FD_INDEX_BITS) | index;
+    
+    kthread_mutex_unlock(&t->lock);
+    
+    return fd;
+}
+
+static struct urs_fd *lookup_fd(struct urs_fd_table *t, unsigned long fd)
+{
+    unsigned long index = fd & URS_FD_INDEX_MASK;
+    
+    if (index >= t->used || !t->fds[index].open || t->fds[index].gen != fd >> URS_FD_INDEX_BITS) {
+        return NULL;
+    }
+    
+    return &t->fds[index];
+}
+
+/*
+ * Empties the slot, the reference it held goes to the caller
+ */
+static struct urs_open *free_fd(struct urs_fd_table *t, unsigned long fd)
+{
+    struct urs_open *o = NULL;
+    struct urs_fd *slot = NULL;
+    
+    kthread_mutex_lock(&t->lock);
+    
+    slot = lookup_fd(t, fd);
+    if (slot) {
+        o = slot->open;
+        slot->open = NULL;
+        slot->gen = slot->gen == URS_FD_GEN_MAX ? 1 : slot->gen + 1;
+        
+        slot->next_free = t->free_head;
+        t->free_head = (fd & URS_FD_INDEX_MASK) + 1;
+    }
+    
+    kthread_mutex_unlock(&t->lock);
+    
+    return o;
+}
+
+
+/*
+ * Init URS
+ */
+void init_urs()
+{
+    super_salloc_id = salloc_create(sizeof(struct urs_super), 0, NULL, NULL);
+    node_salloc_id = salloc_create(sizeof(struct urs_node), 0, NULL, NULL);
+    open_salloc_id = salloc_create(sizeof(struct urs_open), 0, NULL, NULL);
+    
+    init_dcache();
+    init_mount();
+    init_pcache();
+    init_fd_tables();
+}
+
+
+/*
+ * Super
+ */
+#define DEFAULT_NAMESPACE           "vfs://"
+#define DEFAULT_NAMESPACE_LENGTH    (sizeof(DEFAULT_NAMESPACE) - 1)
+
+static struct urs_super *get_super_by_id(unsigned long id)
+{
+    return (struct urs_super *)id;
+}
+
+static char *normalize_path(char *path)
+{
+    char *copy = NULL;
+    
+    int len = strlen(path);
+    if (!len) {
+        return NULL;
+    }
+    
+    if (len >= 3 && path[len - 1] == '/' && (path[len - 2] != '/' || path[len - 3] != ':')) {
+        len--;
+    }
+    
+    if (path[0] == '/') {
+        len += DEFAULT_NAMESPACE_LENGTH;   // vfs://
+    }
+    
+    copy = (char *)calloc(len + 1, sizeof(char));
+    if (path[0] == '/') {
+        memcpy(copy, DEFAULT_NAMESPACE, 6);
+        memcpy(copy + DEFAULT_NAMESPACE_LENGTH, path, len - DEFAULT_NAMESPACE_LENGTH);
+    } else {
+        memcpy(copy, path, len);
+    }
+    copy[len] = '\0';
+    
+//     kprintf("len: %d\n", len);
+//     kprintf(path);
+//     kprintf("Path normalized: %s -> %s @ %p\n", path, copy, copy);
+    
+    return copy;
+}
+
+static struct urs_super *match_super(char *path)
+{
+    struct urs_super *super = NULL;
+    
+    char *copy = normalize_path(path);
+    if (!copy) {
+        return NULL;
+    }
+    
+    super = lookup_mount(copy);
+    if (super) {
+        atomic_inc(&super->ref_count);
+    }
+    
+//     kprintf("Super matched: %s ~ %s @ %p\n", copy, super ? super->path : "", super);
+    
+    free(copy);
+    return super;
+}
+
+static struct urs_super *obtain_super(char *path)
+{
+    struct urs_super *super = NULL;
+    
+    char *copy = normalize_path(path);
+    if (!copy) {
+        return NULL;
+    }
+    
+    super = lookup_mount_exact(copy);
+    if (super) {
+        atomic_inc(&super->ref_count);
+    }
+    
+    free(copy);
+    return super;
+}
+
+static void release_super(struct urs_super *s)
+{
+    atomic_dec(&s->ref_count);
+}
+
+unsigned long urs_register(char *path, char *name, unsigned int flags, struct urs_reg_ops *ops)
+{
+    int i;
+    struct urs_super *super = NULL;
+    
+    char *copy = normalize_path(path);
+    if (!copy) {
+        return 0;
+    }
+    
+    kthread_mutex_lock(&mount_lock);
+    
+    super = obtain_super(copy);
+    if (super) {
+        release_super(super);
+        kthread_mutex_unlock(&mount_lock);
+        free(copy);
+        return 0;
+    }
+    
+    super = (struct urs_super *)salloc(super_salloc_id);
+    super->id = (unsigned long)super;
+    super->path = copy;
+    super->ref_count = 1;
+    super->dcache_seq = 0;
+    
+    // Set up op
+    for (i = 0; i < uop_count; i++) {
+        if (ops && ops->entries[i].type == ureg_func) {
+            super->ops[i].type = udisp_func;
+            super->ops[i].func = ops->entries[i].func;
+        }
+        
+        else if (ops && ops->entries[i].type == ureg_msg) {
+            super->ops[i].type = udisp_msg;
+            super->ops[i].mbox_id = ops->mbox_id;
+            super->ops[i].msg_opcode = ops->entries[i].msg_opcode;
+            super->ops[i].msg_func_num = ops->entries[i].msg_func_num;
+        }
+        
+        else {
+            super->ops[i].type = udisp_none;
+        }
+    }
+    
+    // Caching needs the file system to read, seek and report the data size
+    super->cache = ucache_none;
+    if (super->ops[uop_read].type != udisp_none &&
+        super->ops[uop_seek_data].type != udisp_none &&
+        super->ops[uop_stat].type != udisp_none
+    ) {
+        if (flags & UREG_CACHE_WRITE_BACK) {
+            super->cache = ucache_write_back;
+        } else if (flags & UREG_CACHE_WRITE_THROUGH) {
+            super->cache = ucache_write_through;
+        }
+    }
+    
+    // Readers may pick up the super as soon as it is linked in
+    insert_mount(copy, super);
+    
+    kthread_mutex_unlock(&mount_lock);
+    
+    return super->id;
+}
+
+int urs_unregister(char *path)
+{
+    struct urs_super *super = NULL;
+    
+    char *copy = normalize_path(path);
+    if (!copy) {
+        return -1;
+    }
+    
+    kthread_mutex_lock(&mount_lock);
+    super = remove_mount(copy);
+    kthread_mutex_unlock(&mount_lock);
+    
+    free(copy);
+    if (!super) {
+        return -1;
+    }
+    
+    // Opened nodes may still refer to the super, so it is not freed here
+    dcache_invalidate_super(super);
+    release_super(super);
+    
+    return 0;
+}
+
+// int urs_register_op(
+//     unsigned long id, enum urs_op_type op, void *func,
+//     unsigned long mbox_id, unsigned long msg_opcode, unsigned long msg_func_num)
+// {
+//     struct urs_super *super = get_super_by_id(id);
+//     if (!super) {
+//         return -1;
+//     }
+//     
+//     if (func) {
+//         super->ops[op].type = udisp_func;
+//         super->ops[op].func = func;
+//     }
+//     
+//     else {
+//         super->ops[op].type = udisp_msg;
+//         super->ops[op].mbox_id = mbox_id;
+//         super->ops[op].msg_opcode = msg_opcode;
+//         super->ops[op].msg_func_num = msg_func_num;
+//     }
+//     
+//     return 0;
+// }
+
+
+/*
+ * Dispatch
+ */
+static msg_t *create_dispatch_msg(struct urs_super *super, enum urs_op_type op, unsigned long id)
+{
+    msg_t *msg = syscall_msg();
+    
+    msg->mailbox_id = super->ops[op].mbox_id;
+    msg->opcode = super->ops[op].msg_opcode;
+    msg->func_num = super->ops[op].msg_func_num;
+    
+    msg_param_value(msg, (unsigned long)op);
+    msg_param_value(msg, super->id);
+    msg_param_value(msg, id);   // This can be either node id or open id
+    
+    return msg;
+}
+
+static int dispatch_lookup(struct urs_super *super, unsigned long node_id, unsigned long proc_id, char *next, int *is_link,
+                           unsigned long *next_id, void *buf, unsigned long count, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_lookup;
+    
+//     kprintf("To dispatch lookup @ %s\n", next);
+    
+    if (super->ops[op].type == udisp_none) {
+        if (is_link) {
+            *is_link = 0;
+        }
+        if (next_id) {
+            *next_id = 0;
+        }
+        
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, proc_id, next, is_link, next_id, buf, count, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        ulong len = 0;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, proc_id);
+        msg_param_buffer(s, next, (size_t)(strlen(next) + 1));
+        msg_param_value(s, count);
+        
+        r = syscall_request();
+        if (is_link) {
+            *is_link = (int)r->params[0].value;
+        }
+        if (next_id) {
+            *next_id = r->params[1].value;
+        }
+        
+//         kprintf("send win @ %p, recv win @ %p\n", s, r);
+//         kprintf("lookup returned, is link: %d, next: %p\n", (int)r->params[0].value, r->params[1].value);
+        
+//         if (buf) {
+//             u8 *src = (u8 *)((unsigned long)r + r->params[2].offset);
+//             u8 *dest = buf;
+//             ulong s = r->params[3].value;
+//             
+//             while (len < count && len < s) {
+//                 dest[len] = src[len];
+//                 len++;
+//             }
+//         }
+//         if (actual) {
+//             *actual = len;
+//         }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_lookup_path(struct urs_super *super, unsigned long node_id, unsigned long proc_id, char *path, int *is_link,
+                                unsigned long *next_id, unsigned long *consumed, void *buf, unsigned long count, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_lookup_path;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, proc_id, path, is_link, next_id, consumed, buf, count, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        ulong len = 0;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, proc_id);
+        msg_param_buffer(s, path, (size_t)(strlen(path) + 1));
+        msg_param_value(s, count);
+        
+        r = syscall_request();
+        if (is_link) {
+            *is_link = (int)r->params[0].value;
+        }
+        if (next_id) {
             *next_id = r->params[1].value;
         }
+        if (consumed) {
+            *consumed = r->params[2].value;
+        }
+        
+        // Link target
+        if (buf) {
+            u8 *src = (u8 *)((unsigned long)r + r->params[3].offset);
+            u8 *dest = buf;
+            ulong s = r->params[4].value;
+            
+            while (len < count && len < s) {
+                dest[len] = src[len];
+                len++;
+            }
+        }
+        if (actual) {
+            *actual = len;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_open(struct urs_super *super, unsigned long node_id, unsigned long proc_id, unsigned long *open_dispatch_id)
+{
+    int result = 0;
+    enum urs_op_type op = uop_open;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, proc_id, open_dispatch_id);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, proc_id);
+        
+        r = syscall_request();
+        if (open_dispatch_id) {
+            *open_dispatch_id = r->params[0].value;
+        }
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_close(struct urs_super *super, unsigned long node_id)
+{
+    int result = 0;
+    enum urs_op_type op = uop_release;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        s = create_dispatch_msg(super, op, node_id);
+        
+        r = syscall_request();
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_read(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_read;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        ulong len = 0;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, count);
+        
+        r = syscall_request();
+        if (buf) {
+            len = r->params[1].value;
+            if (len > count) {
+                len = count;
+            }
+            
+            memcpy(buf, (void *)((unsigned long)r + r->params[0].offset), len);
+        }
+        if (actual) {
+            *actual = len;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_write(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_write;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        
+//         kprintf("to dispatch write, buf: %s, size: %p\n", (char *)buf, count);
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_buffer(s, buf, count);
+        msg_param_value(s, count);
+        
+        r = syscall_request();
+        if (actual) {
+            *actual = r->params[0].value;
+        }
         
-//         kprintf("send win @ %p, recv win @ %p\n", s, r);
-//         kprintf("lookup returned, is link: %d, next: %p\n", (int)r->params[0].value, r->params[1].value);
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_truncate(struct urs_super *super, unsigned long node_id)
+{
+    int result = 0;
+    enum urs_op_type op = uop_truncate;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        s = create_dispatch_msg(super, op, node_id);
         
-//         if (buf) {
-//             u8 *src = (u8 *)((unsigned long)r + r->params[2].offset);
-//             u8 *dest = buf;
-//             ulong s = r->params[3].value;
-//             
-//             while (len < count && len < s) {
-//                 dest[len] = src[len];
-//                 len++;
-//             }
-//         }
-//         if (actual) {
-//             *actual = len;
-//         }
+        r = syscall_request();
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_seek_data(struct urs_super *super, unsigned long node_id, u64 offset, enum urs_seek_from from, u64 *newpos)
+{
+    int result = 0;
+    enum urs_op_type op = uop_seek_data;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, offset, from, newpos);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value64(s, offset);
+        msg_param_value(s, (unsigned long)from);
+        
+        r = syscall_request();
+        if (newpos) {
+            *newpos = r->params[0].value64;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_list(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_list;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        ulong len = 0;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, count);
+        
+        r = syscall_request();
+        if (buf) {
+            len = r->params[1].value;
+            if (len > count) {
+                len = count;
+            }
+            
+            memcpy(buf, (void *)((unsigned long)r + r->params[0].offset), len);
+            
+//             kprintf("received: %s\n", buf);
+        }
+        if (actual) {
+            *actual = len;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_list_batch(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned int flags, unsigned long *actual)
+{
+    int result = 0;
+    enum urs_op_type op = uop_list_batch;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, buf, count, flags, actual);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        ulong len = 0;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, count);
+        msg_param_value(s, (unsigned long)flags);
+        
+        r = syscall_request();
+        if (buf) {
+            len = r->params[1].value;
+            if (len > count) {
+                len = count;
+            }
+            
+            memcpy(buf, (void *)((unsigned long)r + r->params[0].offset), len);
+        }
+        if (actual) {
+            *actual = len;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_seek_list(struct urs_super *super, unsigned long node_id, u64 offset, enum urs_seek_from from, u64 *newpos)
+{
+    int result = 0;
+    enum urs_op_type op = uop_seek_list;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, offset, from, newpos);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value64(s, offset);
+        msg_param_value(s, (unsigned long)from);
+        
+        r = syscall_request();
+        if (newpos) {
+            *newpos = r->params[0].value64;
+        }
+        
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_create(struct urs_super *super, unsigned long node_id, char *name, enum urs_create_type type, unsigned int flags, char *target, unsigned long target_id)
+{
+    int result = 0;
+    enum urs_op_type op = uop_create;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, name, type, flags, target, target_id);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
+        
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_buffer(s, name, strlen(name) + 1);
+        msg_param_value(s, (unsigned long)type);
+        msg_param_value(s, (unsigned long)flags);
+        msg_param_buffer(s, target, strlen(target) + 1);
+        msg_param_value(s, target_id);
+        
+        r = syscall_request();
+        result = (int)r->params[r->param_count - 1].value;
+    }
+    
+    else {
+        return -2;
+    }
+    
+    return result;
+}
+
+static int dispatch_remove(struct urs_super *super, unsigned long node_id, int erase)
+{
+    int result = 0;
+    enum urs_op_type op = uop_remove;
+    
+    if (super->ops[op].type == udisp_none) {
+        return -1;
+    }
+    
+    else if (super->ops[op].type == udisp_func) {
+        result = super->ops[op].func(super->id, node_id, erase);
+    }
+    
+    else if (super->ops[op].type == udisp_msg) {
+        msg_t *s, *r;
         
-        result = (int)r->params[r->param_count - 1].value;
+        s = create_dispatch_msg(super, op, node_id);
+        msg_param_value(s, (unsigned long)erase);
+        
+        r = syscall_request();
+        result = (int)r->params[r->param_count - 1].value;;
     }
     
     else {
@@ -336,28 +1653,26 @@ static int dispatch_lookup(struct urs_super *super, unsigned long node_id, unsig
     return result;
 }
 
-static int dispatch_open(struct urs_super *super, unsigned long node_id, unsigned long proc_id, unsigned long *open_dispatch_id)
+static int dispatch_rename(struct urs_super *super, unsigned long node_id, char *name)
 {
     int result = 0;
-    enum urs_op_type op = uop_open;
+    enum urs_op_type op = uop_rename;
     
     if (super->ops[op].type == udisp_none) {
         return -1;
     }
     
     else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, proc_id, open_dispatch_id);
+        result = super->ops[op].func(super->id, node_id, name);
     }
     
     else if (super->ops[op].type == udisp_msg) {
         msg_t *s, *r;
+        
         s = create_dispatch_msg(super, op, node_id);
-        msg_param_value(s, proc_id);
+        msg_param_buffer(s, name, strlen(name) + 1);
         
         r = syscall_request();
-        if (open_dispatch_id) {
-            *open_dispatch_id = r->params[0].value;
-        }
         result = (int)r->params[r->param_count - 1].value;
     }
     
@@ -368,24 +1683,31 @@ static int dispatch_open(struct urs_super *super, unsigned long node_id, unsigne
     return result;
 }
 
-static int dispatch_close(struct urs_super *super, unsigned long node_id)
+static int dispatch_stat(struct urs_super *super, unsigned long node_id, struct urs_stat *stat)
 {
     int result = 0;
-    enum urs_op_type op = uop_release;
+    enum urs_op_type op = uop_stat;
     
     if (super->ops[op].type == udisp_none) {
         return -1;
     }
     
     else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id);
+        result = super->ops[op].func(super->id, node_id, stat);
     }
     
     else if (super->ops[op].type == udisp_msg) {
         msg_t *s, *r;
-        s = create_dispatch_msg(super, op, node_id);
+        struct urs_stat *ret = NULL;
         
+        s = create_dispatch_msg(super, op, node_id);
         r = syscall_request();
+        
+        ret = (struct urs_stat *)((unsigned long)r + r->params[0].offset);
+        if (ret && stat) {
+            memcpy(stat, ret, sizeof(struct urs_stat));
+        }
+        
         result = (int)r->params[r->param_count - 1].value;
     }
     
@@ -396,39 +1718,26 @@ static int dispatch_close(struct urs_super *super, unsigned long node_id)
     return result;
 }
 
-static int dispatch_read(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+static int dispatch_map(struct urs_super *super, unsigned long node_id, unsigned long *image_offset)
 {
     int result = 0;
-    enum urs_op_type op = uop_read;
+    enum urs_op_type op = uop_map;
     
     if (super->ops[op].type == udisp_none) {
         return -1;
     }
     
     else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+        result = super->ops[op].func(super->id, node_id, image_offset);
     }
     
     else if (super->ops[op].type == udisp_msg) {
         msg_t *s, *r;
-        ulong len = 0;
         
         s = create_dispatch_msg(super, op, node_id);
-        msg_param_value(s, count);
-        
         r = syscall_request();
-        if (buf) {
-            u8 *src = (u8 *)((unsigned long)r + r->params[0].offset);
-            u8 *dest = buf;
-            ulong s = r->params[1].value;
-            
-            while (len < count && len < s) {
-                dest[len] = src[len];
-                len++;
-            }
-        }
-        if (actual) {
-            *actual = len;
+        if (image_offset) {
+            *image_offset = r->params[0].value;
         }
         
         result = (int)r->params[r->param_count - 1].value;
@@ -441,326 +1750,956 @@ static int dispatch_read(struct urs_super *super, unsigned long node_id, void *b
     return result;
 }
 
-static int dispatch_write(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+
+/*
+ * Page cache lists, must be called with the cache locked
+ */
+static void pcache_detach(struct urs_page *p)
 {
-    int result = 0;
-    enum urs_op_type op = uop_write;
+    if (p->prev) {
+        p->prev->next = p->next;
+    } else {
+        pcache.head = p->next;
+    }
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
+    if (p->next) {
+        p->next->prev = p->prev;
+    } else {
+        pcache.tail = p->prev;
     }
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+    p->prev = NULL;
+    p->next = NULL;
+}
+
+static void pcache_push_front(struct urs_page *p)
+{
+    p->prev = NULL;
+    p->next = pcache.head;
+    
+    if (pcache.head) {
+        pcache.head->prev = p;
+    } else {
+        pcache.tail = p;
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
+    pcache.head = p;
+}
+
+static void pcache_touch(struct urs_page *p)
+{
+    kthread_mutex_lock(&pcache.lock);
+    
+    if (pcache.head != p) {
+        pcache_detach(p);
+        pcache_push_front(p);
+    }
+    
+    kthread_mutex_unlock(&pcache.lock);
+}
+
+static int cfile_unused(struct urs_cfile *f)
+{
+    return !f->pages && !f->open_count;
+}
+
+static void pcache_link_dirty(struct urs_cfile *f, int dirty)
+{
+    if (f->dirty_linked == dirty) {
+        return;
+    }
+    
+    if (dirty) {
+        f->dirty_prev = NULL;
+        f->dirty_next = pcache.dirty_files;
+        if (pcache.dirty_files) {
+            pcache.dirty_files->dirty_prev = f;
+        }
+        pcache.dirty_files = f;
+    } else {
+        if (f->dirty_prev) {
+            f->dirty_prev->dirty_next = f->dirty_next;
+        } else {
+            pcache.dirty_files = f->dirty_next;
+        }
+        if (f->dirty_next) {
+            f->dirty_next->dirty_prev = f->dirty_prev;
+        }
+    }
+    
+    f->dirty_linked = dirty;
+}
+
+/*
+ * The file lock has to be released first, nobody else can get to the
+ * file once it is unused and the cache is locked
+ */
+static void free_cfile(struct urs_cfile *f)
+{
+    hash_remove(pcache.files, &f->key);
+    sfree(f);
+}
+
+/*
+ * Must be called with both the file and the cache locked
+ */
+static void pcache_drop(struct urs_page *p)
+{
+    struct urs_cfile *f = p->file;
+    
+    pcache_detach(p);
+    
+    if (p->file_prev) {
+        p->file_prev->file_next = p->file_next;
+    } else {
+        f->pages = p->file_next;
+    }
+    if (p->file_next) {
+        p->file_next->file_prev = p->file_prev;
+    }
+    
+    hash_remove(pcache.table, &p->key);
+    pcache.count--;
+    
+    sfree(p->data);
+    sfree(p);
+}
+
+
+/*
+ * Page cache I/O, must be called with the file locked and the cache unlocked
+ */
+static int pcache_write_back(struct urs_page *p)
+{
+    struct urs_open *w = p->file->writer;
+    unsigned long actual = 0;
+    u64 newpos = 0;
+    int error = EOK;
+    
+    if (p->dirty_start == p->dirty_end) {
+        return EOK;
+    }
+    
+    assert(w);
+    
+    error = dispatch_seek_data(w->super, w->open_dispatch_id, (u64)(p->key.index * PCACHE_PAGE_SIZE + p->dirty_start), seek_from_begin, &newpos);
+    if (!error) {
+        error = dispatch_write(w->super, w->open_dispatch_id, p->data + p->dirty_start, p->dirty_end - p->dirty_start, &actual);
+    }
+    
+    // A failed page stays dirty so that it is not lost
+    if (error) {
+        return error;
+    }
+    
+    p->dirty_start = p->dirty_end = 0;
+    atomic_inc(&pcache.write_back_count);
+    
+    return EOK;
+}
+
+static int pcache_flush_file(struct urs_cfile *f)
+{
+    struct urs_page *p;
+    int result = EOK;
+    int error = f->error;
+    
+    // A failure on eviction is reported by the next flush
+    f->error = EOK;
+    
+    for (p = f->pages; p; p = p->file_next) {
+        result = pcache_write_back(p);
+        if (result) {
+            error = result;
+        }
+    }
+    
+    return error;
+}
+
+static void pcache_discard_dirty(struct urs_cfile *f)
+{
+    struct urs_page *p;
+    
+    for (p = f->pages; p; p = p->file_next) {
+        p->dirty_start = p->dirty_end = 0;
+    }
+}
+
+/*
+ * Evict LRU pages until count more fit, self is the file locked by the caller.
+ * Waiting for the lock of another file here could deadlock, so files that are
+ * in use are skipped, the budget is exceeded if nothing can be evicted
+ */
+static void pcache_reserve(struct urs_cfile *self, unsigned long count)
+{
+    struct urs_page *p, *prev;
+    struct urs_cfile *f;
+    int error = EOK;
+    
+    kthread_mutex_lock(&pcache.lock);
+    
+    p = pcache.tail;
+    while (p && pcache.count + count > PCACHE_MAX_PAGES) {
+        f = p->file;
+        if (f != self && !kthread_mutex_trylock(&f->lock)) {
+            p = p->prev;
+            continue;
+        }
         
-//         kprintf("to dispatch write, buf: %s, size: %p\n", (char *)buf, count);
+        // The file lock keeps the page around while the cache is unlocked
+        error = EOK;
+        if (p->dirty_start != p->dirty_end) {
+            kthread_mutex_unlock(&pcache.lock);
+            error = pcache_write_back(p);
+            kthread_mutex_lock(&pcache.lock);
+        }
         
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_buffer(s, buf, count);
-        msg_param_value(s, count);
+        prev = p->prev;
+        if (error) {
+            f->error = error;
+        } else {
+            pcache_drop(p);
+            atomic_inc(&pcache.evict_count);
+        }
         
-        r = syscall_request();
-        if (actual) {
-            *actual = r->params[0].value;
+        if (f != self) {
+            kthread_mutex_unlock(&f->lock);
+            if (cfile_unused(f)) {
+                free_cfile(f);
+            }
+        }
+        
+        p = prev;
+    }
+    
+    kthread_mutex_unlock(&pcache.lock);
+}
+
+static struct urs_page *pcache_find(struct urs_cfile *f, unsigned long index)
+{
+    struct urs_page_key key;
+    struct urs_page *p = NULL;
+    
+    key.super_id = f->key.super_id;
+    key.node_id = f->key.node_id;
+    key.index = index;
+    
+    p = (struct urs_page *)hash_obtain(pcache.table, &key);
+    if (p) {
+        hash_release(pcache.table, &key, p);
+    }
+    
+    return p;
+}
+
+static struct urs_page *pcache_new_page(struct urs_cfile *f, unsigned long index)
+{
+    struct urs_page *p = NULL;
+    
+    pcache_reserve(f, 1);
+    
+    p = (struct urs_page *)salloc(page_salloc_id);
+    if (!p) {
+        return NULL;
+    }
+    
+    p->data = (u8 *)salloc(page_data_salloc_id);
+    if (!p->data) {
+        sfree(p);
+        return NULL;
+    }
+    memzero(p->data, PCACHE_PAGE_SIZE);
+    
+    p->key.super_id = f->key.super_id;
+    p->key.node_id = f->key.node_id;
+    p->key.index = index;
+    p->file = f;
+    p->dirty_start = p->dirty_end = 0;
+    
+    kthread_mutex_lock(&pcache.lock);
+    
+    p->file_prev = NULL;
+    p->file_next = f->pages;
+    if (f->pages) {
+        f->pages->file_prev = p;
+    }
+    f->pages = p;
+    
+    pcache_push_front(p);
+    pcache.count++;
+    
+    hash_insert(pcache.table, &p->key, p);
+    
+    kthread_mutex_unlock(&pcache.lock);
+    
+    return p;
+}
+
+/*
+ * Read count pages starting from index, the first page is the one needed
+ * and the rest are read ahead, stopping at the end of the file or at the
+ * first page that is already cached
+ */
+static struct urs_page *pcache_fill(struct urs_open *o, unsigned long index, unsigned long count)
+{
+    struct urs_cfile *f = o->cfile;
+    struct urs_page *p = NULL;
+    struct urs_page *first = NULL;
+    unsigned long i, len, actual;
+    u64 newpos = 0;
+    int error = EOK;
+    
+    // Evicting may write back through this open, so make room before seeking
+    pcache_reserve(f, count);
+    
+    error = dispatch_seek_data(o->super, o->open_dispatch_id, (u64)(index * PCACHE_PAGE_SIZE), seek_from_begin, &newpos);
+    if (error) {
+        return NULL;
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (i && ((index + i) * PCACHE_PAGE_SIZE >= f->size || pcache_find(f, index + i))) {
+            break;
+        }
+        
+        p = pcache_new_page(f, index + i);
+        if (!p) {
+            break;
+        }
+        
+        // Message dispatched reads may come back short
+        len = 0;
+        do {
+            actual = 0;
+            error = dispatch_read(o->super, o->open_dispatch_id, p->data + len, PCACHE_PAGE_SIZE - len, &actual);
+            len += actual;
+        } while (!error && actual && len < PCACHE_PAGE_SIZE);
+        
+        if (error) {
+            kthread_mutex_lock(&pcache.lock);
+            pcache_drop(p);
+            kthread_mutex_unlock(&pcache.lock);
+            break;
+        }
+        
+        if (i) {
+            atomic_inc(&pcache.read_ahead_count);
+        } else {
+            first = p;
+        }
+        
+        if (len < PCACHE_PAGE_SIZE) {
+            break;
+        }
+    }
+    
+    return first;
+}
+
+
+/*
+ * Cached open
+ */
+static void pcache_open(struct urs_open *o)
+{
+    struct urs_page_key key;
+    struct urs_cfile *f = NULL;
+    struct urs_cfile *n = NULL;
+    struct urs_stat stat;
+    
+    o->cfile = NULL;
+    o->data_pos = 0;
+    o->ra_next = 0;
+    o->ra_window = 0;
+    
+    if (o->super->cache == ucache_none) {
+        return;
+    }
+    
+    key.super_id = o->super->id;
+    key.node_id = o->node->dispatch_id;
+    key.index = 0;
+    
+    kthread_mutex_lock(&pcache.lock);
+    
+    f = (struct urs_cfile *)hash_obtain(pcache.files, &key);
+    if (f) {
+        hash_release(pcache.files, &key, f);
+        f->open_count++;
+    }
+    
+    kthread_mutex_unlock(&pcache.lock);
+    
+    // First open of the node, URS tracks the size from now on
+    if (!f) {
+        if (dispatch_stat(o->super, o->open_dispatch_id, &stat)) {
+            return;
+        }
+        
+        n = (struct urs_cfile *)salloc(cfile_salloc_id);
+        if (!n) {
+            return;
+        }
+        
+        n->key = key;
+        n->size = (unsigned long)stat.data_size;
+        n->open_count = 1;
+        n->writer = NULL;
+        n->pages = NULL;
+        n->error = EOK;
+        n->dirty_linked = 0;
+        n->flush_seq = 0;
+        kthread_mutex_init(&n->lock);
+        
+        // Another open may have cached the node in the meantime
+        kthread_mutex_lock(&pcache.lock);
+        
+        f = (struct urs_cfile *)hash_obtain(pcache.files, &key);
+        if (f) {
+            hash_release(pcache.files, &key, f);
+            f->open_count++;
+        } else {
+            f = n;
+            n = NULL;
+            hash_insert(pcache.files, &f->key, f);
+        }
+        
+        kthread_mutex_unlock(&pcache.lock);
+        
+        if (n) {
+            sfree(n);
+        }
+    }
+    
+    o->cfile = f;
+}
+
+static int pcache_close(struct urs_open *o)
+{
+    struct urs_cfile *f = o->cfile;
+    int error = EOK;
+    
+    if (!f) {
+        return EOK;
+    }
+    
+    kthread_mutex_lock(&f->lock);
+    
+    // Dirty pages have to be written back while this open is still around,
+    // nothing is left to write them through afterwards so close reports the loss
+    if (f->writer == o) {
+        error = pcache_flush_file(f);
+        if (error) {
+            pcache_discard_dirty(f);
         }
-        
-        result = (int)r->params[r->param_count - 1].value;
+        f->writer = NULL;
     }
     
-    else {
-        return -2;
+    kthread_mutex_lock(&pcache.lock);
+    
+    pcache_link_dirty(f, f->writer != NULL);
+    f->open_count--;
+    o->cfile = NULL;
+    
+    kthread_mutex_unlock(&f->lock);
+    if (cfile_unused(f)) {
+        free_cfile(f);
     }
     
-    return result;
+    kthread_mutex_unlock(&pcache.lock);
+    
+    return error;
 }
 
-static int dispatch_truncate(struct urs_super *super, unsigned long node_id)
+static void pcache_remove(struct urs_open *o)
 {
-    int result = 0;
-    enum urs_op_type op = uop_write;
+    struct urs_cfile *f = o->cfile;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
+    if (!f) {
+        return;
     }
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id);
-    }
+    kthread_mutex_lock(&f->lock);
+    kthread_mutex_lock(&pcache.lock);
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        s = create_dispatch_msg(super, op, node_id);
-        
-        r = syscall_request();
-        result = (int)r->params[r->param_count - 1].value;
+    // The data is gone, dirty pages are simply dropped
+    while (f->pages) {
+        pcache_drop(f->pages);
     }
     
-    else {
-        return -2;
+    f->size = 0;
+    f->writer = NULL;
+    f->error = EOK;
+    pcache_link_dirty(f, 0);
+    
+    f->open_count--;
+    o->cfile = NULL;
+    
+    kthread_mutex_unlock(&f->lock);
+    if (cfile_unused(f)) {
+        free_cfile(f);
     }
     
-    return result;
+    kthread_mutex_unlock(&pcache.lock);
 }
 
-static int dispatch_seek_data(struct urs_super *super, unsigned long node_id, u64 offset, enum urs_seek_from from, u64 *newpos)
+
+/*
+ * Cached data operations
+ *  I/O of a file is serialized by the file lock, which is held across
+ *  dispatches to the file system. The cache lock is only taken for updates
+ *  of the LRU list and the page table, so I/O of other files goes on
+ */
+static int pcache_read(struct urs_open *o, void *buf, unsigned long count, unsigned long *actual)
 {
-    int result = 0;
-    enum urs_op_type op = uop_seek_data;
+    struct urs_cfile *f = o->cfile;
+    struct urs_page *p = NULL;
+    unsigned long done = 0;
+    unsigned long index, offset, len;
+    int error = EOK;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
-    }
+    kthread_mutex_lock(&f->lock);
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, offset, from, newpos);
+    // Reads past the end return nothing without asking the file system
+    if (o->data_pos >= f->size) {
+        count = 0;
+    } else if (count > f->size - o->data_pos) {
+        count = f->size - o->data_pos;
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
+    while (done < count) {
+        index = o->data_pos / PCACHE_PAGE_SIZE;
+        offset = o->data_pos % PCACHE_PAGE_SIZE;
+        len = PCACHE_PAGE_SIZE - offset;
+        if (len > count - done) {
+            len = count - done;
+        }
         
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_value64(s, offset);
-        msg_param_value(s, (unsigned long)from);
+        p = pcache_find(f, index);
+        if (p) {
+            atomic_inc(&pcache.hit_count);
+        }
         
-        r = syscall_request();
-        if (newpos) {
-            *newpos = r->params[0].value64;
+        else {
+            atomic_inc(&pcache.miss_count);
+            
+            // A miss right where the last read stopped doubles the read-ahead window
+            if (index == o->ra_next) {
+                o->ra_window = o->ra_window ? o->ra_window * 2 : 2;
+                if (o->ra_window > PCACHE_MAX_READ_AHEAD) {
+                    o->ra_window = PCACHE_MAX_READ_AHEAD;
+                }
+            } else {
+                o->ra_window = 0;
+            }
+            
+            p = pcache_fill(o, index, 1 + o->ra_window);
+            if (!p) {
+                error = done ? EOK : ENOMEM;
+                break;
+            }
         }
         
-        result = (int)r->params[r->param_count - 1].value;
+        memcpy((u8 *)buf + done, p->data + offset, len);
+        pcache_touch(p);
+        
+        done += len;
+        o->data_pos += len;
+        o->ra_next = o->data_pos / PCACHE_PAGE_SIZE;
     }
     
-    else {
-        return -2;
+    kthread_mutex_unlock(&f->lock);
+    
+    if (actual) {
+        *actual = done;
     }
     
-    return result;
+    return error;
 }
 
-static int dispatch_list(struct urs_super *super, unsigned long node_id, void *buf, unsigned long count, unsigned long *actual)
+static int pcache_write(struct urs_open *o, void *buf, unsigned long count, unsigned long *actual)
 {
-    int result = 0;
-    enum urs_op_type op = uop_list;
+    struct urs_cfile *f = o->cfile;
+    struct urs_page *p = NULL;
+    unsigned long done = 0;
+    unsigned long index, offset, len;
+    u64 newpos = 0;
+    int write_back = o->super->cache == ucache_write_back;
+    int error = EOK;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
-    }
+    kthread_mutex_lock(&f->lock);
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, buf, count, actual);
+    // Write-through, the file system gets the data first
+    if (!write_back) {
+        error = dispatch_seek_data(o->super, o->open_dispatch_id, (u64)o->data_pos, seek_from_begin, &newpos);
+        if (!error) {
+            error = dispatch_write(o->super, o->open_dispatch_id, buf, count, &count);
+        }
+        
+        if (error) {
+            count = 0;
+        }
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        ulong len = 0;
-        
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_value(s, count);
+    while (done < count) {
+        index = o->data_pos / PCACHE_PAGE_SIZE;
+        offset = o->data_pos % PCACHE_PAGE_SIZE;
+        len = PCACHE_PAGE_SIZE - offset;
+        if (len > count - done) {
+            len = count - done;
+        }
         
-        r = syscall_request();
-        if (buf) {
-            u8 *src = (u8 *)((unsigned long)r + r->params[0].offset);
-            u8 *dest = buf;
-            ulong s = r->params[1].value;
-            
-            while (len < count && len < s) {
-                dest[len] = src[len];
-                len++;
+        // Write-through only updates the pages that are already cached
+        p = pcache_find(f, index);
+        if (!p && write_back) {
+            // The rest of a partially written page has to be read in first
+            if ((offset || len < PCACHE_PAGE_SIZE) && index * PCACHE_PAGE_SIZE < f->size) {
+                p = pcache_fill(o, index, 1);
+            } else {
+                p = pcache_new_page(f, index);
             }
             
-//             kprintf("received: %s\n", buf);
+            if (!p) {
+                error = done ? EOK : ENOMEM;
+                break;
+            }
         }
-        if (actual) {
-            *actual = len;
+        
+        if (p) {
+            memcpy(p->data + offset, (u8 *)buf + done, len);
+            pcache_touch(p);
+            
+            if (write_back) {
+                if (p->dirty_start == p->dirty_end) {
+                    p->dirty_start = offset;
+                    p->dirty_end = offset + len;
+                } else {
+                    if (offset < p->dirty_start) {
+                        p->dirty_start = offset;
+                    }
+                    if (offset + len > p->dirty_end) {
+                        p->dirty_end = offset + len;
+                    }
+                }
+                
+                f->writer = o;
+            }
         }
         
-        result = (int)r->params[r->param_count - 1].value;
+        done += len;
+        o->data_pos += len;
     }
     
-    else {
-        return -2;
+    if (o->data_pos > f->size) {
+        f->size = o->data_pos;
     }
     
-    return result;
+    if (f->writer && !f->dirty_linked) {
+        kthread_mutex_lock(&pcache.lock);
+        pcache_link_dirty(f, 1);
+        kthread_mutex_unlock(&pcache.lock);
+    }
+    
+    kthread_mutex_unlock(&f->lock);
+    
+    if (actual) {
+        *actual = done;
+    }
+    
+    return error;
 }
 
-static int dispatch_seek_list(struct urs_super *super, unsigned long node_id, u64 offset, enum urs_seek_from from, u64 *newpos)
+static int pcache_truncate(struct urs_open *o)
 {
-    int result = 0;
-    enum urs_op_type op = uop_seek_list;
+    struct urs_cfile *f = o->cfile;
+    struct urs_page *p = NULL;
+    struct urs_page *next = NULL;
+    unsigned long end_index = (o->data_pos + PCACHE_PAGE_SIZE - 1) / PCACHE_PAGE_SIZE;
+    unsigned long offset = o->data_pos % PCACHE_PAGE_SIZE;
+    u64 newpos = 0;
+    int error = EOK;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
-    }
+    kthread_mutex_lock(&f->lock);
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, offset, from, newpos);
+    // The file system has to see the data before it is cut
+    error = pcache_flush_file(f);
+    
+    if (!error) {
+        error = dispatch_seek_data(o->super, o->open_dispatch_id, (u64)o->data_pos, seek_from_begin, &newpos);
+    }
+    if (!error) {
+        error = dispatch_truncate(o->super, o->open_dispatch_id);
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_value64(s, offset);
-        msg_param_value(s, (unsigned long)from);
+    if (!error) {
+        kthread_mutex_lock(&pcache.lock);
         
-        r = syscall_request();
-        if (newpos) {
-            *newpos = r->params[0].value64;
+        for (p = f->pages; p; p = next) {
+            next = p->file_next;
+            
+            if (p->key.index >= end_index) {
+                pcache_drop(p);
+            } else if (offset && p->key.index == end_index - 1) {
+                memzero(p->data + offset, PCACHE_PAGE_SIZE - offset);
+            }
         }
         
-        result = (int)r->params[r->param_count - 1].value;
+        kthread_mutex_unlock(&pcache.lock);
+        
+        f->size = o->data_pos;
     }
     
-    else {
-        return -2;
-    }
+    kthread_mutex_unlock(&f->lock);
     
-    return result;
+    return error;
 }
 
-static int dispatch_create(struct urs_super *super, unsigned long node_id, char *name, enum urs_create_type type, unsigned int flags, char *target, unsigned long target_id)
+static int pcache_seek(struct urs_open *o, u64 offset, enum urs_seek_from from, u64 *newpos)
 {
-    int result = 0;
-    enum urs_op_type op = uop_create;
+    struct urs_cfile *f = o->cfile;
+    unsigned long pos = 0;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
-    }
+    kthread_mutex_lock(&f->lock);
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, name, type, flags, target, target_id);
+    switch (from) {
+    case seek_from_begin:
+        pos = (unsigned long)offset;
+        break;
+    case seek_from_cur_fwd:
+        pos = o->data_pos + (unsigned long)offset;
+        break;
+    case seek_from_cur_bwd:
+        if (o->data_pos > (unsigned long)offset) {
+            pos = o->data_pos - (unsigned long)offset;
+        } else {
+            pos = 0;
+        }
+        break;
+    case seek_from_end:
+        if (f->size > (unsigned long)offset) {
+            pos = f->size - (unsigned long)offset;
+        } else {
+            pos = 0;
+        }
+        break;
+    default:
+        break;
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_buffer(s, name, strlen(name) + 1);
-        msg_param_value(s, (unsigned long)type);
-        msg_param_value(s, (unsigned long)flags);
-        msg_param_buffer(s, target, strlen(target) + 1);
-        msg_param_value(s, target_id);
-        
-        r = syscall_request();
-        result = (int)r->params[r->param_count - 1].value;
-    }
+    o->data_pos = pos;
     
-    else {
-        return -2;
+    kthread_mutex_unlock(&f->lock);
+    
+    if (newpos) {
+        *newpos = (u64)pos;
     }
     
-    return result;
+    return 0;
 }
 
-static int dispatch_remove(struct urs_super *super, unsigned long node_id, int erase)
+static int pcache_stat(struct urs_open *o, struct urs_stat *stat)
 {
-    int result = 0;
-    enum urs_op_type op = uop_remove;
+    struct urs_cfile *f = o->cfile;
+    int error = EOK;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
+    kthread_mutex_lock(&f->lock);
+    
+    error = pcache_flush_file(f);
+    if (!error) {
+        error = dispatch_stat(o->super, o->open_dispatch_id, stat);
     }
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, erase);
+    kthread_mutex_unlock(&f->lock);
+    
+    return error;
+}
+
+/*
+ * Sizes and times the file system reports are stale while pages are dirty,
+ * so write back every file of the super before its stats are listed.
+ * Each file is visited once, a failure is left for the next flush to report
+ */
+static void pcache_flush_super(struct urs_super *super)
+{
+    struct urs_cfile *f = NULL;
+    unsigned long seq = 0;
+    int error = EOK;
+    
+    if (super->cache != ucache_write_back) {
+        return;
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
+    kthread_mutex_lock(&pcache.lock);
+    seq = ++pcache.flush_seq;
+    kthread_mutex_unlock(&pcache.lock);
+    
+    do {
+        // Pinned by an open count so that it stays around while unlocked
+        kthread_mutex_lock(&pcache.lock);
+        for (f = pcache.dirty_files; f; f = f->dirty_next) {
+            if (f->key.super_id == super->id && f->flush_seq != seq) {
+                f->flush_seq = seq;
+                f->open_count++;
+                break;
+            }
+        }
+        kthread_mutex_unlock(&pcache.lock);
         
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_value(s, (unsigned long)erase);
+        if (!f) {
+            break;
+        }
         
-        r = syscall_request();
-        result = (int)r->params[r->param_count - 1].value;;
-    }
+        kthread_mutex_lock(&f->lock);
+        
+        if (f->writer) {
+            error = pcache_flush_file(f);
+            if (error) {
+                f->error = error;
+            }
+        }
+        
+        kthread_mutex_lock(&pcache.lock);
+        
+        f->open_count--;
+        
+        kthread_mutex_unlock(&f->lock);
+        if (cfile_unused(f)) {
+            free_cfile(f);
+        }
+        
+        kthread_mutex_unlock(&pcache.lock);
+    } while (1);
+}
+
+void urs_pcache_stat_report()
+{
+    kthread_mutex_lock(&pcache.lock);
     
-    else {
-        return -2;
+    kprintf("URS page cache: %u pages, hits %u, misses %u, read ahead %u, evictions %u, write backs %u\n",
+            pcache.count, pcache.hit_count, pcache.miss_count, pcache.read_ahead_count,
+            pcache.evict_count, pcache.write_back_count);
+    
+    kthread_mutex_unlock(&pcache.lock);
+}
+
+
+/*
+ * Open references
+ *  The last reference closes the open in the file system
+ */
+static void release_open(struct urs_open *o)
+{
+    // The file system dropped its open along with a removed node
+    if (!o->removed) {
+        // Dirty pages are written back through the open before it goes away
+        pcache_close(o);
+        dispatch_close(o->super, o->open_dispatch_id);
     }
     
-    return result;
+    release_super(o->node->super);
+    sfree(o->node);
+    free(o->path);
+    sfree(o);
 }
 
-static int dispatch_rename(struct urs_super *super, unsigned long node_id, char *name)
+static struct urs_open *get_open(unsigned long proc_id, unsigned long fd)
 {
-    int result = 0;
-    enum urs_op_type op = uop_rename;
+    struct urs_fd_table *t = get_fd_table(proc_id, 0);
+    struct urs_fd *slot = NULL;
+    struct urs_open *o = NULL;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
+    if (!t) {
+        return NULL;
     }
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, name);
+    kthread_mutex_lock(&t->lock);
+    
+    // A removed node stays in the other fds of its open until they are closed
+    slot = lookup_fd(t, fd);
+    if (slot && !slot->open->removed) {
+        o = slot->open;
+        atomic_inc(&o->ref_count);
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        
-        s = create_dispatch_msg(super, op, node_id);
-        msg_param_buffer(s, name, strlen(name) + 1);
-        
-        r = syscall_request();
-        result = (int)r->params[r->param_count - 1].value;
+    kthread_mutex_unlock(&t->lock);
+    put_fd_table(t);
+    
+    return o;
+}
+
+static void put_open(struct urs_open *o)
+{
+    if (atomic_xadd(&o->ref_count, (unsigned long)-1) == 1) {
+        release_open(o);
+    }
+}
+
+unsigned long urs_dup_node(unsigned long proc_id, unsigned long fd)
+{
+    unsigned long new_fd = 0;
+    struct urs_fd_table *t = NULL;
+    struct urs_open *o = get_open(proc_id, fd);
+    
+    if (!o) {
+        return 0;
     }
     
-    else {
-        return -2;
+    // The table may have been closed in between
+    t = get_fd_table(proc_id, 0);
+    if (t) {
+        new_fd = alloc_fd(t, o);
+        put_fd_table(t);
     }
     
-    return result;
+    put_open(o);
+    return new_fd;
 }
 
-static int dispatch_stat(struct urs_super *super, unsigned long node_id, struct urs_stat *stat)
+/*
+ * Called by the process monitor once a process is gone
+ */
+void urs_close_process(unsigned long proc_id)
 {
-    int result = 0;
-    enum urs_op_type op = uop_stat;
+    unsigned long index;
+    struct urs_fd_table *t = NULL;
+    struct urs_open *o = NULL;
     
-    if (super->ops[op].type == udisp_none) {
-        return -1;
-    }
+    kthread_mutex_lock(&fd_tables_lock);
     
-    else if (super->ops[op].type == udisp_func) {
-        result = super->ops[op].func(super->id, node_id, stat);
+    // The reference of the hash entry now belongs to this function
+    t = (struct urs_fd_table *)hash_obtain(fd_tables, (void *)proc_id);
+    if (t) {
+        hash_release(fd_tables, (void *)proc_id, t);
+        hash_remove(fd_tables, (void *)proc_id);
     }
     
-    else if (super->ops[op].type == udisp_msg) {
-        msg_t *s, *r;
-        struct urs_stat *ret = NULL;
-        
-        s = create_dispatch_msg(super, op, node_id);
-        r = syscall_request();
-        
-        ret = (struct urs_stat *)((unsigned long)r + r->params[0].offset);
-        if (ret && stat) {
-            memcpy(stat, ret, sizeof(struct urs_stat));
-        }
-        
-        result = (int)r->params[r->param_count - 1].value;
+    kthread_mutex_unlock(&fd_tables_lock);
+    
+    if (!t) {
+        return;
     }
     
-    else {
-        return -2;
+    // Requests still in flight may hold the table, but they can't add to it
+    kthread_mutex_lock(&t->lock);
+    t->closed = 1;
+    kthread_mutex_unlock(&t->lock);
+    
+    for (index = 0; index < t->used; index++) {
+        o = free_fd(t, (t->fds[index].gen << URS_FD_INDEX_BITS) | index);
+        if (o) {
+            put_open(o);
+        }
     }
     
-    return result;
+    // Freed along with the last request that holds it
+    put_fd_table(t);
 }
 
 
 /*
  * Node operations
  */
-static struct urs_open *get_open_by_id(unsigned long id)
-{
-    return (struct urs_open *)id;
-}
-
 static int get_next_name(char *path, int start, char **name)
 {
     char *copy = NULL;
@@ -803,24 +2742,42 @@ static struct urs_node *get_next_node(struct urs_super *super, struct urs_node *
                                       int *is_link, void *buf, unsigned long count, unsigned long *actual)
 {
     int error = 0;
+    int link = 0;
+    unsigned long seq = 0;
+    unsigned long parent_id = 0;
     unsigned long next_id = 0;
     struct urs_node *next;
     
 //     kprintf("get next node\n");
     
     if (!cur) {
-        if (!name) {
-            error = dispatch_lookup(super, 0, proc_id, "/", is_link,
-                                    &next_id, buf, count, actual);
-        } else {
+        if (name) {
+            if (is_link) {
+                *is_link = 0;
+            }
             return NULL;
         }
+        
+        name = "/";
     } else {
-        error = dispatch_lookup(super, cur->dispatch_id, proc_id, name, is_link,
-                                &next_id, buf, count, actual);
+        parent_id = cur->dispatch_id;
         sfree(cur);
     }
     
+    // Try the lookup cache first, fall back to the file system
+    if (!dcache_lookup(super, parent_id, name, &next_id)) {
+        seq = dcache_seq(super);
+        error = dispatch_lookup(super, parent_id, proc_id, name, &link,
+                                &next_id, buf, count, actual);
+        if (!error && !link) {
+            dcache_insert(super, seq, parent_id, name, next_id);
+        }
+    }
+    
+    if (is_link) {
+        *is_link = link;
+    }
+    
     if (!next_id || error) {
 //         kprintf("Next node empty!\n");
         return NULL;
@@ -835,6 +2792,65 @@ static struct urs_node *get_next_node(struct urs_super *super, struct urs_node *
     return next;
 }
 
+static struct urs_node *get_path_node(struct urs_super *super, struct urs_node *cur, unsigned long proc_id, char *path,
+                                      unsigned long *consumed, int *is_link, void *buf, unsigned long count, unsigned long *actual)
+{
+    int error = 0;
+    int link = 0;
+    unsigned long len = 0;
+    unsigned long seq = 0;
+    unsigned long next_id = 0;
+    unsigned long parent_id = cur->dispatch_id;
+    
+    if (path[0] == '/') {
+        path++;
+        len++;
+    }
+    
+    // Try the lookup cache first, fall back to the file system
+    if (dcache_lookup(super, parent_id, path, &next_id)) {
+        *consumed = len + strlen(path);
+    } else {
+        *consumed = 0;
+        seq = dcache_seq(super);
+        error = dispatch_lookup_path(super, parent_id, proc_id, path, &link,
+                                     &next_id, consumed, buf, count, actual);
+        
+        // Nothing resolved, go through the name one component at a time
+        if (!error && !link && next_id == parent_id && !*consumed) {
+            if (is_link) {
+                *is_link = 0;
+            }
+            return cur;
+        }
+        
+        // Only complete results are cached, and never a negative one that spans components
+        if (!error && !link && (next_id ? !path[*consumed] : !has_separator(path))) {
+            dcache_insert(super, seq, parent_id, path, next_id);
+        }
+        
+        *consumed += len;
+    }
+    
+    sfree(cur);
+    
+    if (is_link) {
+        *is_link = link;
+    }
+    
+    if (!next_id || error) {
+        return NULL;
+    }
+    
+    cur = (struct urs_node *)salloc(node_salloc_id);
+    cur->dispatch_id = next_id;
+    cur->id = (unsigned long)cur;
+    cur->ref_count = 1;
+    cur->super = super;
+    
+    return cur;
+}
+
 static int is_absolute_path(char *path)
 {
     size_t i;
@@ -906,6 +2922,7 @@ static struct urs_node *resolve_path(char *path, struct urs_super **real_super,
 {
     char *name = NULL;
     char *copy = normalize_path(path);
+    int name_pos = 0;
     int cur_pos = 0;
     struct urs_node *cur_node = NULL;
     
@@ -925,15 +2942,28 @@ static struct urs_node *resolve_path(char *path, struct urs_super **real_super,
     cur_pos = strlen(super->path);
     
     do {
-        int is_link;
+        int is_link = 0;
         u8 buf[128];
         unsigned long link_len = 0;
+        unsigned long consumed = 0;
+        
+        // Resolve the rest of the path in one go if the file system supports it
+        if (name && super->ops[uop_lookup_path].type != udisp_none) {
+            cur_node = get_path_node(super, cur_node, proc_id, &copy[name_pos], &consumed, &is_link, buf, sizeof(buf), &link_len);
+            if (consumed || !cur_node) {
+                cur_pos = name_pos + consumed;
+            } else {
+                cur_node = get_next_node(super, cur_node, proc_id, name, &is_link, buf, sizeof(buf), &link_len);
+            }
+        } else {
+            cur_node = get_next_node(super, cur_node, proc_id, name, &is_link, buf, sizeof(buf), &link_len);
+        }
         
-        cur_node = get_next_node(super, cur_node, proc_id, name, &is_link, buf, sizeof(buf), &link_len);
         if (is_link) {
             cur_node = follow_link(super, cur_node, proc_id, (char *)buf, real_super);
         }
         
+        name_pos = cur_pos;
         cur_pos = get_next_name(copy, cur_pos, &name);
     } while (cur_pos && cur_node);
     
@@ -945,9 +2975,41 @@ static struct urs_node *resolve_path(char *path, struct urs_super **real_super,
     return cur_node;
 }
 
-unsigned long urs_open_node(char *path, unsigned int flags, unsigned long process_id)
+/*
+ * Wraps an open of the file system into an fd of the table
+ */
+static unsigned long install_open(char *path, struct urs_super *super, struct urs_node *node,
+                                  unsigned long open_dispatch_id, unsigned long table_proc_id)
 {
+    unsigned long fd = 0;
     struct urs_open *o = NULL;
+    struct urs_fd_table *t = NULL;
+    
+    o = (struct urs_open *)salloc(open_salloc_id);
+    o->ref_count = 0;
+    o->removed = 0;
+    o->path = strdup(path);
+    o->node = node;
+    o->super = super;
+    o->open_dispatch_id = open_dispatch_id;
+    kthread_mutex_init(&o->pos_lock);
+    pcache_open(o);
+    
+    t = get_fd_table(table_proc_id, 1);
+    if (t) {
+        fd = alloc_fd(t, o);
+        put_fd_table(t);
+    }
+    
+    if (!fd) {
+        release_open(o);
+    }
+    
+    return fd;
+}
+
+static unsigned long open_node(char *path, unsigned int flags, unsigned long process_id, unsigned long table_proc_id)
+{
     struct urs_super *super = NULL;
     unsigned long open_dispatch_id = 0;
     
@@ -962,129 +3024,224 @@ unsigned long urs_open_node(char *path, unsigned int flags, unsigned long proces
         return 0;
     }
     
-    o = (struct urs_open *)salloc(open_salloc_id);
-    o->id = (unsigned long)o;
-    o->path = strdup(path);
-    o->node = node;
-    o->super = super;
-    o->open_dispatch_id = open_dispatch_id;
-    hash_insert(open_table, o->path, o);
+    return install_open(path, super, node, open_dispatch_id, table_proc_id);
+}
+
+/*
+ * Opens the node of an existing open once more, the path is not resolved
+ * again so the new open always refers to the same node
+ */
+static unsigned long reopen_node(struct urs_open *src, unsigned long process_id, unsigned long table_proc_id)
+{
+    struct urs_super *super = src->super;
+    struct urs_node *node = NULL;
+    unsigned long open_dispatch_id = 0;
+    
+    if (dispatch_open(super, src->node->dispatch_id, process_id, &open_dispatch_id)) {
+        return 0;
+    }
     
-    return o->id;
+    // The new open holds its own node and super references
+    node = (struct urs_node *)salloc(node_salloc_id);
+    node->dispatch_id = src->node->dispatch_id;
+    node->id = (unsigned long)node;
+    node->ref_count = 1;
+    node->super = super;
+    atomic_inc(&super->ref_count);
+    
+    return install_open(src->path, super, node, open_dispatch_id, table_proc_id);
+}
+
+unsigned long urs_open_node(char *path, unsigned int flags, unsigned long process_id)
+{
+    return open_node(path, flags, process_id, process_id);
 }
 
-int urs_close_node(unsigned long id)
+int urs_close_node(unsigned long proc_id, unsigned long fd)
 {
-    int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = NULL;
+    struct urs_fd_table *t = get_fd_table(proc_id, 0);
+    
+    if (t) {
+        o = free_fd(t, fd);
+        put_fd_table(t);
+    }
     
     if (!o) {
         return EBADF;
     }
     
-    error = dispatch_close(o->super, o->open_dispatch_id);
-//         kprintf("Node released: %p\n", id);
-    if (!error) {
-        hash_remove(open_table, o->path);
-        release_super(o->node->super);
-        sfree(o->node);
-        free(o->path);
-        sfree(o);
-    }
+    // Other fds of the open keep it alive
+    put_open(o);
     
-    return error;
+    return EOK;
 }
 
-int urs_read_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual)
+int urs_read_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual)
 {
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     int error = EOK;
     
-    if (o) {
+    if (o && o->cfile) {
+        error = pcache_read(o, buf, count, actual);
+    } else if (o) {
         error = dispatch_read(o->super, o->open_dispatch_id, buf, count, actual);
     } else {
-        error = EBADF;
+        return EBADF;
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_write_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual)
+int urs_write_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual)
 {
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     int error = EOK;
     
-    if (o) {
+    if (o && o->cfile) {
+        error = pcache_write(o, buf, count, actual);
+    } else if (o) {
         error = dispatch_write(o->super, o->open_dispatch_id, buf, count, actual);
     } else {
-        error = EBADF;
+        return EBADF;
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_truncate_node(unsigned long id)
+int urs_truncate_node(unsigned long proc_id, unsigned long fd)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
+    if (o && o->cfile) {
+        error = pcache_truncate(o);
+    } else if (o) {
         error = dispatch_truncate(o->super, o->open_dispatch_id);
     } else {
-        error = EBADF;
+        return EBADF;
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_seek_data(unsigned long id, u64 offset, enum urs_seek_from from, u64 *newpos)
+int urs_seek_data(unsigned long proc_id, unsigned long fd, u64 offset, enum urs_seek_from from, u64 *newpos)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
+    if (o && o->cfile) {
+        error = pcache_seek(o, offset, from, newpos);
+    } else if (o) {
         error = dispatch_seek_data(o->super, o->open_dispatch_id, offset, from, newpos);
     } else {
-        error = EBADF;
+        return EBADF;
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_list_node(unsigned long id, void *buf, unsigned long count, unsigned long *actual)
+int urs_list_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned long *actual)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
-        error = dispatch_list(o->super, o->open_dispatch_id, buf, count, actual);
-    } else {
-        error = EBADF;
+    if (!o) {
+        return EBADF;
+    }
+    
+    error = dispatch_list(o->super, o->open_dispatch_id, buf, count, actual);
+    
+    put_open(o);
+    return error;
+}
+
+/*
+ * File systems without a batched list are listed one entry at a time, an
+ * entry that doesn't fit is put back with seek list. No stat in this case
+ */
+static int emulate_list_batch(struct urs_open *o, void *buf, unsigned long count, unsigned long *actual)
+{
+    char name[128];
+    unsigned long len = 0;
+    unsigned long name_len = 0;
+    unsigned long size = 0;
+    int error = EOK;
+    
+    while (len < count) {
+        error = dispatch_list(o->super, o->open_dispatch_id, name, sizeof(name), &name_len);
+        if (error) {
+            // End of the list
+            error = EOK;
+            break;
+        }
+        
+        name[sizeof(name) - 1] = '\0';
+        size = urs_list_pack((u8 *)buf + len, count - len, name, 0);
+        if (!size) {
+            dispatch_seek_list(o->super, o->open_dispatch_id, 1, seek_from_cur_bwd, NULL);
+            error = len ? EOK : ELIMIT;
+            break;
+        }
+        
+        len += size;
+    }
+    
+    if (actual) {
+        *actual = len;
     }
     
     return error;
 }
 
-int urs_seek_list(unsigned long id, u64 offset, enum urs_seek_from from, u64 *newpos)
+int urs_list_batch_node(unsigned long proc_id, unsigned long fd, void *buf, unsigned long count, unsigned int flags, unsigned long *actual)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
-        error = dispatch_seek_list(o->super, o->open_dispatch_id, offset, from, newpos);
+    if (!o) {
+        return EBADF;
+    }
+    
+    if (flags & ULIST_STAT) {
+        pcache_flush_super(o->super);
+    }
+    
+    if (o->super->ops[uop_list_batch].type != udisp_none) {
+        error = dispatch_list_batch(o->super, o->open_dispatch_id, buf, count, flags, actual);
     } else {
-        error = EBADF;
+        error = emulate_list_batch(o, buf, count, actual);
+    }
+    
+    put_open(o);
+    return error;
+}
+
+int urs_seek_list(unsigned long proc_id, unsigned long fd, u64 offset, enum urs_seek_from from, u64 *newpos)
+{
+    int error = EOK;
+    struct urs_open *o = get_open(proc_id, fd);
+    
+    if (!o) {
+        return EBADF;
     }
     
+    error = dispatch_seek_list(o->super, o->open_dispatch_id, offset, from, newpos);
+    
+    put_open(o);
     return error;
 }
 
-int urs_create_node(unsigned long id, char *name, enum urs_create_type type, unsigned int flags, char *target)
+int urs_create_node(unsigned long proc_id, unsigned long fd, char *name, enum urs_create_type type, unsigned int flags, char *target)
 {
     int error = EOK;
     unsigned long target_node_id = 0;
     
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     if (!o) {
         return EBADF;
     }
@@ -1093,13 +3250,16 @@ int urs_create_node(unsigned long id, char *name, enum urs_create_type type, uns
     // Hard link needs to figure out the target dispatch node ID first
     case ucreate_hard_link:
         target_node_id = -1;
-    
+        
     // Create the link
     case ucreate_node:
     case ucreate_sym_link:
         error = dispatch_create(o->super, o->open_dispatch_id, name, type, flags, target, target_node_id);
+        
+        // The name may have been cached as non-existent
+        dcache_invalidate(o->super, o->node->dispatch_id, name);
         break;
-    
+        
     // Skip for now
     case ucreate_dyn_link:
     case ucreate_none:
@@ -1107,52 +3267,204 @@ int urs_create_node(unsigned long id, char *name, enum urs_create_type type, uns
         break;
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_remove_node(unsigned long id, int erase)
+int urs_remove_node(unsigned long proc_id, unsigned long fd, int erase)
 {
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_fd_table *t = NULL;
+    struct urs_open *o = get_open(proc_id, fd);
     int error = EOK;
     
+    if (!o) {
+        return EBADF;
+    }
+    
     error = dispatch_remove(o->super, o->open_dispatch_id, erase);
     if (error) {
+        put_open(o);
         return error;
     }
     
-    hash_remove(open_table, o->path);
-    release_super(o->node->super);
-    sfree(o->node);
-    free(o->path);
-    sfree(o);
+    // Drop the entries of the node and of its sub nodes, the dispatch ID may be reused
+    dcache_invalidate_node(o->super, o->node->dispatch_id, 1, 0);
+    pcache_remove(o);
     
-    return 0;
+    // The open went away with the node, the fd is closed along with it
+    o->removed = 1;
+    atomic_writebar();
+    
+    t = get_fd_table(proc_id, 0);
+    if (t) {
+        if (free_fd(t, fd) == o) {
+            put_open(o);
+        }
+        put_fd_table(t);
+    }
+    
+    put_open(o);
+    return EOK;
 }
 
-int urs_rename_node(unsigned long id, char *name)
+int urs_rename_node(unsigned long proc_id, unsigned long fd, char *name)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
-        error = dispatch_rename(o->super, o->open_dispatch_id, name);
-    } else {
-        error = EBADF;
+    if (!o) {
+        return EBADF;
+    }
+    
+    error = dispatch_rename(o->super, o->open_dispatch_id, name);
+    
+    // The parent of the node is unknown here, so drop all the negative entries
+    if (!error) {
+        dcache_invalidate_node(o->super, o->node->dispatch_id, 0, 1);
     }
     
+    put_open(o);
     return error;
 }
 
-int urs_stat_node(unsigned long id, struct urs_stat *stat)
+static int stat_open(struct urs_open *o, struct urs_stat *stat)
+{
+    if (o->cfile) {
+        return pcache_stat(o, stat);
+    }
+    
+    return dispatch_stat(o->super, o->open_dispatch_id, stat);
+}
+
+int urs_stat_node(unsigned long proc_id, unsigned long fd, struct urs_stat *stat)
 {
     int error = EOK;
-    struct urs_open *o = get_open_by_id(id);
+    struct urs_open *o = get_open(proc_id, fd);
     
-    if (o) {
-        error = dispatch_stat(o->super, o->open_dispatch_id, stat);
+    if (!o) {
+        return EBADF;
+    }
+    
+    error = stat_open(o, stat);
+    
+    put_open(o);
+    return error;
+}
+
+
+/*
+ * File mapping
+ *  Data that sits in the core image is mapped by the kernel directly,
+ *  otherwise the mapping gets an open of its own that pages are read through.
+ *  That open lives in the table of the caller, which is the kernel
+ */
+int urs_map_node(unsigned long caller_proc_id, unsigned long proc_id, unsigned long fd,
+                 unsigned long *map_id, unsigned long *size, unsigned long *image_offset)
+{
+    int error = EOK;
+    struct urs_stat stat;
+    struct urs_open *o = NULL;
+    
+    // Only the kernel maps on behalf of a process, to anyone else the fd is unknown
+    if (caller_proc_id != kapi_kernel_proc_id()) {
+        return EBADF;
+    }
+    
+    o = get_open(proc_id, fd);
+    if (!o) {
+        return EBADF;
+    }
+    
+    error = stat_open(o, &stat);
+    if (error) {
+        put_open(o);
+        return error;
+    }
+    *size = (unsigned long)stat.data_size;
+    
+    if (!dispatch_map(o->super, o->open_dispatch_id, image_offset)) {
+        put_open(o);
+        *map_id = 0;
+        return EOK;
+    }
+    
+    // The mapping gets an open of its own, page-ins do not move the position of the fd
+    *image_offset = 0;
+    *map_id = reopen_node(o, proc_id, caller_proc_id);
+    
+    put_open(o);
+    return *map_id ? EOK : ENOENT;
+}
+
+int urs_read_node_at(unsigned long proc_id, unsigned long fd, u64 offset, void *buf, unsigned long count, unsigned long *actual)
+{
+    int error = EOK;
+    u64 newpos = 0;
+    struct urs_open *o = get_open(proc_id, fd);
+    
+    if (!o) {
+        return EBADF;
+    }
+    
+    // Page-ins of the same mapping share its open
+    kthread_mutex_lock(&o->pos_lock);
+    
+    if (o->cfile) {
+        error = pcache_seek(o, offset, seek_from_begin, &newpos);
+        if (!error) {
+            error = pcache_read(o, buf, count, actual);
+        }
     } else {
-        error = EBADF;
+        error = dispatch_seek_data(o->super, o->open_dispatch_id, offset, seek_from_begin, &newpos);
+        if (!error) {
+            error = dispatch_read(o->super, o->open_dispatch_id, buf, count, actual);
+        }
     }
     
+    kthread_mutex_unlock(&o->pos_lock);
+    
+    put_open(o);
     return error;
 }
+
+
+/*
+ * Tests
+ *  A victim table that no process owns, then requests through the fds of it
+ *  made from the tables of others
+ */
+#define URS_TEST_VICTIM_ID  0
+
+void test_urs_fd()
+{
+    unsigned long fd = 0, dup_fd = 0;
+    unsigned long map_id = 0, size = 0, image_offset = 0;
+    unsigned long self_id = kapi_process_id();
+    struct urs_stat stat;
+    
+    kprintf("[urs] fd table test\n");
+    
+    fd = urs_open_node("ramfs://", 0, URS_TEST_VICTIM_ID);
+    assert(fd);
+    
+    // A forged proc ID in a map request
+    assert(urs_map_node(self_id, URS_TEST_VICTIM_ID, fd, &map_id, &size, &image_offset) == EBADF);
+    assert(!map_id);
+    
+    // The fd means nothing in another table
+    assert(urs_stat_node(self_id, fd, &stat) == EBADF);
+    assert(urs_close_node(self_id, fd) == EBADF);
+    
+    // A stale fd is rejected, the dup keeps the open alive
+    dup_fd = urs_dup_node(URS_TEST_VICTIM_ID, fd);
+    assert(dup_fd && dup_fd != fd);
+    assert(urs_close_node(URS_TEST_VICTIM_ID, fd) == EOK);
+    assert(urs_stat_node(URS_TEST_VICTIM_ID, fd, &stat) == EBADF);
+    assert(urs_stat_node(URS_TEST_VICTIM_ID, dup_fd, &stat) == EOK);
+    
+    // Exit of the owner closes whatever is left
+    urs_close_process(URS_TEST_VICTIM_ID);
+    assert(urs_stat_node(URS_TEST_VICTIM_ID, dup_fd, &stat) == EBADF);
+    
+    kprintf("[urs] fd table test done\n");
+}